@@ -0,0 +1,208 @@
+#include "AxisIterator.h"
+
+namespace xpath {
+
+AxisIterator::AxisIterator(Document* document, AxisName axis, uint32_t node)
+    : document_(document),
+      mode_(M_Done),
+      ancestors_(false),
+      node_(Document::kNone),
+      end_(0),
+      pending_(Document::kNone) {
+  Document& d = *document;
+  bool is_attribute = d.kind(node) == K_Attribute;
+  switch (axis) {
+    case A_Ancestor:
+    case A_AncestorOrSelf:
+    case A_Parent:
+    case A_Self:
+      mode_ = M_Ancestors;
+      ancestors_ = axis == A_Ancestor || axis == A_AncestorOrSelf;
+      node_ = axis == A_Ancestor || axis == A_Parent ? d.parent(node) : node;
+      break;
+
+    case A_Attribute:
+    case A_Child:
+      if (!is_attribute) {
+        mode_ = M_Range;
+        if (axis == A_Attribute) {
+          node_ = d.first_attribute(node);
+          end_ = node_ + d.attribute_count(node);
+        } else {
+          node_ = d.first_child(node);
+          end_ = node_ + d.child_count(node);
+        }
+      }
+      break;
+
+    case A_Descendant:
+    case A_DescendantOrSelf: {
+      bool self = axis == A_DescendantOrSelf;
+      if (is_attribute) {
+        // The only node on the descendant-or-self axis of an attribute is
+        // the attribute itself.
+        mode_ = M_Ancestors;
+        if (self) node_ = node;
+      } else if (d.has_order_index()) {
+        mode_ = M_Ranks;
+        node_ = d.order(node) + (self ? 0 : 1);
+        end_ = d.order(node) + 1 + d.subtree_size(node);
+      } else {
+        mode_ = M_Tree;
+        if (self) node_ = node;
+        pending_ = node;
+      }
+      break;
+    }
+
+    case A_Following: {
+      if (d.has_order_index()) {
+        mode_ = M_Ranks;
+        node_ = d.order(node) + d.subtree_size(node) + 1;
+        end_ = d.node_count();
+        break;
+      }
+      // The following siblings of the node and of each of its ancestors,
+      // with the nearest on top. The following nodes of an attribute start
+      // with the children of its parent; after that, they are the same as
+      // those of the parent.
+      mode_ = M_Tree;
+      uint32_t start = is_attribute ? d.parent(node) : node;
+      std::vector<uint32_t> path;
+      for (uint32_t x = start; d.parent(x) != Document::kNone;
+           x = d.parent(x)) {
+        path.push_back(x);
+      }
+      for (size_t i = path.size(); i-- > 0;) {
+        uint32_t p = d.parent(path[i]);
+        stack_.push_back(std::make_pair(path[i] + 1,
+                                        d.first_child(p) + d.child_count(p)));
+      }
+      if (is_attribute) pending_ = start;
+      break;
+    }
+
+    case A_FollowingSibling:
+      if (d.kind(node) == K_Element) {
+        uint32_t p = d.parent(node);
+        mode_ = M_Range;
+        node_ = node + 1;
+        end_ = d.first_child(p) + d.child_count(p);
+      }
+      break;
+
+    case A_Preceding: {
+      if (d.has_order_index()) {
+        mode_ = M_PrecedingRanks;
+        node_ = d.order(node);
+        end_ = node;
+        break;
+      }
+      // Collect the preceding siblings of each ancestor-or-self (and their
+      // descendants) from the top down, which yields document order.
+      mode_ = M_Collected;
+      std::vector<uint32_t> path;
+      for (uint32_t x = is_attribute ? d.parent(node) : node;
+           x != Document::kRoot; x = d.parent(x)) {
+        path.push_back(x);
+      }
+      for (size_t i = path.size(); i-- > 0;) {
+        uint32_t first = d.first_child(d.parent(path[i]));
+        for (uint32_t sibling = first; sibling < path[i]; ++sibling) {
+          AxisIterator subtree(document, A_DescendantOrSelf, sibling);
+          for (uint32_t n; (n = subtree.Next()) != Document::kNone;) {
+            collected_.push_back(n);
+          }
+        }
+      }
+      break;
+    }
+
+    case A_PrecedingSibling:
+      if (d.kind(node) == K_Element) {
+        mode_ = M_ReverseRange;
+        node_ = node;
+        end_ = d.first_child(d.parent(node));
+      }
+      break;
+
+    default:
+      // The namespace axis is always empty.
+      break;
+  }
+}
+
+uint32_t AxisIterator::Next() {
+  Document& d = *document_;
+  switch (mode_) {
+    case M_Ancestors:
+      if (node_ != Document::kNone) {
+        uint32_t node = node_;
+        node_ = ancestors_ ? d.parent(node) : Document::kNone;
+        return node;
+      }
+      break;
+
+    case M_Range:
+      if (node_ < end_) return node_++;
+      break;
+
+    case M_ReverseRange:
+      if (node_ > end_) return --node_;
+      break;
+
+    case M_Ranks:
+      while (node_ < end_) {
+        uint32_t node = d.node_at(node_++);
+        if (d.kind(node) != K_Attribute) return node;
+      }
+      break;
+
+    case M_PrecedingRanks:
+      while (node_ > 0) {
+        uint32_t node = d.node_at(--node_);
+        if (d.kind(node) != K_Attribute && !d.IsAncestor(node, end_)) {
+          return node;
+        }
+      }
+      break;
+
+    case M_Tree:
+      if (node_ != Document::kNone) {
+        uint32_t node = node_;
+        node_ = Document::kNone;
+        return node;
+      }
+      if (pending_ != Document::kNone) {
+        uint32_t first = d.first_child(pending_);
+        stack_.push_back(std::make_pair(first,
+                                        first + d.child_count(pending_)));
+        pending_ = Document::kNone;
+      }
+      while (!stack_.empty()) {
+        std::pair<uint32_t, uint32_t>& range = stack_.back();
+        if (range.first == range.second) {
+          stack_.pop_back();
+          continue;
+        }
+        pending_ = range.first++;
+        return pending_;
+      }
+      break;
+
+    case M_Collected:
+      if (!collected_.empty()) {
+        uint32_t node = collected_.back();
+        collected_.pop_back();
+        return node;
+      }
+      break;
+
+    default:
+      break;
+  }
+  mode_ = M_Done;
+  return Document::kNone;
+}
+
+}  // namespace xpath
@@ -0,0 +1,64 @@
+#ifndef XPATH_AXIS_ITERATOR_INCLUDED
+#define XPATH_AXIS_ITERATOR_INCLUDED
+
+#include "Document.h"
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace xpath {
+
+// Visits the nodes on an axis from a node one at a time, in the order of the
+// axis (reverse document order for reverse axes, and document order
+// otherwise), so that a caller that only needs a few of them can stop early.
+// Nodes are expanded as the iterator reaches them, not up front.
+//
+// All axes are visited lazily, except the preceding axis of a Document
+// without an order index, which is collected on construction. The namespace
+// axis is always empty.
+class AxisIterator {
+ public:
+  AxisIterator(Document* document, AxisName axis, uint32_t node);
+
+  // Returns the next node on the axis, or Document::kNone at the end.
+  uint32_t Next();
+
+ private:
+  // The ways of stepping through an axis.
+  enum Mode {
+    M_Done = 0,
+    // Returns node_ (if it is not kNone), then its ancestors if ancestors_.
+    M_Ancestors,
+    // Returns node_, node_ + 1, ..., end_ - 1.
+    M_Range,
+    // Returns node_ - 1, node_ - 2, ..., end_.
+    M_ReverseRange,
+    // Returns the non-attribute nodes with ranks node_, node_ + 1, ...,
+    // end_ - 1 in document order.
+    M_Ranks,
+    // Returns the nodes with ranks node_ - 1, node_ - 2, ..., 0 that are
+    // neither attributes nor ancestors of end_.
+    M_PrecedingRanks,
+    // Returns node_ (if it is not kNone), then the descendants of pending_
+    // and the nodes of the ranges of children on stack_ and their
+    // descendants, depth first. The children of each node are only looked
+    // up when the iterator moves past it.
+    M_Tree,
+    // Returns collected_ from back to front.
+    M_Collected };
+
+  Document* document_;
+  Mode mode_;
+  bool ancestors_;
+  uint32_t node_;
+  uint32_t end_;
+  uint32_t pending_;
+  std::vector<std::pair<uint32_t, uint32_t>> stack_;
+  std::vector<uint32_t> collected_;
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_AXIS_ITERATOR_INCLUDED */
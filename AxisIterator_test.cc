@@ -0,0 +1,91 @@
+#include "AxisIterator.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+// The shelf has a nested author, and a leaf book.
+const char kShelf[] =
+    "shelf { book { id: 'b4' year: 2001 author { name: 'Ann' } } "
+    "        book { id: 'b5' } }";
+
+const char* const kAxes[] = {
+  "ancestor", "ancestor-or-self", "attribute", "child", "descendant",
+  "descendant-or-self", "following", "following-sibling", "namespace",
+  "parent", "preceding", "preceding-sibling", "self",
+};
+
+bool IsReverseAxis(AxisName axis) {
+  return axis == A_Ancestor || axis == A_AncestorOrSelf ||
+      axis == A_Preceding || axis == A_PrecedingSibling;
+}
+
+vector<uint32_t> Iterate(Document* document, AxisName axis, uint32_t node) {
+  vector<uint32_t> nodes;
+  AxisIterator iterator(document, axis, node);
+  for (uint32_t n; (n = iterator.Next()) != Document::kNone;) {
+    nodes.push_back(n);
+  }
+  // The end is sticky.
+  EXPECT_EQ(Document::kNone, iterator.Next());
+  return nodes;
+}
+
+// Compares the iterator with the Evaluator on every axis from every node,
+// without and with the document-order index. Without it, the iterator runs
+// first, on a document that is only expanded as far as the tests so far have
+// visited.
+TEST(AxisIterator, MatchesEvaluator) {
+  for (bool order_index : { false, true }) {
+    unique_ptr<SimpleMessage> message(
+        SimpleMessage::ParseText(LibraryText(kShelf)));
+    Document document(*message);
+    if (order_index) document.BuildOrderIndex();
+    Evaluator evaluator(&document);
+    for (uint32_t node = 0; node < document.node_count(); ++node) {
+      for (const char* axis_name : kAxes) {
+        SCOPED_TRACE(testing::Message() << axis_name << " " << node << " "
+                                        << order_index);
+        AxisName axis = ParseAxisName(axis_name);
+        vector<uint32_t> nodes = Iterate(&document, axis, node);
+        Ast ast;
+        size_t error_offset;
+        ASSERT_TRUE(Parse(string(axis_name) + "::node()", &ast,
+                          &error_offset));
+        Value value;
+        ASSERT_TRUE(evaluator.Evaluate(ast, node, &value, &error_offset));
+        if (IsReverseAxis(axis)) {
+          std::reverse(value.nodes.begin(), value.nodes.end());
+        }
+        EXPECT_EQ(value.nodes, nodes);
+      }
+    }
+  }
+}
+
+TEST(AxisIterator, ExpandsOnlyWhatItVisits) {
+  unique_ptr<SimpleMessage> message(
+      SimpleMessage::ParseText(LibraryText(kShelf)));
+  Document document(*message);
+  AxisIterator descendants(&document, A_Descendant, Document::kRoot);
+  EXPECT_EQ("book", document.name(descendants.Next()));
+  EXPECT_EQ("author", document.name(descendants.Next()));
+  size_t node_count = document.node_count();
+  document.ExpandAll();
+  EXPECT_LT(node_count, document.node_count());
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,46 @@
+#include "BatchTokenize.h"
+#include "ParallelFor.h"
+
+#include <algorithm>
+
+namespace xpath {
+
+void TokenizeBatch(const std::string* expressions, size_t count,
+                   int num_threads, TokenBatch* batch) {
+  batch->results.assign(count, 0);
+  batch->token_offsets.assign(count + 1, 0);
+  batch->tokens.clear();
+
+  // In the first pass, each worker appends the tokens of the expressions it
+  // processes to a buffer of its own, and records where they went.
+  std::vector<std::vector<Token>> worker_tokens(
+      ParallelForWorkers(count, num_threads));
+  std::vector<int> worker_of(count);
+  std::vector<size_t> worker_offset(count);
+  ParallelFor(count, num_threads, [&](int worker, size_t i) {
+    std::vector<Token>& tokens = worker_tokens[worker];
+    worker_of[i] = worker;
+    worker_offset[i] = tokens.size();
+    TokenStream stream(expressions[i].data(), expressions[i].size());
+    Token token;
+    while (stream.Next(&token)) tokens.push_back(token);
+    batch->results[i] = stream.error_offset();
+    batch->token_offsets[i + 1] = tokens.size() - worker_offset[i];
+  });
+
+  // Convert token counts to offsets in the shared buffer.
+  for (size_t i = 0; i < count; ++i) {
+    batch->token_offsets[i + 1] += batch->token_offsets[i];
+  }
+
+  // In the second pass, copy the tokens into the shared buffer.
+  batch->tokens.resize(batch->token_offsets[count]);
+  ParallelFor(count, num_threads, [&](int, size_t i) {
+    const Token* begin = worker_tokens[worker_of[i]].data() + worker_offset[i];
+    size_t size = batch->token_offsets[i + 1] - batch->token_offsets[i];
+    std::copy(begin, begin + size,
+              batch->tokens.begin() + batch->token_offsets[i]);
+  });
+}
+
+}  // namespace xpath
@@ -0,0 +1,50 @@
+#ifndef XPATH_BATCH_TOKENIZE_INCLUDED
+#define XPATH_BATCH_TOKENIZE_INCLUDED
+
+#include "Tokenizer.h"
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+// The tokens of a batch of expressions, stored in a single flat buffer.
+struct TokenBatch {
+  // The tokens of expression `i` are tokens[token_offsets[i]] up to (but not
+  // including) tokens[token_offsets[i + 1]]. Token offsets are relative to
+  // the start of the expression, as with Tokenize().
+  std::vector<Token> tokens;
+  std::vector<size_t> token_offsets;
+
+  // For each expression, the value that Tokenize() would return: the size of
+  // the expression on success, or the index of the scanning error otherwise.
+  std::vector<size_t> results;
+
+  size_t size() const { return results.size(); }
+
+  const Token* begin(size_t i) const {
+    return tokens.data() + token_offsets[i];
+  }
+  const Token* end(size_t i) const {
+    return tokens.data() + token_offsets[i + 1];
+  }
+};
+
+// Tokenizes the `count` expressions starting at `expressions` and writes the
+// result to *batch, which is cleared first. The work is distributed over
+// `num_threads` threads (or the number of hardware threads, if 0) with
+// ParallelFor(), so a single long expression does not stall the others.
+//
+// The result is identical to calling Tokenize() on each expression in turn.
+void TokenizeBatch(const std::string* expressions, size_t count,
+                   int num_threads, TokenBatch* batch);
+
+inline void TokenizeBatch(const std::vector<std::string>& expressions,
+                          int num_threads, TokenBatch* batch) {
+  TokenizeBatch(expressions.data(), expressions.size(), num_threads, batch);
+}
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_BATCH_TOKENIZE_INCLUDED */
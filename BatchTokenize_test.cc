@@ -0,0 +1,66 @@
+#include "BatchTokenize.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using testing::ContainerEq;
+
+namespace xpath {
+namespace {
+
+vector<string> TestExpressions() {
+  vector<string> expressions = {
+      "", "foo", "/foo/sibling::bar[index()<7]", "foo ~", "1 plus 2",
+      "'unterminated", "  ", "text() | comment()"};
+  // Add a few long expressions, to get some work stealing going.
+  string long_expression = "a";
+  for (int i = 0; i < 10000; ++i) long_expression += " or b[@c = 'd']";
+  expressions.push_back(long_expression);
+  for (int i = 0; i < 200; ++i) expressions.push_back("/x/y[" + std::to_string(i) + "]");
+  return expressions;
+}
+
+void ExpectMatchesTokenize(const vector<string>& expressions,
+                           const TokenBatch& batch) {
+  ASSERT_EQ(expressions.size(), batch.size());
+  ASSERT_EQ(expressions.size() + 1, batch.token_offsets.size());
+  EXPECT_EQ(0, batch.token_offsets.front());
+  EXPECT_EQ(batch.tokens.size(), batch.token_offsets.back());
+  for (size_t i = 0; i < expressions.size(); ++i) {
+    vector<Token> expected;
+    EXPECT_EQ(Tokenize(expressions[i], &expected), batch.results[i]) << i;
+    vector<Token> received(batch.begin(i), batch.end(i));
+    EXPECT_THAT(received, ContainerEq(expected)) << i;
+  }
+}
+
+TEST(TokenizeBatch, MatchesTokenize) {
+  vector<string> expressions = TestExpressions();
+  for (int num_threads : {1, 2, 4, 0}) {
+    TokenBatch batch;
+    TokenizeBatch(expressions, num_threads, &batch);
+    ExpectMatchesTokenize(expressions, batch);
+  }
+}
+
+TEST(TokenizeBatch, EmptyBatch) {
+  TokenBatch batch;
+  TokenizeBatch(vector<string>(), 4, &batch);
+  EXPECT_EQ(0, batch.size());
+  EXPECT_EQ(1, batch.token_offsets.size());
+  EXPECT_TRUE(batch.tokens.empty());
+}
+
+TEST(TokenizeBatch, ReusesBatch) {
+  TokenBatch batch;
+  TokenizeBatch(TestExpressions(), 2, &batch);
+  vector<string> expressions = {"a/b", "c ~"};
+  TokenizeBatch(expressions, 2, &batch);
+  ExpectMatchesTokenize(expressions, batch);
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,618 @@
+#include "Bytecode.h"
+
+#include "CLocale.h"
+#include "Functions.h"
+#include "Profile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <unordered_map>
+
+namespace xpath {
+
+namespace {
+
+const char kMagic[4] = { 'X', 'P', 'B', 'C' };
+const uint32_t kVersion = 1;
+
+// Size of a serialized instruction, including its source offset.
+const size_t kInstructionSize = 20;
+
+class Compiler {
+ public:
+  Compiler(const Ast& ast, Program* program)
+      : ast_(ast), program_(*program), error_offset_(0) {}
+
+  bool Compile(size_t* error_offset);
+
+ private:
+  struct PendingBlock {
+    uint32_t block;
+    uint32_t predicate;
+  };
+
+  bool CompileExpr(uint32_t expr);
+  uint32_t Emit(OpCode opcode, uint32_t source_offset, uint32_t operand);
+  void EmitNodeSet(uint32_t expr);
+  void AddPredicates(uint32_t first, Instruction* instruction);
+  uint32_t AddString(const char* data, size_t size);
+  uint32_t AddNumber(double number);
+
+  const Ast& ast_;
+  Program& program_;
+  size_t error_offset_;
+  std::vector<PendingBlock> pending_;
+  std::unordered_map<std::string, uint32_t> string_ids_;
+  std::unordered_map<uint64_t, uint32_t> number_ids_;
+};
+
+bool Compiler::Compile(size_t* error_offset) {
+  XPATH_PROFILE_PHASE(P_Compile);
+  program_.Clear();
+  if (ast_.root() == Ast::kNone) {
+    *error_offset = 0;
+    return false;
+  }
+  // Predicate blocks are compiled after the code that refers to them, so
+  // blocks always start after the instructions that run them.
+  bool ok = CompileExpr(ast_.root());
+  Emit(I_Return, ast_.node(ast_.root()).text_offset, 0);
+  for (size_t i = 0; ok && i < pending_.size(); ++i) {
+    PendingBlock pending = pending_[i];
+    program_.blocks[pending.block] = program_.code.size();
+    ok = CompileExpr(pending.predicate);
+    Emit(I_Return, ast_.node(pending.predicate).text_offset, 0);
+  }
+  if (!ok) {
+    program_.Clear();
+    *error_offset = error_offset_;
+  }
+  return ok;
+}
+
+uint32_t Compiler::Emit(OpCode opcode, uint32_t source_offset,
+                        uint32_t operand) {
+  Instruction instruction;
+  instruction.opcode = opcode;
+  instruction.axis = A_None;
+  instruction.node_type = N_None;
+  instruction.first_only = false;
+  instruction.operand = operand;
+  instruction.count = 0;
+  instruction.block = 0;
+  program_.code.push_back(instruction);
+  program_.source_offsets.push_back(source_offset);
+  return program_.code.size() - 1;
+}
+
+// Emits a check that the value of `expr`, which was just compiled, is a
+// node-set, unless its last instruction always yields one.
+void Compiler::EmitNodeSet(uint32_t expr) {
+  const Instruction& last = program_.code.back();
+  switch (last.opcode) {
+    case I_Root:
+    case I_Context:
+    case I_Step:
+    case I_Filter:
+    case I_NodeSet:
+      return;
+    case I_Binary:
+      if (last.operand == X_Union) return;
+      break;
+    default:
+      break;
+  }
+  Emit(I_NodeSet, ast_.node(expr).text_offset, 0);
+}
+
+// Reserves blocks for the predicates in the sibling list starting at
+// `first`, and stores them in *instruction.
+void Compiler::AddPredicates(uint32_t first, Instruction* instruction) {
+  instruction->block = program_.blocks.size();
+  for (uint32_t predicate = first; predicate != Ast::kNone;
+       predicate = ast_.node(predicate).next_sibling) {
+    PendingBlock pending = { uint32_t(program_.blocks.size()), predicate };
+    pending_.push_back(pending);
+    program_.blocks.push_back(0);
+    ++instruction->count;
+  }
+}
+
+uint32_t Compiler::AddString(const char* data, size_t size) {
+  std::string s(data, size);
+  auto it = string_ids_.find(s);
+  if (it != string_ids_.end()) return it->second;
+  uint32_t id = program_.strings.size();
+  program_.strings.push_back(s);
+  string_ids_[s] = id;
+  return id;
+}
+
+uint32_t Compiler::AddNumber(double number) {
+  // Numbers are compared by representation, which keeps 0 and -0 apart.
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  auto it = number_ids_.find(bits);
+  if (it != number_ids_.end()) return it->second;
+  uint32_t id = program_.numbers.size();
+  program_.numbers.push_back(number);
+  number_ids_[bits] = id;
+  return id;
+}
+
+bool Compiler::CompileExpr(uint32_t expr) {
+  const Expr& e = ast_.node(expr);
+  switch (e.type) {
+    case X_Or:
+    case X_And: {
+      if (!CompileExpr(e.first_child)) return false;
+      uint32_t jump = Emit(e.type == X_Or ? I_Or : I_And, e.text_offset, 0);
+      if (!CompileExpr(ast_.node(e.first_child).next_sibling)) return false;
+      Emit(I_ToBoolean, e.text_offset, 0);
+      program_.code[jump].operand = program_.code.size();
+      return true;
+    }
+
+    case X_Equal:
+    case X_NotEqual:
+    case X_LessThan:
+    case X_LessEqual:
+    case X_GreaterThan:
+    case X_GreaterEqual:
+    case X_Plus:
+    case X_Minus:
+    case X_Multiply:
+    case X_Div:
+    case X_Mod:
+    case X_Union: {
+      uint32_t right = ast_.node(e.first_child).next_sibling;
+      if (!CompileExpr(e.first_child)) return false;
+      if (e.type == X_Union) EmitNodeSet(e.first_child);
+      if (!CompileExpr(right)) return false;
+      if (e.type == X_Union) EmitNodeSet(right);
+      Emit(I_Binary, e.text_offset, e.type);
+      return true;
+    }
+
+    case X_Negate:
+      if (!CompileExpr(e.first_child)) return false;
+      Emit(I_Negate, e.text_offset, 0);
+      return true;
+
+    case X_Literal:
+      Emit(I_Literal, e.text_offset,
+           AddString(ast_.text_data(e), e.text_size));
+      return true;
+
+    case X_Number:
+      Emit(I_Number, e.text_offset, AddNumber(e.number));
+      return true;
+
+    case X_Boolean:
+      Emit(I_Call, e.text_offset, e.number != 0 ? F_True : F_False);
+      return true;
+
+    case X_VariableReference:
+      Emit(I_Variable, e.text_offset,
+           AddString(ast_.text_data(e), e.text_size));
+      return true;
+
+    case X_FunctionCall: {
+      FunctionName function = e.function;
+      uint32_t arg_count = 0;
+      for (uint32_t arg = e.first_child; arg != Ast::kNone;
+           arg = ast_.node(arg).next_sibling) {
+        ++arg_count;
+      }
+      if (!AcceptsArgumentCount(function, arg_count)) {
+        error_offset_ = e.text_offset;
+        return false;
+      }
+      for (uint32_t arg = e.first_child; arg != Ast::kNone;
+           arg = ast_.node(arg).next_sibling) {
+        if (!CompileExpr(arg)) return false;
+        if (arg == e.first_child && TakesNodeSet(function)) EmitNodeSet(arg);
+      }
+      uint32_t call = Emit(I_Call, e.text_offset, function);
+      program_.code[call].count = arg_count;
+      return true;
+    }
+
+    case X_Filter: {
+      uint32_t predicate = ast_.node(e.first_child).next_sibling;
+      if (!CompileExpr(e.first_child)) return false;
+      if (predicate != Ast::kNone) {
+        EmitNodeSet(e.first_child);
+        uint32_t filter = Emit(I_Filter, e.text_offset, 0);
+        AddPredicates(predicate, &program_.code[filter]);
+      }
+      return true;
+    }
+
+    case X_Path: {
+      uint32_t step = e.first_child;
+      if (e.absolute) {
+        Emit(I_Root, e.text_offset, 0);
+      } else if (ast_.node(step).type != X_Step) {
+        if (!CompileExpr(step)) return false;
+        EmitNodeSet(step);
+        step = ast_.node(step).next_sibling;
+      } else {
+        Emit(I_Context, e.text_offset, 0);
+      }
+      for (; step != Ast::kNone; step = ast_.node(step).next_sibling) {
+        const Expr& s = ast_.node(step);
+        uint32_t i = Emit(I_Step, s.text_offset,
+                          AddString(ast_.text_data(s), s.text_size));
+        Instruction& instruction = program_.code[i];
+        instruction.axis = s.axis;
+        instruction.node_type = s.node_type;
+        instruction.first_only = s.first_only;
+        AddPredicates(s.first_child, &instruction);
+      }
+      return true;
+    }
+
+    default:
+      error_offset_ = e.text_offset;
+      return false;
+  }
+}
+
+// Checks the operands of every instruction, and that the code starting at
+// each entry point reaches an I_Return without underflowing the stack and
+// leaves exactly one value on it.
+bool Verify(const Program& program) {
+  uint32_t code_size = program.code.size();
+  if (code_size == 0 || program.source_offsets.size() != code_size) {
+    return false;
+  }
+  for (uint32_t pc = 0; pc < code_size; ++pc) {
+    const Instruction& instruction = program.code[pc];
+    if (instruction.first_only > 1 ||
+        (instruction.first_only && instruction.opcode != I_Step)) {
+      return false;
+    }
+    switch (instruction.opcode) {
+      case I_Literal:
+      case I_Variable:
+        if (instruction.operand >= program.strings.size()) return false;
+        break;
+      case I_Number:
+        if (instruction.operand >= program.numbers.size()) return false;
+        break;
+      case I_Step:
+        if (instruction.axis == A_None || instruction.axis > A_Self ||
+            instruction.node_type > N_Node ||
+            instruction.operand >= program.strings.size()) {
+          return false;
+        }
+        // Fall through.
+      case I_Filter:
+        // Predicates must come after the instruction that runs them, which
+        // rules out infinite recursion.
+        if (instruction.block > program.blocks.size() ||
+            instruction.count > program.blocks.size() - instruction.block) {
+          return false;
+        }
+        for (uint32_t i = 0; i < instruction.count; ++i) {
+          if (program.blocks[instruction.block + i] <= pc) return false;
+        }
+        break;
+      case I_Call:
+        if (instruction.operand > F_Round ||
+            !AcceptsArgumentCount(FunctionName(instruction.operand),
+                                  instruction.count)) {
+          return false;
+        }
+        break;
+      case I_Or:
+      case I_And:
+        if (instruction.operand <= pc || instruction.operand > code_size) {
+          return false;
+        }
+        break;
+      case I_Binary:
+        if (instruction.operand < X_Equal || instruction.operand > X_Union) {
+          return false;
+        }
+        break;
+      case I_Return:
+      case I_Root:
+      case I_Context:
+      case I_ToBoolean:
+      case I_Negate:
+      case I_NodeSet:
+        break;
+      default:
+        return false;
+    }
+  }
+  for (uint32_t entry : program.blocks) {
+    if (entry >= code_size) return false;
+  }
+
+  std::vector<uint32_t> entries(1, 0);
+  entries.insert(entries.end(), program.blocks.begin(), program.blocks.end());
+  std::map<uint32_t, uint32_t> jump_depths;
+  for (uint32_t entry : entries) {
+    jump_depths.clear();
+    uint32_t depth = 0;
+    uint32_t pc = entry;
+    for (;; ++pc) {
+      if (pc == code_size) return false;
+      auto it = jump_depths.find(pc);
+      if (it != jump_depths.end()) {
+        if (it->second != depth) return false;
+        jump_depths.erase(it);
+      }
+      const Instruction& instruction = program.code[pc];
+      if (instruction.opcode == I_Return) break;
+      uint32_t pops, pushes;
+      switch (instruction.opcode) {
+        case I_Literal:
+        case I_Number:
+        case I_Variable:
+        case I_Root:
+        case I_Context:
+          pops = 0, pushes = 1;
+          break;
+        case I_Call:
+          pops = instruction.count, pushes = 1;
+          break;
+        case I_Or:
+        case I_And: {
+          if (depth == 0) return false;
+          auto inserted = jump_depths.insert(
+              std::make_pair(instruction.operand, depth));
+          if (!inserted.second && inserted.first->second != depth) {
+            return false;
+          }
+          pops = 1, pushes = 0;
+          break;
+        }
+        case I_Binary:
+          pops = 2, pushes = 1;
+          break;
+        default:
+          pops = 1, pushes = 1;
+          break;
+      }
+      if (depth < pops) return false;
+      depth += pushes - pops;
+    }
+    if (depth != 1 || !jump_depths.empty()) return false;
+  }
+  return true;
+}
+
+void AppendUint32(uint32_t value, std::string* output) {
+  for (int i = 0; i < 4; ++i) *output += char(value >> (8 * i));
+}
+
+void AppendDouble(double value, std::string* output) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  AppendUint32(uint32_t(bits), output);
+  AppendUint32(uint32_t(bits >> 32), output);
+}
+
+class Reader {
+ public:
+  Reader(const char* data, size_t size) : data_(data), size_(size) {}
+
+  size_t remaining() const { return size_; }
+
+  bool ReadUint32(uint32_t* value) {
+    if (size_ < 4) return false;
+    *value = 0;
+    for (int i = 0; i < 4; ++i) *value |= uint32_t(uint8_t(data_[i])) << (8 * i);
+    data_ += 4;
+    size_ -= 4;
+    return true;
+  }
+
+  bool ReadDouble(double* value) {
+    uint32_t low, high;
+    if (!ReadUint32(&low) || !ReadUint32(&high)) return false;
+    uint64_t bits = uint64_t(high) << 32 | low;
+    memcpy(value, &bits, sizeof(bits));
+    return true;
+  }
+
+  bool ReadBytes(size_t size, const char** data) {
+    if (size_ < size) return false;
+    *data = data_;
+    data_ += size;
+    size_ -= size;
+    return true;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+const char* const kOpCodeNames[] = {
+  "return", "literal", "number", "variable", "root", "context", "step",
+  "filter", "call", "or", "and", "boolean", "binary", "negate", "nodeset" };
+
+const char* const kAxisNames[] = {
+  "", "ancestor", "ancestor-or-self", "attribute", "child", "descendant",
+  "descendant-or-self", "following", "following-sibling", "namespace",
+  "parent", "preceding", "preceding-sibling", "self" };
+
+const char* const kNodeTypeNames[] = {
+  "", "comment", "text", "processing-instruction", "node" };
+
+// Indexed by ExprType.
+const char* const kOperatorNames[] = {
+  "", "or", "and", "=", "!=", "<", "<=", ">", ">=", "+", "-", "*", "div",
+  "mod", "|" };
+
+void AppendPredicates(const Program& program, const Instruction& instruction,
+                      std::string* out) {
+  if (instruction.count == 0) return;
+  *out += " [";
+  for (uint32_t i = 0; i < instruction.count; ++i) {
+    if (i > 0) *out += ", ";
+    *out += std::to_string(program.blocks[instruction.block + i]);
+  }
+  *out += ']';
+}
+
+}  // namespace
+
+bool Compile(const Ast& ast, Program* program, size_t* error_offset) {
+  Compiler compiler(ast, program);
+  return compiler.Compile(error_offset);
+}
+
+void SerializeProgram(const Program& program, std::string* output) {
+  output->append(kMagic, sizeof(kMagic));
+  AppendUint32(kVersion, output);
+  AppendUint32(program.code.size(), output);
+  AppendUint32(program.blocks.size(), output);
+  AppendUint32(program.numbers.size(), output);
+  AppendUint32(program.strings.size(), output);
+  for (size_t pc = 0; pc < program.code.size(); ++pc) {
+    const Instruction& instruction = program.code[pc];
+    *output += char(instruction.opcode);
+    *output += char(instruction.axis);
+    *output += char(instruction.node_type);
+    *output += char(instruction.first_only);
+    AppendUint32(instruction.operand, output);
+    AppendUint32(instruction.count, output);
+    AppendUint32(instruction.block, output);
+    AppendUint32(program.source_offsets[pc], output);
+  }
+  for (uint32_t entry : program.blocks) AppendUint32(entry, output);
+  for (double number : program.numbers) AppendDouble(number, output);
+  for (const std::string& s : program.strings) {
+    AppendUint32(s.size(), output);
+    *output += s;
+  }
+}
+
+bool LoadProgram(const char* data, size_t size, Program* program) {
+  program->Clear();
+  Reader reader(data, size);
+  const char* magic;
+  uint32_t version, code_size, block_count, number_count, string_count;
+  if (!reader.ReadBytes(sizeof(kMagic), &magic) ||
+      memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      !reader.ReadUint32(&version) || version != kVersion ||
+      !reader.ReadUint32(&code_size) || !reader.ReadUint32(&block_count) ||
+      !reader.ReadUint32(&number_count) || !reader.ReadUint32(&string_count)) {
+    return false;
+  }
+  // Check the sizes before allocating, so that corrupt data cannot cause
+  // huge allocations.
+  if (code_size > reader.remaining() / kInstructionSize) return false;
+  program->code.resize(code_size);
+  program->source_offsets.resize(code_size);
+  for (uint32_t pc = 0; pc < code_size; ++pc) {
+    Instruction& instruction = program->code[pc];
+    const char* bytes;
+    if (!reader.ReadBytes(4, &bytes)) return false;
+    instruction.opcode = bytes[0];
+    instruction.axis = bytes[1];
+    instruction.node_type = bytes[2];
+    instruction.first_only = bytes[3];
+    if (!reader.ReadUint32(&instruction.operand) ||
+        !reader.ReadUint32(&instruction.count) ||
+        !reader.ReadUint32(&instruction.block) ||
+        !reader.ReadUint32(&program->source_offsets[pc])) {
+      return false;
+    }
+  }
+  if (block_count > reader.remaining() / 4) return false;
+  program->blocks.resize(block_count);
+  for (uint32_t& entry : program->blocks) {
+    if (!reader.ReadUint32(&entry)) return false;
+  }
+  if (number_count > reader.remaining() / 8) return false;
+  program->numbers.resize(number_count);
+  for (double& number : program->numbers) {
+    if (!reader.ReadDouble(&number)) return false;
+  }
+  if (string_count > reader.remaining() / 4) return false;
+  program->strings.resize(string_count);
+  for (std::string& s : program->strings) {
+    uint32_t string_size;
+    const char* string_data;
+    if (!reader.ReadUint32(&string_size) ||
+        !reader.ReadBytes(string_size, &string_data)) {
+      return false;
+    }
+    s.assign(string_data, string_size);
+  }
+  return reader.remaining() == 0 && Verify(*program);
+}
+
+std::string DebugString(const Program& program) {
+  std::string result;
+  for (size_t pc = 0; pc < program.code.size(); ++pc) {
+    const Instruction& instruction = program.code[pc];
+    result += std::to_string(pc);
+    result += ": ";
+    if (instruction.opcode > I_NodeSet) {
+      result += "invalid\n";
+      continue;
+    }
+    result += kOpCodeNames[instruction.opcode];
+    switch (instruction.opcode) {
+      case I_Literal:
+        result += " '" + program.strings[instruction.operand] + "'";
+        break;
+      case I_Number: {
+        char buf[32];
+        SnprintfC(buf, sizeof(buf), " %g",
+                  program.numbers[instruction.operand]);
+        result += buf;
+        break;
+      }
+      case I_Variable:
+        result += " $" + program.strings[instruction.operand];
+        break;
+      case I_Step: {
+        const std::string& name = program.strings[instruction.operand];
+        result += ' ';
+        result += kAxisNames[instruction.axis];
+        result += "::";
+        if (instruction.node_type == N_None) {
+          result += name;
+        } else {
+          result += kNodeTypeNames[instruction.node_type];
+          result += name.empty() ? "()" : "('" + name + "')";
+        }
+        if (instruction.first_only) result += " first";
+        AppendPredicates(program, instruction, &result);
+        break;
+      }
+      case I_Filter:
+        AppendPredicates(program, instruction, &result);
+        break;
+      case I_Call:
+        result += ' ';
+        result += FunctionNameString(FunctionName(instruction.operand));
+        result += '/' + std::to_string(instruction.count);
+        break;
+      case I_Or:
+      case I_And:
+        result += " -> " + std::to_string(instruction.operand);
+        break;
+      case I_Binary:
+        result += ' ';
+        result += kOperatorNames[instruction.operand];
+        break;
+      default:
+        break;
+    }
+    result += '\n';
+  }
+  return result;
+}
+
+}  // namespace xpath
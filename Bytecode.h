@@ -0,0 +1,129 @@
+#ifndef XPATH_BYTECODE_INCLUDED
+#define XPATH_BYTECODE_INCLUDED
+
+#include "Parser.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+// Instructions of the stack machine that Evaluator::Execute() runs. Each
+// instruction pops its operands from the value stack and pushes its result.
+enum OpCode {
+  // Ends the program or predicate block. The value on top of the stack is
+  // the result.
+  I_Return = 0,
+
+  // Pushes strings[operand] as a string.
+  I_Literal,
+
+  // Pushes numbers[operand].
+  I_Number,
+
+  // Pushes the value of the variable named strings[operand].
+  I_Variable,
+
+  // Pushes a node-set that contains the root node or the context node.
+  I_Root,
+  I_Context,
+
+  // Replaces the node-set on top of the stack by the nodes selected by the
+  // location step `axis`::`node_type` from each of its nodes. For a name
+  // test, the name (or "*") is strings[operand]. If `first_only` is set,
+  // only the first node that passes the node test is kept, as for
+  // Expr::first_only. The step has `count` predicates, whose code starts at
+  // blocks[block], ..., blocks[block + count - 1].
+  I_Step,
+
+  // Filters the node-set on top of the stack by `count` predicates, given as
+  // for I_Step.
+  I_Filter,
+
+  // Replaces the top `count` values by the result of calling the function
+  // `operand` (a FunctionName) with them as arguments.
+  I_Call,
+
+  // Short-circuit operators. Pops a value; if its boolean value is true (for
+  // I_Or) or false (for I_And), pushes that boolean and jumps to `operand`.
+  I_Or,
+  I_And,
+
+  // Converts the value on top of the stack to a boolean.
+  I_ToBoolean,
+
+  // Replaces the top two values by the result of the binary operator
+  // `operand` (an ExprType between X_Equal and X_Union).
+  I_Binary,
+
+  // Negates the number value of the top of the stack.
+  I_Negate,
+
+  // Fails unless the value on top of the stack is a node-set.
+  I_NodeSet };
+
+struct Instruction {
+  uint8_t opcode;
+  uint8_t axis;
+  uint8_t node_type;
+  uint8_t first_only;
+  uint32_t operand;
+  uint32_t count;
+  uint32_t block;
+};
+
+// An expression compiled into a flat array of instructions. The main program
+// starts at instruction 0; each predicate is a separate block of code that is
+// run once per candidate node and ends with I_Return. Strings and numbers are
+// stored once in pools and referenced by index.
+struct Program {
+  std::vector<Instruction> code;
+
+  // The source offset of each instruction, for error reporting.
+  std::vector<uint32_t> source_offsets;
+
+  // Entry points of predicate blocks.
+  std::vector<uint32_t> blocks;
+
+  std::vector<double> numbers;
+  std::vector<std::string> strings;
+
+  void Clear() {
+    code.clear();
+    source_offsets.clear();
+    blocks.clear();
+    numbers.clear();
+    strings.clear();
+  }
+};
+
+// Compiles the expression in `ast` into *program.
+//
+// Returns true on success. Otherwise, it returns false and sets *error_offset
+// to the source offset of a call to an unknown function or with the wrong
+// number of arguments. Unlike Evaluator::Evaluate(), which only reports such
+// calls if it reaches them, this rejects them anywhere in the expression.
+bool Compile(const Ast& ast, Program* program, size_t* error_offset);
+
+// Appends a portable binary representation of `program` to *output, so that
+// programs can be compiled ahead of time and loaded at startup.
+void SerializeProgram(const Program& program, std::string* output);
+
+// Loads a program written by SerializeProgram(). Returns false if the data is
+// truncated, was written by an incompatible version, or does not describe a
+// well-formed program (for example, if it refers to a string that does not
+// exist or would underflow the stack), in which case *program is unspecified.
+bool LoadProgram(const char* data, size_t size, Program* program);
+
+inline bool LoadProgram(const std::string& data, Program* program) {
+  return LoadProgram(data.data(), data.size(), program);
+}
+
+// Returns a listing of the program with one instruction per line. Mainly
+// useful for testing.
+std::string DebugString(const Program& program);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_BYTECODE_INCLUDED */
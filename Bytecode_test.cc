@@ -0,0 +1,321 @@
+#include "Bytecode.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include "TestUtil.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+using std::string;
+using std::unique_ptr;
+
+namespace xpath {
+namespace {
+
+string CompileToString(const string& input) {
+  Ast ast;
+  Program program;
+  size_t error_offset;
+  if (!Parse(input, &ast, &error_offset)) return "parse error";
+  if (!Compile(ast, &program, &error_offset)) {
+    return "error at " + std::to_string(error_offset);
+  }
+  return DebugString(program);
+}
+
+TEST(Compile, Instructions) {
+  EXPECT_EQ("0: literal 'a'\n"
+            "1: return\n",
+            CompileToString("'a'"));
+  EXPECT_EQ("0: number 1\n"
+            "1: variable $x\n"
+            "2: negate\n"
+            "3: binary +\n"
+            "4: return\n",
+            CompileToString("1 + -$x"));
+  EXPECT_EQ("0: root\n"
+            "1: step descendant-or-self::node()\n"
+            "2: step child::book [4]\n"
+            "3: return\n"
+            "4: context\n"
+            "5: step attribute::id\n"
+            "6: literal 'b1'\n"
+            "7: binary =\n"
+            "8: return\n",
+            CompileToString("//book[@id = 'b1']"));
+  EXPECT_EQ("0: context\n"
+            "1: step child::a\n"
+            "2: variable $b\n"
+            "3: nodeset\n"
+            "4: binary |\n"
+            "5: return\n",
+            CompileToString("a | $b"));
+  EXPECT_EQ("0: variable $a\n"
+            "1: nodeset\n"
+            "2: call count/1\n"
+            "3: return\n",
+            CompileToString("count($a)"));
+  EXPECT_EQ("0: variable $x\n"
+            "1: nodeset\n"
+            "2: filter [5, 7]\n"
+            "3: step parent::node()\n"
+            "4: return\n"
+            "5: number 1\n"
+            "6: return\n"
+            "7: call true/0\n"
+            "8: return\n",
+            CompileToString("$x[1][true()]/.."));
+}
+
+TEST(Compile, ShortCircuit) {
+  EXPECT_EQ("0: call true/0\n"
+            "1: or -> 8\n"
+            "2: call false/0\n"
+            "3: and -> 7\n"
+            "4: context\n"
+            "5: step self::node()\n"
+            "6: boolean\n"
+            "7: boolean\n"
+            "8: return\n",
+            CompileToString("true() or false() and ."));
+}
+
+TEST(Compile, SharesConstants) {
+  Ast ast;
+  Program program;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("a[@x = 'a'] | a[1] | a['a'][1]", &ast, &error_offset));
+  ASSERT_TRUE(Compile(ast, &program, &error_offset));
+  // The literal 'a' shares its entry with the name test.
+  EXPECT_EQ(2u, program.strings.size());
+  EXPECT_EQ(1u, program.numbers.size());
+}
+
+TEST(Compile, IgnoresLocale) {
+  ScopedCommaLocale locale;
+  if (!locale.active()) return;  // No comma-decimal locale is installed.
+  EXPECT_EQ("0: number 1.5\n"
+            "1: return\n",
+            CompileToString("1.5"));
+}
+
+TEST(Compile, Errors) {
+  EXPECT_EQ("error at 0", CompileToString("foo()"));
+  EXPECT_EQ("error at 4", CompileToString("1 + count()"));
+  EXPECT_EQ("error at 6", CompileToString("a[1 = not(1, 2)]"));
+  // Unlike Evaluate(), this reports calls that are never reached.
+  EXPECT_EQ("error at 10", CompileToString("true() or foo()"));
+}
+
+// Expressions that exercise every instruction, evaluated both ways.
+const char* const kExpressions[] = {
+  "/", "/@name", "book/@id", "book[2]/author", "*/*/@name", "book/text()",
+  "//book", "//book[@id = 'b4']/title", "//@year[. > 2000]", "//name/..",
+  "//author/ancestor::*", "//author[1]/ancestor-or-self::node()",
+  "book[1]/following::author", "//shelf/preceding::*[1]",
+  "book[last()]/preceding-sibling::book", "book[1]/following-sibling::*",
+  "book[position() mod 2 = 1]/@id", "book[author][year < 2010]/@id",
+  "(//book)[last()]/@id", "(book | shelf/book)[3]", "book | //title",
+  "count(//author)", "sum(//@year)", "name(book[2]/*[last()])",
+  "local-name(/*)", "string(book[2]/@title)", "string()",
+  "concat(book[1]/@id, '-', 2 * 3)", "starts-with(book[1]/@title, 'XP')",
+  "contains(//@title, 'Path')", "substring-before('a/b', '/')",
+  "substring-after('a/b', '/')", "substring('12345', 1.5, 2.6)",
+  "string-length(book[3]/@title)", "normalize-space(book[3]/@title)",
+  "translate('bar', 'abc', 'ABC')", "boolean(//nothing)", "not(book)",
+  "lang('en')", "number(book[1]/@year) + 1", "floor(-1.5)", "ceiling(1.2)",
+  "round(2.5)", "-book[1]/@year", "1 div 0", "0 div 0 != 0 div 0",
+  "1 < 2 and 2 <= 2 or $missing", "false() and $missing",
+  "book/@year = 2008", "//@year >= $year", "$books[2]/@id",
+  "$books/author/@name", "id('b1')", "book[true()][1]/@id",
+  "//book[count(author) > 1 or @year = 2015]/@id",
+  "book[@id = 'b2']/author[2]/@name = 'Sanjay'",
+  // Errors.
+  "$missing", "count(1)", "1 | book", "book | 1", "1/book", "'x'[1]",
+  "sum('a')", "book[$missing]", "book[count(@id)][name(1)]",
+};
+
+class ExecuteTest : public LibraryTest {
+ protected:
+  ExecuteTest() {
+    Value books;
+    Ast ast;
+    size_t error_offset;
+    Parse("//book", &ast, &error_offset);
+    evaluator_.Evaluate(ast, &books, &error_offset);
+    evaluator_.SetVariable("books", books);
+    evaluator_.SetVariable("year", NumberValue(2008));
+  }
+};
+
+TEST_P(ExecuteTest, MatchesEvaluate) {
+  Ast ast;
+  Program program, loaded;
+  for (const char* input : kExpressions) {
+    SCOPED_TRACE(input);
+    size_t error_offset;
+    ASSERT_TRUE(Parse(input, &ast, &error_offset));
+    ASSERT_TRUE(Compile(ast, &program, &error_offset));
+    string serialized;
+    SerializeProgram(program, &serialized);
+    ASSERT_TRUE(LoadProgram(serialized, &loaded));
+    EXPECT_EQ(DebugString(program), DebugString(loaded));
+
+    Value expected, actual;
+    bool ok = evaluator_.Evaluate(ast, &expected, &error_offset);
+    string expected_string = ToString(ok, expected, error_offset);
+    ok = evaluator_.Execute(loaded, &actual, &error_offset);
+    EXPECT_EQ(expected_string, ToString(ok, actual, error_offset));
+
+    // The context node is honored.
+    uint32_t context = document_.first_child(Document::kRoot) + 1;
+    ok = evaluator_.Evaluate(ast, context, &expected, &error_offset);
+    expected_string = ToString(ok, expected, error_offset);
+    ok = evaluator_.Execute(loaded, context, &actual, &error_offset);
+    EXPECT_EQ(expected_string, ToString(ok, actual, error_offset));
+  }
+}
+
+TEST_P(ExecuteTest, MatchesSequentialInParallel) {
+  document_.ExpandAll();
+  Evaluator parallel(&document_);
+  parallel.SetParallelism(4, 2);
+  Value books;
+  size_t error_offset;
+  Ast ast;
+  Program program;
+  ASSERT_TRUE(Parse("//book", &ast, &error_offset));
+  ASSERT_TRUE(parallel.Evaluate(ast, &books, &error_offset));
+  parallel.SetVariable("books", books);
+  parallel.SetVariable("year", NumberValue(2008));
+  for (const char* input : kExpressions) {
+    SCOPED_TRACE(input);
+    ASSERT_TRUE(Parse(input, &ast, &error_offset));
+    ASSERT_TRUE(Compile(ast, &program, &error_offset));
+    Value expected, actual;
+    bool ok = evaluator_.Execute(program, &expected, &error_offset);
+    string expected_string = ToString(ok, expected, error_offset);
+    ok = parallel.Execute(program, &actual, &error_offset);
+    EXPECT_EQ(expected_string, ToString(ok, actual, error_offset));
+    ok = parallel.Evaluate(ast, &actual, &error_offset);
+    EXPECT_EQ(expected_string, ToString(ok, actual, error_offset));
+  }
+}
+
+// Evaluate() stops searching a path once it has found a node, and so never
+// evaluates the undefined variable, while the program does.
+TEST_P(ExecuteTest, ReportsErrorsEvaluateSkips) {
+  unique_ptr<SimpleMessage> message(
+      SimpleMessage::ParseText("book { id: 'b1' } book { id: 'b2' }"));
+  Document document(*message);
+  Evaluator evaluator(&document);
+  const struct {
+    const char* input;
+    const char* error;
+  } kTests[] = {
+    { "boolean(//book[@id = 'b1' or $undef])", "error at 30" },
+    { "count(//book[@id = 'b1' or $undef]) > 0", "error at 28" },
+  };
+  for (const auto& test : kTests) {
+    const char* input = test.input;
+    SCOPED_TRACE(input);
+    Ast ast;
+    Program program;
+    size_t error_offset;
+    ASSERT_TRUE(Parse(input, &ast, &error_offset));
+    ASSERT_TRUE(Compile(ast, &program, &error_offset));
+    Value value;
+    bool ok = evaluator.Evaluate(ast, &value, &error_offset);
+    EXPECT_EQ("true", ToString(ok, value, error_offset));
+    ok = evaluator.Execute(program, &value, &error_offset);
+    EXPECT_EQ(test.error, ToString(ok, value, error_offset));
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(OrderIndex, ExecuteTest, ::testing::Bool());
+
+TEST(LoadProgram, RejectsCorruptData) {
+  Ast ast;
+  Program program;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("//book[@id = 'b1' or position() = 2]/author[1]", &ast,
+                    &error_offset));
+  ASSERT_TRUE(Compile(ast, &program, &error_offset));
+  string serialized;
+  SerializeProgram(program, &serialized);
+  ASSERT_TRUE(LoadProgram(serialized, &program));
+
+  Program loaded;
+  // Every truncation is rejected.
+  for (size_t size = 0; size < serialized.size(); ++size) {
+    EXPECT_FALSE(LoadProgram(serialized.data(), size, &loaded)) << size;
+  }
+  EXPECT_FALSE(LoadProgram(serialized + '\0', &loaded));
+
+  // So are bad magic numbers and versions.
+  string corrupt = serialized;
+  corrupt[0] = 'Y';
+  EXPECT_FALSE(LoadProgram(corrupt, &loaded));
+  corrupt = serialized;
+  corrupt[4] = 2;
+  EXPECT_FALSE(LoadProgram(corrupt, &loaded));
+
+  // Corrupting any single byte either is rejected or yields a program that
+  // still runs without crashing.
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(LibraryText());
+  Document document(*message);
+  Evaluator evaluator(&document);
+  for (size_t i = 0; i < serialized.size(); ++i) {
+    for (int value : { 0x00, 0x01, 0x02, 0x07, 0x0e, 0x0f, 0x7f, 0xff }) {
+      corrupt = serialized;
+      corrupt[i] = char(value);
+      if (!LoadProgram(corrupt, &loaded)) continue;
+      Value result;
+      evaluator.Execute(loaded, &result, &error_offset);
+    }
+  }
+}
+
+TEST(LoadProgram, RejectsMalformedPrograms) {
+  Ast ast;
+  Program program;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("a[1] and 'x'", &ast, &error_offset));
+  ASSERT_TRUE(Compile(ast, &program, &error_offset));
+
+  auto loads = [](const Program& p) {
+    string serialized;
+    SerializeProgram(p, &serialized);
+    Program loaded;
+    return LoadProgram(serialized, &loaded);
+  };
+  ASSERT_TRUE(loads(program));
+
+  Program bad = program;
+  bad.code[0].opcode = I_NodeSet + 1;  // unknown instruction
+  EXPECT_FALSE(loads(bad));
+  bad = program;
+  bad.code[1].block = 1;  // predicate block out of range
+  EXPECT_FALSE(loads(bad));
+  bad = program;
+  bad.blocks[0] = 0;  // predicate block that would recurse
+  EXPECT_FALSE(loads(bad));
+  bad = program;
+  bad.code[2].operand = 1;  // jump backwards
+  EXPECT_FALSE(loads(bad));
+  bad = program;
+  bad.code.insert(bad.code.begin(), bad.code[4]);  // stack underflow
+  bad.source_offsets.push_back(0);
+  EXPECT_FALSE(loads(bad));
+  bad = program;
+  bad.code[3].operand = 5;  // string out of range
+  EXPECT_FALSE(loads(bad));
+  bad = program;
+  bad.code.back().opcode = I_Root;  // missing return
+  EXPECT_FALSE(loads(bad));
+}
+
+}  // namespace
+}  // namespace xpath
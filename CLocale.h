@@ -0,0 +1,40 @@
+#ifndef XPATH_CLOCALE_INCLUDED
+#define XPATH_CLOCALE_INCLUDED
+
+// Conversions between numbers and text that do not depend on LC_NUMERIC.
+// XPath numbers always use '.' as the decimal point, but strtod() and the
+// printf() family use the decimal point of the current locale, so that in a
+// comma-decimal locale "1.5" would read as 1.
+
+#include <locale.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace xpath {
+
+// Returns the "C" locale, created on first use.
+inline locale_t CLocale() {
+  static const locale_t locale = newlocale(LC_ALL_MASK, "C", locale_t(0));
+  return locale;
+}
+
+// Same as strtod(), in the "C" locale.
+inline double StrtodC(const char* data, char** end) {
+  return strtod_l(data, end, CLocale());
+}
+
+// Same as snprintf(), in the "C" locale.
+inline int SnprintfC(char* buffer, size_t size, const char* format, ...) {
+  locale_t previous = uselocale(CLocale());
+  va_list args;
+  va_start(args, format);
+  int result = vsnprintf(buffer, size, format, args);
+  va_end(args);
+  uselocale(previous);
+  return result;
+}
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_CLOCALE_INCLUDED */
@@ -0,0 +1,60 @@
+#ifndef XPATH_CHAR_CLASSES_INCLUDED
+#define XPATH_CHAR_CLASSES_INCLUDED
+
+// Locale-independent character classification used by the scanner. This
+// header is internal to the tokenizer implementation.
+
+namespace xpath {
+
+// Character classes, used as bits in kCharClasses.
+enum CharClass {
+  C_Space = 1,
+  C_Digit = 2,
+  C_IdentifierStart = 4,
+  C_Identifier = 8 };
+
+constexpr unsigned char ClassifyChar(int c) {
+  // Whitespace characters are the same as for isspace() in the "C" locale.
+  return (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+          c == '\r' ? C_Space : 0) |
+         (c >= '0' && c <= '9' ? C_Digit | C_Identifier : 0) |
+         // TODO: support Unicode chars too. Requires UTF-8 decoding?
+         // Note: unlike XPath we don't support ':' in identifiers.
+         (c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ?
+             C_IdentifierStart | C_Identifier : 0) |
+         (c == '-' || c == '.' ? C_Identifier : 0);
+}
+
+#define CLASSIFY4(c) ClassifyChar(c), ClassifyChar(c + 1), \
+                     ClassifyChar(c + 2), ClassifyChar(c + 3)
+#define CLASSIFY16(c) CLASSIFY4(c), CLASSIFY4(c + 4), CLASSIFY4(c + 8), \
+                      CLASSIFY4(c + 12)
+#define CLASSIFY64(c) CLASSIFY16(c), CLASSIFY16(c + 16), CLASSIFY16(c + 32), \
+                      CLASSIFY16(c + 48)
+
+// Bitmask of CharClass values for each byte value. Unlike the functions in
+// <ctype.h>, this does not depend on the current locale.
+constexpr unsigned char kCharClasses[256] = {
+  CLASSIFY64(0), CLASSIFY64(64), CLASSIFY64(128), CLASSIFY64(192) };
+
+#undef CLASSIFY64
+#undef CLASSIFY16
+#undef CLASSIFY4
+
+inline bool HasClass(char c, CharClass char_class) {
+  return (kCharClasses[static_cast<unsigned char>(c)] & char_class) != 0;
+}
+
+inline bool IsSpace(char c) { return HasClass(c, C_Space); }
+
+inline bool IsDigit(char c) { return HasClass(c, C_Digit); }
+
+inline bool IsIdentifierStartChar(char c) {
+  return HasClass(c, C_IdentifierStart);
+}
+
+inline bool IsIdentifierChar(char c) { return HasClass(c, C_Identifier); }
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_CHAR_CLASSES_INCLUDED */
@@ -0,0 +1,351 @@
+// Benchmarks the tokenizer and parser over the expressions in
+// bench_corpus.txt, one benchmark per category and stage.
+//
+// Besides the usual Google Benchmark flags, this accepts:
+//
+//   --corpus=FILE               read expressions from FILE instead of
+//                               bench_corpus.txt
+//   --save_baseline=FILE        write the CPU time of every benchmark to FILE
+//   --compare_baseline=FILE     compare CPU times against those in FILE and
+//                               exit with status 1 if any benchmark got slower
+//                               by more than the threshold
+//   --regression_threshold=X    the allowed slowdown as a fraction (default
+//                               0.1, i.e. 10%)
+//   --worst_cases=DIR           also benchmark the files in DIR, one
+//                               expression per file, as the category
+//                               fuzz-worst-cases (see FuzzReplay.cc)
+//
+// With --benchmark_repetitions, the fastest repetition of each benchmark is
+// used for the baseline, which makes the comparison less sensitive to noise.
+
+#include "Parser.h"
+#include "Tokenizer.h"
+#include <benchmark/benchmark.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Number of calls to operator new since the program started.
+size_t allocation_count = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocation_count;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+namespace xpath {
+namespace {
+
+struct Category {
+  string name;
+  vector<string> expressions;
+  size_t bytes;
+  size_t tokens;
+};
+
+// Sets the byte and token counts of the category.
+void CountTokens(Category* category) {
+  category->bytes = 0;
+  category->tokens = 0;
+  vector<Token> tokens;
+  for (const string& expression : category->expressions) {
+    category->bytes += expression.size();
+    Tokenize(expression, &tokens);
+    category->tokens += tokens.size();
+  }
+}
+
+// Reads the corpus described at the top of bench_corpus.txt.
+bool ReadCorpus(const string& path, vector<Category>* categories) {
+  std::ifstream in(path.c_str());
+  if (!in) return false;
+  string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    if (line[0] == '[' && line[line.size() - 1] == ']') {
+      categories->push_back(Category());
+      categories->back().name = line.substr(1, line.size() - 2);
+      continue;
+    }
+    if (categories->empty()) return false;
+    categories->back().expressions.push_back(line);
+  }
+  for (Category& category : *categories) CountTokens(&category);
+  return true;
+}
+
+// Adds the files in `dir` as the category fuzz-worst-cases, in the order of
+// their names, unless there are none. Expressions may span lines.
+bool ReadWorstCases(const string& dir, vector<Category>* categories) {
+  DIR* entries = opendir(dir.c_str());
+  if (entries == nullptr) return false;
+  vector<string> names;
+  while (struct dirent* entry = readdir(entries)) {
+    if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+  }
+  closedir(entries);
+  std::sort(names.begin(), names.end());
+  Category category;
+  category.name = "fuzz-worst-cases";
+  for (const string& name : names) {
+    std::ifstream in((dir + "/" + name).c_str(), std::ios::binary);
+    if (!in) return false;
+    category.expressions.push_back(
+        string(std::istreambuf_iterator<char>(in),
+               std::istreambuf_iterator<char>()));
+  }
+  if (category.expressions.empty()) return true;
+  CountTokens(&category);
+  categories->push_back(category);
+  return true;
+}
+
+// Records throughput and the average number of allocations per expression.
+void SetCounters(benchmark::State& state, const Category& category,
+                 size_t allocations) {
+  state.SetBytesProcessed(state.iterations() * category.bytes);
+  state.SetItemsProcessed(state.iterations() * category.tokens);
+  state.counters["allocs/expr"] = double(allocations) /
+      (double(state.iterations()) * category.expressions.size());
+}
+
+// Scans all tokens with ScanToken(), without disambiguation.
+void BM_ScanToken(benchmark::State& state, const Category* category) {
+  size_t allocations = allocation_count;
+  while (state.KeepRunning()) {
+    for (const string& expression : category->expressions) {
+      const char* data = expression.data();
+      const char* data_end = data + expression.size();
+      const char* token_data;
+      size_t token_size;
+      while (ScanToken(data, data_end - data, &token_data, &token_size) !=
+             T_None) {
+        data = token_data + token_size;
+      }
+      benchmark::DoNotOptimize(data);
+    }
+  }
+  SetCounters(state, *category, allocation_count - allocations);
+}
+
+// Disambiguates pre-scanned token types with DisambiguateToken().
+void BM_DisambiguateToken(benchmark::State& state, const Category* category) {
+  vector<vector<TokenType>> types;
+  for (const string& expression : category->expressions) {
+    types.push_back(vector<TokenType>());
+    const char* data = expression.data();
+    const char* data_end = data + expression.size();
+    const char* token_data;
+    size_t token_size;
+    TokenType type;
+    while ((type = ScanToken(data, data_end - data, &token_data,
+                             &token_size)) != T_None) {
+      types.back().push_back(type);
+      data = token_data + token_size;
+    }
+  }
+  size_t allocations = allocation_count;
+  while (state.KeepRunning()) {
+    for (const vector<TokenType>& sequence : types) {
+      TokenType previous = T_None;
+      for (size_t i = 0; i < sequence.size(); ++i) {
+        TokenType next = i + 1 < sequence.size() ? sequence[i + 1] : T_None;
+        previous = DisambiguateToken(previous, sequence[i], next);
+      }
+      benchmark::DoNotOptimize(previous);
+    }
+  }
+  SetCounters(state, *category, allocation_count - allocations);
+}
+
+// Tokenizes each expression into a reused vector with Tokenize().
+void BM_Tokenize(benchmark::State& state, const Category* category) {
+  vector<Token> tokens;
+  size_t allocations = allocation_count;
+  while (state.KeepRunning()) {
+    for (const string& expression : category->expressions) {
+      benchmark::DoNotOptimize(Tokenize(expression, &tokens));
+    }
+  }
+  SetCounters(state, *category, allocation_count - allocations);
+}
+
+// Tokenizes each expression with a reused Tokenizer.
+void BM_Tokenizer(benchmark::State& state, const Category* category) {
+  Tokenizer tokenizer;
+  size_t allocations = allocation_count;
+  while (state.KeepRunning()) {
+    for (const string& expression : category->expressions) {
+      benchmark::DoNotOptimize(tokenizer.Tokenize(expression));
+    }
+  }
+  SetCounters(state, *category, allocation_count - allocations);
+}
+
+// Parses each expression into a reused Ast with Parse().
+void BM_Parse(benchmark::State& state, const Category* category) {
+  Ast ast;
+  size_t error_offset;
+  size_t allocations = allocation_count;
+  while (state.KeepRunning()) {
+    for (const string& expression : category->expressions) {
+      benchmark::DoNotOptimize(Parse(expression, &ast, &error_offset));
+    }
+  }
+  SetCounters(state, *category, allocation_count - allocations);
+}
+
+// Prints results to the console like the default reporter, and collects the
+// fastest CPU time of every benchmark for the baseline.
+class BaselineReporter : public benchmark::ConsoleReporter {
+ public:
+  BaselineReporter()
+      : ConsoleReporter(isatty(STDOUT_FILENO) ? OO_ColorTabular : OO_Tabular) {}
+
+  void ReportRuns(const vector<Run>& runs) override {
+    ConsoleReporter::ReportRuns(runs);
+    for (const Run& run : runs) {
+      if (run.run_type != Run::RT_Iteration || run.error_occurred) continue;
+      double time = run.GetAdjustedCPUTime();
+      auto it = times_.find(run.benchmark_name());
+      if (it == times_.end() || time < it->second) {
+        times_[run.benchmark_name()] = time;
+      }
+    }
+  }
+
+  const std::map<string, double>& times() const { return times_; }
+
+ private:
+  std::map<string, double> times_;
+};
+
+bool SaveBaseline(const string& path, const std::map<string, double>& times) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == nullptr) return false;
+  for (const auto& entry : times) {
+    fprintf(file, "%s %.6g\n", entry.first.c_str(), entry.second);
+  }
+  return fclose(file) == 0;
+}
+
+// Compares `times` against the baseline in `path`. Returns the number of
+// regressions, or -1 if the baseline cannot be read.
+int CompareBaseline(const string& path, const std::map<string, double>& times,
+                    double threshold) {
+  std::ifstream in(path.c_str());
+  if (!in) return -1;
+  int regressions = 0;
+  string name;
+  double baseline;
+  printf("\n%-60s %12s %12s %8s\n", "Benchmark", "Baseline", "Current",
+         "Change");
+  while (in >> name >> baseline) {
+    auto it = times.find(name);
+    if (it == times.end()) continue;
+    double change = it->second / baseline - 1;
+    bool regression = change > threshold;
+    regressions += regression;
+    printf("%-60s %12.6g %12.6g %+7.1f%%%s\n", name.c_str(), baseline,
+           it->second, change * 100, regression ? "  REGRESSION" : "");
+  }
+  return regressions;
+}
+
+// Removes the flag `--name=value` from the arguments and stores its value.
+bool TakeFlag(int* argc, char** argv, const char* name, string* value) {
+  size_t name_size = strlen(name);
+  for (int i = 1; i < *argc; ++i) {
+    if (strncmp(argv[i], "--", 2) == 0 &&
+        strncmp(argv[i] + 2, name, name_size) == 0 &&
+        argv[i][2 + name_size] == '=') {
+      *value = argv[i] + 3 + name_size;
+      for (int j = i; j < *argc; ++j) argv[j] = argv[j + 1];
+      --*argc;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+}  // namespace xpath
+
+int main(int argc, char** argv) {
+  using namespace xpath;
+  string corpus = "bench_corpus.txt", save_baseline, compare_baseline;
+  string threshold = "0.1", worst_cases;
+  TakeFlag(&argc, argv, "corpus", &corpus);
+  TakeFlag(&argc, argv, "save_baseline", &save_baseline);
+  TakeFlag(&argc, argv, "compare_baseline", &compare_baseline);
+  TakeFlag(&argc, argv, "regression_threshold", &threshold);
+  TakeFlag(&argc, argv, "worst_cases", &worst_cases);
+
+  vector<Category> categories;
+  if (!ReadCorpus(corpus, &categories)) {
+    fprintf(stderr, "Cannot read corpus %s\n", corpus.c_str());
+    return 1;
+  }
+  if (!worst_cases.empty() && !ReadWorstCases(worst_cases, &categories)) {
+    fprintf(stderr, "Cannot read worst cases in %s\n", worst_cases.c_str());
+    return 1;
+  }
+  for (const Category& category : categories) {
+    benchmark::RegisterBenchmark(("BM_ScanToken/" + category.name).c_str(),
+                                 BM_ScanToken, &category);
+    benchmark::RegisterBenchmark(
+        ("BM_DisambiguateToken/" + category.name).c_str(),
+        BM_DisambiguateToken, &category);
+    benchmark::RegisterBenchmark(("BM_Tokenize/" + category.name).c_str(),
+                                 BM_Tokenize, &category);
+    benchmark::RegisterBenchmark(("BM_Tokenizer/" + category.name).c_str(),
+                                 BM_Tokenizer, &category);
+    benchmark::RegisterBenchmark(("BM_Parse/" + category.name).c_str(),
+                                 BM_Parse, &category);
+  }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  BaselineReporter reporter;
+  benchmark::RunSpecifiedBenchmarks(&reporter);
+
+  if (!save_baseline.empty() && !SaveBaseline(save_baseline, reporter.times())) {
+    fprintf(stderr, "Cannot write baseline %s\n", save_baseline.c_str());
+    return 1;
+  }
+  if (!compare_baseline.empty()) {
+    int regressions = CompareBaseline(compare_baseline, reporter.times(),
+                                      atof(threshold.c_str()));
+    if (regressions < 0) {
+      fprintf(stderr, "Cannot read baseline %s\n", compare_baseline.c_str());
+      return 1;
+    }
+    if (regressions > 0) {
+      printf("%d benchmark(s) regressed by more than %g%%\n", regressions,
+             atof(threshold.c_str()) * 100);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,200 @@
+#include "Document.h"
+#include "NodeSet.h"
+
+#include <algorithm>
+
+namespace xpath {
+
+const uint32_t Document::kRoot;
+const uint32_t Document::kNone;
+
+namespace {
+
+// SortDocumentOrder() sorts node-sets at least this large through a NodeSet,
+// which sets bits instead of sorting when the ranks are dense.
+const size_t kMinNodeSetSortSize = 4096;
+
+void AppendScalars(const Message& message, std::string* result) {
+  int field_count = message.field_count();
+  for (int field = 0; field < field_count; ++field) {
+    if (message.is_message_field(field)) continue;
+    size_t value_count = message.value_count(field);
+    for (size_t i = 0; i < value_count; ++i) {
+      *result += message.scalar_value(field, i);
+    }
+  }
+  for (int field = 0; field < field_count; ++field) {
+    if (!message.is_message_field(field)) continue;
+    size_t value_count = message.value_count(field);
+    for (size_t i = 0; i < value_count; ++i) {
+      AppendScalars(message.message_value(field, i), result);
+    }
+  }
+}
+
+}  // namespace
+
+Document::Document(const Message& message) : expanded_all_(false) {
+  AddNode(K_Root, kNone, -1, 0, &message);
+}
+
+uint32_t Document::AddNode(NodeKind kind, uint32_t parent, int field,
+                           uint32_t index, const Message* message) {
+  NodeInfo info;
+  info.kind = kind;
+  info.expanded = kind == K_Attribute;
+  info.field = field;
+  info.index = index;
+  info.parent = parent;
+  info.depth = parent == kNone ? 0 : nodes_[parent].depth + 1;
+  info.message = message;
+  info.first_attribute = 0;
+  info.attribute_count = 0;
+  info.first_child = 0;
+  info.child_count = 0;
+  nodes_.push_back(info);
+  return nodes_.size() - 1;
+}
+
+void Document::ExpandNode(uint32_t node) {
+  // Attributes are created before children, so that comparing the ids of two
+  // nodes with the same parent yields their document order.
+  const Message& message = *nodes_[node].message;
+  int field_count = message.field_count();
+  uint32_t first_attribute = nodes_.size();
+  for (int field = 0; field < field_count; ++field) {
+    if (message.is_message_field(field)) continue;
+    size_t value_count = message.value_count(field);
+    for (size_t i = 0; i < value_count; ++i) {
+      AddNode(K_Attribute, node, field, i, nullptr);
+    }
+  }
+  uint32_t first_child = nodes_.size();
+  for (int field = 0; field < field_count; ++field) {
+    if (!message.is_message_field(field)) continue;
+    size_t value_count = message.value_count(field);
+    for (size_t i = 0; i < value_count; ++i) {
+      AddNode(K_Element, node, field, i, &message.message_value(field, i));
+    }
+  }
+  NodeInfo& info = nodes_[node];
+  info.expanded = true;
+  info.first_attribute = first_attribute;
+  info.attribute_count = first_child - first_attribute;
+  info.first_child = first_child;
+  info.child_count = nodes_.size() - first_child;
+}
+
+void Document::ExpandAll() {
+  // Nodes are appended while iterating, so this also visits new nodes.
+  for (uint32_t node = 0; node < nodes_.size(); ++node) Expand(node);
+  expanded_all_ = true;
+}
+
+void Document::BuildOrderIndex() {
+  ExpandAll();
+  uint32_t node_count = nodes_.size();
+  order_.resize(node_count);
+  subtree_size_.assign(node_count, 0);
+  preorder_.clear();
+  preorder_.reserve(node_count);
+
+  // Assign ranks in pre-order, visiting attributes before children.
+  std::vector<uint32_t> stack(1, kRoot);
+  while (!stack.empty()) {
+    uint32_t node = stack.back();
+    stack.pop_back();
+    order_[node] = preorder_.size();
+    preorder_.push_back(node);
+    const NodeInfo& info = nodes_[node];
+    for (uint32_t i = info.child_count; i-- > 0;) {
+      stack.push_back(info.first_child + i);
+    }
+    for (uint32_t i = info.attribute_count; i-- > 0;) {
+      stack.push_back(info.first_attribute + i);
+    }
+  }
+
+  // In reverse pre-order, every node is visited after its descendants.
+  for (uint32_t rank = node_count; rank-- > 0;) {
+    uint32_t node = preorder_[rank];
+    if (node != kRoot) {
+      subtree_size_[nodes_[node].parent] += subtree_size_[node] + 1;
+    }
+  }
+}
+
+bool Document::IsAncestor(uint32_t ancestor, uint32_t node) const {
+  if (has_order_index()) {
+    return order_[ancestor] < order_[node] &&
+        order_[node] <= order_[ancestor] + subtree_size_[ancestor];
+  }
+  for (uint32_t depth = nodes_[ancestor].depth; nodes_[node].depth > depth;) {
+    node = nodes_[node].parent;
+    if (node == ancestor) return true;
+  }
+  return false;
+}
+
+const std::string& Document::name(uint32_t node) const {
+  static const std::string kEmpty;
+  const NodeInfo& info = nodes_[node];
+  if (info.kind == K_Root) return kEmpty;
+  return nodes_[info.parent].message->field_name(info.field);
+}
+
+std::string Document::StringValue(uint32_t node) const {
+  const NodeInfo& info = nodes_[node];
+  if (info.kind == K_Attribute) {
+    return nodes_[info.parent].message->scalar_value(info.field, info.index);
+  }
+  std::string result;
+  AppendScalars(*info.message, &result);
+  return result;
+}
+
+int Document::Compare(uint32_t a, uint32_t b) const {
+  if (a == b) return 0;
+  if (has_order_index()) return order_[a] < order_[b] ? -1 : 1;
+  uint32_t depth_a = nodes_[a].depth, depth_b = nodes_[b].depth;
+  // An ancestor precedes its descendants.
+  while (depth_a > depth_b) {
+    a = nodes_[a].parent;
+    if (a == b) return 1;
+    --depth_a;
+  }
+  while (depth_b > depth_a) {
+    b = nodes_[b].parent;
+    if (a == b) return -1;
+    --depth_b;
+  }
+  while (nodes_[a].parent != nodes_[b].parent) {
+    a = nodes_[a].parent;
+    b = nodes_[b].parent;
+  }
+  return a < b ? -1 : 1;
+}
+
+void Document::SortDocumentOrder(std::vector<uint32_t>* nodes) const {
+  if (has_order_index()) {
+    for (uint32_t& node : *nodes) node = order_[node];
+    if (nodes->size() >= kMinNodeSetSortSize) {
+      NodeSet ranks;
+      ranks.Assign(*nodes);
+      nodes->clear();
+      ranks.AppendTo(nodes);
+    } else {
+      std::sort(nodes->begin(), nodes->end());
+      nodes->erase(std::unique(nodes->begin(), nodes->end()), nodes->end());
+    }
+    for (uint32_t& rank : *nodes) rank = preorder_[rank];
+    return;
+  }
+  auto less = [this](uint32_t a, uint32_t b) { return Compare(a, b) < 0; };
+  if (!std::is_sorted(nodes->begin(), nodes->end(), less)) {
+    std::sort(nodes->begin(), nodes->end(), less);
+  }
+  nodes->erase(std::unique(nodes->begin(), nodes->end()), nodes->end());
+}
+
+}  // namespace xpath
@@ -0,0 +1,170 @@
+#ifndef XPATH_DOCUMENT_INCLUDED
+#define XPATH_DOCUMENT_INCLUDED
+
+#include "Message.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+enum NodeKind {
+  // The root node, which represents the top-level message. Its scalar fields
+  // are attributes, and its message fields are child elements.
+  K_Root = 0,
+
+  // A value of a message field. The name of the element is the field name.
+  K_Element,
+
+  // A value of a scalar field. The name of the attribute is the field name.
+  K_Attribute };
+
+// The XPath data model of a protocol buffer message.
+//
+// Nodes are identified by 32-bit ids. The root node is always kRoot; other
+// nodes are created on demand, when the children or attributes of their
+// parent are first requested, so evaluating an expression only touches the
+// part of the message that it actually visits. The ids of the attributes and
+// children of a node are each contiguous ranges in document order, but ids of
+// unrelated nodes are not ordered; use Compare() for that.
+//
+// A Document keeps a reference to the message, which must outlive it. It is
+// not thread-safe, because even const-looking queries may expand nodes.
+class Document {
+ public:
+  // Id of the root node.
+  static const uint32_t kRoot = 0;
+
+  // Id value used to indicate the absence of a node.
+  static const uint32_t kNone = 0xffffffffu;
+
+  explicit Document(const Message& message);
+
+  // Returns the number of nodes that have been created so far.
+  size_t node_count() const { return nodes_.size(); }
+
+  NodeKind kind(uint32_t node) const { return nodes_[node].kind; }
+
+  // Returns the parent of the node, or kNone for the root node. The parent of
+  // an attribute is the element (or root) that contains it.
+  uint32_t parent(uint32_t node) const { return nodes_[node].parent; }
+
+  // Returns the number of ancestors of the node.
+  uint32_t depth(uint32_t node) const { return nodes_[node].depth; }
+
+  // Returns the name of an element or attribute, or an empty string for the
+  // root node.
+  const std::string& name(uint32_t node) const;
+
+  // Returns the message represented by an element or the root node, or
+  // nullptr for an attribute.
+  const Message* message(uint32_t node) const { return nodes_[node].message; }
+
+  // Returns the child elements of the node as the range of ids
+  // [first_child(), first_child() + child_count()). Attributes have no
+  // children.
+  uint32_t first_child(uint32_t node) {
+    Expand(node);
+    return nodes_[node].first_child;
+  }
+  uint32_t child_count(uint32_t node) {
+    Expand(node);
+    return nodes_[node].child_count;
+  }
+
+  // Returns the attributes of the node as the range of ids
+  // [first_attribute(), first_attribute() + attribute_count()).
+  uint32_t first_attribute(uint32_t node) {
+    Expand(node);
+    return nodes_[node].first_attribute;
+  }
+  uint32_t attribute_count(uint32_t node) {
+    Expand(node);
+    return nodes_[node].attribute_count;
+  }
+
+  // Returns the XPath string-value of the node. For an attribute, this is the
+  // scalar value; for an element or the root node, it is the concatenation of
+  // all scalar values in the message, in document order. Does not create any
+  // nodes.
+  std::string StringValue(uint32_t node) const;
+
+  // Returns a negative number, zero, or a positive number if `a` comes
+  // before, is the same as, or comes after `b` in document order.
+  int Compare(uint32_t a, uint32_t b) const;
+
+  // Sorts `nodes` in document order and removes duplicates.
+  void SortDocumentOrder(std::vector<uint32_t>* nodes) const;
+
+  // Creates all nodes of the document, after which no further nodes are
+  // created and the Document can be read from multiple threads.
+  void ExpandAll();
+
+  // Returns true once ExpandAll() (or BuildOrderIndex()) has been called.
+  bool is_expanded() const { return expanded_all_; }
+
+  // Expands all nodes and builds an index of the document order, for large
+  // documents that are queried repeatedly. The index stores the pre-order
+  // rank and subtree size of every node in flat arrays (which together give
+  // the same interval as pre- and post-order ranks), so that ancestor
+  // tests and Compare() take constant time, SortDocumentOrder() becomes an
+  // integer sort, and the descendant, following and preceding axes are
+  // contiguous rank ranges (see node_at()). Node ids do not change.
+  void BuildOrderIndex();
+
+  bool has_order_index() const { return !order_.empty(); }
+
+  // Returns the rank of the node in document order. Requires the index.
+  uint32_t order(uint32_t node) const { return order_[node]; }
+
+  // Returns the number of nodes (attributes included) in the subtree below
+  // the node, which are the nodes with ranks in (order(node),
+  // order(node) + subtree_size(node)]. Requires the index.
+  uint32_t subtree_size(uint32_t node) const { return subtree_size_[node]; }
+
+  // Returns the node with the given rank in document order. Requires the
+  // index.
+  uint32_t node_at(uint32_t rank) const { return preorder_[rank]; }
+
+  // Returns true if `ancestor` is a proper ancestor of `node`.
+  bool IsAncestor(uint32_t ancestor, uint32_t node) const;
+
+ private:
+  struct NodeInfo {
+    NodeKind kind;
+    bool expanded;
+    int field;
+    uint32_t index;
+    uint32_t parent;
+    uint32_t depth;
+    const Message* message;
+    uint32_t first_attribute;
+    uint32_t attribute_count;
+    uint32_t first_child;
+    uint32_t child_count;
+  };
+
+  void Expand(uint32_t node) {
+    if (!nodes_[node].expanded) ExpandNode(node);
+  }
+  void ExpandNode(uint32_t node);
+  uint32_t AddNode(NodeKind kind, uint32_t parent, int field, uint32_t index,
+                   const Message* message);
+
+  std::vector<NodeInfo> nodes_;
+  bool expanded_all_;
+
+  // Document-order index, indexed by node id (order_, subtree_size_) or by
+  // rank (preorder_). Empty unless BuildOrderIndex() was called.
+  std::vector<uint32_t> order_;
+  std::vector<uint32_t> subtree_size_;
+  std::vector<uint32_t> preorder_;
+
+  Document(const Document&);
+  void operator=(const Document&);
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_DOCUMENT_INCLUDED */
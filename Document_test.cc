@@ -0,0 +1,163 @@
+#include "Document.h"
+#include "SimpleMessage.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+const char kMessage[] =
+    "id: 1 "
+    "item { name: 'a' part { x: 'p' } } "
+    "item { name: 'b' } "
+    "tag: 't'";
+
+TEST(Document, ExpandsLazily) {
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(kMessage);
+  ASSERT_TRUE(message != nullptr);
+  Document document(*message);
+  EXPECT_EQ(1, document.node_count());
+  EXPECT_EQ(K_Root, document.kind(Document::kRoot));
+  EXPECT_EQ(Document::kNone, document.parent(Document::kRoot));
+  EXPECT_EQ("", document.name(Document::kRoot));
+
+  // Scalar fields become attributes, message fields become children.
+  EXPECT_EQ(2, document.child_count(Document::kRoot));
+  EXPECT_EQ(2, document.attribute_count(Document::kRoot));
+  EXPECT_EQ(5, document.node_count());
+  uint32_t id = document.first_attribute(Document::kRoot);
+  EXPECT_EQ(K_Attribute, document.kind(id));
+  EXPECT_EQ("id", document.name(id));
+  EXPECT_EQ("tag", document.name(id + 1));
+  EXPECT_EQ("1", document.StringValue(id));
+  EXPECT_EQ(0, document.child_count(id));
+
+  uint32_t item = document.first_child(Document::kRoot);
+  EXPECT_EQ(K_Element, document.kind(item));
+  EXPECT_EQ("item", document.name(item));
+  EXPECT_EQ(Document::kRoot, document.parent(item));
+  EXPECT_EQ(1, document.depth(item));
+  EXPECT_EQ(5, document.node_count());
+  EXPECT_EQ(1, document.child_count(item));
+  EXPECT_EQ(7, document.node_count());
+}
+
+TEST(Document, StringValue) {
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(kMessage);
+  Document document(*message);
+  EXPECT_EQ("1tapb", document.StringValue(Document::kRoot));
+  uint32_t item = document.first_child(Document::kRoot);
+  EXPECT_EQ("ap", document.StringValue(item));
+  EXPECT_EQ("b", document.StringValue(item + 1));
+}
+
+TEST(Document, DocumentOrder) {
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(kMessage);
+  Document document(*message);
+  uint32_t root = Document::kRoot;
+  uint32_t id = document.first_attribute(root);
+  uint32_t tag = id + 1;
+  uint32_t item_b = document.first_child(root) + 1;
+  uint32_t name_b = document.first_attribute(item_b);
+  document.ExpandAll();
+  uint32_t item_a = document.first_child(root);
+  uint32_t name_a = document.first_attribute(item_a);
+  uint32_t part = document.first_child(item_a);
+  uint32_t x = document.first_attribute(part);
+
+  // Nodes of item_b were created before those of item_a.
+  EXPECT_LT(name_b, name_a);
+
+  vector<uint32_t> expected = {
+      root, id, tag, item_a, name_a, part, x, item_b, name_b };
+  for (size_t i = 0; i < expected.size(); ++i) {
+    for (size_t j = 0; j < expected.size(); ++j) {
+      int c = document.Compare(expected[i], expected[j]);
+      EXPECT_EQ(i < j, c < 0) << i << " " << j;
+      EXPECT_EQ(i == j, c == 0) << i << " " << j;
+    }
+  }
+
+  vector<uint32_t> nodes = {
+      name_b, x, root, item_a, tag, x, id, name_a, part, item_b, root };
+  document.SortDocumentOrder(&nodes);
+  EXPECT_EQ(expected, nodes);
+}
+
+TEST(Document, OrderIndex) {
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(kMessage);
+  Document lazy(*message);
+  Document indexed(*message);
+  lazy.ExpandAll();
+  indexed.BuildOrderIndex();
+  ASSERT_TRUE(indexed.has_order_index());
+  EXPECT_FALSE(lazy.has_order_index());
+  ASSERT_EQ(lazy.node_count(), indexed.node_count());
+  uint32_t node_count = indexed.node_count();
+
+  EXPECT_EQ(0, indexed.order(Document::kRoot));
+  EXPECT_EQ(node_count - 1, indexed.subtree_size(Document::kRoot));
+  uint32_t item_a = indexed.first_child(Document::kRoot);
+  EXPECT_EQ(3, indexed.order(item_a));
+  EXPECT_EQ(3, indexed.subtree_size(item_a));
+  EXPECT_EQ(0, indexed.subtree_size(indexed.first_attribute(item_a)));
+
+  for (uint32_t a = 0; a < node_count; ++a) {
+    EXPECT_EQ(a, indexed.node_at(indexed.order(a)));
+    for (uint32_t b = 0; b < node_count; ++b) {
+      EXPECT_EQ(lazy.Compare(a, b), indexed.Compare(a, b)) << a << " " << b;
+      EXPECT_EQ(lazy.IsAncestor(a, b), indexed.IsAncestor(a, b))
+          << a << " " << b;
+    }
+  }
+  EXPECT_TRUE(indexed.IsAncestor(Document::kRoot, item_a));
+  EXPECT_FALSE(indexed.IsAncestor(item_a, item_a));
+  EXPECT_FALSE(indexed.IsAncestor(item_a, Document::kRoot));
+
+  vector<uint32_t> lazy_nodes, indexed_nodes;
+  for (uint32_t i = 0; i < 3 * node_count; ++i) {
+    lazy_nodes.push_back((i * 7) % node_count);
+  }
+  indexed_nodes = lazy_nodes;
+  lazy.SortDocumentOrder(&lazy_nodes);
+  indexed.SortDocumentOrder(&indexed_nodes);
+  EXPECT_EQ(node_count, indexed_nodes.size());
+  EXPECT_EQ(lazy_nodes, indexed_nodes);
+}
+
+TEST(Document, SortsLargeNodeSets) {
+  string text;
+  for (int i = 0; i < 5000; ++i) {
+    text += "item { id: " + std::to_string(i) + " part { x: 1 } } ";
+  }
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(text);
+  Document lazy(*message);
+  Document indexed(*message);
+  lazy.ExpandAll();
+  indexed.BuildOrderIndex();
+  uint32_t node_count = indexed.node_count();
+
+  // Dense and sparse node-sets, with duplicates, large enough to be sorted
+  // through a NodeSet.
+  for (uint32_t step : { 7, 4099 }) {
+    vector<uint32_t> lazy_nodes, indexed_nodes;
+    for (uint32_t i = 0; i < 2 * node_count; ++i) {
+      lazy_nodes.push_back(uint64_t(i) * step % node_count);
+    }
+    indexed_nodes = lazy_nodes;
+    lazy.SortDocumentOrder(&lazy_nodes);
+    indexed.SortDocumentOrder(&indexed_nodes);
+    EXPECT_EQ(node_count, indexed_nodes.size());
+    EXPECT_EQ(lazy_nodes, indexed_nodes);
+  }
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,1503 @@
+#include "Evaluator.h"
+
+#include "AxisIterator.h"
+#include "CLocale.h"
+#include "FieldIndex.h"
+#include "Functions.h"
+#include "ParallelFor.h"
+#include "Profile.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_set>
+#include <utility>
+
+namespace xpath {
+
+const size_t Evaluator::kDefaultMinParallelNodes;
+
+namespace {
+
+// The largest number of nodes that FilterParallel() hands to a worker at a
+// time. Smaller sets are split into a few chunks per worker.
+const size_t kMaxParallelChunkSize = 256;
+
+// A limit on the number of nodes to select that does not limit anything.
+const size_t kUnlimited = size_t(-1);
+
+bool IsCall(const Ast& ast, uint32_t expr, FunctionName function) {
+  const Expr& e = ast.node(expr);
+  return e.type == X_FunctionCall && e.first_child == Ast::kNone &&
+      e.function == function;
+}
+
+bool MayBeNumber(const Ast& ast, uint32_t expr) {
+  const Expr& e = ast.node(expr);
+  switch (e.type) {
+    case X_Plus:
+    case X_Minus:
+    case X_Multiply:
+    case X_Div:
+    case X_Mod:
+    case X_Negate:
+    case X_Number:
+    case X_VariableReference:
+      return true;
+    case X_FunctionCall:
+      switch (e.function) {
+        case F_None:
+        case F_Last:
+        case F_Position:
+        case F_Count:
+        case F_StringLength:
+        case F_Number:
+        case F_Sum:
+        case F_Floor:
+        case F_Ceiling:
+        case F_Round:
+          return true;
+        default:
+          return false;
+      }
+    case X_Filter:
+      return ast.node(e.first_child).next_sibling == Ast::kNone &&
+          MayBeNumber(ast, e.first_child);
+    default:
+      return false;
+  }
+}
+
+// Returns true if `expr` calls position() or last() for its own context.
+// Predicates of steps and filters inside it have a context of their own.
+bool UsesPosition(const Ast& ast, uint32_t expr) {
+  const Expr& e = ast.node(expr);
+  if (IsCall(ast, expr, F_Position) || IsCall(ast, expr, F_Last)) return true;
+  if (e.type == X_Step) return false;
+  uint32_t end = e.type == X_Filter ? ast.node(e.first_child).next_sibling
+                                    : Ast::kNone;
+  for (uint32_t child = e.first_child; child != end;
+       child = ast.node(child).next_sibling) {
+    if (UsesPosition(ast, child)) return true;
+  }
+  return false;
+}
+
+// Whitespace as defined by the XML specification.
+bool IsXmlSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Splits a UTF-8 string into the byte offsets at which characters start, plus
+// a final entry for the end of the string. XPath string functions count
+// characters, not bytes.
+void CharacterOffsets(const std::string& s, std::vector<size_t>* offsets) {
+  offsets->clear();
+  for (size_t i = 0; i < s.size(); ++i) {
+    if ((s[i] & 0xc0) != 0x80) offsets->push_back(i);
+  }
+  offsets->push_back(s.size());
+}
+
+size_t CharacterCount(const std::string& s) {
+  size_t count = 0;
+  for (char c : s) count += (c & 0xc0) != 0x80;
+  return count;
+}
+
+std::string Substring(const std::string& s, double start, double length,
+                      bool has_length) {
+  std::vector<size_t> offsets;
+  CharacterOffsets(s, &offsets);
+  double first = floor(start + 0.5);
+  double last = has_length ? first + floor(length + 0.5) : INFINITY;
+  size_t begin = 0, end = 0;
+  bool found = false;
+  for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+    double position = i + 1;
+    if (position >= first && position < last) {
+      if (!found) begin = offsets[i];
+      end = offsets[i + 1];
+      found = true;
+    }
+  }
+  return found ? s.substr(begin, end - begin) : std::string();
+}
+
+std::string NormalizeSpace(const std::string& s) {
+  std::string result;
+  bool pending_space = false;
+  for (char c : s) {
+    if (IsXmlSpace(c)) {
+      pending_space = !result.empty();
+    } else {
+      if (pending_space) result += ' ';
+      pending_space = false;
+      result += c;
+    }
+  }
+  return result;
+}
+
+std::string Translate(const std::string& s, const std::string& from,
+                      const std::string& to) {
+  std::vector<size_t> s_offsets, from_offsets, to_offsets;
+  CharacterOffsets(s, &s_offsets);
+  CharacterOffsets(from, &from_offsets);
+  CharacterOffsets(to, &to_offsets);
+  std::string result;
+  for (size_t i = 0; i + 1 < s_offsets.size(); ++i) {
+    const char* c = s.data() + s_offsets[i];
+    size_t c_size = s_offsets[i + 1] - s_offsets[i];
+    size_t j = 0;
+    for (; j + 1 < from_offsets.size(); ++j) {
+      size_t size = from_offsets[j + 1] - from_offsets[j];
+      if (size == c_size &&
+          memcmp(from.data() + from_offsets[j], c, size) == 0) {
+        break;
+      }
+    }
+    if (j + 1 == from_offsets.size()) {
+      result.append(c, c_size);
+    } else if (j + 1 < to_offsets.size()) {
+      result.append(to, to_offsets[j], to_offsets[j + 1] - to_offsets[j]);
+    }
+  }
+  return result;
+}
+
+double Round(double x) {
+  if (isnan(x) || isinf(x)) return x;
+  if (x < 0 && x >= -0.5) return -0.0;
+  return floor(x + 0.5);
+}
+
+}  // namespace
+
+Value BooleanValue(bool boolean) {
+  Value value;
+  value.type = V_Boolean;
+  value.boolean = boolean;
+  return value;
+}
+
+Value NumberValue(double number) {
+  Value value;
+  value.type = V_Number;
+  value.number = number;
+  return value;
+}
+
+Value StringValue(const std::string& string) {
+  Value value;
+  value.type = V_String;
+  value.string = string;
+  return value;
+}
+
+std::string NumberToString(double number) {
+  if (isnan(number)) return "NaN";
+  if (isinf(number)) return number > 0 ? "Infinity" : "-Infinity";
+  if (number == 0) return "0";
+
+  // Find the shortest representation that reads back as the same number.
+  char buffer[32];
+  for (int precision = 1; precision <= 17; ++precision) {
+    SnprintfC(buffer, sizeof(buffer), "%.*e", precision - 1, number);
+    if (StrtodC(buffer, nullptr) == number) break;
+  }
+
+  // Rewrite [-]d.ddde[+-]xx in plain decimal notation.
+  std::string result;
+  const char* p = buffer;
+  if (*p == '-') result += *p++;
+  std::string digits;
+  for (; *p != 'e'; ++p) {
+    if (*p != '.') digits += *p;
+  }
+  int exponent = atoi(p + 1);
+  int digit_count = digits.size();
+  if (exponent >= digit_count - 1) {
+    result += digits;
+    result.append(exponent - (digit_count - 1), '0');
+  } else if (exponent >= 0) {
+    result.append(digits, 0, exponent + 1);
+    result += '.';
+    result.append(digits, exponent + 1, std::string::npos);
+  } else {
+    result += "0.";
+    result.append(-exponent - 1, '0');
+    result += digits;
+  }
+  return result;
+}
+
+double StringToNumber(const std::string& string) {
+  size_t size = string.size();
+  size_t begin = 0;
+  while (begin < size && IsXmlSpace(string[begin])) ++begin;
+  size_t end = begin;
+  if (end < size && string[end] == '-') ++end;
+  size_t digits = 0;
+  while (end < size && string[end] >= '0' && string[end] <= '9') {
+    ++end;
+    ++digits;
+  }
+  if (end < size && string[end] == '.') {
+    ++end;
+    while (end < size && string[end] >= '0' && string[end] <= '9') {
+      ++end;
+      ++digits;
+    }
+  }
+  size_t pos = end;
+  while (pos < size && IsXmlSpace(string[pos])) ++pos;
+  if (digits == 0 || pos != size) return NAN;
+  return StrtodC(string.substr(begin, end - begin).c_str(), nullptr);
+}
+
+bool ToBoolean(const Value& value) {
+  switch (value.type) {
+    case V_NodeSet:
+      return !value.nodes.empty();
+    case V_Boolean:
+      return value.boolean;
+    case V_Number:
+      return value.number != 0 && !isnan(value.number);
+    default:
+      return !value.string.empty();
+  }
+}
+
+bool IsPositionalPredicate(const Ast& ast, uint32_t predicate) {
+  return MayBeNumber(ast, predicate) || UsesPosition(ast, predicate);
+}
+
+bool Evaluator::Evaluate(const Ast& ast, uint32_t context, Value* result,
+                         size_t* error_offset) {
+  XPATH_PROFILE_PHASE(P_Evaluate);
+  if (ast.root() == Ast::kNone) {
+    *error_offset = 0;
+    return false;
+  }
+  ast_ = &ast;
+  Context root_context = { context, 1, 1 };
+  if (!Eval(ast.root(), root_context, result)) {
+    *error_offset = error_offset_;
+    return false;
+  }
+  return true;
+}
+
+bool Evaluator::Error(uint32_t expr) {
+  error_offset_ = ast_->node(expr).text_offset;
+  return false;
+}
+
+bool Evaluator::Execute(const Program& program, uint32_t context,
+                        Value* result, size_t* error_offset) {
+  XPATH_PROFILE_PHASE(P_Evaluate);
+  if (program.code.empty()) {
+    *error_offset = 0;
+    return false;
+  }
+  stack_.clear();
+  Context root_context = { context, 1, 1 };
+  if (!Run(program, 0, root_context)) {
+    stack_.clear();
+    *error_offset = error_offset_;
+    return false;
+  }
+  *result = std::move(stack_.back());
+  stack_.pop_back();
+  return true;
+}
+
+bool Evaluator::RunError(const Program& program, uint32_t pc) {
+  error_offset_ = program.source_offsets[pc];
+  return false;
+}
+
+// Runs the code starting at `pc` up to the next I_Return, which leaves the
+// result on top of the stack.
+bool Evaluator::Run(const Program& program, uint32_t pc,
+                    const Context& context) {
+  const Instruction* code = program.code.data();
+  for (;; ++pc) {
+    const Instruction& instruction = code[pc];
+    switch (instruction.opcode) {
+      case I_Return:
+        return true;
+
+      case I_Literal:
+        stack_.push_back(StringValue(program.strings[instruction.operand]));
+        break;
+
+      case I_Number:
+        stack_.push_back(NumberValue(program.numbers[instruction.operand]));
+        break;
+
+      case I_Variable: {
+        auto it = variables_.find(program.strings[instruction.operand]);
+        if (it == variables_.end()) return RunError(program, pc);
+        stack_.push_back(it->second);
+        break;
+      }
+
+      case I_Root:
+      case I_Context:
+        stack_.push_back(Value());
+        stack_.back().nodes.push_back(
+            instruction.opcode == I_Root ? Document::kRoot : context.node);
+        break;
+
+      case I_Step:
+      case I_Filter: {
+        if (stack_.back().type != V_NodeSet) return RunError(program, pc);
+        // Predicates push onto the stack, so work on a detached node-set.
+        std::vector<uint32_t> nodes;
+        nodes.swap(stack_.back().nodes);
+        if (instruction.opcode == I_Step
+                ? !RunStep(program, &pc, &nodes)
+                : !RunPredicates(program, instruction, &nodes)) {
+          return false;
+        }
+        stack_.back().nodes.swap(nodes);
+        break;
+      }
+
+      case I_Call: {
+        size_t base = stack_.size() - instruction.count;
+        Value value;
+        if (!CallFunction(FunctionName(instruction.operand), &stack_[base],
+                          instruction.count, context, &value)) {
+          return RunError(program, pc);
+        }
+        stack_.erase(stack_.begin() + base, stack_.end());
+        stack_.push_back(std::move(value));
+        break;
+      }
+
+      case I_Or:
+      case I_And: {
+        bool boolean = ToBoolean(stack_.back());
+        if (boolean == (instruction.opcode == I_Or)) {
+          stack_.back() = BooleanValue(boolean);
+          pc = instruction.operand - 1;
+        } else {
+          stack_.pop_back();
+        }
+        break;
+      }
+
+      case I_ToBoolean:
+        stack_.back() = BooleanValue(ToBoolean(stack_.back()));
+        break;
+
+      case I_Binary: {
+        Value& left = stack_[stack_.size() - 2];
+        const Value& right = stack_.back();
+        if (instruction.operand == X_Union &&
+            (left.type != V_NodeSet || right.type != V_NodeSet)) {
+          return RunError(program, pc);
+        }
+        ApplyOperator(ExprType(instruction.operand), &left, right);
+        stack_.pop_back();
+        break;
+      }
+
+      case I_Negate:
+        stack_.back() = NumberValue(-ToNumber(stack_.back()));
+        break;
+
+      case I_NodeSet:
+        if (stack_.back().type != V_NodeSet) return RunError(program, pc);
+        break;
+    }
+  }
+}
+
+// Runs the I_Step at *pc, which may also run the step after it (see
+// PlanIndexedStep()), in which case *pc is advanced to that step.
+bool Evaluator::RunStep(const Program& program, uint32_t* pc,
+                        std::vector<uint32_t>* nodes) {
+  std::vector<uint32_t> next, selected;
+  Instruction rest;
+  if (PlanIndexedStep(program, pc, *nodes, &next, &rest)) {
+    if (!RunPredicates(program, rest, &next)) return false;
+    nodes->swap(next);
+    return true;
+  }
+  const Instruction& step = program.code[*pc];
+  const std::string& name = program.strings[step.operand];
+  AxisName axis = AxisName(step.axis);
+  NodeType node_type = NodeType(step.node_type);
+  for (uint32_t node : *nodes) {
+    if (step.count == 0) {
+      SelectStep(axis, node_type, name.data(), name.size(), step.first_only,
+                 node, &next);
+      continue;
+    }
+    selected.clear();
+    SelectStep(axis, node_type, name.data(), name.size(), step.first_only,
+               node, &selected);
+    if (!RunPredicates(program, step, &selected)) return false;
+    next.insert(next.end(), selected.begin(), selected.end());
+  }
+  document_->SortDocumentOrder(&next);
+  nodes->swap(next);
+  return true;
+}
+
+bool Evaluator::RunPredicates(const Program& program,
+                              const Instruction& instruction,
+                              std::vector<uint32_t>* nodes) {
+  for (uint32_t i = 0; i < instruction.count; ++i) {
+    uint32_t entry = program.blocks[instruction.block + i];
+    if (ShouldFilterParallel(nodes->size())) {
+      auto filter = [&program, entry](Evaluator* evaluator,
+                                      const Context& context, bool* keep) {
+        if (!evaluator->Run(program, entry, context)) return false;
+        *keep = evaluator->IsPredicateTrue(evaluator->stack_.back(),
+                                           context.position);
+        evaluator->stack_.pop_back();
+        return true;
+      };
+      if (!FilterParallel(filter, nodes)) return false;
+      continue;
+    }
+    Context context;
+    context.size = nodes->size();
+    size_t kept = 0;
+    for (size_t j = 0; j < context.size; ++j) {
+      context.node = (*nodes)[j];
+      context.position = j + 1;
+      XPATH_PROFILE_ADD(predicates_evaluated, 1);
+      if (!Run(program, entry, context)) return false;
+      bool keep = IsPredicateTrue(stack_.back(), context.position);
+      stack_.pop_back();
+      if (keep) (*nodes)[kept++] = context.node;
+    }
+    nodes->resize(kept);
+  }
+  return true;
+}
+
+bool Evaluator::Eval(uint32_t expr, const Context& context, Value* result) {
+  const Expr& e = ast_->node(expr);
+  switch (e.type) {
+    case X_Or:
+    case X_And: {
+      bool boolean;
+      if (!EvalBoolean(e.first_child, context, &boolean)) return false;
+      if (boolean == (e.type == X_And)) {
+        uint32_t right = ast_->node(e.first_child).next_sibling;
+        if (!EvalBoolean(right, context, &boolean)) return false;
+      }
+      *result = BooleanValue(boolean);
+      return true;
+    }
+
+    case X_Equal:
+    case X_NotEqual:
+    case X_LessThan:
+    case X_LessEqual:
+    case X_GreaterThan:
+    case X_GreaterEqual: {
+      uint32_t left = e.first_child;
+      uint32_t right = ast_->node(left).next_sibling;
+      Value right_value;
+      if (!EvalComparand(left, right, context, result) ||
+          !EvalComparand(right, left, context, &right_value)) {
+        return false;
+      }
+      ApplyOperator(e.type, result, right_value);
+      return true;
+    }
+
+    case X_Plus:
+    case X_Minus:
+    case X_Multiply:
+    case X_Div:
+    case X_Mod: {
+      Value right;
+      if (!Eval(e.first_child, context, result)) return false;
+      if (!Eval(ast_->node(e.first_child).next_sibling, context, &right)) {
+        return false;
+      }
+      ApplyOperator(e.type, result, right);
+      return true;
+    }
+
+    case X_Union: {
+      Value right;
+      if (!EvalNodeSet(e.first_child, context, result)) return false;
+      if (!EvalNodeSet(ast_->node(e.first_child).next_sibling, context,
+                       &right)) {
+        return false;
+      }
+      ApplyOperator(e.type, result, right);
+      return true;
+    }
+
+    case X_Negate: {
+      Value operand;
+      if (!Eval(e.first_child, context, &operand)) return false;
+      *result = NumberValue(-ToNumber(operand));
+      return true;
+    }
+
+    case X_Literal:
+      *result = StringValue(ast_->text(e));
+      return true;
+
+    case X_Number:
+      *result = NumberValue(e.number);
+      return true;
+
+    case X_Boolean:
+      *result = BooleanValue(e.number != 0);
+      return true;
+
+    case X_VariableReference: {
+      auto it = variables_.find(ast_->text(e));
+      if (it == variables_.end()) return Error(expr);
+      *result = it->second;
+      return true;
+    }
+
+    case X_FunctionCall:
+      return EvalFunction(expr, context, result);
+
+    case X_Filter: {
+      uint32_t predicate = ast_->node(e.first_child).next_sibling;
+      if (predicate == Ast::kNone) return Eval(e.first_child, context, result);
+      if (!EvalNodeSet(e.first_child, context, result)) return false;
+      for (; predicate != Ast::kNone;
+           predicate = ast_->node(predicate).next_sibling) {
+        if (!ApplyPredicate(predicate, &result->nodes)) return false;
+      }
+      return true;
+    }
+
+    case X_Path:
+      return EvalPath(expr, context, result);
+
+    default:
+      return Error(expr);
+  }
+}
+
+// Evaluates `expr` converted to a boolean. A location path is only searched
+// until its first node is found.
+bool Evaluator::EvalBoolean(uint32_t expr, const Context& context,
+                            bool* result) {
+  if (ast_->node(expr).type == X_Path) {
+    size_t count;
+    if (!CountPath(expr, context, 1, &count)) return false;
+    *result = count != 0;
+    return true;
+  }
+  Value value;
+  if (!Eval(expr, context, &value)) return false;
+  *result = ToBoolean(value);
+  return true;
+}
+
+// Evaluates a predicate for a context node, and sets *keep to whether the
+// node passes.
+bool Evaluator::EvalPredicate(uint32_t predicate, const Context& context,
+                              bool* keep) {
+  if (ast_->node(predicate).type == X_Path) {
+    return EvalBoolean(predicate, context, keep);
+  }
+  Value value;
+  if (!Eval(predicate, context, &value)) return false;
+  *keep = IsPredicateTrue(value, context.position);
+  return true;
+}
+
+// Evaluates `expr`, an operand of a comparison with `other`. If `expr` is
+// count(path) and `other` is a number, the path is only counted up to
+// floor(number) + 1 nodes, since the comparison has the same result for any
+// count beyond that.
+bool Evaluator::EvalComparand(uint32_t expr, uint32_t other,
+                              const Context& context, Value* result) {
+  const Expr& e = ast_->node(expr);
+  const Expr& o = ast_->node(other);
+  if (e.type != X_FunctionCall || o.type != X_Number ||
+      !(o.number < 4294967295.0) || e.first_child == Ast::kNone ||
+      ast_->node(e.first_child).type != X_Path ||
+      ast_->node(e.first_child).next_sibling != Ast::kNone ||
+      e.function != F_Count) {
+    return Eval(expr, context, result);
+  }
+  size_t limit = o.number < 0 ? 1 : size_t(floor(o.number)) + 1;
+  size_t count;
+  if (!CountPath(e.first_child, context, limit, &count)) return false;
+  *result = NumberValue(count);
+  return true;
+}
+
+// Sets *count to the number of distinct nodes selected by the location path
+// `expr`, or to `limit` once that many have been found, at which point the
+// search stops. Steps without positional predicates (see
+// IsPositionalPredicate()) are searched depth first, pulling one node at a
+// time from an AxisIterator and testing the predicates on it. Other steps
+// select all of their nodes for each context node, as EvalStep() does.
+bool Evaluator::CountPath(uint32_t expr, const Context& context,
+                          size_t limit, size_t* count) {
+  const Expr& e = ast_->node(expr);
+  uint32_t step = e.first_child;
+  Value start;
+  if (e.absolute) {
+    start.nodes.push_back(Document::kRoot);
+  } else if (ast_->node(step).type != X_Step) {
+    if (!EvalNodeSet(step, context, &start)) return false;
+    step = ast_->node(step).next_sibling;
+  } else {
+    start.nodes.push_back(context.node);
+  }
+
+  PathCount state;
+  state.limit = limit;
+  state.count = 0;
+  // A node can only be reached twice if a step other than the first (or the
+  // first, from several nodes) can select the same node from different
+  // context nodes, which the child, attribute and self axes cannot.
+  state.may_repeat = false;
+  for (uint32_t s = step; s != Ast::kNone; s = ast_->node(s).next_sibling) {
+    AxisName axis = ast_->node(s).axis;
+    if (limit > 1 && (s != step || start.nodes.size() > 1) &&
+        axis != A_Child && axis != A_Attribute && axis != A_Self) {
+      state.may_repeat = true;
+    }
+    bool positional = false;
+    for (uint32_t predicate = ast_->node(s).first_child;
+         predicate != Ast::kNone;
+         predicate = ast_->node(predicate).next_sibling) {
+      if (IsPositionalPredicate(*ast_, predicate)) positional = true;
+    }
+    state.positional.push_back(positional);
+  }
+  for (uint32_t node : start.nodes) {
+    if (!CountFrom(step, 0, node, &state)) return false;
+    if (state.count == limit) break;
+  }
+  *count = state.count;
+  return true;
+}
+
+// Counts the nodes selected by `step`, which is step `index` of the path, and
+// the steps after it from `node`.
+bool Evaluator::CountFrom(uint32_t step, size_t index, uint32_t node,
+                          PathCount* count) {
+  if (step == Ast::kNone) {
+    if (!count->may_repeat || count->seen.insert(node).second) ++count->count;
+    return true;
+  }
+  const Expr& e = ast_->node(step);
+  if (count->positional[index]) {
+    std::vector<uint32_t> nodes;
+    if (!EvalStep(step, node, &nodes)) return false;
+    for (uint32_t selected : nodes) {
+      if (!CountFrom(e.next_sibling, index + 1, selected, count)) {
+        return false;
+      }
+      if (count->count == count->limit) break;
+    }
+    return true;
+  }
+
+  const char* name = ast_->text_data(e);
+  AxisIterator candidates(document_, e.axis, node);
+  // The predicates do not depend on the position or size.
+  Context context = { Document::kNone, 1, 1 };
+  for (uint32_t candidate; (candidate = candidates.Next()) != Document::kNone;) {
+    XPATH_PROFILE_VISIT(e.axis, 1);
+    if (!MatchesNodeTest(e.axis, e.node_type, name, e.text_size, candidate)) {
+      continue;
+    }
+    context.node = candidate;
+    bool keep = true;
+    for (uint32_t predicate = e.first_child;
+         keep && predicate != Ast::kNone;
+         predicate = ast_->node(predicate).next_sibling) {
+      XPATH_PROFILE_ADD(predicates_evaluated, 1);
+      if (!EvalBoolean(predicate, context, &keep)) return false;
+    }
+    if (keep && !CountFrom(e.next_sibling, index + 1, candidate, count)) {
+      return false;
+    }
+    if (e.first_only || count->count == count->limit) break;
+  }
+  return true;
+}
+
+// Returns a position beyond which `predicate` is false for every node, for
+// [n], [position() = n], [position() < n] and [position() <= n], or
+// kUnlimited.
+size_t Evaluator::MaxPosition(uint32_t predicate) {
+  const Expr& e = ast_->node(predicate);
+  double bound;
+  if (e.type == X_Number) {
+    bound = e.number;
+  } else if (e.type == X_Equal || e.type == X_LessThan ||
+             e.type == X_LessEqual || e.type == X_GreaterThan ||
+             e.type == X_GreaterEqual) {
+    uint32_t left = e.first_child;
+    uint32_t right = ast_->node(left).next_sibling;
+    ExprType op = e.type;
+    if (IsCall(*ast_, right, F_Position)) {
+      std::swap(left, right);
+      op = SwapOperands(op);
+    }
+    if (!IsCall(*ast_, left, F_Position) ||
+        ast_->node(right).type != X_Number) {
+      return kUnlimited;
+    }
+    double number = ast_->node(right).number;
+    switch (op) {
+      case X_Equal: bound = number; break;
+      case X_LessThan: bound = ceil(number) - 1; break;
+      case X_LessEqual: bound = floor(number); break;
+      default: return kUnlimited;
+    }
+  } else {
+    return kUnlimited;
+  }
+  // No position is negative or NaN.
+  if (!(bound >= 0)) return 0;
+  return bound < 4294967296.0 ? size_t(bound) : kUnlimited;
+}
+
+bool Evaluator::EvalNodeSet(uint32_t expr, const Context& context,
+                            Value* result) {
+  if (!Eval(expr, context, result)) return false;
+  if (result->type != V_NodeSet) return Error(expr);
+  return true;
+}
+
+bool Evaluator::EvalPath(uint32_t expr, const Context& context,
+                         Value* result) {
+  const Expr& e = ast_->node(expr);
+  uint32_t step = e.first_child;
+  result->type = V_NodeSet;
+  std::vector<uint32_t>& nodes = result->nodes;
+  nodes.clear();
+  if (e.absolute) {
+    nodes.push_back(Document::kRoot);
+  } else if (ast_->node(step).type != X_Step) {
+    if (!EvalNodeSet(step, context, result)) return false;
+    step = ast_->node(step).next_sibling;
+  } else {
+    nodes.push_back(context.node);
+  }
+  std::vector<uint32_t> next;
+  for (; step != Ast::kNone; step = ast_->node(step).next_sibling) {
+    next.clear();
+    uint32_t predicate;
+    if (PlanIndexedStep(&step, nodes, &next, &predicate)) {
+      for (; predicate != Ast::kNone;
+           predicate = ast_->node(predicate).next_sibling) {
+        if (!ApplyPredicate(predicate, &next)) return false;
+      }
+    } else {
+      for (uint32_t node : nodes) {
+        if (!EvalStep(step, node, &next)) return false;
+      }
+      document_->SortDocumentOrder(&next);
+    }
+    nodes.swap(next);
+  }
+  return true;
+}
+
+bool Evaluator::EvalStep(uint32_t step, uint32_t node,
+                         std::vector<uint32_t>* result) {
+  const Expr& e = ast_->node(step);
+  std::vector<uint32_t> nodes;
+  size_t limit = e.first_child == Ast::kNone || e.first_only
+      ? kUnlimited : MaxPosition(e.first_child);
+  if (limit != kUnlimited) {
+    SelectFirst(e.axis, e.node_type, ast_->text_data(e), e.text_size, limit,
+                node, &nodes);
+  } else {
+    SelectStep(e.axis, e.node_type, ast_->text_data(e), e.text_size,
+               e.first_only, node, &nodes);
+  }
+  for (uint32_t predicate = e.first_child; predicate != Ast::kNone;
+       predicate = ast_->node(predicate).next_sibling) {
+    if (!ApplyPredicate(predicate, &nodes)) return false;
+  }
+  result->insert(result->end(), nodes.begin(), nodes.end());
+  return true;
+}
+
+bool Evaluator::ApplyPredicate(uint32_t predicate,
+                               std::vector<uint32_t>* nodes) {
+  if (ShouldFilterParallel(nodes->size())) {
+    auto filter = [predicate](Evaluator* evaluator, const Context& context,
+                              bool* keep) {
+      return evaluator->EvalPredicate(predicate, context, keep);
+    };
+    return FilterParallel(filter, nodes);
+  }
+  Context context;
+  context.size = nodes->size();
+  size_t kept = 0;
+  for (size_t i = 0; i < context.size; ++i) {
+    context.node = (*nodes)[i];
+    context.position = i + 1;
+    XPATH_PROFILE_ADD(predicates_evaluated, 1);
+    bool keep;
+    if (!EvalPredicate(predicate, context, &keep)) return false;
+    if (keep) (*nodes)[kept++] = context.node;
+  }
+  nodes->resize(kept);
+  return true;
+}
+
+// Tries to select the nodes of `*step` from `nodes` through field_index_
+// (see SelectIndexed()). If *step is descendant-or-self::node() and the next
+// step is a child step with a single predicate, the two are selected
+// together as a descendant step, which gives the same nodes since the
+// predicate does not depend on the position. On success, sets *step to the
+// last step selected and *predicates to the first predicate that is still
+// to be applied (or Ast::kNone) to *result.
+bool Evaluator::PlanIndexedStep(uint32_t* step,
+                                const std::vector<uint32_t>& nodes,
+                                std::vector<uint32_t>* result,
+                                uint32_t* predicates) {
+  if (field_index_ == nullptr) return false;
+  uint32_t last = *step;
+  const Expr* e = &ast_->node(last);
+  AxisName axis = e->axis;
+  if (e->axis == A_DescendantOrSelf && e->node_type == N_Node &&
+      e->first_child == Ast::kNone && e->next_sibling != Ast::kNone) {
+    const Expr& child = ast_->node(e->next_sibling);
+    if (child.axis == A_Child && child.first_child != Ast::kNone &&
+        ast_->node(child.first_child).next_sibling == Ast::kNone) {
+      last = e->next_sibling;
+      e = &child;
+      axis = A_Descendant;
+    }
+  }
+  IndexPredicate predicate;
+  if (e->node_type != N_None || e->first_only ||
+      e->first_child == Ast::kNone ||
+      !GetIndexPredicate(*ast_, e->first_child, &predicate)) {
+    return false;
+  }
+  uint32_t rest = ast_->node(e->first_child).next_sibling;
+  if (!SelectIndexed(axis, ast_->text_data(*e), e->text_size, predicate,
+                     rest != Ast::kNone, nodes, result)) {
+    return false;
+  }
+  *step = last;
+  *predicates = rest;
+  return true;
+}
+
+// The same as above for the I_Step at *pc. On success, *rest is the last
+// step selected with the predicates that are still to be run.
+bool Evaluator::PlanIndexedStep(const Program& program, uint32_t* pc,
+                                const std::vector<uint32_t>& nodes,
+                                std::vector<uint32_t>* result,
+                                Instruction* rest) {
+  if (field_index_ == nullptr) return false;
+  uint32_t last = *pc;
+  const Instruction* step = &program.code[last];
+  AxisName axis = AxisName(step->axis);
+  if (step->axis == A_DescendantOrSelf && step->node_type == N_Node &&
+      step->count == 0 && !step->first_only) {
+    const Instruction& child = program.code[last + 1];
+    if (child.opcode == I_Step && child.axis == A_Child && child.count == 1) {
+      step = &program.code[++last];
+      axis = A_Descendant;
+    }
+  }
+  IndexPredicate predicate;
+  if (step->node_type != N_None || step->first_only || step->count == 0 ||
+      !GetIndexPredicate(program, program.blocks[step->block], &predicate)) {
+    return false;
+  }
+  const std::string& name = program.strings[step->operand];
+  if (!SelectIndexed(axis, name.data(), name.size(), predicate,
+                     step->count > 1, nodes, result)) {
+    return false;
+  }
+  *pc = last;
+  *rest = *step;
+  ++rest->block;
+  --rest->count;
+  return true;
+}
+
+// Sets *result to the elements named `name` on `axis` from any of `nodes`
+// that pass `predicate`, in document order, by looking them up in
+// field_index_. Returns false if the index cannot answer this. The nodes of
+// all context nodes are merged, so when `more_predicates` follow, this is
+// only done for a single context node.
+bool Evaluator::SelectIndexed(AxisName axis, const char* name,
+                              size_t name_size,
+                              const IndexPredicate& predicate,
+                              bool more_predicates,
+                              const std::vector<uint32_t>& nodes,
+                              std::vector<uint32_t>* result) {
+  if ((axis != A_Child && axis != A_Descendant &&
+       axis != A_DescendantOrSelf) ||
+      nodes.empty() || (more_predicates && nodes.size() > 1) ||
+      (name_size == 1 && *name == '*')) {
+    return false;
+  }
+  std::vector<uint32_t> candidates;
+  if (!field_index_->Lookup(name, name_size, predicate, &candidates)) {
+    return false;
+  }
+  // Every element is a descendant of the root.
+  if (axis != A_Child && nodes.size() == 1 && nodes[0] == Document::kRoot) {
+    result->swap(candidates);
+    return true;
+  }
+  std::unordered_set<uint32_t> contexts(nodes.begin(), nodes.end());
+  for (uint32_t candidate : candidates) {
+    uint32_t node = axis == A_DescendantOrSelf
+        ? candidate : document_->parent(candidate);
+    for (; node != Document::kNone; node = document_->parent(node)) {
+      if (contexts.count(node) != 0) {
+        result->push_back(candidate);
+        break;
+      }
+      if (axis == A_Child) break;
+    }
+  }
+  return true;
+}
+
+bool Evaluator::ShouldFilterParallel(size_t node_count) const {
+  return num_threads_ != 1 && node_count >= min_parallel_nodes_ &&
+         node_count > 1 && document_->is_expanded();
+}
+
+// Keeps the nodes of *nodes that pass `filter`, with each node as the context
+// node, its index in *nodes plus one as the context position, and the size of
+// *nodes as the context size. Chunks of nodes are filtered in parallel by
+// worker evaluators, each of which only sets the flags of its own nodes, so
+// the nodes that are kept stay in their original order. If the filter fails,
+// the error is that of the first node for which it failed, as in sequential
+// evaluation.
+bool Evaluator::FilterParallel(const NodeFilter& filter,
+                               std::vector<uint32_t>* nodes) {
+  size_t size = nodes->size();
+  size_t chunk_size = size / (4 * ParallelForWorkers(size, num_threads_));
+  chunk_size = std::max<size_t>(1, std::min(chunk_size, kMaxParallelChunkSize));
+  size_t chunk_count = (size + chunk_size - 1) / chunk_size;
+  int worker_count = ParallelForWorkers(chunk_count, num_threads_);
+  while (workers_.size() < size_t(worker_count)) {
+    workers_.emplace_back(new Evaluator(document_));
+  }
+  for (int i = 0; i < worker_count; ++i) {
+    Evaluator* worker = workers_[i].get();
+    if (worker->variables_generation_ != variables_generation_) {
+      worker->variables_ = variables_;
+      worker->variables_generation_ = variables_generation_;
+    }
+    worker->ast_ = ast_;
+  }
+
+  std::vector<char> keep(size);
+  // The first node for which each worker failed, and the error offset.
+  std::vector<std::pair<size_t, size_t>> errors(worker_count,
+                                                std::make_pair(size, 0));
+  ParallelFor(chunk_count, num_threads_, [&](int worker, size_t chunk) {
+    Evaluator* evaluator = workers_[worker].get();
+    Context context;
+    context.size = size;
+    size_t begin = chunk * chunk_size;
+    size_t end = std::min(size, begin + chunk_size);
+    for (size_t i = begin; i < end; ++i) {
+      context.node = (*nodes)[i];
+      context.position = i + 1;
+      XPATH_PROFILE_ADD(predicates_evaluated, 1);
+      bool kept;
+      if (!filter(evaluator, context, &kept)) {
+        evaluator->stack_.clear();
+        if (i < errors[worker].first) {
+          errors[worker] = std::make_pair(i, evaluator->error_offset_);
+        }
+        return;
+      }
+      keep[i] = kept;
+    }
+  });
+
+  std::pair<size_t, size_t> error = *std::min_element(errors.begin(),
+                                                      errors.end());
+  if (error.first != size) {
+    error_offset_ = error.second;
+    return false;
+  }
+  size_t kept = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (keep[i]) (*nodes)[kept++] = (*nodes)[i];
+  }
+  nodes->resize(kept);
+  return true;
+}
+
+// A predicate that evaluates to a number selects the node at that position;
+// any other value is converted to a boolean.
+bool Evaluator::IsPredicateTrue(const Value& value, size_t position) {
+  return value.type == V_Number ? value.number == position : ToBoolean(value);
+}
+
+// Appends the nodes on `axis` from `node` that pass the node test to *nodes,
+// in the order of the axis. If `first_only` is set, only the first of them is
+// appended.
+void Evaluator::SelectStep(AxisName axis, NodeType node_type,
+                           const char* name, size_t name_size,
+                           bool first_only, uint32_t node,
+                           std::vector<uint32_t>* nodes) {
+  if (first_only) {
+    SelectFirst(axis, node_type, name, name_size, 1, node, nodes);
+    return;
+  }
+  size_t begin = nodes->size();
+  CollectAxis(axis, node, nodes);
+  XPATH_PROFILE_VISIT(axis, nodes->size() - begin);
+  size_t size = begin;
+  for (size_t i = begin; i < nodes->size(); ++i) {
+    uint32_t candidate = (*nodes)[i];
+    if (MatchesNodeTest(axis, node_type, name, name_size, candidate)) {
+      (*nodes)[size++] = candidate;
+    }
+  }
+  nodes->resize(size);
+}
+
+// Appends the first `limit` nodes on `axis` from `node` that pass the node
+// test to *nodes, in the order of the axis. This stops at the last of them,
+// so it does not expand the rest of the document.
+void Evaluator::SelectFirst(AxisName axis, NodeType node_type,
+                            const char* name, size_t name_size, size_t limit,
+                            uint32_t node, std::vector<uint32_t>* nodes) {
+  if (limit == 0) return;
+  AxisIterator candidates(document_, axis, node);
+  for (uint32_t candidate; (candidate = candidates.Next()) != Document::kNone;) {
+    XPATH_PROFILE_VISIT(axis, 1);
+    if (!MatchesNodeTest(axis, node_type, name, name_size, candidate)) {
+      continue;
+    }
+    nodes->push_back(candidate);
+    if (--limit == 0) return;
+  }
+}
+
+void Evaluator::CollectDescendants(uint32_t node,
+                                   std::vector<uint32_t>* nodes) {
+  if (document_->kind(node) == K_Attribute) return;
+  if (document_->has_order_index()) {
+    uint32_t begin = document_->order(node) + 1;
+    uint32_t end = begin + document_->subtree_size(node);
+    for (uint32_t rank = begin; rank < end; ++rank) {
+      uint32_t descendant = document_->node_at(rank);
+      if (document_->kind(descendant) != K_Attribute) {
+        nodes->push_back(descendant);
+      }
+    }
+    return;
+  }
+  uint32_t first = document_->first_child(node);
+  uint32_t end = first + document_->child_count(node);
+  for (uint32_t child = first; child < end; ++child) {
+    nodes->push_back(child);
+    CollectDescendants(child, nodes);
+  }
+}
+
+// Appends the nodes on `axis` from `node` to *nodes, in the order of the axis:
+// reverse document order for reverse axes, and document order otherwise.
+void Evaluator::CollectAxis(AxisName axis, uint32_t node,
+                            std::vector<uint32_t>* nodes) {
+  Document& d = *document_;
+  bool is_attribute = d.kind(node) == K_Attribute;
+  switch (axis) {
+    case A_AncestorOrSelf:
+      nodes->push_back(node);
+      // Fall through.
+    case A_Ancestor:
+      for (uint32_t p = d.parent(node); p != Document::kNone; p = d.parent(p)) {
+        nodes->push_back(p);
+      }
+      break;
+
+    case A_Attribute:
+      if (!is_attribute) {
+        uint32_t first = d.first_attribute(node);
+        uint32_t end = first + d.attribute_count(node);
+        for (uint32_t attribute = first; attribute < end; ++attribute) {
+          nodes->push_back(attribute);
+        }
+      }
+      break;
+
+    case A_Child:
+      if (!is_attribute) {
+        uint32_t first = d.first_child(node);
+        uint32_t end = first + d.child_count(node);
+        for (uint32_t child = first; child < end; ++child) {
+          nodes->push_back(child);
+        }
+      }
+      break;
+
+    case A_DescendantOrSelf:
+      nodes->push_back(node);
+      // Fall through.
+    case A_Descendant:
+      CollectDescendants(node, nodes);
+      break;
+
+    case A_Following: {
+      if (d.has_order_index()) {
+        uint32_t end = d.node_count();
+        for (uint32_t rank = d.order(node) + d.subtree_size(node) + 1;
+             rank < end; ++rank) {
+          uint32_t following = d.node_at(rank);
+          if (d.kind(following) != K_Attribute) nodes->push_back(following);
+        }
+        break;
+      }
+      // The following nodes of an attribute start with the children of its
+      // parent; after that, they are the same as those of the parent.
+      if (is_attribute) {
+        node = d.parent(node);
+        CollectDescendants(node, nodes);
+      }
+      for (uint32_t p = d.parent(node); p != Document::kNone;
+           node = p, p = d.parent(p)) {
+        uint32_t end = d.first_child(p) + d.child_count(p);
+        for (uint32_t sibling = node + 1; sibling < end; ++sibling) {
+          nodes->push_back(sibling);
+          CollectDescendants(sibling, nodes);
+        }
+      }
+      break;
+    }
+
+    case A_FollowingSibling:
+      if (d.kind(node) == K_Element) {
+        uint32_t p = d.parent(node);
+        uint32_t end = d.first_child(p) + d.child_count(p);
+        for (uint32_t sibling = node + 1; sibling < end; ++sibling) {
+          nodes->push_back(sibling);
+        }
+      }
+      break;
+
+    case A_Parent:
+      if (d.parent(node) != Document::kNone) nodes->push_back(d.parent(node));
+      break;
+
+    case A_Preceding: {
+      AxisIterator preceding(document_, axis, node);
+      for (uint32_t n; (n = preceding.Next()) != Document::kNone;) {
+        nodes->push_back(n);
+      }
+      break;
+    }
+
+    case A_PrecedingSibling:
+      if (d.kind(node) == K_Element) {
+        uint32_t first = d.first_child(d.parent(node));
+        for (uint32_t sibling = node; sibling-- > first;) {
+          nodes->push_back(sibling);
+        }
+      }
+      break;
+
+    case A_Self:
+      nodes->push_back(node);
+      break;
+
+    default:
+      // The namespace axis is always empty.
+      break;
+  }
+}
+
+bool Evaluator::MatchesNodeTest(AxisName axis, NodeType node_type,
+                                const char* name, size_t name_size,
+                                uint32_t node) {
+  switch (node_type) {
+    case N_Node:
+      return true;
+    case N_None: {
+      NodeKind principal = axis == A_Attribute ? K_Attribute : K_Element;
+      if (document_->kind(node) != principal) return false;
+      if (name_size == 1 && name[0] == '*') return true;
+      const std::string& node_name = document_->name(node);
+      return node_name.size() == name_size &&
+          memcmp(node_name.data(), name, name_size) == 0;
+    }
+    default:
+      // Messages have no comment, text or processing-instruction nodes.
+      return false;
+  }
+}
+
+bool Evaluator::EvalFunction(uint32_t expr, const Context& context,
+                             Value* result) {
+  const Expr& e = ast_->node(expr);
+  FunctionName function = e.function;
+  std::vector<uint32_t> arg_exprs;
+  for (uint32_t arg = e.first_child; arg != Ast::kNone;
+       arg = ast_->node(arg).next_sibling) {
+    arg_exprs.push_back(arg);
+  }
+  size_t arg_count = arg_exprs.size();
+  if (!AcceptsArgumentCount(function, arg_count)) return Error(expr);
+  if (function == F_Boolean || function == F_Not) {
+    bool boolean;
+    if (!EvalBoolean(arg_exprs[0], context, &boolean)) return false;
+    *result = BooleanValue(boolean == (function == F_Boolean));
+    return true;
+  }
+  std::vector<Value> args(arg_count);
+  for (size_t i = 0; i < arg_count; ++i) {
+    if (!Eval(arg_exprs[i], context, &args[i])) return false;
+  }
+  if (!CallFunction(function, args.data(), arg_count, context, result)) {
+    return Error(arg_exprs[0]);
+  }
+  return true;
+}
+
+// Calls `function` with arguments that have already been evaluated. Returns
+// false if its first argument must be, but is not, a node-set.
+bool Evaluator::CallFunction(FunctionName function, const Value* args,
+                             size_t arg_count, const Context& context,
+                             Value* result) {
+  // Functions whose optional argument defaults to the context node.
+  Value context_node;
+  if (arg_count == 0 && DefaultsToContextNode(function)) {
+    context_node.nodes.push_back(context.node);
+    args = &context_node;
+  }
+  if (TakesNodeSet(function) && args[0].type != V_NodeSet) return false;
+
+  switch (function) {
+    case F_None:
+      break;
+    case F_Last:
+      *result = NumberValue(context.size);
+      break;
+    case F_Position:
+      *result = NumberValue(context.position);
+      break;
+    case F_Count:
+      *result = NumberValue(args[0].nodes.size());
+      break;
+    case F_Id:
+      // Messages have no ID attributes.
+      *result = Value();
+      break;
+    case F_LocalName:
+    case F_Name:
+      *result = StringValue(args[0].nodes.empty()
+          ? std::string() : document_->name(args[0].nodes[0]));
+      break;
+    case F_NamespaceUri:
+      *result = StringValue(std::string());
+      break;
+    case F_String:
+      *result = StringValue(ToString(args[0]));
+      break;
+    case F_Concat: {
+      std::string s;
+      for (size_t i = 0; i < arg_count; ++i) s += ToString(args[i]);
+      *result = StringValue(s);
+      break;
+    }
+    case F_StartsWith: {
+      std::string s = ToString(args[0]), prefix = ToString(args[1]);
+      *result = BooleanValue(s.compare(0, prefix.size(), prefix) == 0);
+      break;
+    }
+    case F_Contains:
+      *result = BooleanValue(
+          ToString(args[0]).find(ToString(args[1])) != std::string::npos);
+      break;
+    case F_SubstringBefore:
+    case F_SubstringAfter: {
+      std::string s = ToString(args[0]), separator = ToString(args[1]);
+      size_t pos = s.find(separator);
+      if (pos == std::string::npos) {
+        *result = StringValue(std::string());
+      } else if (function == F_SubstringBefore) {
+        *result = StringValue(s.substr(0, pos));
+      } else {
+        *result = StringValue(s.substr(pos + separator.size()));
+      }
+      break;
+    }
+    case F_Substring:
+      *result = StringValue(Substring(
+          ToString(args[0]), ToNumber(args[1]),
+          arg_count == 3 ? ToNumber(args[2]) : 0, arg_count == 3));
+      break;
+    case F_StringLength:
+      *result = NumberValue(CharacterCount(ToString(args[0])));
+      break;
+    case F_NormalizeSpace:
+      *result = StringValue(NormalizeSpace(ToString(args[0])));
+      break;
+    case F_Translate:
+      *result = StringValue(Translate(ToString(args[0]), ToString(args[1]),
+                                      ToString(args[2])));
+      break;
+    case F_Boolean:
+      *result = BooleanValue(ToBoolean(args[0]));
+      break;
+    case F_Not:
+      *result = BooleanValue(!ToBoolean(args[0]));
+      break;
+    case F_True:
+      *result = BooleanValue(true);
+      break;
+    case F_False:
+    case F_Lang:
+      *result = BooleanValue(false);
+      break;
+    case F_Number:
+      *result = NumberValue(ToNumber(args[0]));
+      break;
+    case F_Sum: {
+      double sum = 0;
+      for (uint32_t node : args[0].nodes) {
+        sum += StringToNumber(document_->StringValue(node));
+      }
+      *result = NumberValue(sum);
+      break;
+    }
+    case F_Floor:
+      *result = NumberValue(floor(ToNumber(args[0])));
+      break;
+    case F_Ceiling:
+      *result = NumberValue(ceil(ToNumber(args[0])));
+      break;
+    case F_Round:
+      *result = NumberValue(Round(ToNumber(args[0])));
+      break;
+  }
+  return true;
+}
+
+// Applies a binary operator other than `and` and `or` to two evaluated
+// operands, and stores the result in *left. Both operands of a union must be
+// node-sets.
+void Evaluator::ApplyOperator(ExprType op, Value* left, const Value& right) {
+  if (op == X_Union) {
+    left->nodes.insert(left->nodes.end(), right.nodes.begin(),
+                       right.nodes.end());
+    document_->SortDocumentOrder(&left->nodes);
+    return;
+  }
+  if (op <= X_GreaterEqual) {
+    *left = BooleanValue(Compare(op, *left, right));
+    return;
+  }
+  double a = ToNumber(*left), b = ToNumber(right);
+  switch (op) {
+    case X_Plus: *left = NumberValue(a + b); break;
+    case X_Minus: *left = NumberValue(a - b); break;
+    case X_Multiply: *left = NumberValue(a * b); break;
+    case X_Div: *left = NumberValue(a / b); break;
+    default: *left = NumberValue(fmod(a, b)); break;
+  }
+}
+
+std::string Evaluator::ToString(const Value& value) {
+  switch (value.type) {
+    case V_NodeSet:
+      return value.nodes.empty() ? std::string()
+                                 : document_->StringValue(value.nodes[0]);
+    case V_Boolean:
+      return value.boolean ? "true" : "false";
+    case V_Number:
+      return NumberToString(value.number);
+    default:
+      return value.string;
+  }
+}
+
+double Evaluator::ToNumber(const Value& value) {
+  switch (value.type) {
+    case V_Boolean:
+      return value.boolean ? 1 : 0;
+    case V_Number:
+      return value.number;
+    default:
+      return StringToNumber(ToString(value));
+  }
+}
+
+// Compares two values as the XPath comparison operators do. If either value
+// is a node-set (other than in a comparison with a boolean), the comparison
+// is true if it holds for the string-value of any of its nodes.
+bool Evaluator::Compare(ExprType op, const Value& left, const Value& right) {
+  if (left.type == V_NodeSet && right.type == V_NodeSet) {
+    std::vector<Value> right_strings;
+    for (uint32_t node : right.nodes) {
+      right_strings.push_back(StringValue(document_->StringValue(node)));
+    }
+    for (uint32_t node : left.nodes) {
+      Value left_string = StringValue(document_->StringValue(node));
+      for (const Value& right_string : right_strings) {
+        if (Compare(op, left_string, right_string)) return true;
+      }
+    }
+    return false;
+  }
+  if (left.type == V_NodeSet || right.type == V_NodeSet) {
+    bool left_is_set = left.type == V_NodeSet;
+    const Value& set = left_is_set ? left : right;
+    const Value& other = left_is_set ? right : left;
+    if (other.type == V_Boolean) {
+      Value boolean = BooleanValue(ToBoolean(set));
+      return left_is_set ? Compare(op, boolean, other)
+                         : Compare(op, other, boolean);
+    }
+    for (uint32_t node : set.nodes) {
+      Value string = StringValue(document_->StringValue(node));
+      if (left_is_set ? Compare(op, string, other)
+                      : Compare(op, other, string)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  if (op == X_Equal || op == X_NotEqual) {
+    bool equal;
+    if (left.type == V_Boolean || right.type == V_Boolean) {
+      equal = ToBoolean(left) == ToBoolean(right);
+    } else if (left.type == V_Number || right.type == V_Number) {
+      equal = ToNumber(left) == ToNumber(right);
+    } else {
+      equal = left.string == right.string;
+    }
+    return equal == (op == X_Equal);
+  }
+  double a = ToNumber(left), b = ToNumber(right);
+  switch (op) {
+    case X_LessThan: return a < b;
+    case X_LessEqual: return a <= b;
+    case X_GreaterThan: return a > b;
+    default: return a >= b;
+  }
+}
+
+}  // namespace xpath
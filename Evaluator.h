@@ -0,0 +1,255 @@
+#ifndef XPATH_EVALUATOR_INCLUDED
+#define XPATH_EVALUATOR_INCLUDED
+
+#include "Bytecode.h"
+#include "Document.h"
+#include "Functions.h"
+#include "Parser.h"
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace xpath {
+
+class FieldIndex;
+struct IndexPredicate;
+
+enum ValueType {
+  V_NodeSet = 0,
+  V_Boolean,
+  V_Number,
+  V_String };
+
+// The result of evaluating an XPath expression. Only the member that
+// corresponds to `type` is meaningful. Node-sets are in document order.
+struct Value {
+  Value() : type(V_NodeSet), boolean(false), number(0) {}
+
+  ValueType type;
+  bool boolean;
+  double number;
+  std::string string;
+  std::vector<uint32_t> nodes;
+};
+
+Value BooleanValue(bool boolean);
+Value NumberValue(double number);
+Value StringValue(const std::string& string);
+
+// Converts a number to a string as the XPath string() function does: integers
+// have no decimal point, other values are written in decimal notation with as
+// few digits as needed, and the special values are "NaN", "Infinity" and
+// "-Infinity".
+std::string NumberToString(double number);
+
+// Converts a string to a number as the XPath number() function does. Returns
+// NaN unless the string is an optionally signed decimal number surrounded by
+// optional whitespace.
+double StringToNumber(const std::string& string);
+
+// Converts a value to a boolean as the XPath boolean() function does.
+bool ToBoolean(const Value& value);
+
+// Returns true if `predicate` (an expression in `ast`) may select nodes by
+// their position, either because it may evaluate to a number or because it
+// calls position() or last() for its own context. Other predicates can be
+// tested on each node on its own.
+bool IsPositionalPredicate(const Ast& ast, uint32_t predicate);
+
+// Evaluates parsed expressions against a Document.
+//
+// All axes except the namespace axis are supported (it is always empty), and
+// all functions of the XPath 1.0 core function library are available. Since
+// messages have no text, comment or processing-instruction nodes, those node
+// tests never match, and id() and lang() never select anything.
+//
+// Evaluate() stops early where the rest of a node-set cannot change the
+// result: location paths that are converted to booleans (by boolean(),
+// not(), `and`, `or` or as predicates) are searched depth first until their
+// first node, count(path) compared with a number only counts as far as the
+// comparison needs, and steps whose first predicate is [n], [position() = n]
+// or [position() < n] only visit the first n nodes of their axis. Errors in
+// the parts of an expression that are skipped are not reported, as for the
+// right operand of `and` and `or`.
+class Evaluator {
+ public:
+  // Default for the `min_nodes` argument of SetParallelism().
+  static const size_t kDefaultMinParallelNodes = 4096;
+
+  explicit Evaluator(Document* document)
+      : document_(document),
+        field_index_(nullptr),
+        variables_generation_(0),
+        num_threads_(1),
+        min_parallel_nodes_(kDefaultMinParallelNodes) {}
+
+  // Evaluates the predicates of a step or filter on up to `num_threads`
+  // threads (or one per hardware thread if it is 0) when they apply to at
+  // least `min_nodes` nodes, such as the descendants of a large document.
+  // The nodes are split into chunks that are distributed with ParallelFor(),
+  // and the nodes that pass are merged back in document order, so the result
+  // is the same as that of sequential evaluation, errors included. Threads
+  // are started for each node-set that is filtered in parallel, so this only
+  // pays off for node-sets that take much longer than starting a thread.
+  //
+  // Since expanding nodes is not thread-safe, this only applies once the
+  // document has been fully expanded (see Document::ExpandAll()). By default
+  // (with num_threads = 1) evaluation is sequential.
+  void SetParallelism(int num_threads,
+                      size_t min_nodes = kDefaultMinParallelNodes) {
+    num_threads_ = num_threads;
+    min_parallel_nodes_ = min_nodes;
+  }
+
+  // Answers the first predicate of a step from `index` when it compares an
+  // attribute with a constant (see IndexPredicate) on a path that the index
+  // has, as in `//item[@id = 'x']` or `book[@year > 2005]`. The step then
+  // selects the matching elements from the index and checks that they are
+  // on the axis, instead of testing every node on the axis. This applies to
+  // child, descendant and descendant-or-self steps with a name test, and
+  // `//x` is handled as descendant::x, as Optimize() would. Steps that have
+  // more predicates are only planned for a single context node, so that
+  // those predicates see the same positions.
+  //
+  // The index must be for the same document, and outlive the evaluations.
+  // Results are the same with or without it. Pass nullptr to stop using it.
+  void SetFieldIndex(FieldIndex* index) { field_index_ = index; }
+
+  // Sets the value of the variable `$name` for subsequent evaluations.
+  void SetVariable(const std::string& name, const Value& value) {
+    variables_[name] = value;
+    ++variables_generation_;
+  }
+
+  // Evaluates the expression in `ast` with `context` as the context node, and
+  // a context position and size of 1.
+  //
+  // Returns true on success. Otherwise, it returns false and sets
+  // *error_offset to the source offset of the expression that could not be
+  // evaluated (an unknown function or variable, a function call with the
+  // wrong number of arguments, or an operand that is not a node-set where one
+  // is required).
+  bool Evaluate(const Ast& ast, uint32_t context, Value* result,
+                size_t* error_offset);
+
+  bool Evaluate(const Ast& ast, Value* result, size_t* error_offset) {
+    return Evaluate(ast, Document::kRoot, result, error_offset);
+  }
+
+  // Runs a compiled expression (see Compile()) with `context` as the context
+  // node. On success, the result is the same as that of Evaluate() for the
+  // expression the program was compiled from. Programs do not stop early
+  // everywhere Evaluate() does, though, so Execute() may report errors in
+  // parts of the expression that Evaluate() skips.
+  bool Execute(const Program& program, uint32_t context, Value* result,
+               size_t* error_offset);
+
+  bool Execute(const Program& program, Value* result, size_t* error_offset) {
+    return Execute(program, Document::kRoot, result, error_offset);
+  }
+
+ private:
+  struct Context {
+    uint32_t node;
+    size_t position;
+    size_t size;
+  };
+
+  // Evaluates a predicate for a context node on the given evaluator, and sets
+  // *keep to whether the node passes.
+  typedef std::function<bool(Evaluator* evaluator, const Context& context,
+                             bool* keep)> NodeFilter;
+
+  // State of CountPath(): the distinct nodes found so far, up to `limit`,
+  // and whether each step of the path has a positional predicate.
+  struct PathCount {
+    size_t limit;
+    size_t count;
+    bool may_repeat;
+    std::unordered_set<uint32_t> seen;
+    std::vector<bool> positional;
+  };
+
+  bool Eval(uint32_t expr, const Context& context, Value* result);
+  bool EvalBoolean(uint32_t expr, const Context& context, bool* result);
+  bool EvalPredicate(uint32_t predicate, const Context& context, bool* keep);
+  bool EvalComparand(uint32_t expr, uint32_t other, const Context& context,
+                     Value* result);
+  bool CountPath(uint32_t expr, const Context& context, size_t limit,
+                 size_t* count);
+  bool CountFrom(uint32_t step, size_t index, uint32_t node,
+                 PathCount* count);
+  size_t MaxPosition(uint32_t predicate);
+  bool EvalNodeSet(uint32_t expr, const Context& context, Value* result);
+  bool EvalPath(uint32_t expr, const Context& context, Value* result);
+  bool EvalStep(uint32_t step, uint32_t node, std::vector<uint32_t>* result);
+  bool EvalFunction(uint32_t expr, const Context& context, Value* result);
+  bool ApplyPredicate(uint32_t predicate, std::vector<uint32_t>* nodes);
+  bool Error(uint32_t expr);
+
+  bool Run(const Program& program, uint32_t pc, const Context& context);
+  bool RunStep(const Program& program, uint32_t* pc,
+               std::vector<uint32_t>* nodes);
+  bool RunPredicates(const Program& program, const Instruction& instruction,
+                     std::vector<uint32_t>* nodes);
+  bool RunError(const Program& program, uint32_t pc);
+
+  bool PlanIndexedStep(uint32_t* step, const std::vector<uint32_t>& nodes,
+                       std::vector<uint32_t>* result, uint32_t* predicates);
+  bool PlanIndexedStep(const Program& program, uint32_t* pc,
+                       const std::vector<uint32_t>& nodes,
+                       std::vector<uint32_t>* result, Instruction* rest);
+  bool SelectIndexed(AxisName axis, const char* name, size_t name_size,
+                     const IndexPredicate& predicate, bool more_predicates,
+                     const std::vector<uint32_t>& nodes,
+                     std::vector<uint32_t>* result);
+
+  bool ShouldFilterParallel(size_t node_count) const;
+  bool FilterParallel(const NodeFilter& filter, std::vector<uint32_t>* nodes);
+
+  bool IsPredicateTrue(const Value& value, size_t position);
+  bool CallFunction(FunctionName function, const Value* args,
+                    size_t arg_count, const Context& context, Value* result);
+  void ApplyOperator(ExprType op, Value* left, const Value& right);
+
+  void SelectStep(AxisName axis, NodeType node_type, const char* name,
+                  size_t name_size, bool first_only, uint32_t node,
+                  std::vector<uint32_t>* nodes);
+  void SelectFirst(AxisName axis, NodeType node_type, const char* name,
+                   size_t name_size, size_t limit, uint32_t node,
+                   std::vector<uint32_t>* nodes);
+  void CollectAxis(AxisName axis, uint32_t node, std::vector<uint32_t>* nodes);
+  void CollectDescendants(uint32_t node, std::vector<uint32_t>* nodes);
+  bool MatchesNodeTest(AxisName axis, NodeType node_type, const char* name,
+                       size_t name_size, uint32_t node);
+
+  std::string ToString(const Value& value);
+  double ToNumber(const Value& value);
+  bool Compare(ExprType op, const Value& left, const Value& right);
+
+  Document* document_;
+  FieldIndex* field_index_;
+  std::unordered_map<std::string, Value> variables_;
+  // Incremented when variables_ changes. Workers have the generation of the
+  // variables that they copied from this evaluator.
+  uint64_t variables_generation_;
+  const Ast* ast_;
+  size_t error_offset_;
+
+  // The value stack of Execute(), kept to reuse its memory.
+  std::vector<Value> stack_;
+
+  // See SetParallelism(). Workers are created on first use, and kept.
+  int num_threads_;
+  size_t min_parallel_nodes_;
+  std::vector<std::unique_ptr<Evaluator>> workers_;
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_EVALUATOR_INCLUDED */
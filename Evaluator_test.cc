@@ -0,0 +1,369 @@
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include "TestUtil.h"
+#include <math.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+using std::string;
+using std::unique_ptr;
+
+namespace xpath {
+namespace {
+
+class EvaluatorTest : public LibraryTest {
+ protected:
+  // Evaluates `input` with the root as context node. Node-sets are rendered
+  // as a space-separated list with '@' before attribute names, followed by
+  // the string-value in brackets; other values are converted to strings.
+  string Eval(const string& input) {
+    Ast ast;
+    size_t error_offset;
+    if (!Parse(input, &ast, &error_offset)) return "parse error";
+    Value value;
+    if (!evaluator_.Evaluate(ast, &value, &error_offset)) {
+      return "error at " + std::to_string(error_offset);
+    }
+    switch (value.type) {
+      case V_Boolean:
+        return value.boolean ? "true" : "false";
+      case V_Number:
+        return NumberToString(value.number);
+      case V_String:
+        return "'" + value.string + "'";
+      default:
+        break;
+    }
+    string result;
+    for (uint32_t node : value.nodes) {
+      if (!result.empty()) result += ' ';
+      if (document_.kind(node) == K_Root) {
+        result += '/';
+        continue;
+      }
+      if (document_.kind(node) == K_Attribute) result += '@';
+      result += document_.name(node) + "[" + document_.StringValue(node) + "]";
+    }
+    return result;
+  }
+};
+
+TEST_P(EvaluatorTest, ChildAndAttributeAxes) {
+  EXPECT_EQ("/", Eval("/"));
+  EXPECT_EQ("@name[library]", Eval("/@name"));
+  EXPECT_EQ("@id[b1] @id[b2] @id[b3]", Eval("book/@id"));
+  EXPECT_EQ("author[Kenton] author[Sanjay]", Eval("book[2]/author"));
+  EXPECT_EQ("@name[James] @name[Kenton] @name[Sanjay]", Eval("*/*/@name"));
+  EXPECT_EQ("", Eval("book/nothing"));
+  EXPECT_EQ("", Eval("/@id/*"));
+  EXPECT_EQ("", Eval("book/text()"));
+  EXPECT_EQ("@id[b1] @title[XPath] @year[1999]", Eval("book[1]/@*"));
+  EXPECT_EQ("@id[b1] @title[XPath] @year[1999] author[James]",
+            Eval("book[1]/@* | book[1]/*"));
+}
+
+TEST_P(EvaluatorTest, DescendantAxes) {
+  EXPECT_EQ("@id[b1] @id[b2] @id[b3] @id[b4]", Eval("//book/@id"));
+  EXPECT_EQ("@id[b4]", Eval("shelf//@id"));
+  EXPECT_EQ("book[b2Protocol Buffers2008KentonSanjay]",
+            Eval("descendant::book[author[2]]"));
+  EXPECT_EQ("shelf[b4Nested2001] book[b4Nested2001]",
+            Eval("shelf/descendant-or-self::*"));
+  EXPECT_EQ("4", Eval("count(//book)"));
+  EXPECT_EQ("3", Eval("count(//author)"));
+  EXPECT_EQ("4", Eval("count(//@year)"));
+}
+
+TEST_P(EvaluatorTest, ReverseAndSiblingAxes) {
+  EXPECT_EQ("@id[b2]", Eval("//author[@name='Sanjay']/../@id"));
+  EXPECT_EQ("'b2'", Eval("string(//@name[.='Kenton']/ancestor::book/@id)"));
+  EXPECT_EQ("4", Eval("count(//@name[.='James']/ancestor-or-self::node())"));
+  EXPECT_EQ("@id[b3]", Eval("book[1]/following-sibling::book[2]/@id"));
+  EXPECT_EQ("@id[b1]", Eval("book[3]/preceding-sibling::book[last()]/@id"));
+  EXPECT_EQ("@id[b2]", Eval("book[3]/preceding-sibling::book[1]/@id"));
+  EXPECT_EQ("", Eval("@name/following-sibling::node()"));
+  EXPECT_EQ("1", Eval("count(book[2]/author[1]/following::author)"));
+  EXPECT_EQ("2", Eval("count(book[2]/@id/following::book)"));
+  EXPECT_EQ("@name[Kenton]",
+            Eval("book[2]/author[2]/preceding::author[1]/@name"));
+  EXPECT_EQ("3", Eval("count(shelf/preceding::author)"));
+  EXPECT_EQ("book[b4Nested2001]", Eval("//book[@id='b4']/self::book"));
+  EXPECT_EQ("0", Eval("count(/namespace::*)"));
+}
+
+TEST_P(EvaluatorTest, Predicates) {
+  EXPECT_EQ("@id[b3]", Eval("book[last()]/@id"));
+  EXPECT_EQ("@id[b2]", Eval("book[position() = 2]/@id"));
+  EXPECT_EQ("@id[b2] @id[b4]", Eval("//book[@year > 2000][@year < 2010]/@id"));
+  EXPECT_EQ("@id[b1]", Eval("(//book)[1]/@id"));
+  EXPECT_EQ("@id[b4]", Eval("(//book)[last()]/@id"));
+  EXPECT_EQ("@id[b1] @id[b2]", Eval("book[author]/@id"));
+  EXPECT_EQ("@id[b3]", Eval("book[not(author)]/@id"));
+  EXPECT_EQ("@id[b2]", Eval("book[count(author) = 2]/@id"));
+}
+
+TEST_P(EvaluatorTest, Comparisons) {
+  EXPECT_EQ("true", Eval("//@id = 'b3'"));
+  EXPECT_EQ("true", Eval("//@id != 'b3'"));
+  EXPECT_EQ("false", Eval("/@name != 'library'"));
+  EXPECT_EQ("true", Eval("//@year = 2015"));
+  EXPECT_EQ("true", Eval("//@year < 2000"));
+  EXPECT_EQ("true", Eval("2000 < //@year"));
+  EXPECT_EQ("false", Eval("//@year > 2015"));
+  EXPECT_EQ("true", Eval("book/@id = //book/@id"));
+  EXPECT_EQ("false", Eval("book/@id = shelf/book/@id"));
+  EXPECT_EQ("true", Eval("book = true()"));
+  EXPECT_EQ("false", Eval("nothing = true()"));
+  EXPECT_EQ("true", Eval("nothing = false()"));
+  EXPECT_EQ("false", Eval("nothing = nothing"));
+  EXPECT_EQ("false", Eval("nothing != nothing"));
+  EXPECT_EQ("true", Eval("1 = '1.0'"));
+  EXPECT_EQ("true", Eval("'1' != '1.0'"));
+  EXPECT_EQ("true", Eval("true() = 'x'"));
+  EXPECT_EQ("true", Eval("'10' > '9'"));
+  EXPECT_EQ("false", Eval("number('x') = number('x')"));
+  EXPECT_EQ("true", Eval("number('x') != number('x')"));
+}
+
+TEST_P(EvaluatorTest, Arithmetic) {
+  EXPECT_EQ("7", Eval("1 + 2 * 3"));
+  EXPECT_EQ("0.5", Eval("1 div 2"));
+  EXPECT_EQ("2", Eval("5 mod 3"));
+  EXPECT_EQ("-2", Eval("-5 mod 3"));
+  EXPECT_EQ("Infinity", Eval("1 div 0"));
+  EXPECT_EQ("-Infinity", Eval("-1 div 0"));
+  EXPECT_EQ("NaN", Eval("0 div 0"));
+  EXPECT_EQ("2008", Eval("book[2]/@year + 0"));
+  EXPECT_EQ("NaN", Eval("book[2]/@title * 1"));
+  EXPECT_EQ("true", Eval("1 or nothing()"));
+  EXPECT_EQ("false", Eval("0 and nothing()"));
+}
+
+TEST_P(EvaluatorTest, Functions) {
+  EXPECT_EQ("'library'", Eval("string(@name)"));
+  EXPECT_EQ("'book'", Eval("name(book)"));
+  EXPECT_EQ("'year'", Eval("local-name(book/@year)"));
+  EXPECT_EQ("''", Eval("name()"));
+  EXPECT_EQ("''", Eval("namespace-uri(book)"));
+  EXPECT_EQ("''", Eval("name(nothing)"));
+  EXPECT_EQ("'b1-b2'", Eval("concat(book[1]/@id, '-', book[2]/@id)"));
+  EXPECT_EQ("true", Eval("starts-with(book[2]/@title, 'Proto')"));
+  EXPECT_EQ("false", Eval("contains(book[1]/@title, 'Proto')"));
+  EXPECT_EQ("'Protocol'", Eval("substring-before(book[2]/@title, ' ')"));
+  EXPECT_EQ("'Buffers'", Eval("substring-after(book[2]/@title, ' ')"));
+  EXPECT_EQ("''", Eval("substring-after('abc', 'x')"));
+  EXPECT_EQ("'234'", Eval("substring('12345', 1.5, 2.6)"));
+  EXPECT_EQ("'12'", Eval("substring('12345', 0, 3)"));
+  EXPECT_EQ("'345'", Eval("substring('12345', 3)"));
+  EXPECT_EQ("''", Eval("substring('12345', 0 div 0, 3)"));
+  EXPECT_EQ("'12345'", Eval("substring('12345', -42, 1 div 0)"));
+  EXPECT_EQ("'\xc3\xa9t'", Eval("substring('\xc3\xa9t\xc3\xa9', 1, 2)"));
+  EXPECT_EQ("3", Eval("string-length('\xc3\xa9t\xc3\xa9')"));
+  EXPECT_EQ("7", Eval("string-length(@name)"));
+  EXPECT_EQ("'Spaced out'", Eval("normalize-space(book[3]/@title)"));
+  EXPECT_EQ("'BAr'", Eval("translate('bar', 'abc', 'AB')"));
+  EXPECT_EQ("true", Eval("boolean(book)"));
+  EXPECT_EQ("false", Eval("boolean('')"));
+  EXPECT_EQ("true", Eval("not(0)"));
+  EXPECT_EQ("false", Eval("lang('en')"));
+  EXPECT_EQ("0", Eval("count(id('b1'))"));
+  EXPECT_EQ("1999", Eval("number(book/@year)"));
+  EXPECT_EQ("NaN", Eval("number()"));
+  EXPECT_EQ("8023", Eval("sum(//@year)"));
+  EXPECT_EQ("2", Eval("floor(2.5)"));
+  EXPECT_EQ("3", Eval("ceiling(2.5)"));
+  EXPECT_EQ("3", Eval("round(2.5)"));
+  EXPECT_EQ("-2", Eval("round(-2.5)"));
+  EXPECT_EQ("0", Eval("round(-0.25)"));
+  EXPECT_EQ("3", Eval("last() + position() + true()"));
+}
+
+TEST_P(EvaluatorTest, Variables) {
+  Value books;
+  books.nodes.push_back(document_.first_child(Document::kRoot) + 1);
+  evaluator_.SetVariable("books", books);
+  evaluator_.SetVariable("year", NumberValue(2008));
+  EXPECT_EQ("@title[Protocol Buffers]", Eval("$books/@title"));
+  EXPECT_EQ("@id[b2]", Eval("//book[@year = $year]/@id"));
+  EXPECT_EQ("author[Sanjay]", Eval("$books/author[last()]"));
+  EXPECT_EQ("2", Eval("count($books/author)"));
+}
+
+TEST_P(EvaluatorTest, ContextNode) {
+  Ast ast;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("string(@title)", &ast, &error_offset));
+  uint32_t book = document_.first_child(Document::kRoot) + 2;
+  Value value;
+  ASSERT_TRUE(evaluator_.Evaluate(ast, book, &value, &error_offset));
+  EXPECT_EQ(" Spaced   out ", value.string);
+}
+
+TEST_P(EvaluatorTest, Errors) {
+  EXPECT_EQ("error at 0", Eval("nothing()"));
+  EXPECT_EQ("error at 5", Eval("1 + $undefined"));
+  EXPECT_EQ("error at 0", Eval("count()"));
+  EXPECT_EQ("error at 0", Eval("true(1)"));
+  EXPECT_EQ("error at 6", Eval("count(1)"));
+  EXPECT_EQ("error at 0", Eval("1 | book"));
+  EXPECT_EQ("error at 1", Eval("'x'[1]"));
+  EXPECT_EQ("error at 8", Eval("book[1][foo()]"));
+}
+
+INSTANTIATE_TEST_CASE_P(OrderIndex, EvaluatorTest, ::testing::Bool());
+
+// Renders the result of evaluating `input` with `evaluator`, like
+// EvaluatorTest::Eval() but with node ids instead of names.
+string EvalIds(Evaluator* evaluator, const string& input) {
+  Ast ast;
+  size_t error_offset;
+  if (!Parse(input, &ast, &error_offset)) return "parse error";
+  Value value;
+  if (!evaluator->Evaluate(ast, &value, &error_offset)) {
+    return "error at " + std::to_string(error_offset);
+  }
+  string result = std::to_string(value.type) + ":" + value.string + ":" +
+                  NumberToString(value.number) + ":";
+  for (uint32_t node : value.nodes) result += std::to_string(node) + " ";
+  return result;
+}
+
+TEST(Evaluator, FiltersInParallel) {
+  string text;
+  for (int i = 0; i < 3000; ++i) {
+    text += "item { id: " + std::to_string(i) + " value: " +
+            std::to_string(i % 7) + " part { value: " +
+            std::to_string(i % 5) + " } } ";
+  }
+  unique_ptr<SimpleMessage> message(SimpleMessage::ParseText(text));
+  Document document(*message);
+  document.ExpandAll();
+  Evaluator sequential(&document);
+  Evaluator parallel(&document);
+  parallel.SetParallelism(4, 1000);
+  sequential.SetVariable("v", NumberValue(3));
+  parallel.SetVariable("v", NumberValue(3));
+
+  const char* const kExpressions[] = {
+    "//item[@value = 3]/@id",
+    "count(//*[@value = $v])",
+    "//item[position() mod 3 = 0][last()]/@id",
+    "//item[@value = 1][2]/@id",
+    "//*[part/@value = 4][@value > 4]",
+    "(//part)[@value = 0][position() > 590]",
+    "sum(//item[count(part[@value = 2]) > 0]/@value)",
+    "//item[foo()]",
+    "//item[@id > 2000][$undefined]",
+    "//item[@value = 1 and part[@value != 9][1 | 2]]",
+  };
+  for (const char* expression : kExpressions) {
+    EXPECT_EQ(EvalIds(&sequential, expression),
+              EvalIds(&parallel, expression)) << expression;
+  }
+  EXPECT_EQ("error at 7", EvalIds(&parallel, "//item[foo()]"));
+
+  // Workers see variables that change between evaluations.
+  sequential.SetVariable("v", NumberValue(5));
+  parallel.SetVariable("v", NumberValue(5));
+  EXPECT_EQ(EvalIds(&sequential, "count(//*[@value = $v])"),
+            EvalIds(&parallel, "count(//*[@value = $v])"));
+}
+
+TEST(Evaluator, StopsEarly) {
+  string text = "list { ";
+  for (int i = 0; i < 2000; ++i) {
+    if (i % 10 == 0) text += "group { ";
+    text += "item { id: " + std::to_string(i) + " value: " +
+            std::to_string(i % 7) + " part { value: " +
+            std::to_string(i % 5) + " } part { value: 9 } } ";
+    if (i % 10 == 9) text += "} ";
+  }
+  text += "}";
+  unique_ptr<SimpleMessage> message(SimpleMessage::ParseText(text));
+
+  // These only need the first few items, so they expand little of the
+  // document besides the 200 groups.
+  const char* const kEarly[] = {
+    "boolean(//part)", "count(//part) > 2", "not(//item[@value = 3])",
+    "/list/group[2]/item[3]/part", "/descendant::part[position() < 4]",
+  };
+  for (const char* expression : kEarly) {
+    Document document(*message);
+    Evaluator evaluator(&document);
+    EvalIds(&evaluator, expression);
+    EXPECT_GT(300u, document.node_count()) << expression;
+  }
+
+  // Each expression gives the same result as the second, which adding zero
+  // keeps from stopping early.
+  const char* const kEquivalent[][2] = {
+    { "boolean(//item[@value = 3])", "count(//item[@value = 3]) + 0 > 0" },
+    { "count(//item[part/@value = 4]) > 5",
+      "count(//item[part/@value = 4]) + 0 > 5" },
+    { "count(//part/..) = 3", "count(//part/..) + 0 = 3" },
+    { "1999.5 < count(//part/..)", "1999.5 < count(//part/..) + 0" },
+    { "count(//item//@value) <= 4000", "count(//item//@value) + 0 <= 4000" },
+    { "count(//item) != -1", "count(//item) + 0 != -1" },
+    { "not(//item[@id = 'x'])", "count(//item[@id = 'x']) + 0 = 0" },
+    { "//item[2]/@id", "//item[position() + 0 = 2]/@id" },
+    { "//item[position() < 3.5]/@id", "//item[position() + 0 < 3.5]/@id" },
+    { "//item[4 >= position()][last()]/@id",
+      "//item[4 >= position() + 0][last()]/@id" },
+    { "boolean(//item[3][@value = 3])",
+      "count(//item[position() + 0 = 3][@value = 3]) + 0 > 0" },
+    { "//item[part[@value = 2] and @value > 4][1]/@id",
+      "//item[part[@value = 2] and @value > 4][position() + 0 = 1]/@id" },
+    { "count(//part[1]/preceding::part) > 10",
+      "count(//part[1]/preceding::part) + 0 > 10" },
+    { "//item[-1]", "//item[position() + 0 = -1]" },
+    { "boolean(//item[$undefined])", "boolean(//item[$undefined] | /)" },
+  };
+  Document document(*message);
+  Evaluator evaluator(&document);
+  for (const auto& expressions : kEquivalent) {
+    EXPECT_EQ(EvalIds(&evaluator, expressions[1]),
+              EvalIds(&evaluator, expressions[0])) << expressions[0];
+  }
+}
+
+TEST(NumberToString, Formats) {
+  EXPECT_EQ("0", NumberToString(0));
+  EXPECT_EQ("0", NumberToString(-0.0));
+  EXPECT_EQ("42", NumberToString(42));
+  EXPECT_EQ("-42", NumberToString(-42));
+  EXPECT_EQ("0.1", NumberToString(0.1));
+  EXPECT_EQ("-1.25", NumberToString(-1.25));
+  EXPECT_EQ("0.000001", NumberToString(1e-6));
+  EXPECT_EQ("100000000000000000000", NumberToString(1e20));
+  EXPECT_EQ("123456.789", NumberToString(123456.789));
+  EXPECT_EQ("NaN", NumberToString(NAN));
+  EXPECT_EQ("Infinity", NumberToString(INFINITY));
+}
+
+TEST(StringToNumber, Parses) {
+  EXPECT_EQ(42, StringToNumber("42"));
+  EXPECT_EQ(-0.5, StringToNumber(" -.5\n"));
+  EXPECT_EQ(3, StringToNumber("3."));
+  EXPECT_TRUE(isnan(StringToNumber("")));
+  EXPECT_TRUE(isnan(StringToNumber("-")));
+  EXPECT_TRUE(isnan(StringToNumber(".")));
+  EXPECT_TRUE(isnan(StringToNumber("+1")));
+  EXPECT_TRUE(isnan(StringToNumber("1e3")));
+  EXPECT_TRUE(isnan(StringToNumber("1 2")));
+}
+
+TEST(NumberConversions, IgnoreLocale) {
+  ScopedCommaLocale locale;
+  if (!locale.active()) return;  // No comma-decimal locale is installed.
+  EXPECT_EQ("-1.25", NumberToString(-1.25));
+  EXPECT_EQ("0.000001", NumberToString(1e-6));
+  EXPECT_EQ("123456.789", NumberToString(123456.789));
+  EXPECT_EQ(1.5, StringToNumber("1.5"));
+  EXPECT_TRUE(isnan(StringToNumber("1,5")));
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,255 @@
+#include "FieldIndex.h"
+#include "Evaluator.h"
+
+#include <math.h>
+#include <algorithm>
+#include <utility>
+
+namespace xpath {
+
+const size_t FieldIndex::kDefaultMaxMemory;
+
+namespace {
+
+// Estimated bytes per distinct value in the hash table, besides the value
+// itself: the key and posting list objects, and the hash node and bucket.
+const size_t kStringEntrySize =
+    sizeof(std::string) + sizeof(std::vector<uint32_t>) + 3 * sizeof(void*);
+
+typedef std::pair<double, uint32_t> NumberEntry;
+
+bool IsIndexOperator(ExprType op) {
+  return op == X_Equal || (op >= X_LessThan && op <= X_GreaterEqual);
+}
+
+// Sets the constant of *result, converting literals to numbers for all
+// comparisons but string equality.
+void SetConstant(bool is_literal, const std::string& literal, double number,
+                 IndexPredicate* result) {
+  result->is_string = is_literal && result->op == X_Equal;
+  result->string = result->is_string ? literal : std::string();
+  result->number = is_literal ? StringToNumber(literal) : number;
+}
+
+// Returns true if `expr` is the relative path `@name` (for a name other than
+// "*"), and sets *name.
+bool GetAttributeName(const Ast& ast, uint32_t expr, std::string* name) {
+  const Expr& path = ast.node(expr);
+  if (path.type != X_Path || path.absolute) return false;
+  const Expr& step = ast.node(path.first_child);
+  if (step.type != X_Step || step.next_sibling != Ast::kNone ||
+      step.axis != A_Attribute || step.node_type != N_None ||
+      step.first_child != Ast::kNone || step.first_only) {
+    return false;
+  }
+  *name = ast.text(step);
+  return *name != "*";
+}
+
+}  // namespace
+
+bool GetIndexPredicate(const Ast& ast, uint32_t predicate,
+                       IndexPredicate* result) {
+  const Expr& e = ast.node(predicate);
+  if (!IsIndexOperator(e.type)) return false;
+  uint32_t left = e.first_child;
+  uint32_t right = ast.node(left).next_sibling;
+  result->op = e.type;
+  if (!GetAttributeName(ast, left, &result->attribute)) {
+    if (!GetAttributeName(ast, right, &result->attribute)) return false;
+    std::swap(left, right);
+    result->op = SwapOperands(e.type);
+  }
+  const Expr& constant = ast.node(right);
+  if (constant.type != X_Literal && constant.type != X_Number) return false;
+  SetConstant(constant.type == X_Literal, ast.text(constant), constant.number,
+              result);
+  return true;
+}
+
+// Matches the code that Compile() emits for the predicates above:
+//
+//   context; step attribute::name; <constant>; binary op; return
+//   <constant>; context; step attribute::name; binary op; return
+bool GetIndexPredicate(const Program& program, uint32_t entry,
+                       IndexPredicate* result) {
+  if (entry > program.code.size() || program.code.size() - entry < 5) {
+    return false;
+  }
+  const Instruction* code = &program.code[entry];
+  if (code[3].opcode != I_Binary || code[4].opcode != I_Return ||
+      !IsIndexOperator(ExprType(code[3].operand))) {
+    return false;
+  }
+  const Instruction* step;
+  const Instruction* constant;
+  result->op = ExprType(code[3].operand);
+  if (code[0].opcode == I_Context) {
+    step = &code[1];
+    constant = &code[2];
+  } else if (code[1].opcode == I_Context) {
+    constant = &code[0];
+    step = &code[2];
+    result->op = SwapOperands(result->op);
+  } else {
+    return false;
+  }
+  if (step->opcode != I_Step || step->axis != A_Attribute ||
+      step->node_type != N_None || step->count != 0 || step->first_only ||
+      program.strings[step->operand] == "*") {
+    return false;
+  }
+  result->attribute = program.strings[step->operand];
+  if (constant->opcode == I_Literal) {
+    SetConstant(true, program.strings[constant->operand], 0, result);
+  } else if (constant->opcode == I_Number) {
+    SetConstant(false, std::string(), program.numbers[constant->operand],
+                result);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+struct FieldIndex::PathIndex {
+  PathIndex(const std::string& element, const std::string& attribute)
+      : element(element), attribute(attribute), built(false),
+        too_large(false), memory_usage(0) {}
+
+  std::string element;
+  std::string attribute;
+  bool built;
+  bool too_large;
+  size_t memory_usage;
+
+  // The elements with each value, in document order.
+  std::unordered_map<std::string, std::vector<uint32_t>> strings;
+
+  // The number and element of every value that is a number, sorted by
+  // number.
+  std::vector<NumberEntry> numbers;
+};
+
+FieldIndex::FieldIndex(Document* document, size_t max_memory)
+    : document_(document), max_memory_(max_memory), memory_usage_(0) {}
+
+FieldIndex::~FieldIndex() {}
+
+void FieldIndex::AddPath(const std::string& element,
+                         const std::string& attribute) {
+  std::unique_ptr<PathIndex>& index = paths_[element + "/@" + attribute];
+  if (!index) index.reset(new PathIndex(element, attribute));
+}
+
+bool FieldIndex::HasPath(const std::string& element,
+                         const std::string& attribute) const {
+  return paths_.count(element + "/@" + attribute) != 0;
+}
+
+// Builds the index, unless it would take more than the memory that is left,
+// in which case the partial index is freed.
+bool FieldIndex::Build(PathIndex* index) {
+  document_->ExpandAll();
+  size_t budget = max_memory_ - memory_usage_;
+  size_t size = 0;
+  for (uint32_t node = 0; node < document_->node_count(); ++node) {
+    if (document_->kind(node) != K_Element ||
+        document_->name(node) != index->element) {
+      continue;
+    }
+    uint32_t first = document_->first_attribute(node);
+    uint32_t end = first + document_->attribute_count(node);
+    for (uint32_t attribute = first; attribute < end; ++attribute) {
+      if (document_->name(attribute) != index->attribute) continue;
+      std::string value = document_->StringValue(attribute);
+      double number = StringToNumber(value);
+      if (!isnan(number)) {
+        index->numbers.push_back(NumberEntry(number, node));
+        size += sizeof(NumberEntry);
+      }
+      size_t value_size = value.size();
+      auto inserted = index->strings.emplace(std::move(value),
+                                             std::vector<uint32_t>());
+      if (inserted.second) size += kStringEntrySize + value_size;
+      inserted.first->second.push_back(node);
+      size += sizeof(uint32_t);
+      if (size > budget) {
+        index->strings.clear();
+        std::vector<NumberEntry>().swap(index->numbers);
+        return false;
+      }
+    }
+  }
+  for (auto& entry : index->strings) {
+    document_->SortDocumentOrder(&entry.second);
+    entry.second.shrink_to_fit();
+  }
+  std::sort(index->numbers.begin(), index->numbers.end());
+  index->memory_usage = size;
+  memory_usage_ += size;
+  return true;
+}
+
+bool FieldIndex::Lookup(const char* element, size_t element_size,
+                        const IndexPredicate& predicate,
+                        std::vector<uint32_t>* nodes) {
+  std::string key(element, element_size);
+  key += "/@";
+  key += predicate.attribute;
+  auto it = paths_.find(key);
+  if (it == paths_.end()) return false;
+  PathIndex* index = it->second.get();
+  if (!index->built) {
+    if (index->too_large) return false;
+    if (!Build(index)) {
+      index->too_large = true;
+      return false;
+    }
+    index->built = true;
+  }
+
+  if (predicate.is_string) {
+    auto found = index->strings.find(predicate.string);
+    if (found != index->strings.end()) {
+      nodes->insert(nodes->end(), found->second.begin(), found->second.end());
+    }
+    return true;
+  }
+  // No comparison with NaN is true.
+  double number = predicate.number;
+  if (isnan(number)) return true;
+  auto less = [](const NumberEntry& entry, double number) {
+    return entry.first < number;
+  };
+  auto greater = [](double number, const NumberEntry& entry) {
+    return number < entry.first;
+  };
+  auto begin = index->numbers.begin();
+  auto end = index->numbers.end();
+  switch (predicate.op) {
+    case X_Equal:
+      begin = std::lower_bound(begin, end, number, less);
+      end = std::upper_bound(begin, end, number, greater);
+      break;
+    case X_LessThan:
+      end = std::lower_bound(begin, end, number, less);
+      break;
+    case X_LessEqual:
+      end = std::upper_bound(begin, end, number, greater);
+      break;
+    case X_GreaterThan:
+      begin = std::upper_bound(begin, end, number, greater);
+      break;
+    default:
+      begin = std::lower_bound(begin, end, number, less);
+      break;
+  }
+  std::vector<uint32_t> matches;
+  matches.reserve(end - begin);
+  for (; begin != end; ++begin) matches.push_back(begin->second);
+  document_->SortDocumentOrder(&matches);
+  nodes->insert(nodes->end(), matches.begin(), matches.end());
+  return true;
+}
+
+}  // namespace xpath
@@ -0,0 +1,96 @@
+#ifndef XPATH_FIELD_INDEX_INCLUDED
+#define XPATH_FIELD_INDEX_INCLUDED
+
+#include "Bytecode.h"
+#include "Document.h"
+#include "Parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xpath {
+
+// A predicate that compares an attribute of the context node with a
+// constant, such as [@id = 'b1'] or [2005 < @year]. `op` is X_Equal or one
+// of X_LessThan ... X_GreaterEqual, with the attribute as its left operand.
+// An equality with a string literal compares strings; all other predicates
+// compare numbers, as XPath does.
+struct IndexPredicate {
+  std::string attribute;
+  ExprType op;
+  bool is_string;
+  std::string string;
+  double number;
+};
+
+// Returns true if `predicate` (an expression in `ast`) or the predicate
+// block starting at program.code[entry] has the form of an IndexPredicate,
+// and sets *result to it.
+bool GetIndexPredicate(const Ast& ast, uint32_t predicate,
+                       IndexPredicate* result);
+bool GetIndexPredicate(const Program& program, uint32_t entry,
+                       IndexPredicate* result);
+
+// Secondary indexes on the attribute values of a Document, which let the
+// Evaluator answer predicates like `//item[@id = 'x']` or
+// `//book[@year >= 2005]` without testing every node on the axis (see
+// Evaluator::SetFieldIndex()).
+//
+// Each path names an element and one of its attributes. Its index maps every
+// value of the attribute to the elements (anywhere in the document) that
+// have it, through a hash table for string equality and an array sorted by
+// number for numeric comparisons. Indexes are built when they are first
+// used, which expands the whole document (see Document::ExpandAll()).
+//
+// The indexes of all paths together are limited to `max_memory` bytes. A
+// path whose index does not fit is given up on, and lookups on it fail, so
+// that the Evaluator falls back to testing each node.
+//
+// Like Document, a FieldIndex is not thread-safe.
+class FieldIndex {
+ public:
+  static const size_t kDefaultMaxMemory = 64 << 20;
+
+  explicit FieldIndex(Document* document,
+                      size_t max_memory = kDefaultMaxMemory);
+  ~FieldIndex();
+
+  // Indexes elements named `element` by their attributes named `attribute`.
+  void AddPath(const std::string& element, const std::string& attribute);
+
+  // Returns true if AddPath() was called for the element and attribute.
+  bool HasPath(const std::string& element,
+               const std::string& attribute) const;
+
+  // Appends the elements named `element` for which `predicate` holds to
+  // *nodes, in document order, and returns true. Returns false if the path
+  // was not added or its index exceeds the memory limit.
+  bool Lookup(const char* element, size_t element_size,
+              const IndexPredicate& predicate, std::vector<uint32_t>* nodes);
+
+  // Returns an estimate of the bytes used by the indexes built so far.
+  size_t memory_usage() const { return memory_usage_; }
+
+ private:
+  struct PathIndex;
+
+  bool Build(PathIndex* index);
+
+  Document* document_;
+  size_t max_memory_;
+  size_t memory_usage_;
+
+  // Keyed by "element/@attribute".
+  std::unordered_map<std::string, std::unique_ptr<PathIndex>> paths_;
+
+  FieldIndex(const FieldIndex&);
+  void operator=(const FieldIndex&);
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_FIELD_INDEX_INCLUDED */
@@ -0,0 +1,222 @@
+#include "FieldIndex.h"
+#include "Evaluator.h"
+#include "Optimizer.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+// The shelf has a second 'b1', and years that are not plain numbers.
+const char kShelf[] =
+    "shelf { book { id: 'b4' title: 'Nested' year: ' 2001 ' } "
+    "        book { id: 'b1' year: 'unknown' } }";
+
+// Returns the ids of the books, or the names of other nodes.
+string Describe(Document* document, const vector<uint32_t>& nodes) {
+  string result;
+  for (uint32_t node : nodes) {
+    if (!result.empty()) result += ' ';
+    string name = document->name(node);
+    uint32_t first = document->first_attribute(node);
+    uint32_t end = first + document->attribute_count(node);
+    for (uint32_t attribute = first; attribute < end; ++attribute) {
+      if (name == "book" && document->name(attribute) == "id") {
+        name = document->StringValue(attribute);
+      }
+    }
+    result += name;
+  }
+  return result;
+}
+
+class FieldIndexTest : public ::testing::Test {
+ protected:
+  FieldIndexTest()
+      : message_(SimpleMessage::ParseText(LibraryText(kShelf))),
+        document_(*message_) {}
+
+  string Lookup(FieldIndex* index, const string& element,
+                const string& predicate) {
+    Ast ast;
+    size_t error_offset;
+    Parse(predicate, &ast, &error_offset);
+    IndexPredicate index_predicate;
+    if (!GetIndexPredicate(ast, ast.root(), &index_predicate)) {
+      return "not a predicate";
+    }
+    vector<uint32_t> nodes;
+    if (!index->Lookup(element.data(), element.size(), index_predicate,
+                       &nodes)) {
+      return "not indexed";
+    }
+    return Describe(&document_, nodes);
+  }
+
+  unique_ptr<SimpleMessage> message_;
+  Document document_;
+};
+
+TEST_F(FieldIndexTest, LooksUpValues) {
+  FieldIndex index(&document_);
+  index.AddPath("book", "id");
+  index.AddPath("book", "year");
+  EXPECT_TRUE(index.HasPath("book", "year"));
+  EXPECT_FALSE(index.HasPath("book", "title"));
+  EXPECT_EQ(0u, index.memory_usage());
+
+  EXPECT_EQ("b2", Lookup(&index, "book", "@id = 'b2'"));
+  EXPECT_EQ("b1 b1", Lookup(&index, "book", "'b1' = @id"));
+  EXPECT_EQ("", Lookup(&index, "book", "@id = 'b5'"));
+  EXPECT_NE(0u, index.memory_usage());
+
+  // Numbers ignore surrounding whitespace, and values that are not numbers
+  // never compare true.
+  EXPECT_EQ("b2 b3 b4", Lookup(&index, "book", "@year > 2000"));
+  EXPECT_EQ("b2 b3", Lookup(&index, "book", "@year >= '2008'"));
+  EXPECT_EQ("b1 b4", Lookup(&index, "book", "2008 > @year"));
+  EXPECT_EQ("b1 b2 b4", Lookup(&index, "book", "@year <= 2008"));
+  EXPECT_EQ("b4", Lookup(&index, "book", "@year = 2001"));
+  EXPECT_EQ("", Lookup(&index, "book", "@year = '2001'"));
+  EXPECT_EQ("", Lookup(&index, "book", "@year < 'unknown'"));
+
+  EXPECT_EQ("not indexed", Lookup(&index, "book", "@title = 'XPath'"));
+  EXPECT_EQ("not indexed", Lookup(&index, "shelf", "@id = 'b1'"));
+  EXPECT_EQ("not a predicate", Lookup(&index, "book", "@id != 'b1'"));
+  EXPECT_EQ("not a predicate", Lookup(&index, "book", "@* = 'b1'"));
+  EXPECT_EQ("not a predicate", Lookup(&index, "book", "@id = $id"));
+  EXPECT_EQ("not a predicate", Lookup(&index, "book", "author/@name = 'x'"));
+}
+
+TEST_F(FieldIndexTest, IsMemoryBounded) {
+  FieldIndex authors(&document_);
+  authors.AddPath("author", "name");
+  EXPECT_EQ("author", Lookup(&authors, "author", "@name = 'Kenton'"));
+  size_t memory_usage = authors.memory_usage();
+  EXPECT_NE(0u, memory_usage);
+
+  FieldIndex too_small(&document_, memory_usage - 1);
+  too_small.AddPath("author", "name");
+  EXPECT_EQ("not indexed", Lookup(&too_small, "author", "@name = 'Kenton'"));
+  EXPECT_EQ(0u, too_small.memory_usage());
+
+  FieldIndex index(&document_, memory_usage + 20);
+  index.AddPath("book", "id");
+  index.AddPath("author", "name");
+  EXPECT_EQ("author", Lookup(&index, "author", "@name = 'Kenton'"));
+  EXPECT_EQ(memory_usage, index.memory_usage());
+  // The other index does not fit next to it, and is not retried.
+  EXPECT_EQ("not indexed", Lookup(&index, "book", "@id = 'b2'"));
+  EXPECT_EQ("not indexed", Lookup(&index, "book", "@id = 'b2'"));
+  EXPECT_EQ(memory_usage, index.memory_usage());
+}
+
+TEST(GetIndexPredicate, MatchesCompiledPredicates) {
+  const char* const kPredicates[] = {
+    "@id = 'b1'", "'b1' = @id", "@year < 2000", "2000 < @year",
+    "@year >= '2000'", "@year != 2000", "@* = 'b1'", "@id = $x",
+    "@id = @year", "id = 'b1'", "@id[1] = 'b1'", "position() = 1",
+  };
+  for (const char* predicate : kPredicates) {
+    SCOPED_TRACE(predicate);
+    string input = string("book[") + predicate + "]";
+    Ast ast;
+    Program program;
+    size_t error_offset;
+    ASSERT_TRUE(Parse(input, &ast, &error_offset));
+    ASSERT_TRUE(Compile(ast, &program, &error_offset));
+    IndexPredicate from_ast, from_program;
+    uint32_t step = ast.node(ast.root()).first_child;
+    bool matched = GetIndexPredicate(ast, ast.node(step).first_child,
+                                     &from_ast);
+    ASSERT_EQ(matched,
+              GetIndexPredicate(program, program.blocks[0], &from_program));
+    if (!matched) continue;
+    EXPECT_EQ(from_ast.attribute, from_program.attribute);
+    EXPECT_EQ(from_ast.op, from_program.op);
+    EXPECT_EQ(from_ast.is_string, from_program.is_string);
+    EXPECT_EQ(from_ast.string, from_program.string);
+    if (!from_ast.is_string) {
+      EXPECT_EQ(from_ast.number, from_program.number);
+    }
+  }
+  Ast ast;
+  size_t error_offset;
+  IndexPredicate predicate;
+  Parse("2000 < @year", &ast, &error_offset);
+  ASSERT_TRUE(GetIndexPredicate(ast, ast.root(), &predicate));
+  EXPECT_EQ("year", predicate.attribute);
+  EXPECT_EQ(X_GreaterThan, predicate.op);
+  EXPECT_FALSE(predicate.is_string);
+  EXPECT_EQ(2000, predicate.number);
+}
+
+// Evaluates each query with and without the index, optimized or not and
+// compiled or not, with and without the document-order index.
+TEST(FieldIndex, EvaluatorMatchesScan) {
+  const char* const kQueries[] = {
+    "//book[@id = 'b1']", "//book[@year > 2000]", "/book[@id = 'b1']",
+    "book[@year < 2010]/@id", "shelf/book[@id = 'b1']",
+    "//shelf//book[@id = 'b1']", "/descendant-or-self::book[@id = 'b4']",
+    "//book[@id = 'b1'][2]", "//book[@year >= 1999][last()]",
+    "/descendant::book[@id = 'b1'][2]", "//*[@id = 'b1']",
+    "//book[@id = 'b1'][@year]", "shelf/descendant::book[@year < 2010][1]",
+    "//book[@id = 'b1'][1]/../@name", "//author[@name = 'Sanjay']/..",
+    "//book[author/@name = 'James']", "//book[1][@id = 'b1']",
+    "//book[@title = 'XPath']", "count(//book[@id != 'b1'])",
+    "//book[@id = 'b1'][$missing]",
+  };
+  for (bool order_index : { false, true }) {
+    unique_ptr<SimpleMessage> message(
+        SimpleMessage::ParseText(LibraryText(kShelf)));
+    Document document(*message);
+    if (order_index) document.BuildOrderIndex();
+    Evaluator scan(&document);
+    Evaluator indexed(&document);
+    FieldIndex index(&document);
+    index.AddPath("book", "id");
+    index.AddPath("book", "year");
+    index.AddPath("author", "name");
+    indexed.SetFieldIndex(&index);
+    for (const char* query : kQueries) {
+      for (bool optimize : { false, true }) {
+        SCOPED_TRACE(testing::Message() << query << " " << order_index
+                                        << optimize);
+        Ast ast;
+        Program program;
+        size_t error_offset;
+        ASSERT_TRUE(Parse(query, &ast, &error_offset));
+        if (optimize) Optimize(&ast);
+        ASSERT_TRUE(Compile(ast, &program, &error_offset));
+
+        Value expected, evaluated, executed;
+        size_t expected_offset = 0, evaluated_offset = 0, executed_offset = 0;
+        bool ok = scan.Evaluate(ast, &expected, &expected_offset);
+        EXPECT_EQ(ok, indexed.Evaluate(ast, &evaluated, &evaluated_offset));
+        EXPECT_EQ(ok, indexed.Execute(program, &executed, &executed_offset));
+        EXPECT_EQ(expected_offset, evaluated_offset);
+        EXPECT_EQ(expected_offset, executed_offset);
+        if (!ok) continue;
+        EXPECT_EQ(Describe(&document, expected.nodes),
+                  Describe(&document, evaluated.nodes));
+        EXPECT_EQ(Describe(&document, expected.nodes),
+                  Describe(&document, executed.nodes));
+        EXPECT_EQ(expected.number, evaluated.number);
+        EXPECT_EQ(expected.number, executed.number);
+      }
+    }
+    EXPECT_NE(0u, index.memory_usage());
+  }
+}
+
+}  // namespace
+}  // namespace xpath
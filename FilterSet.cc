@@ -0,0 +1,402 @@
+#include "FilterSet.h"
+
+#include "Evaluator.h"
+#include "Optimizer.h"
+#include "Parser.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace xpath {
+
+const uint32_t FilterSet::kNone;
+
+namespace {
+
+// A step of a filter path, as run by the automaton.
+struct PathStep {
+  bool descendant;
+  bool attribute;
+  std::string name;  // or "*"
+
+  // The predicate [@condition_name = 'condition_value'], if
+  // `condition_name` is not empty.
+  std::string condition_name;
+  std::string condition_value;
+};
+
+// Returns true if `predicate` compares an attribute of the context node with
+// a literal, and stores the attribute name and the literal.
+bool GetCondition(const Ast& ast, uint32_t predicate, std::string* name,
+                  std::string* value) {
+  const Expr& e = ast.node(predicate);
+  if (e.type != X_Equal) return false;
+  uint32_t path = e.first_child, literal = ast.node(path).next_sibling;
+  if (ast.node(path).type == X_Literal) std::swap(path, literal);
+  const Expr& p = ast.node(path);
+  if (p.type != X_Path || p.absolute || ast.node(literal).type != X_Literal) {
+    return false;
+  }
+  const Expr& step = ast.node(p.first_child);
+  if (step.type != X_Step || step.next_sibling != Ast::kNone ||
+      step.axis != A_Attribute || step.node_type != N_None ||
+      step.first_child != Ast::kNone || step.first_only) {
+    return false;
+  }
+  *name = ast.text(step);
+  *value = ast.text(ast.node(literal));
+  return *name != "*";
+}
+
+// Converts the location path in `ast` into steps, if the automaton can run
+// it. Sets *exact to false if the path has predicates, which the automaton
+// ignores.
+bool GetPathSteps(const Ast& ast, std::vector<PathStep>* steps,
+                  bool* exact) {
+  const Expr& path = ast.node(ast.root());
+  if (path.type != X_Path) return false;
+  uint32_t step = path.first_child;
+  // A relative path is evaluated from the root, just like an absolute one.
+  if (!path.absolute && ast.node(step).type != X_Step) return false;
+  *exact = true;
+  bool descendant = false;
+  for (; step != Ast::kNone; step = ast.node(step).next_sibling) {
+    const Expr& s = ast.node(step);
+    if (!steps->empty() && steps->back().attribute) return false;
+    bool has_predicates = s.first_child != Ast::kNone || s.first_only;
+    // descendant-or-self::node() is the first half of `//`.
+    if (s.axis == A_DescendantOrSelf && s.node_type == N_Node &&
+        !has_predicates && !descendant) {
+      descendant = true;
+      continue;
+    }
+    if (s.node_type != N_None) return false;
+    PathStep path_step;
+    switch (s.axis) {
+      case A_Child:
+      case A_Attribute:
+        path_step.descendant = descendant;
+        path_step.attribute = s.axis == A_Attribute;
+        break;
+      case A_Descendant:
+        path_step.descendant = true;
+        path_step.attribute = false;
+        break;
+      default:
+        return false;
+    }
+    path_step.name = ast.text(s);
+    // The first predicate can be part of the automaton if it is a
+    // condition, since the others only select among the nodes it accepts.
+    uint32_t predicate = s.first_child;
+    if (!s.first_only && !path_step.attribute && predicate != Ast::kNone &&
+        GetCondition(ast, predicate, &path_step.condition_name,
+                     &path_step.condition_value)) {
+      predicate = ast.node(predicate).next_sibling;
+    }
+    if (s.first_only || predicate != Ast::kNone) *exact = false;
+    steps->push_back(path_step);
+    descendant = false;
+  }
+  return !descendant;
+}
+
+}  // namespace
+
+FilterSet::FilterSet() : filter_count_(0), stamp_(0), match_stamp_(0) {
+  // The start state.
+  AddTransition(kNone, E_Child, 0, kNone);
+}
+
+uint32_t FilterSet::Symbol(const std::string& name, bool add) {
+  uint32_t symbol = add ? symbols_.Intern(name) : symbols_.Find(name);
+  return symbol == Interner::kNone ? kNone : symbol;
+}
+
+// Returns the target of the transition from `state` over `edge`, creating it
+// if necessary, and counts one more reference to it. With kNone as `state`,
+// creates the start state.
+uint32_t FilterSet::AddTransition(uint32_t state, Edge edge, uint64_t symbol,
+                                  uint32_t value) {
+  uint32_t target = kNone;
+  if (state != kNone) {
+    const State& s = states_[state];
+    switch (edge) {
+      case E_Child: {
+        auto it = s.children.find(symbol);
+        if (it != s.children.end()) target = it->second;
+        break;
+      }
+      case E_Attribute: {
+        auto it = s.attributes.find(symbol);
+        if (it != s.attributes.end()) target = it->second;
+        break;
+      }
+      case E_AnyChild: target = s.any_child; break;
+      case E_AnyAttribute: target = s.any_attribute; break;
+      case E_Descendant: target = s.descendant; break;
+      case E_Condition: {
+        auto it = s.conditions.find(symbol);
+        if (it == s.conditions.end()) break;
+        auto value_it = it->second.find(value);
+        if (value_it != it->second.end()) target = value_it->second;
+        break;
+      }
+    }
+  }
+  if (target == kNone) {
+    if (free_states_.empty()) {
+      target = states_.size();
+      states_.push_back(State());
+    } else {
+      target = free_states_.back();
+      free_states_.pop_back();
+    }
+    State& t = states_[target];
+    t.any_child = kNone;
+    t.any_attribute = kNone;
+    t.descendant = kNone;
+    t.self_loop = edge == E_Descendant;
+    t.parent = state;
+    t.edge = edge;
+    t.symbol = symbol;
+    t.value = value;
+    t.references = 0;
+    t.stamp = 0;
+    if (state != kNone) {
+      State& s = states_[state];
+      switch (edge) {
+        case E_Child: s.children[symbol] = target; break;
+        case E_Attribute: s.attributes[symbol] = target; break;
+        case E_AnyChild: s.any_child = target; break;
+        case E_AnyAttribute: s.any_attribute = target; break;
+        case E_Descendant: s.descendant = target; break;
+        case E_Condition: s.conditions[symbol][value] = target; break;
+      }
+    }
+  }
+  ++states_[target].references;
+  return target;
+}
+
+// Unlinks a state that is no longer used by any filter, and frees it.
+void FilterSet::RemoveState(uint32_t state) {
+  State& t = states_[state];
+  State& s = states_[t.parent];
+  switch (t.edge) {
+    case E_Child: s.children.erase(t.symbol); break;
+    case E_Attribute: s.attributes.erase(t.symbol); break;
+    case E_AnyChild: s.any_child = kNone; break;
+    case E_AnyAttribute: s.any_attribute = kNone; break;
+    case E_Descendant: s.descendant = kNone; break;
+    case E_Condition: {
+      auto it = s.conditions.find(t.symbol);
+      it->second.erase(t.value);
+      if (it->second.empty()) s.conditions.erase(it);
+      break;
+    }
+  }
+  // Release the memory of the maps.
+  std::unordered_map<uint32_t, uint32_t>().swap(t.children);
+  std::unordered_map<uint32_t, uint32_t>().swap(t.attributes);
+  t.conditions.clear();
+  free_states_.push_back(state);
+}
+
+bool FilterSet::Add(const std::string& expression, uint32_t* id,
+                    size_t* error_offset) {
+  Ast ast;
+  if (!Parse(expression, &ast, error_offset)) return false;
+  Filter filter;
+  // Check calls in the expression as written, before it is optimized.
+  if (!Compile(ast, &filter.program, error_offset)) return false;
+  Optimize(&ast);
+  if (!Compile(ast, &filter.program, error_offset)) return false;
+  filter.used = true;
+  filter.exact = false;
+  filter.accepting = kNone;
+  filter.stamp = 0;
+
+  std::vector<PathStep> steps;
+  if (GetPathSteps(ast, &steps, &filter.exact)) {
+    uint32_t state = 0;
+    for (const PathStep& step : steps) {
+      if (step.descendant) {
+        state = AddTransition(state, E_Descendant, 0, kNone);
+        filter.states.push_back(state);
+      }
+      bool any = step.name == "*";
+      uint32_t symbol = any ? kNone : Symbol(step.name, true);
+      if (!step.condition_name.empty()) {
+        uint64_t key = ConditionKey(symbol,
+                                    Symbol(step.condition_name, true));
+        state = AddTransition(state, E_Condition, key,
+                              Symbol(step.condition_value, true));
+      } else {
+        Edge edge = step.attribute ? (any ? E_AnyAttribute : E_Attribute)
+                                   : (any ? E_AnyChild : E_Child);
+        state = AddTransition(state, edge, symbol, kNone);
+      }
+      filter.states.push_back(state);
+    }
+    filter.accepting = state;
+  }
+
+  if (free_filters_.empty()) {
+    *id = filters_.size();
+    filters_.push_back(Filter());
+  } else {
+    *id = free_filters_.back();
+    free_filters_.pop_back();
+  }
+  if (filter.accepting != kNone) {
+    states_[filter.accepting].filters.push_back(*id);
+  }
+  filters_[*id] = std::move(filter);
+  ++filter_count_;
+  return true;
+}
+
+bool FilterSet::Remove(uint32_t id) {
+  if (id >= filters_.size() || !filters_[id].used) return false;
+  Filter& filter = filters_[id];
+  if (filter.accepting != kNone) {
+    std::vector<uint32_t>& filters = states_[filter.accepting].filters;
+    filters.erase(std::find(filters.begin(), filters.end(), id));
+  }
+  // Deeper states have no more references than the states before them, so
+  // they are removed first.
+  for (size_t i = filter.states.size(); i-- > 0;) {
+    if (--states_[filter.states[i]].references == 0) {
+      RemoveState(filter.states[i]);
+    }
+  }
+  filters_[id] = Filter();
+  filters_[id].used = false;
+  free_filters_.push_back(id);
+  --filter_count_;
+  return true;
+}
+
+void FilterSet::Accept(uint32_t state) {
+  for (uint32_t id : states_[state].filters) filters_[id].stamp = match_stamp_;
+}
+
+// Makes `state` active for the current element, together with the state
+// that its `//` leads to.
+void FilterSet::Activate(uint32_t state) {
+  State& s = states_[state];
+  if (s.stamp == stamp_) return;
+  s.stamp = stamp_;
+  active_.push_back(state);
+  Accept(state);
+  if (s.descendant != kNone) Activate(s.descendant);
+}
+
+// Runs the automaton on the attributes and children of `node`, whose active
+// states are active_[begin, end).
+void FilterSet::Visit(Document* document, uint32_t node, size_t begin,
+                      size_t end) {
+  bool has_attribute_transitions = false, has_child_transitions = false;
+  for (size_t i = begin; i < end; ++i) {
+    const State& s = states_[active_[i]];
+    has_attribute_transitions |=
+        !s.attributes.empty() || s.any_attribute != kNone;
+    has_child_transitions |= s.self_loop || !s.children.empty() ||
+        s.any_child != kNone || !s.conditions.empty();
+  }
+
+  if (has_attribute_transitions) {
+    uint32_t first = document->first_attribute(node);
+    uint32_t last = first + document->attribute_count(node);
+    for (uint32_t attribute = first; attribute < last; ++attribute) {
+      uint32_t symbol = Symbol(document->name(attribute), false);
+      for (size_t i = begin; i < end; ++i) {
+        const State& s = states_[active_[i]];
+        if (s.any_attribute != kNone) Accept(s.any_attribute);
+        if (symbol == kNone) continue;
+        auto it = s.attributes.find(symbol);
+        if (it != s.attributes.end()) Accept(it->second);
+      }
+    }
+  }
+
+  if (!has_child_transitions) return;
+  uint32_t first = document->first_child(node);
+  uint32_t last = first + document->child_count(node);
+  for (uint32_t child = first; child < last; ++child) {
+    ++stamp_;
+    size_t child_begin = active_.size();
+    uint32_t symbol = Symbol(document->name(child), false);
+    for (size_t i = begin; i < end; ++i) {
+      uint32_t state = active_[i];
+      const State& s = states_[state];
+      if (s.self_loop) Activate(state);
+      if (s.any_child != kNone) Activate(s.any_child);
+      if (!s.conditions.empty()) {
+        ActivateConditions(document, s, symbol, child);
+      }
+      if (symbol == kNone) continue;
+      auto it = s.children.find(symbol);
+      if (it != s.children.end()) Activate(it->second);
+    }
+    if (active_.size() > child_begin) {
+      Visit(document, child, child_begin, active_.size());
+      active_.resize(child_begin);
+    }
+  }
+}
+
+// Activates the targets of the conditions of `state` that `element`, whose
+// name has the given symbol, satisfies.
+void FilterSet::ActivateConditions(Document* document, const State& state,
+                                   uint32_t symbol, uint32_t element) {
+  uint32_t first = document->first_attribute(element);
+  uint32_t last = first + document->attribute_count(element);
+  for (uint32_t attribute = first; attribute < last; ++attribute) {
+    uint32_t attribute_symbol = Symbol(document->name(attribute), false);
+    if (attribute_symbol == kNone) continue;
+    // Conditions on the element name, and on `*`.
+    for (uint32_t element_symbol : { symbol, kNone }) {
+      auto it = state.conditions.find(
+          ConditionKey(element_symbol, attribute_symbol));
+      if (it == state.conditions.end()) continue;
+      // Values that are not symbols are in no condition.
+      uint32_t value = Symbol(document->StringValue(attribute), false);
+      if (value == kNone) break;
+      auto value_it = it->second.find(value);
+      if (value_it != it->second.end()) Activate(value_it->second);
+      if (symbol == kNone) break;
+    }
+  }
+}
+
+void FilterSet::Match(Document* document, std::vector<uint32_t>* matches) {
+  matches->clear();
+  ++match_stamp_;
+  ++stamp_;
+  active_.clear();
+  Activate(0);
+  Visit(document, Document::kRoot, 0, active_.size());
+
+  Evaluator evaluator(document);
+  Value value;
+  size_t error_offset;
+  for (uint32_t id = 0; id < filters_.size(); ++id) {
+    const Filter& filter = filters_[id];
+    if (!filter.used) continue;
+    if (filter.accepting != kNone) {
+      if (filter.stamp != match_stamp_) continue;
+      if (filter.exact) {
+        matches->push_back(id);
+        continue;
+      }
+    }
+    if (evaluator.Execute(filter.program, &value, &error_offset) &&
+        ToBoolean(value)) {
+      matches->push_back(id);
+    }
+  }
+}
+
+}  // namespace xpath
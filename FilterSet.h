@@ -0,0 +1,161 @@
+#ifndef XPATH_FILTER_SET_INCLUDED
+#define XPATH_FILTER_SET_INCLUDED
+
+#include "Bytecode.h"
+#include "Document.h"
+#include "Interner.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xpath {
+
+// A set of XPath filters that are matched against a document together.
+//
+// A filter matches a document if its boolean value, evaluated with the root
+// as the context node, is true. Filters that are location paths made of
+// child, descendant (or `//`) and final attribute steps with name tests are
+// merged into a shared automaton: states are keyed by axis and name, so that
+// filters with a common prefix share states, and `//` is a state that loops
+// on every element. A step predicate of the form [@name = 'value'] is part
+// of the key as well, and is checked with a hash lookup of the attribute
+// value. A single depth-first traversal of the document runs the automaton
+// and finds all filters whose path matches, only descending into elements
+// that some filter can still reach. Filters with other predicates are then
+// confirmed by evaluating them in full, and filters that are not such paths
+// at all are always evaluated in full.
+//
+// Filters can be added and removed at any time; the automaton is updated
+// incrementally, and states that no filter uses any more are reclaimed.
+// A FilterSet is not thread-safe.
+class FilterSet {
+ public:
+  FilterSet();
+
+  // Adds the filter `expression` and stores its id in *id. Ids of removed
+  // filters are reused.
+  //
+  // Returns true on success. Otherwise, it returns false and sets
+  // *error_offset to the offset of the syntax error, or of a call to an
+  // unknown function or with the wrong number of arguments.
+  bool Add(const std::string& expression, uint32_t* id, size_t* error_offset);
+
+  // Removes the filter with the given id. Returns false if there is none.
+  bool Remove(uint32_t id);
+
+  // Returns the number of filters.
+  size_t size() const { return filter_count_; }
+
+  // Returns the number of states of the automaton, including the start
+  // state. Mainly useful for testing.
+  size_t state_count() const { return states_.size() - free_states_.size(); }
+
+  // Sets *matches to the ids of the filters that match the document, in
+  // increasing order. Filters that cannot be evaluated, for example because
+  // they refer to a variable, do not match.
+  void Match(Document* document, std::vector<uint32_t>* matches);
+
+ private:
+  // Index value used to indicate the absence of a state.
+  static const uint32_t kNone = 0xffffffffu;
+
+  enum Edge {
+    E_Child = 0,
+    E_AnyChild,
+    E_Attribute,
+    E_AnyAttribute,
+    E_Descendant,
+    E_Condition };
+
+  struct State {
+    // Transitions by name symbol, or kNone.
+    std::unordered_map<uint32_t, uint32_t> children;
+    std::unordered_map<uint32_t, uint32_t> attributes;
+    uint32_t any_child;
+    uint32_t any_attribute;
+    uint32_t descendant;
+
+    // Transitions to elements that have an attribute with a given value, by
+    // ConditionKey() of the element and attribute names, and then by the
+    // symbol of the value.
+    std::unordered_map<uint64_t, std::unordered_map<uint32_t, uint32_t>>
+        conditions;
+
+    // True for the states that `descendant` refers to, which stay active
+    // below the element where they were entered.
+    bool self_loop;
+
+    // Ids of the filters whose path ends in this state.
+    std::vector<uint32_t> filters;
+
+    // The transition that leads to this state, and the number of filters
+    // whose path uses it.
+    uint32_t parent;
+    Edge edge;
+    uint64_t symbol;
+    uint32_t value;
+    uint32_t references;
+
+    // Value of FilterSet::stamp_ when this state was last made active, to
+    // avoid activating a state twice for the same element.
+    uint64_t stamp;
+  };
+
+  struct Filter {
+    bool used;
+
+    // True if the automaton alone decides whether the filter matches.
+    // Otherwise, the program is run if the path of the filter matched, or
+    // always if the filter is not handled by the automaton.
+    bool exact;
+    Program program;
+
+    // The states on the path of the filter, and the last of them, which
+    // accepts the filter. `accepting` is kNone if the filter is not handled
+    // by the automaton.
+    std::vector<uint32_t> states;
+    uint32_t accepting;
+
+    // Value of FilterSet::match_stamp_ when the path last matched.
+    uint64_t stamp;
+  };
+
+  static uint64_t ConditionKey(uint32_t element, uint32_t attribute) {
+    return uint64_t(element) << 32 | attribute;
+  }
+
+  uint32_t Symbol(const std::string& name, bool add);
+  uint32_t AddTransition(uint32_t state, Edge edge, uint64_t symbol,
+                         uint32_t value);
+  void RemoveState(uint32_t state);
+  void Activate(uint32_t state);
+  void ActivateConditions(Document* document, const State& state,
+                          uint32_t symbol, uint32_t element);
+  void Accept(uint32_t state);
+  void Visit(Document* document, uint32_t node, size_t begin, size_t end);
+
+  std::vector<State> states_;
+  std::vector<uint32_t> free_states_;
+  std::vector<Filter> filters_;
+  std::vector<uint32_t> free_filters_;
+  size_t filter_count_;
+
+  // Ids of the names and values used in the automaton. Match() only looks
+  // them up, which does not lock.
+  Interner symbols_;
+
+  // State of Match(): the active states of all elements on the current path,
+  // one range per element.
+  std::vector<uint32_t> active_;
+  uint64_t stamp_;
+  uint64_t match_stamp_;
+
+  FilterSet(const FilterSet&);
+  void operator=(const FilterSet&);
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_FILTER_SET_INCLUDED */
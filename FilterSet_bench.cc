@@ -0,0 +1,94 @@
+#include "FilterSet.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+// A document with 50 orders of 5 lines each, where every line has a product
+// and a quantity.
+unique_ptr<SimpleMessage> MakeOrders() {
+  string text;
+  for (int order = 0; order < 50; ++order) {
+    text += "order { id: '" + std::to_string(order) + "' customer { name: 'c" +
+        std::to_string(order % 7) + "' } ";
+    for (int line = 0; line < 5; ++line) {
+      text += "line { product: 'p" + std::to_string(order * 5 + line) +
+          "' quantity: " + std::to_string(line + 1) + " } ";
+    }
+    text += "} ";
+  }
+  return SimpleMessage::ParseText(text);
+}
+
+// Subscription filters in a few shapes: plain paths, most of which do not
+// match because they name fields that are not present, `//` paths, and paths
+// with a predicate.
+string MakeFilter(int i) {
+  string n = std::to_string(i);
+  switch (i % 4) {
+    case 0: return "/order/line/@field" + n;
+    case 1: return "//element" + n + "/@id";
+    case 2: return "/order/customer[@name = 'c" + n + "']";
+    default: return "/order/line[@product = 'p" + n + "']/@quantity";
+  }
+}
+
+// Matches all filters with a FilterSet.
+void BM_FilterSet(benchmark::State& state) {
+  unique_ptr<SimpleMessage> message = MakeOrders();
+  FilterSet filters;
+  for (int i = 0; i < state.range(0); ++i) {
+    uint32_t id;
+    size_t error_offset;
+    filters.Add(MakeFilter(i), &id, &error_offset);
+  }
+  vector<uint32_t> matches;
+  while (state.KeepRunning()) {
+    Document document(*message);
+    filters.Match(&document, &matches);
+    benchmark::DoNotOptimize(matches.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FilterSet)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Evaluates every filter on its own, from precompiled programs.
+void BM_ExecuteEach(benchmark::State& state) {
+  unique_ptr<SimpleMessage> message = MakeOrders();
+  vector<Program> programs(state.range(0));
+  for (int i = 0; i < state.range(0); ++i) {
+    Ast ast;
+    size_t error_offset;
+    Parse(MakeFilter(i), &ast, &error_offset);
+    Compile(ast, &programs[i], &error_offset);
+  }
+  vector<uint32_t> matches;
+  while (state.KeepRunning()) {
+    Document document(*message);
+    Evaluator evaluator(&document);
+    matches.clear();
+    for (size_t i = 0; i < programs.size(); ++i) {
+      Value value;
+      size_t error_offset;
+      evaluator.Execute(programs[i], &value, &error_offset);
+      if (ToBoolean(value)) matches.push_back(i);
+    }
+    benchmark::DoNotOptimize(matches.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ExecuteEach)->Arg(100)->Arg(1000)->Arg(10000);
+
+}  // namespace
+}  // namespace xpath
+
+BENCHMARK_MAIN();
@@ -0,0 +1,184 @@
+#include "FilterSet.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+namespace xpath {
+namespace {
+
+class FilterSetTest : public ::testing::Test {
+ protected:
+  FilterSetTest()
+      : message_(SimpleMessage::ParseText(LibraryText())),
+        document_(*message_) {}
+
+  uint32_t Add(const string& expression) {
+    uint32_t id;
+    size_t error_offset;
+    EXPECT_TRUE(filters_.Add(expression, &id, &error_offset)) << expression;
+    return id;
+  }
+
+  vector<uint32_t> Match() {
+    vector<uint32_t> matches;
+    filters_.Match(&document_, &matches);
+    return matches;
+  }
+
+  unique_ptr<SimpleMessage> message_;
+  Document document_;
+  FilterSet filters_;
+};
+
+TEST_F(FilterSetTest, MatchesPaths) {
+  EXPECT_EQ(0u, Add("/book/author"));
+  EXPECT_EQ(1u, Add("/book/editor"));
+  EXPECT_EQ(2u, Add("//author/@name"));
+  EXPECT_EQ(3u, Add("shelf//@title"));
+  EXPECT_EQ(4u, Add("/*/*/*"));
+  EXPECT_EQ(5u, Add("//shelf//author"));
+  EXPECT_EQ(6u, Add("/@name"));
+  EXPECT_EQ(7u, Add("//@*"));
+  EXPECT_EQ(8u, Add("/"));
+  EXPECT_EQ(9u, Add("descendant::book/@id"));
+  EXPECT_THAT(Match(), ElementsAre(0, 2, 3, 6, 7, 8, 9));
+}
+
+TEST_F(FilterSetTest, ConfirmsPredicates) {
+  Add("//book[@year > 2010]");
+  Add("//book[@year > 2020]");
+  Add("/book[2]/author[2]");
+  Add("/book[4]");
+  Add("count(//author) = 3");
+  Add("//book/@year = $year");
+  EXPECT_THAT(Match(), ElementsAre(0, 2, 4));
+}
+
+TEST_F(FilterSetTest, RejectsInvalidExpressions) {
+  uint32_t id;
+  size_t error_offset;
+  EXPECT_FALSE(filters_.Add("/book[", &id, &error_offset));
+  EXPECT_EQ(6u, error_offset);
+  EXPECT_FALSE(filters_.Add("//book[foo()]", &id, &error_offset));
+  EXPECT_EQ(7u, error_offset);
+  EXPECT_FALSE(filters_.Add("true() or foo()", &id, &error_offset));
+  EXPECT_EQ(10u, error_offset);
+  EXPECT_EQ(0u, filters_.size());
+  EXPECT_EQ(1u, filters_.state_count());
+}
+
+TEST_F(FilterSetTest, SharesStates) {
+  Add("/book/author");
+  EXPECT_EQ(3u, filters_.state_count());
+  Add("/book/author/@name");
+  EXPECT_EQ(4u, filters_.state_count());
+  Add("/book/title");
+  EXPECT_EQ(5u, filters_.state_count());
+  Add("/book[@id]/author");  // Same path, with a predicate.
+  EXPECT_EQ(5u, filters_.state_count());
+  Add("//author");
+  EXPECT_EQ(7u, filters_.state_count());
+  Add("//title");  // Shares the state for `//`.
+  EXPECT_EQ(8u, filters_.state_count());
+}
+
+TEST_F(FilterSetTest, IndexesConditions) {
+  uint32_t sanjay = Add("//author[@name = 'Sanjay']");
+  EXPECT_EQ(3u, filters_.state_count());
+  uint32_t james = Add("//author['James' = @name]");
+  EXPECT_EQ(4u, filters_.state_count());
+  uint32_t b2 = Add("/book[@id = 'b2']/author[@name = 'Sanjay']");
+  EXPECT_EQ(6u, filters_.state_count());
+  uint32_t b4 = Add("/*[@id = 'b4']");  // Not a child of the root.
+  uint32_t shelf = Add("/shelf/*[@id = 'b4']/@title");
+  uint32_t year = Add("//book[@year = '2008'][author]");
+  EXPECT_THAT(Match(), ElementsAre(sanjay, james, b2, shelf, year));
+
+  EXPECT_TRUE(filters_.Remove(b2));
+  EXPECT_TRUE(filters_.Remove(b4));
+  EXPECT_TRUE(filters_.Remove(shelf));
+  EXPECT_TRUE(filters_.Remove(year));
+  EXPECT_EQ(4u, filters_.state_count());
+  EXPECT_TRUE(filters_.Remove(james));
+  EXPECT_EQ(3u, filters_.state_count());
+  EXPECT_THAT(Match(), ElementsAre(sanjay));
+}
+
+TEST_F(FilterSetTest, AddsAndRemovesAtRuntime) {
+  uint32_t author = Add("//author");
+  uint32_t name = Add("//author/@name");
+  uint32_t shelf = Add("/shelf/book");
+  EXPECT_THAT(Match(), ElementsAre(author, name, shelf));
+  size_t states = filters_.state_count();
+
+  EXPECT_TRUE(filters_.Remove(name));
+  EXPECT_FALSE(filters_.Remove(name));
+  EXPECT_FALSE(filters_.Remove(100));
+  EXPECT_EQ(2u, filters_.size());
+  EXPECT_EQ(states - 1, filters_.state_count());
+  EXPECT_THAT(Match(), ElementsAre(author, shelf));
+
+  // The id is reused, and so is the prefix of the path.
+  EXPECT_EQ(name, Add("//author/@id"));
+  EXPECT_EQ(states, filters_.state_count());
+  EXPECT_THAT(Match(), ElementsAre(author, shelf));
+
+  EXPECT_TRUE(filters_.Remove(author));
+  EXPECT_TRUE(filters_.Remove(name));
+  EXPECT_TRUE(filters_.Remove(shelf));
+  EXPECT_EQ(1u, filters_.state_count());
+  EXPECT_THAT(Match(), IsEmpty());
+}
+
+TEST_F(FilterSetTest, MatchesEvaluate) {
+  const char* const kFilters[] = {
+    "/book", "book", "/book/author/@name", "//name", "//@name", "//book/@id",
+    "//*", "/*/@*", "//shelf/book", "//shelf/book/author", "/shelf//title",
+    "/shelf//@title", "//book//@name", "book//book", "//book//book",
+    "/descendant::shelf/book", "/*/*/@year", "/nothing", "//nothing",
+    "//@nothing", "/book/@id/..", "//author[@name = 'Sanjay']",
+    "//book[author][@year < 2000]", "/book[last()]/@title",
+    "//book[1]/@id", "//*[2]/author", "count(//book) > 3", "'x'", "0",
+    "/book | /shelf", "//author/ancestor::shelf", "not(//shelf)",
+    "//book[@id = 'b2']/author[@name = 'Kenton']", "//*[@id = 'b3']",
+    "//book['b4' = @id]/@title", "//book[@id = 'b1'][2]",
+    "//book[@id = 'b1' or @id = 'b3']", "//book[@year = '2001']",
+  };
+  for (const char* filter : kFilters) Add(filter);
+
+  for (int index = 0; index < 2; ++index) {
+    vector<uint32_t> expected;
+    Evaluator evaluator(&document_);
+    for (uint32_t id = 0; id < sizeof(kFilters) / sizeof(kFilters[0]); ++id) {
+      Ast ast;
+      size_t error_offset;
+      ASSERT_TRUE(Parse(kFilters[id], &ast, &error_offset));
+      Value value;
+      ASSERT_TRUE(evaluator.Evaluate(ast, &value, &error_offset));
+      bool match;
+      switch (value.type) {
+        case V_NodeSet: match = !value.nodes.empty(); break;
+        case V_Boolean: match = value.boolean; break;
+        case V_Number: match = value.number != 0; break;
+        default: match = !value.string.empty(); break;
+      }
+      if (match) expected.push_back(id);
+    }
+    EXPECT_EQ(expected, Match());
+    document_.BuildOrderIndex();
+  }
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,89 @@
+#include "Functions.h"
+
+#include <string.h>
+
+namespace xpath {
+
+namespace {
+
+struct FunctionInfo {
+  const char* name;
+  int min_args;
+  int max_args;  // -1 if unbounded
+};
+
+// Indexed by FunctionName.
+const FunctionInfo kFunctions[] = {
+  { "", 0, 0 },
+  { "last", 0, 0 },
+  { "position", 0, 0 },
+  { "count", 1, 1 },
+  { "id", 1, 1 },
+  { "local-name", 0, 1 },
+  { "namespace-uri", 0, 1 },
+  { "name", 0, 1 },
+  { "string", 0, 1 },
+  { "concat", 2, -1 },
+  { "starts-with", 2, 2 },
+  { "contains", 2, 2 },
+  { "substring-before", 2, 2 },
+  { "substring-after", 2, 2 },
+  { "substring", 2, 3 },
+  { "string-length", 0, 1 },
+  { "normalize-space", 0, 1 },
+  { "translate", 3, 3 },
+  { "boolean", 1, 1 },
+  { "not", 1, 1 },
+  { "true", 0, 0 },
+  { "false", 0, 0 },
+  { "lang", 1, 1 },
+  { "number", 0, 1 },
+  { "sum", 1, 1 },
+  { "floor", 1, 1 },
+  { "ceiling", 1, 1 },
+  { "round", 1, 1 } };
+
+static_assert(sizeof(kFunctions) / sizeof(kFunctions[0]) == F_Round + 1,
+              "kFunctions must have an entry for every FunctionName");
+
+}  // namespace
+
+FunctionName ParseFunctionName(const char* data, size_t size) {
+  for (int i = F_Last; i <= F_Round; ++i) {
+    if (strlen(kFunctions[i].name) == size &&
+        memcmp(kFunctions[i].name, data, size) == 0) {
+      return FunctionName(i);
+    }
+  }
+  return F_None;
+}
+
+const char* FunctionNameString(FunctionName function) {
+  return kFunctions[function].name;
+}
+
+bool AcceptsArgumentCount(FunctionName function, size_t arg_count) {
+  const FunctionInfo& info = kFunctions[function];
+  return function != F_None && arg_count >= size_t(info.min_args) &&
+      (info.max_args < 0 || arg_count <= size_t(info.max_args));
+}
+
+bool TakesNodeSet(FunctionName function) {
+  switch (function) {
+    case F_Count:
+    case F_LocalName:
+    case F_NamespaceUri:
+    case F_Name:
+    case F_Sum:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool DefaultsToContextNode(FunctionName function) {
+  return kFunctions[function].min_args == 0 &&
+      kFunctions[function].max_args == 1;
+}
+
+}  // namespace xpath
@@ -0,0 +1,63 @@
+#ifndef XPATH_FUNCTIONS_INCLUDED
+#define XPATH_FUNCTIONS_INCLUDED
+
+#include <stdlib.h>
+#include <string>
+
+namespace xpath {
+
+// The functions of the XPath 1.0 core function library.
+enum FunctionName {
+  F_None = 0,
+  F_Last,
+  F_Position,
+  F_Count,
+  F_Id,
+  F_LocalName,
+  F_NamespaceUri,
+  F_Name,
+  F_String,
+  F_Concat,
+  F_StartsWith,
+  F_Contains,
+  F_SubstringBefore,
+  F_SubstringAfter,
+  F_Substring,
+  F_StringLength,
+  F_NormalizeSpace,
+  F_Translate,
+  F_Boolean,
+  F_Not,
+  F_True,
+  F_False,
+  F_Lang,
+  F_Number,
+  F_Sum,
+  F_Floor,
+  F_Ceiling,
+  F_Round };
+
+// Converts the string described by `data` and `size` to a FunctionName or
+// returns F_None if it does not name a core function.
+FunctionName ParseFunctionName(const char* data, size_t size);
+
+inline FunctionName ParseFunctionName(const std::string& s) {
+  return ParseFunctionName(s.data(), s.size());
+}
+
+// Returns the name of `function`, or an empty string for F_None.
+const char* FunctionNameString(FunctionName function);
+
+// Returns true if `function` accepts `arg_count` arguments.
+bool AcceptsArgumentCount(FunctionName function, size_t arg_count);
+
+// Returns true if the first argument of `function` must be a node-set.
+bool TakesNodeSet(FunctionName function);
+
+// Returns true if `function` uses the context node as its argument when
+// called without arguments, as string() does.
+bool DefaultsToContextNode(FunctionName function);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_FUNCTIONS_INCLUDED */
@@ -0,0 +1,31 @@
+#ifndef XPATH_FUZZ_INCLUDED
+#define XPATH_FUZZ_INCLUDED
+
+// Support for the fuzz targets (the *_fuzz.cc files). Each target defines
+// LLVMFuzzerTestOneInput() and FuzzTimedRun(), and is linked either with
+// libFuzzer (see `make fuzz`) or with FuzzReplay.cc, which runs it on saved
+// inputs.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Aborts with a message if `condition` is false. Unlike assert(), this is
+// never compiled out, and the abort is what the fuzzer reports as a crash.
+#define FUZZ_CHECK(condition)                                          \
+  do {                                                                 \
+    if (!(condition)) {                                                \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #condition);                                             \
+      abort();                                                         \
+    }                                                                  \
+  } while (0)
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+// Runs the code under test on an input without checking it, for FuzzReplay
+// to time. Inputs for which this is slow are worst cases.
+void FuzzTimedRun(const uint8_t* data, size_t size);
+
+#endif /* ndef XPATH_FUZZ_INCLUDED */
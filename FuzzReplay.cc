@@ -0,0 +1,171 @@
+// Runs a fuzz target (see Fuzz.h) on saved inputs, without libFuzzer:
+//
+//   X_fuzz_replay [--slowest=N --output=DIR [--min_size=BYTES]] PATH...
+//
+// Each PATH is a file or a directory of files, such as a fuzzer corpus. The
+// target runs once on every input, and aborts if a check fails. With
+// --slowest, FuzzTimedRun() is also timed on each input (the fastest of
+// several batches of runs), and the N inputs of at least --min_size bytes
+// (default 64) that took the longest per byte are copied to DIR, replacing
+// the files there. Corpus_bench --worst_cases=DIR times them, so that
+// bench-compare reports when a change makes those inputs slower.
+
+#include "Fuzz.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Number of timed batches per input, of which the fastest counts, and the
+// number of runs per batch.
+const int kTimedBatches = 5;
+const int kRunsPerBatch = 20;
+
+// Appends the files at `path` (a file, or the regular files in a directory)
+// to *files. Returns false if `path` cannot be read.
+bool ListFiles(const string& path, vector<string>* files) {
+  struct stat status;
+  if (stat(path.c_str(), &status) != 0) return false;
+  if (!S_ISDIR(status.st_mode)) {
+    files->push_back(path);
+    return true;
+  }
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) return false;
+  vector<string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    string file = path + "/" + entry->d_name;
+    if (stat(file.c_str(), &status) == 0 && S_ISREG(status.st_mode)) {
+      names.push_back(file);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  files->insert(files->end(), names.begin(), names.end());
+  return true;
+}
+
+bool ReadFile(const string& path, string* contents) {
+  std::ifstream in(path.c_str(), std::ios::binary);
+  if (!in) return false;
+  std::ostringstream buffer;
+  buffer << in.rdbuf();
+  *contents = buffer.str();
+  return true;
+}
+
+double Seconds() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+void RunOnce(const string& input) {
+  LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()),
+                         input.size());
+}
+
+// Removes the flag `--name=value` from the arguments and stores its value.
+bool TakeFlag(int* argc, char** argv, const char* name, string* value) {
+  size_t name_size = strlen(name);
+  for (int i = 1; i < *argc; ++i) {
+    if (strncmp(argv[i], "--", 2) == 0 &&
+        strncmp(argv[i] + 2, name, name_size) == 0 &&
+        argv[i][2 + name_size] == '=') {
+      *value = argv[i] + 3 + name_size;
+      for (int j = i; j < *argc; ++j) argv[j] = argv[j + 1];
+      --*argc;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  string slowest, output, min_size = "64";
+  TakeFlag(&argc, argv, "slowest", &slowest);
+  TakeFlag(&argc, argv, "output", &output);
+  TakeFlag(&argc, argv, "min_size", &min_size);
+  if (!slowest.empty() && output.empty()) {
+    fprintf(stderr, "--slowest requires --output\n");
+    return 1;
+  }
+
+  vector<string> files;
+  for (int i = 1; i < argc; ++i) {
+    if (!ListFiles(argv[i], &files)) {
+      fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  // Seconds per byte and contents of the inputs that are timed.
+  vector<std::pair<double, string>> timed;
+  for (const string& file : files) {
+    string input;
+    if (!ReadFile(file, &input)) {
+      fprintf(stderr, "Cannot read %s\n", file.c_str());
+      return 1;
+    }
+    RunOnce(input);
+    if (slowest.empty() || input.size() < size_t(atol(min_size.c_str()))) {
+      continue;
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(input.data());
+    double best = 0;
+    for (int batch = 0; batch < kTimedBatches; ++batch) {
+      double start = Seconds();
+      for (int run = 0; run < kRunsPerBatch; ++run) {
+        FuzzTimedRun(data, input.size());
+      }
+      double elapsed = (Seconds() - start) / kRunsPerBatch;
+      if (batch == 0 || elapsed < best) best = elapsed;
+    }
+    timed.push_back(std::make_pair(best / input.size(), input));
+  }
+  printf("Ran %zu inputs\n", files.size());
+  if (slowest.empty()) return 0;
+
+  // Replace the previous worst cases.
+  vector<string> old_files;
+  if (ListFiles(output, &old_files)) {
+    for (const string& file : old_files) remove(file.c_str());
+  } else if (mkdir(output.c_str(), 0777) != 0) {
+    fprintf(stderr, "Cannot create %s\n", output.c_str());
+    return 1;
+  }
+  size_t count = std::min(timed.size(), size_t(atol(slowest.c_str())));
+  std::partial_sort(timed.begin(), timed.begin() + count, timed.end(),
+                    [](const std::pair<double, string>& a,
+                       const std::pair<double, string>& b) {
+                      return a.first > b.first;
+                    });
+  for (size_t i = 0; i < count; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "/worst-%02zu", i);
+    std::ofstream out((output + name).c_str(), std::ios::binary);
+    out << timed[i].second;
+    if (!out) {
+      fprintf(stderr, "Cannot write %s%s\n", output.c_str(), name);
+      return 1;
+    }
+    printf("%s%s: %zu bytes, %.3g ns/byte\n", output.c_str(), name,
+           timed[i].second.size(), timed[i].first * 1e9);
+  }
+  return 0;
+}
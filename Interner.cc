@@ -0,0 +1,195 @@
+#include "Interner.h"
+
+#include <string.h>
+
+namespace xpath {
+
+const uint32_t Interner::kNone;
+const uint32_t Interner::kFirstChunkSize;
+const int Interner::kMaxChunks;
+
+namespace {
+
+// The initial number of slots of the hash table.
+const size_t kInitialCapacity = 1024;
+
+// The size of the blocks that store the text of symbols. Longer strings get
+// a block of their own.
+const size_t kBlockSize = 64 * 1024;
+
+// FNV-1a.
+uint32_t Hash(const char* data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ uint8_t(data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+// Returns the chunk that holds id, and sets *index to its index in the chunk.
+int ChunkOf(uint32_t id, uint32_t first_chunk_size, size_t* index) {
+  // Chunk k starts at id first_chunk_size * (2^k - 1).
+  uint64_t scaled = uint64_t(id) / first_chunk_size + 1;
+  int chunk = 63 - __builtin_clzll(scaled);
+  *index = id - uint64_t(first_chunk_size) * ((uint64_t(1) << chunk) - 1);
+  return chunk;
+}
+
+}  // namespace
+
+Interner::Table::Table(size_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<uint32_t>[capacity]) {
+  for (size_t i = 0; i < capacity; ++i) slots[i].store(0);
+}
+
+Interner::Interner()
+    : size_(0), block_used_(0), block_size_(0), text_bytes_(0) {
+  for (int i = 0; i < kMaxChunks; ++i) chunks_[i].store(nullptr);
+  tables_.push_back(std::unique_ptr<Table>(new Table(kInitialCapacity)));
+  table_.store(tables_.back().get());
+}
+
+Interner::~Interner() {
+  for (int i = 0; i < kMaxChunks; ++i) delete[] chunks_[i].load();
+}
+
+const Interner::Entry& Interner::GetEntry(uint32_t id) const {
+  size_t index;
+  int chunk = ChunkOf(id, kFirstChunkSize, &index);
+  return chunks_[chunk].load(std::memory_order_acquire)[index];
+}
+
+// Returns the id of the string in `table`, or kNone.
+uint32_t Interner::Lookup(const Table& table, const char* data, size_t size,
+                          uint32_t hash) const {
+  for (size_t slot = hash & table.mask;; slot = (slot + 1) & table.mask) {
+    uint32_t value = table.slots[slot].load(std::memory_order_acquire);
+    if (value == 0) return kNone;
+    const Entry& entry = GetEntry(value - 1);
+    if (entry.hash == hash && entry.size == size &&
+        memcmp(entry.data, data, size) == 0) {
+      return value - 1;
+    }
+  }
+}
+
+uint32_t Interner::Find(const char* data, size_t size) const {
+  const Table* table = table_.load(std::memory_order_acquire);
+  return Lookup(*table, data, size, Hash(data, size));
+}
+
+uint32_t Interner::Intern(const char* data, size_t size) {
+  uint32_t hash = Hash(data, size);
+  uint32_t id = Lookup(*table_.load(std::memory_order_acquire), data, size,
+                       hash);
+  if (id != kNone) return id;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Only writers replace the table, so this is the current one.
+  Table* table = table_.load(std::memory_order_relaxed);
+  id = Lookup(*table, data, size, hash);
+  if (id != kNone) return id;
+
+  id = size_.load(std::memory_order_relaxed);
+  size_t index;
+  int chunk = ChunkOf(id, kFirstChunkSize, &index);
+  Entry* entries = chunks_[chunk].load(std::memory_order_relaxed);
+  if (entries == nullptr) {
+    entries = new Entry[size_t(kFirstChunkSize) << chunk];
+    chunks_[chunk].store(entries, std::memory_order_release);
+  }
+  Entry& entry = entries[index];
+  entry.data = StoreText(data, size);
+  entry.size = size;
+  entry.hash = hash;
+
+  // Keep the load factor at most 1/2.
+  if (2 * (size_t(id) + 1) > table->mask + 1) {
+    std::unique_ptr<Table> grown(new Table(2 * (table->mask + 1)));
+    for (uint32_t i = 0; i < id; ++i) {
+      Insert(grown.get(), i, GetEntry(i).hash);
+    }
+    table = grown.get();
+    tables_.push_back(std::move(grown));
+  }
+  // Publishing the id in a slot also publishes the entry.
+  Insert(table, id, hash);
+  table_.store(table, std::memory_order_release);
+  size_.store(id + 1, std::memory_order_release);
+  return id;
+}
+
+void Interner::Insert(Table* table, uint32_t id, uint32_t hash) {
+  size_t slot = hash & table->mask;
+  while (table->slots[slot].load(std::memory_order_relaxed) != 0) {
+    slot = (slot + 1) & table->mask;
+  }
+  table->slots[slot].store(id + 1, std::memory_order_release);
+}
+
+// Copies the text of a new symbol, with a terminating null character, into
+// storage that never moves.
+const char* Interner::StoreText(const char* data, size_t size) {
+  size_t needed = size + 1;
+  char* text;
+  if (needed > kBlockSize / 4) {
+    // The current block stays the last one, to be filled further.
+    text = new char[needed];
+    text_bytes_ += needed;
+    blocks_.insert(blocks_.begin(), std::unique_ptr<char[]>(text));
+  } else {
+    if (block_used_ + needed > block_size_) {
+      blocks_.push_back(std::unique_ptr<char[]>(new char[kBlockSize]));
+      text_bytes_ += kBlockSize;
+      block_used_ = 0;
+      block_size_ = kBlockSize;
+    }
+    text = blocks_.back().get() + block_used_;
+    block_used_ += needed;
+  }
+  memcpy(text, data, size);
+  text[size] = '\0';
+  return text;
+}
+
+size_t Interner::memory_usage() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t usage = sizeof(*this);
+  for (const auto& table : tables_) {
+    usage += sizeof(Table) + (table->mask + 1) * sizeof(std::atomic<uint32_t>);
+  }
+  for (int i = 0; i < kMaxChunks; ++i) {
+    if (chunks_[i].load() != nullptr) {
+      usage += (size_t(kFirstChunkSize) << i) * sizeof(Entry);
+    }
+  }
+  return usage + text_bytes_;
+}
+
+Interner* GlobalInterner() {
+  // Never destroyed, so that it can be used during static destruction.
+  static Interner* interner = new Interner();
+  return interner;
+}
+
+void InternTokens(const char* data, const Token* begin, const Token* end,
+                  Interner* interner, std::vector<uint32_t>* symbols) {
+  symbols->clear();
+  for (const Token* token = begin; token != end; ++token) {
+    switch (token->type) {
+      case T_NameTest:
+        symbols->push_back(interner->Intern(data + token->offset,
+                                            token->size));
+        break;
+      case T_Literal:
+        symbols->push_back(interner->Intern(data + token->offset + 1,
+                                            token->size - 2));
+        break;
+      default:
+        symbols->push_back(Interner::kNone);
+        break;
+    }
+  }
+}
+
+}  // namespace xpath
@@ -0,0 +1,118 @@
+#ifndef XPATH_INTERNER_INCLUDED
+#define XPATH_INTERNER_INCLUDED
+
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+// Maps strings, such as the names and literals of many queries, to dense
+// 32-bit symbol ids, so that they are stored once and compared as integers.
+//
+// Symbols are never removed, and their ids and text stay valid for the
+// lifetime of the interner. An interner can be shared by all threads of a
+// process (see GlobalInterner()) or owned by a single context.
+//
+// An Interner is thread-safe. Looking up a symbol that already exists,
+// whether with Find() or Intern(), and reading the text of a symbol never
+// lock: the hash table is an array of atomic ids that readers probe with
+// acquire loads, and entries are stored in chunks that never move. Adding a
+// symbol takes a mutex. When the table grows, readers that still use the old
+// table find every symbol that existed before, since old tables are only
+// freed with the interner.
+class Interner {
+ public:
+  // Id value used to indicate the absence of a symbol.
+  static const uint32_t kNone = 0xffffffffu;
+
+  Interner();
+  ~Interner();
+
+  // Returns the id of the string described by `data` and `size`, adding it if
+  // it is not a symbol yet. Ids are assigned in order from 0.
+  uint32_t Intern(const char* data, size_t size);
+
+  uint32_t Intern(const std::string& s) { return Intern(s.data(), s.size()); }
+
+  // Returns the id of the string, or kNone if it is not a symbol.
+  uint32_t Find(const char* data, size_t size) const;
+
+  uint32_t Find(const std::string& s) const { return Find(s.data(), s.size()); }
+
+  // Returns the number of symbols.
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+
+  // Returns the text of the symbol `id`, which is size(id) bytes, followed by
+  // a null character.
+  const char* data(uint32_t id) const { return GetEntry(id).data; }
+  size_t size(uint32_t id) const { return GetEntry(id).size; }
+
+  std::string text(uint32_t id) const {
+    const Entry& entry = GetEntry(id);
+    return std::string(entry.data, entry.size);
+  }
+
+  // Returns the number of bytes used by the interner.
+  size_t memory_usage() const;
+
+ private:
+  struct Entry {
+    const char* data;
+    uint32_t size;
+    uint32_t hash;
+  };
+
+  struct Table {
+    explicit Table(size_t capacity);
+
+    size_t mask;
+    // Symbol id + 1 for each slot, or 0 for empty slots.
+    std::unique_ptr<std::atomic<uint32_t>[]> slots;
+  };
+
+  // Entries are stored in chunks of kFirstChunkSize << k entries for chunk
+  // k, which cover all 32-bit ids with kMaxChunks chunks.
+  static const uint32_t kFirstChunkSize = 1024;
+  static const int kMaxChunks = 23;
+
+  const Entry& GetEntry(uint32_t id) const;
+  uint32_t Lookup(const Table& table, const char* data, size_t size,
+                  uint32_t hash) const;
+  const char* StoreText(const char* data, size_t size);
+  void Insert(Table* table, uint32_t id, uint32_t hash);
+
+  std::atomic<Table*> table_;
+  std::atomic<Entry*> chunks_[kMaxChunks];
+  std::atomic<size_t> size_;
+
+  // Writers only: the lock, retired tables, and the storage for text.
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Table>> tables_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  size_t block_used_;
+  size_t block_size_;
+  size_t text_bytes_;
+
+  Interner(const Interner&);
+  void operator=(const Interner&);
+};
+
+// Returns an interner shared by the whole process.
+Interner* GlobalInterner();
+
+// Interns the name tests and literals among the tokens [begin, end) of the
+// expression `data`, and writes one symbol id per token to *symbols: the id
+// of the text of a T_NameTest token, or of the value of a T_Literal token
+// (without the quotes), and Interner::kNone for other tokens.
+void InternTokens(const char* data, const Token* begin, const Token* end,
+                  Interner* interner, std::vector<uint32_t>* symbols);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_INTERNER_INCLUDED */
@@ -0,0 +1,117 @@
+#include "Interner.h"
+#include "ParallelFor.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using ::testing::ElementsAre;
+
+namespace xpath {
+namespace {
+
+TEST(Interner, InternsStrings) {
+  Interner interner;
+  EXPECT_EQ(0u, interner.size());
+  EXPECT_EQ(Interner::kNone, interner.Find("book"));
+  EXPECT_EQ(0u, interner.Intern("book"));
+  EXPECT_EQ(1u, interner.Intern("author"));
+  EXPECT_EQ(0u, interner.Intern(string("book")));
+  EXPECT_EQ(2u, interner.Intern(""));
+  EXPECT_EQ(3u, interner.Intern("bo"));
+  EXPECT_EQ(4u, interner.Intern(string("a\0b", 3)));
+  EXPECT_EQ(5u, interner.size());
+
+  EXPECT_EQ(1u, interner.Find("author"));
+  EXPECT_EQ(2u, interner.Find(""));
+  EXPECT_EQ(Interner::kNone, interner.Find("a"));
+  EXPECT_EQ("author", interner.text(1));
+  EXPECT_EQ(string("a\0b", 3), interner.text(4));
+  EXPECT_STREQ("book", interner.data(0));
+  EXPECT_EQ(4u, interner.size(0));
+}
+
+TEST(Interner, Grows) {
+  Interner interner;
+  const size_t kCount = 100000;
+  vector<const char*> data;
+  for (size_t i = 0; i < kCount; ++i) {
+    string s = "name" + std::to_string(i);
+    ASSERT_EQ(i, interner.Intern(s));
+    data.push_back(interner.data(i));
+  }
+  // Long strings are stored separately.
+  string long_string(100000, 'x');
+  EXPECT_EQ(kCount, interner.Intern(long_string));
+  EXPECT_EQ(kCount + 1, interner.Intern("after"));
+
+  for (size_t i = 0; i < kCount; ++i) {
+    string s = "name" + std::to_string(i);
+    ASSERT_EQ(i, interner.Find(s));
+    // Text never moves.
+    ASSERT_EQ(data[i], interner.data(i));
+    ASSERT_EQ(s, interner.text(i));
+  }
+  EXPECT_EQ(long_string, interner.text(kCount));
+  EXPECT_EQ("after", interner.text(kCount + 1));
+
+  // Each symbol costs little more than its text.
+  EXPECT_LT(interner.memory_usage(), long_string.size() + 64 * kCount);
+}
+
+TEST(Interner, IsThreadSafe) {
+  Interner interner;
+  const size_t kCount = 1 << 14;
+  const int kThreads = 8;
+  vector<string> strings;
+  for (size_t i = 0; i < kCount; ++i) {
+    strings.push_back("field_" + std::to_string(i * 7919 % kCount));
+  }
+  // Every thread interns all strings, in a different order, and looks them
+  // up again while other threads add symbols and grow the table.
+  vector<vector<uint32_t>> ids(kThreads, vector<uint32_t>(kCount));
+  ParallelFor(kThreads, kThreads, [&](int, size_t thread) {
+    for (size_t n = 0; n < kCount; ++n) {
+      size_t i = (n * (2 * thread + 1) + thread * 1000) % kCount;
+      uint32_t id = interner.Intern(strings[i]);
+      ids[thread][i] = id;
+      if (interner.Find(strings[i]) != id || interner.text(id) != strings[i]) {
+        ADD_FAILURE() << strings[i];
+      }
+    }
+  });
+
+  EXPECT_EQ(kCount, interner.size());
+  vector<bool> used(kCount);
+  for (size_t i = 0; i < kCount; ++i) {
+    uint32_t id = interner.Find(strings[i]);
+    ASSERT_LT(id, kCount);
+    EXPECT_FALSE(used[id]);
+    used[id] = true;
+    EXPECT_EQ(strings[i], interner.text(id));
+    for (int thread = 0; thread < kThreads; ++thread) {
+      EXPECT_EQ(id, ids[thread][i]);
+    }
+  }
+}
+
+TEST(Interner, InternsTokens) {
+  Interner interner;
+  string input = "//book[@id = 'b1' or author = \"book\"]/title";
+  vector<Token> tokens;
+  ASSERT_EQ(input.size(), Tokenize(input, &tokens));
+  vector<uint32_t> symbols;
+  InternTokens(input.data(), tokens.data(), tokens.data() + tokens.size(),
+               &interner, &symbols);
+  const uint32_t kNone = Interner::kNone;
+  EXPECT_THAT(symbols, ElementsAre(kNone, 0, kNone, kNone, 1, kNone, 2,
+                                   kNone, 3, kNone, 0, kNone, kNone, 4));
+  EXPECT_EQ("b1", interner.text(2));
+  EXPECT_EQ(5u, interner.size());
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,45 @@
+#ifndef XPATH_MESSAGE_INCLUDED
+#define XPATH_MESSAGE_INCLUDED
+
+#include <stdlib.h>
+#include <string>
+
+namespace xpath {
+
+// Reflection-like interface to a protocol buffer message, which is all the
+// evaluator needs to query a message. An adapter for the protobuf runtime can
+// implement this on top of google::protobuf::Reflection; SimpleMessage.h
+// provides a stand-alone implementation.
+//
+// Fields are identified by their index in definition order, which is also the
+// order in which they appear in the document (see NOTES.txt). Message fields
+// become child elements, and scalar fields become attributes.
+class Message {
+ public:
+  virtual ~Message() {}
+
+  // Returns the number of fields defined for this message type.
+  virtual int field_count() const = 0;
+
+  // Returns the name of the field with index `field`.
+  virtual const std::string& field_name(int field) const = 0;
+
+  // Returns true if the field with index `field` holds messages, or false if
+  // it holds scalar values.
+  virtual bool is_message_field(int field) const = 0;
+
+  // Returns the number of values present in the field with index `field`:
+  // 0 or 1 for singular fields, or the number of elements for repeated fields.
+  virtual size_t value_count(int field) const = 0;
+
+  // Returns value `index` of a message field.
+  virtual const Message& message_value(int field, size_t index) const = 0;
+
+  // Returns value `index` of a scalar field, converted to a string as in the
+  // protobuf text format (but without quotes).
+  virtual std::string scalar_value(int field, size_t index) const = 0;
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_MESSAGE_INCLUDED */
@@ -0,0 +1,435 @@
+#include "NodeSet.h"
+
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XPATH_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace xpath {
+
+const uint32_t NodeSet::kChunkSize;
+const size_t NodeSet::kChunkWords;
+
+namespace {
+
+// A set switches to bitmaps above this many values per chunk, and back to an
+// array below half of it.
+const size_t kMaxArrayValuesPerChunk = 2048;
+
+// Intersections of arrays whose sizes differ by more than this factor search
+// the larger array instead of merging.
+const size_t kGallopRatio = 32;
+
+uint32_t KeyOf(uint32_t value) { return value >> 16; }
+
+// Returns the number of distinct keys of the sorted `values`.
+size_t CountKeys(const std::vector<uint32_t>& values) {
+  size_t count = 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i == 0 || KeyOf(values[i]) != KeyOf(values[i - 1])) ++count;
+  }
+  return count;
+}
+
+// Appends to *result the values of the sorted `small` that occur in the sorted
+// `large`, searching `large` with exponentially growing steps from the last
+// match, which takes O(small log(large / small)) time.
+void GallopIntersect(const std::vector<uint32_t>& small,
+                     const std::vector<uint32_t>& large,
+                     std::vector<uint32_t>* result) {
+  auto begin = large.begin();
+  for (uint32_t value : small) {
+    size_t step = 1;
+    auto end = begin;
+    while (end != large.end() && *end < value) {
+      begin = end;
+      end = size_t(large.end() - end) > step ? end + step : large.end();
+      step *= 2;
+    }
+    begin = std::lower_bound(begin, end, value);
+    if (begin == large.end()) return;
+    if (*begin == value) result->push_back(value);
+  }
+}
+
+// Scalar reference implementations of the kernels.
+
+size_t OrWordsScalar(const uint64_t* a, const uint64_t* b, uint64_t* out,
+                     size_t count) {
+  size_t bits = 0;
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = a[i] | b[i];
+    bits += __builtin_popcountll(out[i]);
+  }
+  return bits;
+}
+
+size_t AndWordsScalar(const uint64_t* a, const uint64_t* b, uint64_t* out,
+                      size_t count) {
+  size_t bits = 0;
+  for (size_t i = 0; i < count; ++i) {
+    out[i] = a[i] & b[i];
+    bits += __builtin_popcountll(out[i]);
+  }
+  return bits;
+}
+
+const BitmapKernels kScalarKernels = { OrWordsScalar, AndWordsScalar };
+
+#ifdef XPATH_HAVE_X86_SIMD
+
+// The vectorized kernels combine 2 or 4 words at a time and count the bits of
+// the result per byte, which _mm(256)_sad_epu8 then sums into 64-bit lanes.
+// SSE2 counts bits with shifts and masks; AVX2 looks up the count of each
+// nibble with a shuffle.
+
+TARGET_SSE2 inline __m128i PopcountBytesSse2(__m128i v) {
+  const __m128i m1 = _mm_set1_epi8(0x55);
+  const __m128i m2 = _mm_set1_epi8(0x33);
+  const __m128i m4 = _mm_set1_epi8(0x0f);
+  v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+  v = _mm_add_epi8(_mm_and_si128(v, m2),
+                   _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+  return _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+}
+
+template<bool is_or>
+TARGET_SSE2 size_t CombineWordsSse2(const uint64_t* a, const uint64_t* b,
+                                    uint64_t* out, size_t count) {
+  __m128i total = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i r = is_or ? _mm_or_si128(x, y) : _mm_and_si128(x, y);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), r);
+    total = _mm_add_epi64(total, _mm_sad_epu8(PopcountBytesSse2(r),
+                                              _mm_setzero_si128()));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), total);
+  size_t bits = lanes[0] + lanes[1];
+  return bits + (is_or ? OrWordsScalar : AndWordsScalar)(a + i, b + i,
+                                                         out + i, count - i);
+}
+
+TARGET_AVX2 inline __m256i PopcountBytesAvx2(__m256i v) {
+  const __m256i counts = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+  __m256i low = _mm256_and_si256(v, low_nibbles);
+  __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(counts, low),
+                         _mm256_shuffle_epi8(counts, high));
+}
+
+template<bool is_or>
+TARGET_AVX2 size_t CombineWordsAvx2(const uint64_t* a, const uint64_t* b,
+                                    uint64_t* out, size_t count) {
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    __m256i r = is_or ? _mm256_or_si256(x, y) : _mm256_and_si256(x, y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), r);
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(PopcountBytesAvx2(r),
+                                                    _mm256_setzero_si256()));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+  size_t bits = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  return bits + (is_or ? OrWordsScalar : AndWordsScalar)(a + i, b + i,
+                                                         out + i, count - i);
+}
+
+const BitmapKernels kSse2Kernels = {
+  CombineWordsSse2<true>, CombineWordsSse2<false> };
+
+const BitmapKernels kAvx2Kernels = {
+  CombineWordsAvx2<true>, CombineWordsAvx2<false> };
+
+#endif /* XPATH_HAVE_X86_SIMD */
+
+const BitmapKernels& Kernels() {
+  static const BitmapKernels* const kernels =
+      GetBitmapKernels(DetectSimdLevel());
+  return *kernels;
+}
+
+}  // namespace
+
+const BitmapKernels* GetBitmapKernels(SimdLevel level) {
+  switch (level) {
+    case SIMD_None:
+      return &kScalarKernels;
+#ifdef XPATH_HAVE_X86_SIMD
+    case SIMD_SSE2:
+      return &kSse2Kernels;
+    case SIMD_AVX2:
+      return &kAvx2Kernels;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+void NodeSet::AssignSorted(const uint32_t* values, size_t count) {
+  Clear();
+  values_.assign(values, values + count);
+  size_ = count;
+  Adapt();
+}
+
+void NodeSet::Assign(const uint32_t* values, size_t count) {
+  Clear();
+  if (count > kMaxArrayValuesPerChunk) {
+    // Find the chunks that the values fall in, and set bits directly if the
+    // values are dense enough to be stored as bitmaps.
+    uint32_t max_key = 0;
+    for (size_t i = 0; i < count; ++i) {
+      max_key = std::max(max_key, KeyOf(values[i]));
+    }
+    std::vector<uint32_t> chunks(max_key + 1, 0);
+    for (size_t i = 0; i < count; ++i) chunks[KeyOf(values[i])] = 1;
+    for (uint32_t key = 0; key <= max_key; ++key) {
+      if (chunks[key] != 0) {
+        chunks[key] = keys_.size();
+        keys_.push_back(key);
+      }
+    }
+    if (count > kMaxArrayValuesPerChunk * keys_.size()) {
+      bitmap_ = true;
+      counts_.assign(keys_.size(), 0);
+      words_.assign(keys_.size() * kChunkWords, 0);
+      for (size_t i = 0; i < count; ++i) {
+        uint32_t value = values[i];
+        uint32_t chunk = chunks[KeyOf(value)];
+        uint64_t& word = chunk_words(chunk)[(value >> 6) & 1023];
+        uint64_t bit = uint64_t(1) << (value & 63);
+        if ((word & bit) == 0) {
+          word |= bit;
+          ++counts_[chunk];
+          ++size_;
+        }
+      }
+      Adapt();
+      return;
+    }
+    keys_.clear();
+  }
+  values_.assign(values, values + count);
+  std::sort(values_.begin(), values_.end());
+  values_.erase(std::unique(values_.begin(), values_.end()), values_.end());
+  size_ = values_.size();
+  Adapt();
+}
+
+void NodeSet::Clear() {
+  bitmap_ = false;
+  size_ = 0;
+  values_.clear();
+  keys_.clear();
+  counts_.clear();
+  words_.clear();
+}
+
+size_t NodeSet::memory_usage() const {
+  return (values_.capacity() + keys_.capacity() + counts_.capacity()) *
+             sizeof(uint32_t) +
+         words_.capacity() * sizeof(uint64_t);
+}
+
+size_t NodeSet::FindChunk(uint32_t key) const {
+  size_t chunk = std::lower_bound(keys_.begin(), keys_.end(), key) -
+                 keys_.begin();
+  return chunk < keys_.size() && keys_[chunk] == key ? chunk : keys_.size();
+}
+
+bool NodeSet::Contains(uint32_t value) const {
+  if (!bitmap_) {
+    return std::binary_search(values_.begin(), values_.end(), value);
+  }
+  size_t chunk = FindChunk(KeyOf(value));
+  if (chunk == keys_.size()) return false;
+  return (chunk_words(chunk)[(value >> 6) & 1023] >> (value & 63)) & 1;
+}
+
+void NodeSet::ToBitmap() {
+  bitmap_ = true;
+  keys_.clear();
+  for (uint32_t value : values_) {
+    if (keys_.empty() || keys_.back() != KeyOf(value)) {
+      keys_.push_back(KeyOf(value));
+    }
+  }
+  counts_.assign(keys_.size(), 0);
+  words_.assign(keys_.size() * kChunkWords, 0);
+  size_t chunk = 0;
+  for (uint32_t value : values_) {
+    while (keys_[chunk] != KeyOf(value)) ++chunk;
+    chunk_words(chunk)[(value >> 6) & 1023] |= uint64_t(1) << (value & 63);
+    ++counts_[chunk];
+  }
+  std::vector<uint32_t>().swap(values_);
+}
+
+void NodeSet::ToArray() {
+  std::vector<uint32_t> values;
+  values.reserve(size_);
+  AppendTo(&values);
+  bitmap_ = false;
+  values_.swap(values);
+  std::vector<uint32_t>().swap(keys_);
+  std::vector<uint32_t>().swap(counts_);
+  std::vector<uint64_t>().swap(words_);
+}
+
+void NodeSet::Adapt() {
+  if (!bitmap_) {
+    if (size_ > kMaxArrayValuesPerChunk &&
+        size_ > kMaxArrayValuesPerChunk * CountKeys(values_)) {
+      ToBitmap();
+    }
+  } else if (size_ < kMaxArrayValuesPerChunk / 2 * keys_.size()) {
+    ToArray();
+  }
+}
+
+void NodeSet::UnionArrays(const std::vector<uint32_t>& other) {
+  std::vector<uint32_t> values;
+  values.reserve(values_.size() + other.size());
+  std::set_union(values_.begin(), values_.end(), other.begin(), other.end(),
+                 std::back_inserter(values));
+  values_.swap(values);
+  size_ = values_.size();
+}
+
+void NodeSet::UnionBitmaps(const NodeSet& other) {
+  // Make room for the chunks of `other` that this set does not have.
+  std::vector<uint32_t> keys;
+  std::set_union(keys_.begin(), keys_.end(), other.keys_.begin(),
+                 other.keys_.end(), std::back_inserter(keys));
+  if (keys.size() != keys_.size()) {
+    std::vector<uint32_t> counts(keys.size(), 0);
+    std::vector<uint64_t> words(keys.size() * kChunkWords, 0);
+    for (size_t i = 0, old = 0; old < keys_.size(); ++i) {
+      if (keys[i] != keys_[old]) continue;
+      memcpy(&words[i * kChunkWords], chunk_words(old),
+             kChunkWords * sizeof(uint64_t));
+      counts[i] = counts_[old++];
+    }
+    keys_.swap(keys);
+    counts_.swap(counts);
+    words_.swap(words);
+  }
+  const BitmapKernels& kernels = Kernels();
+  for (size_t i = 0, j = 0; j < other.keys_.size(); ++i) {
+    if (keys_[i] != other.keys_[j]) continue;
+    counts_[i] = kernels.or_words(chunk_words(i), other.chunk_words(j++),
+                                  chunk_words(i), kChunkWords);
+  }
+  size_ = 0;
+  for (uint32_t count : counts_) size_ += count;
+}
+
+void NodeSet::UnionWith(const NodeSet& other) {
+  if (other.empty()) return;
+  if (!bitmap_ && !other.bitmap_) {
+    UnionArrays(other.values_);
+  } else {
+    if (!bitmap_) ToBitmap();
+    if (other.bitmap_) {
+      UnionBitmaps(other);
+    } else {
+      NodeSet copy(other);
+      copy.ToBitmap();
+      UnionBitmaps(copy);
+    }
+  }
+  Adapt();
+}
+
+void NodeSet::IntersectWith(const NodeSet& other) {
+  if (bitmap_ && other.bitmap_) {
+    const BitmapKernels& kernels = Kernels();
+    size_t kept = 0;
+    size_ = 0;
+    for (size_t i = 0, j = 0; i < keys_.size(); ++i) {
+      while (j < other.keys_.size() && other.keys_[j] < keys_[i]) ++j;
+      if (j == other.keys_.size() || other.keys_[j] != keys_[i]) continue;
+      size_t count = kernels.and_words(chunk_words(i), other.chunk_words(j),
+                                       chunk_words(kept), kChunkWords);
+      if (count == 0) continue;
+      keys_[kept] = keys_[i];
+      counts_[kept++] = count;
+      size_ += count;
+    }
+    keys_.resize(kept);
+    counts_.resize(kept);
+    words_.resize(kept * kChunkWords);
+    Adapt();
+    return;
+  }
+
+  // At least one side is an array, and so is the result.
+  std::vector<uint32_t> values;
+  if (bitmap_ || other.bitmap_) {
+    const NodeSet& array = bitmap_ ? other : *this;
+    const NodeSet& bitmap = bitmap_ ? *this : other;
+    for (uint32_t value : array.values_) {
+      if (bitmap.Contains(value)) values.push_back(value);
+    }
+  } else {
+    const std::vector<uint32_t>& small =
+        values_.size() <= other.values_.size() ? values_ : other.values_;
+    const std::vector<uint32_t>& large =
+        &small == &values_ ? other.values_ : values_;
+    if (large.size() / kGallopRatio > small.size()) {
+      GallopIntersect(small, large, &values);
+    } else {
+      std::set_intersection(small.begin(), small.end(), large.begin(),
+                            large.end(), std::back_inserter(values));
+    }
+  }
+  Clear();
+  values_.swap(values);
+  size_ = values_.size();
+}
+
+void NodeSet::AppendTo(std::vector<uint32_t>* values) const {
+  if (!bitmap_) {
+    values->insert(values->end(), values_.begin(), values_.end());
+    return;
+  }
+  for (size_t chunk = 0; chunk < keys_.size(); ++chunk) {
+    uint32_t base = keys_[chunk] << 16;
+    const uint64_t* words = chunk_words(chunk);
+    for (size_t i = 0; i < kChunkWords; ++i) {
+      for (uint64_t word = words[i]; word != 0; word &= word - 1) {
+        values->push_back(base + i * 64 + __builtin_ctzll(word));
+      }
+    }
+  }
+}
+
+bool NodeSet::operator==(const NodeSet& other) const {
+  if (size_ != other.size_) return false;
+  if (!bitmap_ && !other.bitmap_) return values_ == other.values_;
+  if (bitmap_ && other.bitmap_) {
+    return keys_ == other.keys_ && words_ == other.words_;
+  }
+  std::vector<uint32_t> a, b;
+  AppendTo(&a);
+  other.AppendTo(&b);
+  return a == b;
+}
+
+}  // namespace xpath
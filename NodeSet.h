@@ -0,0 +1,119 @@
+#ifndef XPATH_NODE_SET_INCLUDED
+#define XPATH_NODE_SET_INCLUDED
+
+#include "SimdScan.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace xpath {
+
+// A set of 32-bit values, meant for the document-order ranks of nodes (see
+// Document::order()), so that iterating a set visits nodes in document order
+// without sorting.
+//
+// Small or sparse sets are stored as a sorted array. Dense sets are stored
+// like a Roaring bitmap: values are split into chunks of 2^16 by their high
+// 16 bits, and each nonempty chunk is a bitmap of 2^16 bits (8 KB). A set
+// switches to bitmaps when it averages more than 2048 values per chunk, which
+// is where a bitmap becomes smaller than the array, and back to an array when
+// it drops below half of that. Union and intersection of bitmaps use SIMD
+// instructions where available (see GetBitmapKernels()).
+class NodeSet {
+ public:
+  NodeSet() : bitmap_(false), size_(0) {}
+
+  // Replaces the contents with `count` values in increasing order, without
+  // duplicates.
+  void AssignSorted(const uint32_t* values, size_t count);
+
+  void AssignSorted(const std::vector<uint32_t>& values) {
+    AssignSorted(values.data(), values.size());
+  }
+
+  // Replaces the contents with `count` values in any order, possibly with
+  // duplicates. Large dense inputs are set as bits directly, without sorting.
+  void Assign(const uint32_t* values, size_t count);
+
+  void Assign(const std::vector<uint32_t>& values) {
+    Assign(values.data(), values.size());
+  }
+
+  void Clear();
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Returns true if the set is stored as bitmaps rather than as an array.
+  bool is_bitmap() const { return bitmap_; }
+
+  // Returns the number of bytes used by the values.
+  size_t memory_usage() const;
+
+  bool Contains(uint32_t value) const;
+
+  // Sets this set to its union or intersection with `other`.
+  void UnionWith(const NodeSet& other);
+  void IntersectWith(const NodeSet& other);
+
+  // Appends the values to *values in increasing order.
+  void AppendTo(std::vector<uint32_t>* values) const;
+
+  bool operator==(const NodeSet& other) const;
+  bool operator!=(const NodeSet& other) const { return !(*this == other); }
+
+ private:
+  // Values per chunk, and 64-bit words per chunk bitmap.
+  static const uint32_t kChunkSize = 1 << 16;
+  static const size_t kChunkWords = kChunkSize / 64;
+
+  uint64_t* chunk_words(size_t chunk) {
+    return &words_[chunk * kChunkWords];
+  }
+  const uint64_t* chunk_words(size_t chunk) const {
+    return &words_[chunk * kChunkWords];
+  }
+
+  // Returns the index of the chunk with the given key, or keys_.size().
+  size_t FindChunk(uint32_t key) const;
+
+  void ToBitmap();
+  void ToArray();
+  // Switches representation if the other one suits the current size better.
+  void Adapt();
+  void UnionArrays(const std::vector<uint32_t>& other);
+  void UnionBitmaps(const NodeSet& other);
+
+  bool bitmap_;
+  size_t size_;
+
+  // Array representation: the values, in increasing order.
+  std::vector<uint32_t> values_;
+
+  // Bitmap representation: the high 16 bits of the values in each chunk, in
+  // increasing order, the number of values in each chunk, and kChunkWords
+  // words of bits per chunk.
+  std::vector<uint32_t> keys_;
+  std::vector<uint32_t> counts_;
+  std::vector<uint64_t> words_;
+};
+
+// The word loops of NodeSet bitmap operations at a particular SIMD level.
+struct BitmapKernels {
+  // Sets out[i] to a[i] | b[i] (or_words) or a[i] & b[i] (and_words) for i in
+  // [0, count), and returns the number of bits set in out. `out` may be `a`
+  // or `b`.
+  size_t (*or_words)(const uint64_t* a, const uint64_t* b, uint64_t* out,
+                     size_t count);
+  size_t (*and_words)(const uint64_t* a, const uint64_t* b, uint64_t* out,
+                      size_t count);
+};
+
+// Returns the kernels for the given level, or nullptr if they are not
+// available in this build. NodeSet uses the kernels for DetectSimdLevel().
+const BitmapKernels* GetBitmapKernels(SimdLevel level);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_NODE_SET_INCLUDED */
@@ -0,0 +1,241 @@
+// Compares NodeSet with sorted vectors of document-order ranks on the
+// node-sets of union-heavy queries over a large document.
+
+#include "NodeSet.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+// The operands of the union "//item | //part | //@id | //@x | ...", as ranks
+// in document order.
+const char* const kQueries[] = {
+  "//item", "//part", "//@id", "//@x", "//item[@id mod 3 = 0]/part",
+  "//part[@x = 2]/..", "//item[@id mod 100 = 0]/@*",
+};
+
+class Operands {
+ public:
+  // Builds a document with `item_count` items of 3 parts each.
+  explicit Operands(int item_count) {
+    string text;
+    for (int i = 0; i < item_count; ++i) {
+      text += "item { id: " + std::to_string(i) + " ";
+      for (int part = 0; part < 3; ++part) {
+        text += "part { x: " + std::to_string((i + part) % 5) + " } ";
+      }
+      text += "} ";
+    }
+    message_ = SimpleMessage::ParseText(text);
+    document_.reset(new Document(*message_));
+    document_->BuildOrderIndex();
+    Evaluator evaluator(document_.get());
+    for (const char* query : kQueries) {
+      Ast ast;
+      Value value;
+      size_t error_offset;
+      Parse(query, &ast, &error_offset);
+      evaluator.Evaluate(ast, &value, &error_offset);
+      vector<uint32_t> ranks;
+      for (uint32_t node : value.nodes) ranks.push_back(document_->order(node));
+      sets_.push_back(ranks);
+    }
+  }
+
+  const vector<vector<uint32_t>>& sets() const { return sets_; }
+
+  size_t total_size() const {
+    size_t size = 0;
+    for (const vector<uint32_t>& set : sets_) size += set.size();
+    return size;
+  }
+
+ private:
+  unique_ptr<SimpleMessage> message_;
+  unique_ptr<Document> document_;
+  vector<vector<uint32_t>> sets_;
+};
+
+// Unions all operands as the Evaluator did before NodeSet: concatenate, sort
+// and remove duplicates.
+void BM_UnionVectorSort(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<uint32_t> result;
+  while (state.KeepRunning()) {
+    result.clear();
+    for (const vector<uint32_t>& set : operands.sets()) {
+      result.insert(result.end(), set.begin(), set.end());
+      std::sort(result.begin(), result.end());
+      result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+    benchmark::DoNotOptimize(result.data());
+  }
+  state.SetItemsProcessed(state.iterations() * operands.total_size());
+}
+BENCHMARK(BM_UnionVectorSort)->Arg(10000)->Arg(100000);
+
+// Unions all operands by merging sorted vectors.
+void BM_UnionVectorMerge(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<uint32_t> result, merged;
+  while (state.KeepRunning()) {
+    result.clear();
+    for (const vector<uint32_t>& set : operands.sets()) {
+      merged.clear();
+      std::set_union(result.begin(), result.end(), set.begin(), set.end(),
+                     std::back_inserter(merged));
+      result.swap(merged);
+    }
+    benchmark::DoNotOptimize(result.data());
+  }
+  state.SetItemsProcessed(state.iterations() * operands.total_size());
+}
+BENCHMARK(BM_UnionVectorMerge)->Arg(10000)->Arg(100000);
+
+// Unions all operands as NodeSets, and reads the result back into a vector.
+void BM_UnionNodeSet(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<NodeSet> sets(operands.sets().size());
+  for (size_t i = 0; i < sets.size(); ++i) {
+    sets[i].AssignSorted(operands.sets()[i]);
+  }
+  NodeSet result;
+  vector<uint32_t> values;
+  while (state.KeepRunning()) {
+    result.Clear();
+    for (const NodeSet& set : sets) result.UnionWith(set);
+    values.clear();
+    result.AppendTo(&values);
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(state.iterations() * operands.total_size());
+}
+BENCHMARK(BM_UnionNodeSet)->Arg(10000)->Arg(100000);
+
+// Deduplicates the concatenation of all operands, as SortDocumentOrder()
+// does after a union or an ancestor step.
+void BM_DeduplicateVector(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<uint32_t> all, values;
+  for (const vector<uint32_t>& set : operands.sets()) {
+    all.insert(all.end(), set.begin(), set.end());
+  }
+  while (state.KeepRunning()) {
+    values = all;
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(state.iterations() * all.size());
+}
+BENCHMARK(BM_DeduplicateVector)->Arg(10000)->Arg(100000);
+
+void BM_DeduplicateNodeSet(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<uint32_t> all, values;
+  for (const vector<uint32_t>& set : operands.sets()) {
+    all.insert(all.end(), set.begin(), set.end());
+  }
+  NodeSet set;
+  while (state.KeepRunning()) {
+    set.Assign(all);
+    values.clear();
+    set.AppendTo(&values);
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(state.iterations() * all.size());
+}
+BENCHMARK(BM_DeduplicateNodeSet)->Arg(10000)->Arg(100000);
+
+// Intersects "//item | //part" with every other operand.
+void BM_IntersectVector(benchmark::State& state) {
+  Operands operands(state.range(0));
+  const vector<vector<uint32_t>>& sets = operands.sets();
+  vector<uint32_t> elements, result;
+  std::set_union(sets[0].begin(), sets[0].end(), sets[1].begin(),
+                 sets[1].end(), std::back_inserter(elements));
+  while (state.KeepRunning()) {
+    for (size_t i = 1; i < sets.size(); ++i) {
+      result.clear();
+      std::set_intersection(elements.begin(), elements.end(), sets[i].begin(),
+                            sets[i].end(), std::back_inserter(result));
+      benchmark::DoNotOptimize(result.data());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * operands.total_size());
+}
+BENCHMARK(BM_IntersectVector)->Arg(10000)->Arg(100000);
+
+void BM_IntersectNodeSet(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<NodeSet> sets(operands.sets().size());
+  for (size_t i = 0; i < sets.size(); ++i) {
+    sets[i].AssignSorted(operands.sets()[i]);
+  }
+  sets[0].UnionWith(sets[1]);
+  NodeSet result;
+  while (state.KeepRunning()) {
+    for (size_t i = 1; i < sets.size(); ++i) {
+      result = sets[0];
+      result.IntersectWith(sets[i]);
+      benchmark::DoNotOptimize(result.size());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * operands.total_size());
+}
+BENCHMARK(BM_IntersectNodeSet)->Arg(10000)->Arg(100000);
+
+// Tests every rank of the document for membership in the union.
+void BM_ContainsVector(benchmark::State& state) {
+  Operands operands(state.range(0));
+  vector<uint32_t> all;
+  for (const vector<uint32_t>& set : operands.sets()) {
+    all.insert(all.end(), set.begin(), set.end());
+  }
+  std::sort(all.begin(), all.end());
+  all.erase(std::unique(all.begin(), all.end()), all.end());
+  uint32_t limit = all.back() + 1;
+  while (state.KeepRunning()) {
+    size_t count = 0;
+    for (uint32_t rank = 0; rank < limit; ++rank) {
+      count += std::binary_search(all.begin(), all.end(), rank);
+    }
+    benchmark::DoNotOptimize(count);
+  }
+  state.SetItemsProcessed(state.iterations() * limit);
+}
+BENCHMARK(BM_ContainsVector)->Arg(10000)->Arg(100000);
+
+void BM_ContainsNodeSet(benchmark::State& state) {
+  Operands operands(state.range(0));
+  NodeSet set;
+  vector<uint32_t> all;
+  for (const vector<uint32_t>& ranks : operands.sets()) {
+    all.insert(all.end(), ranks.begin(), ranks.end());
+  }
+  set.Assign(all);
+  uint32_t limit = *std::max_element(all.begin(), all.end()) + 1;
+  while (state.KeepRunning()) {
+    size_t count = 0;
+    for (uint32_t rank = 0; rank < limit; ++rank) count += set.Contains(rank);
+    benchmark::DoNotOptimize(count);
+  }
+  state.SetItemsProcessed(state.iterations() * limit);
+}
+BENCHMARK(BM_ContainsNodeSet)->Arg(10000)->Arg(100000);
+
+}  // namespace
+}  // namespace xpath
+
+BENCHMARK_MAIN();
@@ -0,0 +1,163 @@
+#include "NodeSet.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <vector>
+
+using std::vector;
+using ::testing::ElementsAre;
+
+namespace xpath {
+namespace {
+
+vector<uint32_t> Values(const NodeSet& set) {
+  vector<uint32_t> values;
+  set.AppendTo(&values);
+  return values;
+}
+
+// Returns `count` distinct random values below `limit`, in increasing order.
+vector<uint32_t> RandomValues(std::mt19937* random, size_t count,
+                              uint32_t limit) {
+  vector<uint32_t> values;
+  std::uniform_int_distribution<uint32_t> distribution(0, limit - 1);
+  while (values.size() < count) {
+    for (size_t i = values.size(); i < count; ++i) {
+      values.push_back(distribution(*random));
+    }
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
+  }
+  return values;
+}
+
+TEST(NodeSet, StoresSmallSetsAsArrays) {
+  NodeSet set;
+  EXPECT_TRUE(set.empty());
+  set.Assign(vector<uint32_t>{ 7, 3, 70000, 3, 12 });
+  EXPECT_FALSE(set.is_bitmap());
+  EXPECT_EQ(4u, set.size());
+  EXPECT_THAT(Values(set), ElementsAre(3, 7, 12, 70000));
+  EXPECT_TRUE(set.Contains(12));
+  EXPECT_TRUE(set.Contains(70000));
+  EXPECT_FALSE(set.Contains(4));
+
+  NodeSet other;
+  other.AssignSorted(vector<uint32_t>{ 1, 7, 13 });
+  set.UnionWith(other);
+  EXPECT_THAT(Values(set), ElementsAre(1, 3, 7, 12, 13, 70000));
+  other.AssignSorted(vector<uint32_t>{ 0, 7, 12, 99999 });
+  set.IntersectWith(other);
+  EXPECT_THAT(Values(set), ElementsAre(7, 12));
+  set.Clear();
+  EXPECT_TRUE(set.empty());
+  EXPECT_THAT(Values(set), ElementsAre());
+}
+
+TEST(NodeSet, SwitchesToBitmaps) {
+  vector<uint32_t> dense;
+  for (uint32_t i = 0; i < 100000; i += 3) dense.push_back(i + 65536);
+  NodeSet set;
+  set.AssignSorted(dense);
+  EXPECT_TRUE(set.is_bitmap());
+  EXPECT_EQ(dense.size(), set.size());
+  EXPECT_EQ(dense, Values(set));
+  EXPECT_TRUE(set.Contains(65536 + 300));
+  EXPECT_FALSE(set.Contains(65536 + 301));
+  EXPECT_FALSE(set.Contains(300));
+  // The bitmaps take less memory than the array.
+  EXPECT_LT(set.memory_usage(), dense.size() * sizeof(uint32_t));
+
+  // Unsorted input gives the same set.
+  vector<uint32_t> shuffled = dense;
+  std::reverse(shuffled.begin(), shuffled.end());
+  shuffled.insert(shuffled.end(), dense.begin(), dense.begin() + 100);
+  NodeSet unsorted;
+  unsorted.Assign(shuffled);
+  EXPECT_TRUE(unsorted.is_bitmap());
+  EXPECT_TRUE(set == unsorted);
+
+  // Intersecting with a sparse set goes back to an array.
+  NodeSet sparse;
+  sparse.AssignSorted(vector<uint32_t>{ 5, 65536 + 3, 65536 + 4, 200000 });
+  set.IntersectWith(sparse);
+  EXPECT_FALSE(set.is_bitmap());
+  EXPECT_THAT(Values(set), ElementsAre(65536 + 3));
+}
+
+TEST(NodeSet, MatchesSortedVectors) {
+  std::mt19937 random(42);
+  // Sizes and ranges that give arrays, bitmaps, and mixes of both.
+  const size_t kSizes[] = { 0, 1, 100, 3000, 20000, 150000 };
+  const uint32_t kLimits[] = { 1000, 70000, 400000, 50000000 };
+  for (int round = 0; round < 40; ++round) {
+    size_t a_size = kSizes[round % 6];
+    size_t b_size = kSizes[(round / 6) % 6];
+    uint32_t limit = kLimits[round % 4];
+    if (limit < a_size || limit < b_size) limit = 4 * (a_size + b_size);
+    vector<uint32_t> a = RandomValues(&random, a_size, limit);
+    vector<uint32_t> b = RandomValues(&random, b_size, limit);
+    SCOPED_TRACE(testing::Message() << a_size << " " << b_size << " " << limit);
+
+    NodeSet a_set, b_set;
+    a_set.AssignSorted(a);
+    b_set.Assign(b);
+    ASSERT_EQ(a, Values(a_set));
+    ASSERT_EQ(b, Values(b_set));
+    for (size_t i = 0; i < 100 && !b.empty(); ++i) {
+      uint32_t value = b[i * 7919 % b.size()] + (i & 1);
+      ASSERT_EQ(std::binary_search(a.begin(), a.end(), value),
+                a_set.Contains(value));
+    }
+
+    vector<uint32_t> expected;
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                   std::back_inserter(expected));
+    NodeSet result = a_set;
+    result.UnionWith(b_set);
+    EXPECT_EQ(expected, Values(result));
+    EXPECT_EQ(expected.size(), result.size());
+
+    expected.clear();
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(),
+                          std::back_inserter(expected));
+    result = b_set;
+    result.IntersectWith(a_set);
+    EXPECT_EQ(expected, Values(result));
+    EXPECT_EQ(expected.size(), result.size());
+
+    // Operations with itself change nothing.
+    result = a_set;
+    result.UnionWith(result);
+    result.IntersectWith(result);
+    EXPECT_TRUE(result == a_set);
+  }
+}
+
+TEST(NodeSet, KernelsMatchScalar) {
+  std::mt19937_64 random(7);
+  const BitmapKernels* scalar = GetBitmapKernels(SIMD_None);
+  ASSERT_NE(nullptr, scalar);
+  for (SimdLevel level : { SIMD_SSE2, SIMD_AVX2 }) {
+    const BitmapKernels* kernels = GetBitmapKernels(level);
+    if (kernels == nullptr || DetectSimdLevel() < level) continue;
+    for (size_t count : { 0, 1, 2, 3, 5, 8, 17, 1024 }) {
+      vector<uint64_t> a(count), b(count), expected(count), actual(count);
+      for (size_t i = 0; i < count; ++i) {
+        a[i] = random() & random();
+        b[i] = i % 5 == 0 ? ~uint64_t(0) : random();
+      }
+      EXPECT_EQ(scalar->or_words(a.data(), b.data(), expected.data(), count),
+                kernels->or_words(a.data(), b.data(), actual.data(), count));
+      EXPECT_EQ(expected, actual);
+      EXPECT_EQ(scalar->and_words(a.data(), b.data(), expected.data(), count),
+                kernels->and_words(a.data(), b.data(), actual.data(), count));
+      EXPECT_EQ(expected, actual);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,291 @@
+#include "Optimizer.h"
+
+#include "Evaluator.h"
+#include "Functions.h"
+
+#include <math.h>
+#include <utility>
+
+namespace xpath {
+
+namespace {
+
+// Returns the value of a constant expression in *value, or false if the
+// expression is not a constant.
+bool GetConstant(const Ast& ast, const Expr& expr, Value* value) {
+  switch (expr.type) {
+    case X_Literal:
+      *value = StringValue(ast.text(expr));
+      return true;
+    case X_Number:
+      *value = NumberValue(expr.number);
+      return true;
+    case X_Boolean:
+      *value = BooleanValue(expr.number != 0);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Conversions of constants, which are never node-sets.
+double ToNumber(const Value& value) {
+  switch (value.type) {
+    case V_Boolean:
+      return value.boolean ? 1 : 0;
+    case V_Number:
+      return value.number;
+    default:
+      return StringToNumber(value.string);
+  }
+}
+
+bool Compare(ExprType op, const Value& left, const Value& right) {
+  if (op == X_Equal || op == X_NotEqual) {
+    bool equal;
+    if (left.type == V_Boolean || right.type == V_Boolean) {
+      equal = ToBoolean(left) == ToBoolean(right);
+    } else if (left.type == V_Number || right.type == V_Number) {
+      equal = ToNumber(left) == ToNumber(right);
+    } else {
+      equal = left.string == right.string;
+    }
+    return equal == (op == X_Equal);
+  }
+  double a = ToNumber(left), b = ToNumber(right);
+  switch (op) {
+    case X_LessThan: return a < b;
+    case X_LessEqual: return a <= b;
+    case X_GreaterThan: return a > b;
+    default: return a >= b;
+  }
+}
+
+double Arithmetic(ExprType op, double a, double b) {
+  switch (op) {
+    case X_Plus: return a + b;
+    case X_Minus: return a - b;
+    case X_Multiply: return a * b;
+    case X_Div: return a / b;
+    default: return fmod(a, b);
+  }
+}
+
+}  // namespace
+
+class Optimizer {
+ public:
+  explicit Optimizer(Ast* ast) : ast_(*ast) {}
+
+  void Optimize() {
+    if (ast_.root_ != Ast::kNone) Visit(ast_.root_);
+  }
+
+ private:
+  Expr& node(uint32_t i) { return ast_.nodes_[i]; }
+  uint32_t next(uint32_t i) { return ast_.nodes_[i].next_sibling; }
+
+  void Visit(uint32_t expr);
+  void FoldBinary(Expr& e);
+  void FoldFunction(Expr& e);
+  void OptimizePath(Expr& path);
+  void RemoveTruePredicates(Expr& step);
+  bool IsFirstPosition(uint32_t predicate);
+  bool IsCall(uint32_t expr, FunctionName function);
+  bool HasInvalidCall(uint32_t expr);
+
+  void SetNumber(Expr& e, double number) {
+    e.type = X_Number;
+    e.number = number;
+    e.first_child = Ast::kNone;
+    e.text_size = 0;
+  }
+  void SetBoolean(Expr& e, bool boolean) {
+    SetNumber(e, boolean);
+    e.type = X_Boolean;
+  }
+
+  Ast& ast_;
+};
+
+// Optimizes the children of `expr` before `expr` itself, so that constants
+// propagate upwards. Nodes are rewritten in place, which keeps the sibling
+// links of their parents intact.
+void Optimizer::Visit(uint32_t expr) {
+  for (uint32_t child = node(expr).first_child; child != Ast::kNone;
+       child = next(child)) {
+    Visit(child);
+  }
+  Expr& e = node(expr);
+  switch (e.type) {
+    case X_Negate: {
+      Value operand;
+      if (GetConstant(ast_, node(e.first_child), &operand)) {
+        SetNumber(e, -ToNumber(operand));
+      }
+      break;
+    }
+    case X_FunctionCall:
+      FoldFunction(e);
+      break;
+    case X_Path:
+      OptimizePath(e);
+      break;
+    default:
+      if (e.type >= X_Or && e.type < X_Union) FoldBinary(e);
+      break;
+  }
+}
+
+void Optimizer::FoldBinary(Expr& e) {
+  Value left, right;
+  bool left_is_constant = GetConstant(ast_, node(e.first_child), &left);
+  bool right_is_constant = GetConstant(ast_, node(next(e.first_child)),
+                                       &right);
+  if (e.type == X_Or || e.type == X_And) {
+    // The right operand does not matter if the left one decides the result,
+    // in which case it is not evaluated and cannot fail either. It is kept
+    // if it has calls that Compile() rejects, so that they are still
+    // reported.
+    if (left_is_constant && ToBoolean(left) == (e.type == X_Or)) {
+      if (!HasInvalidCall(next(e.first_child))) SetBoolean(e, e.type == X_Or);
+    } else if (left_is_constant && right_is_constant) {
+      SetBoolean(e, ToBoolean(right));
+    }
+    return;
+  }
+  if (!left_is_constant || !right_is_constant) return;
+  if (e.type <= X_GreaterEqual) {
+    SetBoolean(e, Compare(e.type, left, right));
+  } else {
+    SetNumber(e, Arithmetic(e.type, ToNumber(left), ToNumber(right)));
+  }
+}
+
+void Optimizer::FoldFunction(Expr& e) {
+  FunctionName function = e.function;
+  uint32_t arg = e.first_child;
+  Value value;
+  switch (function) {
+    case F_True:
+    case F_False:
+      if (arg == Ast::kNone) SetBoolean(e, function == F_True);
+      break;
+    case F_Not:
+    case F_Boolean:
+      if (arg != Ast::kNone && next(arg) == Ast::kNone &&
+          GetConstant(ast_, node(arg), &value)) {
+        SetBoolean(e, ToBoolean(value) == (function == F_Boolean));
+      }
+      break;
+    case F_Number:
+      if (arg != Ast::kNone && next(arg) == Ast::kNone &&
+          GetConstant(ast_, node(arg), &value)) {
+        SetNumber(e, ToNumber(value));
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void Optimizer::OptimizePath(Expr& path) {
+  for (uint32_t step = path.first_child; step != Ast::kNone;
+       step = next(step)) {
+    if (node(step).type == X_Step) RemoveTruePredicates(node(step));
+  }
+
+  // Merge descendant-or-self::node() with a following child step. This is
+  // only valid if the predicates of the child step do not depend on the
+  // position, since descendant::x[1] selects a single node while
+  // descendant-or-self::node()/child::x[1] selects the first x child of
+  // every node.
+  uint32_t previous = Ast::kNone;
+  for (uint32_t step = path.first_child; step != Ast::kNone;
+       step = next(step)) {
+    const Expr& s = node(step);
+    uint32_t following = s.next_sibling;
+    bool merge = s.type == X_Step && s.axis == A_DescendantOrSelf &&
+        s.node_type == N_Node && s.first_child == Ast::kNone &&
+        following != Ast::kNone && node(following).axis == A_Child;
+    for (uint32_t predicate = merge ? node(following).first_child
+                                    : Ast::kNone;
+         predicate != Ast::kNone; predicate = next(predicate)) {
+      if (IsPositionalPredicate(ast_, predicate)) merge = false;
+    }
+    if (!merge) {
+      previous = step;
+      continue;
+    }
+    node(following).axis = A_Descendant;
+    if (previous == Ast::kNone) {
+      path.first_child = following;
+    } else {
+      node(previous).next_sibling = following;
+    }
+  }
+
+  for (uint32_t step = path.first_child; step != Ast::kNone;
+       step = next(step)) {
+    Expr& s = node(step);
+    if (s.type == X_Step && s.first_child != Ast::kNone &&
+        IsFirstPosition(s.first_child)) {
+      s.first_only = true;
+      s.first_child = next(s.first_child);
+    }
+  }
+}
+
+void Optimizer::RemoveTruePredicates(Expr& step) {
+  uint32_t* link = &step.first_child;
+  while (*link != Ast::kNone) {
+    const Expr& predicate = node(*link);
+    if (predicate.type == X_Boolean && predicate.number != 0) {
+      *link = predicate.next_sibling;
+    } else {
+      link = &node(*link).next_sibling;
+    }
+  }
+}
+
+// Returns true for [1], [position() = 1] and [1 = position()].
+bool Optimizer::IsFirstPosition(uint32_t predicate) {
+  const Expr& e = node(predicate);
+  if (e.type == X_Number) return e.number == 1;
+  if (e.type != X_Equal) return false;
+  uint32_t left = e.first_child, right = next(left);
+  if (IsCall(right, F_Position)) std::swap(left, right);
+  return IsCall(left, F_Position) && node(right).type == X_Number &&
+      node(right).number == 1;
+}
+
+bool Optimizer::IsCall(uint32_t expr, FunctionName function) {
+  const Expr& e = node(expr);
+  return e.type == X_FunctionCall && e.first_child == Ast::kNone &&
+      e.function == function;
+}
+
+// Returns true if `expr` calls an unknown function, or one with the wrong
+// number of arguments.
+bool Optimizer::HasInvalidCall(uint32_t expr) {
+  const Expr& e = node(expr);
+  if (e.type == X_FunctionCall) {
+    size_t arg_count = 0;
+    for (uint32_t arg = e.first_child; arg != Ast::kNone; arg = next(arg)) {
+      ++arg_count;
+    }
+    if (!AcceptsArgumentCount(e.function, arg_count)) return true;
+  }
+  for (uint32_t child = e.first_child; child != Ast::kNone;
+       child = next(child)) {
+    if (HasInvalidCall(child)) return true;
+  }
+  return false;
+}
+
+void Optimize(Ast* ast) {
+  Optimizer optimizer(ast);
+  optimizer.Optimize();
+}
+
+}  // namespace xpath
@@ -0,0 +1,27 @@
+#ifndef XPATH_OPTIMIZER_INCLUDED
+#define XPATH_OPTIMIZER_INCLUDED
+
+#include "Parser.h"
+
+namespace xpath {
+
+// Rewrites a parsed expression in place into an equivalent one that is
+// cheaper to evaluate, for expressions that are evaluated many times. It
+//
+//   - folds arithmetic, comparisons, `and`, `or` and the functions true(),
+//     false(), not(), boolean() and number() whose operands are constants;
+//   - removes step predicates that are always true;
+//   - rewrites descendant-or-self::node()/child::x (that is, `//x`) as
+//     descendant::x, unless x has predicates that depend on the position;
+//   - replaces a leading [1] or [position() = 1] predicate of a step by
+//     Expr::first_only, so that evaluation stops at the first match.
+//
+// Evaluating the optimized expression gives the same result, and reports
+// errors at the same offsets. Calls that Compile() rejects are kept, even in
+// operands that are never evaluated, so it still rejects them. Removed nodes
+// stay in Ast::nodes(), but are no longer reachable from the root.
+void Optimize(Ast* ast);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_OPTIMIZER_INCLUDED */
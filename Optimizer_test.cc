@@ -0,0 +1,193 @@
+#include "Optimizer.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+using std::string;
+using std::unique_ptr;
+
+namespace xpath {
+namespace {
+
+string Optimized(const string& input) {
+  Ast ast;
+  size_t error_offset;
+  if (!Parse(input, &ast, &error_offset)) return "parse error";
+  Optimize(&ast);
+  return DebugString(ast);
+}
+
+TEST(Optimize, FoldsConstants) {
+  EXPECT_EQ("7", Optimized("1 + 2 * 3"));
+  EXPECT_EQ("-1", Optimized("-(3 mod 2)"));
+  EXPECT_EQ("3", Optimized("number('12') div 4"));
+  EXPECT_EQ("nan", Optimized("'a' + 1"));
+  EXPECT_EQ("true", Optimized("'a' = 'a'"));
+  EXPECT_EQ("false", Optimized("1 = '2'"));
+  EXPECT_EQ("true", Optimized("true() = 'x'"));
+  EXPECT_EQ("true", Optimized("not(1 = 2) and boolean('x')"));
+  EXPECT_EQ("(path (child::a (path (child::b))))", Optimized("a[2 > 1][b]"));
+  EXPECT_EQ("(+ $x 1)", Optimized("$x + (2 - 1)"));
+
+  // The right operand of `and` and `or` can be dropped only if it would not
+  // be evaluated.
+  EXPECT_EQ("true", Optimized("true() or $x"));
+  EXPECT_EQ("false", Optimized("0 and $x"));
+  EXPECT_EQ("(or $x true)", Optimized("$x or true()"));
+
+  // Calls that fail are kept, so that they still fail.
+  EXPECT_EQ("(foo() 1)", Optimized("foo(1)"));
+  EXPECT_EQ("(true() 1)", Optimized("true(1)"));
+  // Including in operands that are never evaluated, which Compile() still
+  // reports.
+  EXPECT_EQ("(or true (foo()))", Optimized("true() or foo()"));
+  EXPECT_EQ("(and false (not() (+ 1 (count()))))",
+            Optimized("false() and not(1 + count())"));
+  EXPECT_EQ("true", Optimized("true() or count(a)"));
+}
+
+TEST(Optimize, KeepsCompileErrors) {
+  for (const char* input : { "foo()", "true() or foo()", "0 and 1 + true(1)",
+                             "a[true() or not()]" }) {
+    SCOPED_TRACE(input);
+    Ast ast;
+    Program program;
+    size_t error_offset, optimized_error_offset;
+    ASSERT_TRUE(Parse(input, &ast, &error_offset));
+    EXPECT_FALSE(Compile(ast, &program, &error_offset));
+    Optimize(&ast);
+    EXPECT_FALSE(Compile(ast, &program, &optimized_error_offset));
+    EXPECT_EQ(error_offset, optimized_error_offset);
+  }
+}
+
+TEST(Optimize, MergesDescendantSteps) {
+  EXPECT_EQ("(/ (descendant::book))", Optimized("//book"));
+  EXPECT_EQ("(/ (descendant::book (path (attribute::id))))",
+            Optimized("//book[@id]"));
+  EXPECT_EQ("(path (child::a) (descendant::b (path (child::c first))))",
+            Optimized("a//b[c[1]]"));
+
+  // Positional predicates select among the children of each node.
+  EXPECT_EQ("(/ (descendant-or-self::node()) (child::book first))",
+            Optimized("//book[1]"));
+  EXPECT_EQ("(/ (descendant-or-self::node()) (child::book (last())))",
+            Optimized("//book[last()]"));
+  EXPECT_EQ("(/ (descendant-or-self::node()) (child::book "
+            "(and (> (position()) 1) (path (attribute::id)))))",
+            Optimized("//book[position() > 1 and @id]"));
+  EXPECT_EQ("(/ (descendant-or-self::node()) (child::book $n))",
+            Optimized("//book[$n]"));
+  EXPECT_EQ("(/ (descendant-or-self::node()) (child::book "
+            "(count() (path (child::author)))))",
+            Optimized("//book[count(author)]"));
+
+  // There is no descendant attribute axis.
+  EXPECT_EQ("(/ (descendant-or-self::node()) (attribute::id))",
+            Optimized("//@id"));
+}
+
+TEST(Optimize, MarksFirstMatch) {
+  EXPECT_EQ("(path (child::book first))", Optimized("book[1]"));
+  EXPECT_EQ("(path (child::book first (path (attribute::id))))",
+            Optimized("book[position() = 1][@id]"));
+  EXPECT_EQ("(path (preceding-sibling::* first))",
+            Optimized("preceding-sibling::*[true()][1 = position()]"));
+  EXPECT_EQ("(path (child::book (path (attribute::id)) 1))",
+            Optimized("book[@id][1]"));
+  EXPECT_EQ("(filter $x 1)", Optimized("$x[1]"));
+}
+
+const char* const kExpressions[] = {
+  "//book/@id", "//book[1]/@id", "//book[last()]/@id", "//*[2]",
+  "//book[@year > 2000]/@id", "//book[author][1]/@id", "//@name",
+  "//author[1]/@name", "//author[position() = 1]/@name",
+  "book[1]/following::*[1]", "//author[1]/ancestor::*[1]",
+  "//author/ancestor-or-self::*[1]", "//name/..", "book[3]/preceding::*[1]",
+  "book[3]/preceding-sibling::*[1]/@id", "book[1]/following-sibling::*[1]",
+  "shelf/descendant::*[1]", "descendant-or-self::node()[1]",
+  "//book[1]/self::book[1]", "//@year[1]", "/descendant::author[1]",
+  "book[true()][1]/@id", "book[1 + 1]/@id", "count(//book[1])",
+  "1 + 2 * 3", "'a' = 'a' and not(1 = 2)", "//book[position() > 1]/@id",
+  "(//book)[1]/@id", "$x + 1", "true() or $x", "false() and $x",
+  "foo(1 + 2)",
+};
+
+class OptimizeTest : public LibraryTest {
+ protected:
+  string Evaluate(const Ast& ast, uint32_t context) {
+    Value value;
+    size_t error_offset;
+    bool ok = evaluator_.Evaluate(ast, context, &value, &error_offset);
+    return ToString(ok, value, error_offset);
+  }
+
+  string Execute(const Ast& ast, uint32_t context) {
+    Program program;
+    Value value;
+    size_t error_offset;
+    bool ok = Compile(ast, &program, &error_offset) &&
+              evaluator_.Execute(program, context, &value, &error_offset);
+    return ToString(ok, value, error_offset);
+  }
+};
+
+TEST_P(OptimizeTest, PreservesResults) {
+  for (const char* input : kExpressions) {
+    SCOPED_TRACE(input);
+    Ast ast, optimized;
+    size_t error_offset;
+    ASSERT_TRUE(Parse(input, &ast, &error_offset));
+    optimized = ast;
+    Optimize(&optimized);
+    uint32_t book = document_.first_child(Document::kRoot);
+    for (uint32_t context : { Document::kRoot, book }) {
+      string expected = Evaluate(ast, context);
+      EXPECT_EQ(expected, Evaluate(optimized, context));
+      EXPECT_EQ(expected, Execute(optimized, context));
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(OrderIndex, OptimizeTest, ::testing::Bool());
+
+TEST(Optimize, StopsAtFirstMatch) {
+  string text;
+  for (int i = 0; i < 100; ++i) {
+    text += "item { id: '" + std::to_string(i) + "' part { name: 'p' } } ";
+  }
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(text);
+  Ast ast, optimized;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("/descendant::part[1]/@name", &ast, &error_offset));
+  optimized = ast;
+  Optimize(&optimized);
+
+  Program program;
+  ASSERT_TRUE(Compile(ast, &program, &error_offset));
+  Document document(*message);
+  Evaluator evaluator(&document);
+  Value value;
+  ASSERT_TRUE(evaluator.Execute(program, &value, &error_offset));
+  size_t expanded = document.node_count();
+
+  Document lazy_document(*message);
+  Evaluator lazy_evaluator(&lazy_document);
+  Value lazy_value;
+  ASSERT_TRUE(lazy_evaluator.Evaluate(optimized, &lazy_value, &error_offset));
+  EXPECT_EQ(1u, lazy_value.nodes.size());
+  EXPECT_EQ(lazy_document.StringValue(lazy_value.nodes[0]),
+            document.StringValue(value.nodes[0]));
+  // Without the optimization, the compiled program searches every item; with
+  // it, only the first one is (the root, its 100 items, and the id, part and
+  // name of the first item).
+  EXPECT_EQ(401u, expanded);
+  EXPECT_EQ(104u, lazy_document.node_count());
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,90 @@
+#include "ParallelFor.h"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xpath {
+
+namespace {
+
+// The range of indices [begin, end) that remains to be processed by a worker.
+// Aligned to avoid false sharing between workers.
+struct alignas(64) WorkRange {
+  std::mutex mutex;
+  size_t begin;
+  size_t end;
+};
+
+// Takes the next index from the worker's own range. Returns false if the
+// range is empty.
+bool TakeOwn(WorkRange& range, size_t* index) {
+  std::lock_guard<std::mutex> lock(range.mutex);
+  if (range.begin == range.end) return false;
+  *index = range.begin++;
+  return true;
+}
+
+// Moves the upper half of another worker's remaining range into `own`.
+// Returns false if all other ranges are empty.
+bool Steal(std::vector<WorkRange>& ranges, int worker) {
+  int num_workers = ranges.size();
+  for (int i = 1; i < num_workers; ++i) {
+    WorkRange& victim = ranges[(worker + i) % num_workers];
+    size_t begin, end;
+    {
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      size_t remaining = victim.end - victim.begin;
+      if (remaining == 0) continue;
+      end = victim.end;
+      begin = victim.end -= (remaining + 1) / 2;
+    }
+    WorkRange& own = ranges[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.begin = begin;
+    own.end = end;
+    return true;
+  }
+  return false;
+}
+
+void RunWorker(std::vector<WorkRange>& ranges, int worker,
+               const std::function<void(int, size_t)>& body) {
+  size_t index;
+  do {
+    while (TakeOwn(ranges[worker], &index)) body(worker, index);
+  } while (Steal(ranges, worker));
+}
+
+}  // namespace
+
+int ParallelForWorkers(size_t count, int num_threads) {
+  if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+  if (num_threads <= 0) num_threads = 1;
+  if (size_t(num_threads) > count) num_threads = count > 0 ? count : 1;
+  return num_threads;
+}
+
+void ParallelFor(size_t count, int num_threads,
+                 const std::function<void(int worker, size_t index)>& body) {
+  int num_workers = ParallelForWorkers(count, num_threads);
+  if (num_workers == 1) {
+    for (size_t i = 0; i < count; ++i) body(0, i);
+    return;
+  }
+  std::vector<WorkRange> ranges(num_workers);
+  for (int i = 0; i < num_workers; ++i) {
+    ranges[i].begin = count * i / num_workers;
+    ranges[i].end = count * (i + 1) / num_workers;
+  }
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_workers; ++i) {
+    threads.push_back(std::thread(
+        [&ranges, &body, i]() { RunWorker(ranges, i, body); }));
+  }
+  RunWorker(ranges, 0, body);
+  for (auto& thread : threads) thread.join();
+}
+
+}  // namespace xpath
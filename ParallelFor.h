@@ -0,0 +1,30 @@
+#ifndef XPATH_PARALLEL_FOR_INCLUDED
+#define XPATH_PARALLEL_FOR_INCLUDED
+
+#include <stdlib.h>
+#include <functional>
+
+namespace xpath {
+
+// Calls `body(worker, index)` once for every index in [0, count), distributed
+// over at most `num_threads` threads, and returns when all calls have
+// finished. `worker` identifies the thread (from 0 to num_threads - 1) so
+// that callers can keep per-thread state without locking. If `num_threads` is
+// 0, the number of hardware threads is used.
+//
+// Each thread starts with an equal contiguous range of indices. A thread that
+// runs out of work steals the upper half of the remaining range of another
+// thread, so a few expensive items do not hold up the rest of the work.
+//
+// The calling thread acts as worker 0, so with a single thread (or a single
+// item) no threads are started at all.
+void ParallelFor(size_t count, int num_threads,
+                 const std::function<void(int worker, size_t index)>& body);
+
+// Returns the number of workers that ParallelFor() uses for the given
+// arguments, which callers can use to size their per-worker state.
+int ParallelForWorkers(size_t count, int num_threads);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_PARALLEL_FOR_INCLUDED */
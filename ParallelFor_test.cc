@@ -0,0 +1,53 @@
+#include "ParallelFor.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+namespace xpath {
+namespace {
+
+TEST(ParallelFor, VisitsEveryIndexOnce) {
+  for (int num_threads : {1, 2, 3, 8}) {
+    for (size_t count : {0, 1, 2, 7, 1000}) {
+      vector<std::atomic<int>> visits(count);
+      for (auto& v : visits) v = 0;
+      ParallelFor(count, num_threads, [&](int worker, size_t i) {
+        EXPECT_GE(worker, 0);
+        EXPECT_LT(worker, ParallelForWorkers(count, num_threads));
+        ++visits[i];
+      });
+      for (size_t i = 0; i < count; ++i) {
+        EXPECT_EQ(1, visits[i]) << num_threads << " " << count << " " << i;
+      }
+    }
+  }
+}
+
+TEST(ParallelFor, Workers) {
+  EXPECT_EQ(1, ParallelForWorkers(0, 4));
+  EXPECT_EQ(2, ParallelForWorkers(2, 4));
+  EXPECT_EQ(4, ParallelForWorkers(100, 4));
+  EXPECT_GE(ParallelForWorkers(100, 0), 1);
+}
+
+TEST(ParallelFor, StealsWork) {
+  // Worker 0 starts with the slow item at index 0. The other worker should
+  // steal the remaining items in worker 0's range instead of waiting.
+  vector<int> worker_of(100, -1);
+  ParallelFor(100, 2, [&](int worker, size_t i) {
+    if (i == 0) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    worker_of[i] = worker;
+  });
+  EXPECT_EQ(0, worker_of[0]);
+  int stolen = 0;
+  for (size_t i = 1; i < 50; ++i) stolen += worker_of[i] == 1;
+  EXPECT_GT(stolen, 0);
+}
+
+}  // namespace
+}  // namespace xpath
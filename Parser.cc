@@ -0,0 +1,640 @@
+// XPath parser.
+// Based on: http://www.w3.org/TR/xpath/#section-Expressions
+
+#include "Parser.h"
+#include "CLocale.h"
+#include "Profile.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+namespace xpath {
+
+const uint32_t Ast::kNone;
+
+namespace {
+
+// Maximum nesting depth of expressions (parentheses, predicates and function
+// arguments), to protect against stack overflow on malicious input.
+const int kMaxDepth = 200;
+
+// Maximum depth of the parsed tree, which also grows with chains of binary
+// operators and negations. Evaluate(), Compile(), Optimize() and
+// DebugString() recurse once per level.
+const int kMaxAstDepth = 1000;
+
+const uint32_t kNone = Ast::kNone;
+
+bool StartsStep(TokenType type) {
+  return type == T_AxisName || type == T_At || type == T_Dot ||
+         type == T_DoubleDot || type == T_NameTest || type == T_NodeType;
+}
+
+// Converts the decimal number described by `data` and `size`, which must have
+// been scanned as T_Number, to a double.
+double ParseNumber(const char* data, size_t size) {
+  // strtod() requires a null-terminated string, and would accept exponents
+  // and hexadecimal digits that are not part of the token, so copy it first.
+  char buf[64];
+  if (size < sizeof(buf)) {
+    memcpy(buf, data, size);
+    buf[size] = '\0';
+    return StrtodC(buf, nullptr);
+  }
+  return StrtodC(std::string(data, size).c_str(), nullptr);
+}
+
+}  // namespace
+
+class Parser {
+ public:
+  Parser(const char* data, size_t size, Ast* ast)
+      : size_(size), stream_(data, size), ast_(*ast), depth_(0),
+        error_offset_(size) {
+    ast_.Clear();
+    ast_.source_.assign(data, size);
+  }
+
+  bool Parse(size_t* error_offset);
+
+ private:
+  uint32_t ParseExpr();
+  uint32_t ParseOrExpr();
+  uint32_t ParseAndExpr();
+  uint32_t ParseEqualityExpr();
+  uint32_t ParseRelationalExpr();
+  uint32_t ParseAdditiveExpr();
+  uint32_t ParseMultiplicativeExpr();
+  uint32_t ParseUnaryExpr();
+  uint32_t ParseUnionExpr();
+  uint32_t ParsePathExpr();
+  uint32_t ParseFilterExpr();
+  uint32_t ParsePrimaryExpr();
+  uint32_t ParseFunctionCall();
+  uint32_t ParseStep();
+  uint32_t ParsePredicate();
+  bool ParseSteps(uint32_t path, uint32_t* last_child);
+  bool CheckDepth(uint32_t root);
+
+  const Token& Peek() const { return stream_.Peek(); }
+  bool PeekOperator(OperatorName name) const {
+    return Peek().type == T_OperatorName &&
+           ParseOperatorName(ast_.source_.data() + Peek().offset,
+                             Peek().size) == name;
+  }
+  Token Consume() {
+    Token token;
+    bool success = stream_.Next(&token);
+    assert(success);
+    (void)success;
+    return token;
+  }
+  bool Expect(TokenType type) {
+    if (Peek().type != type) return Fail();
+    Consume();
+    return true;
+  }
+  bool Fail() {
+    error_offset_ = Peek().offset;
+    return false;
+  }
+
+  Expr& node(uint32_t i) { return ast_.nodes_[i]; }
+  uint32_t Add(ExprType type, uint32_t first_child = kNone);
+  uint32_t AddBinary(ExprType type, uint32_t left, uint32_t right,
+                     size_t offset);
+  uint32_t AddStep(AxisName axis, NodeType node_type);
+  void SetText(uint32_t i, size_t offset, size_t size);
+  void AppendChild(uint32_t parent, uint32_t* last_child, uint32_t child);
+
+  size_t size_;
+  TokenStream stream_;
+  Ast& ast_;
+  int depth_;
+  size_t error_offset_;
+};
+
+uint32_t Parser::Add(ExprType type, uint32_t first_child) {
+  Expr expr = {type, A_None, N_None, F_None, false, false, first_child, kNone,
+               0, 0, 0.0};
+  ast_.nodes_.push_back(expr);
+  return ast_.nodes_.size() - 1;
+}
+
+uint32_t Parser::AddBinary(ExprType type, uint32_t left, uint32_t right,
+                           size_t offset) {
+  node(left).next_sibling = right;
+  uint32_t expr = Add(type, left);
+  SetText(expr, offset, 0);
+  return expr;
+}
+
+uint32_t Parser::AddStep(AxisName axis, NodeType node_type) {
+  uint32_t step = Add(X_Step);
+  node(step).axis = axis;
+  node(step).node_type = node_type;
+  return step;
+}
+
+void Parser::SetText(uint32_t i, size_t offset, size_t size) {
+  node(i).text_offset = offset;
+  node(i).text_size = size;
+}
+
+void Parser::AppendChild(uint32_t parent, uint32_t* last_child, uint32_t child) {
+  if (*last_child == kNone) {
+    node(parent).first_child = child;
+  } else {
+    node(*last_child).next_sibling = child;
+  }
+  *last_child = child;
+}
+
+bool Parser::Parse(size_t* error_offset) {
+  XPATH_PROFILE_PHASE(P_Parse);
+  uint32_t root = ParseExpr();
+  if (root != kNone && Peek().type != T_None) root = kNone, Fail();
+  if (root != kNone && stream_.error_offset() != size_) root = kNone, Fail();
+  if (root != kNone && !CheckDepth(root)) root = kNone;
+  if (root == kNone) {
+    ast_.nodes_.clear();
+    *error_offset = error_offset_;
+    return false;
+  }
+  ast_.root_ = root;
+  return true;
+}
+
+// Returns false, with the offset of the first node found below the limit,
+// if the tree of `root` is deeper than kMaxAstDepth.
+bool Parser::CheckDepth(uint32_t root) {
+  std::vector<std::pair<uint32_t, int>> stack(1, std::make_pair(root, 1));
+  while (!stack.empty()) {
+    uint32_t expr = stack.back().first;
+    int depth = stack.back().second;
+    stack.pop_back();
+    if (depth > kMaxAstDepth) {
+      error_offset_ = node(expr).text_offset;
+      return false;
+    }
+    for (uint32_t child = node(expr).first_child; child != kNone;
+         child = node(child).next_sibling) {
+      stack.push_back(std::make_pair(child, depth + 1));
+    }
+  }
+  return true;
+}
+
+// Expr ::= OrExpr
+uint32_t Parser::ParseExpr() {
+  if (depth_ == kMaxDepth) return Fail(), kNone;
+  ++depth_;
+  uint32_t expr = ParseOrExpr();
+  --depth_;
+  return expr;
+}
+
+// OrExpr ::= AndExpr | OrExpr 'or' AndExpr
+uint32_t Parser::ParseOrExpr() {
+  uint32_t left = ParseAndExpr();
+  while (left != kNone && PeekOperator(O_Or)) {
+    size_t offset = Consume().offset;
+    uint32_t right = ParseAndExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(X_Or, left, right, offset);
+  }
+  return left;
+}
+
+// AndExpr ::= EqualityExpr | AndExpr 'and' EqualityExpr
+uint32_t Parser::ParseAndExpr() {
+  uint32_t left = ParseEqualityExpr();
+  while (left != kNone && PeekOperator(O_And)) {
+    size_t offset = Consume().offset;
+    uint32_t right = ParseEqualityExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(X_And, left, right, offset);
+  }
+  return left;
+}
+
+// EqualityExpr ::= RelationalExpr | EqualityExpr ('=' | '!=') RelationalExpr
+uint32_t Parser::ParseEqualityExpr() {
+  uint32_t left = ParseRelationalExpr();
+  while (left != kNone) {
+    ExprType type;
+    switch (Peek().type) {
+      case T_Equal: type = X_Equal; break;
+      case T_NotEqual: type = X_NotEqual; break;
+      default: return left;
+    }
+    size_t offset = Consume().offset;
+    uint32_t right = ParseRelationalExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(type, left, right, offset);
+  }
+  return left;
+}
+
+// RelationalExpr ::= AdditiveExpr
+//                  | RelationalExpr ('<' | '>' | '<=' | '>=') AdditiveExpr
+uint32_t Parser::ParseRelationalExpr() {
+  uint32_t left = ParseAdditiveExpr();
+  while (left != kNone) {
+    ExprType type;
+    switch (Peek().type) {
+      case T_LessThan: type = X_LessThan; break;
+      case T_LessEqual: type = X_LessEqual; break;
+      case T_GreaterThan: type = X_GreaterThan; break;
+      case T_GreaterEqual: type = X_GreaterEqual; break;
+      default: return left;
+    }
+    size_t offset = Consume().offset;
+    uint32_t right = ParseAdditiveExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(type, left, right, offset);
+  }
+  return left;
+}
+
+// AdditiveExpr ::= MultiplicativeExpr
+//                | AdditiveExpr ('+' | '-') MultiplicativeExpr
+uint32_t Parser::ParseAdditiveExpr() {
+  uint32_t left = ParseMultiplicativeExpr();
+  while (left != kNone) {
+    ExprType type;
+    switch (Peek().type) {
+      case T_Plus: type = X_Plus; break;
+      case T_Minus: type = X_Minus; break;
+      default: return left;
+    }
+    size_t offset = Consume().offset;
+    uint32_t right = ParseMultiplicativeExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(type, left, right, offset);
+  }
+  return left;
+}
+
+// MultiplicativeExpr ::= UnaryExpr
+//                      | MultiplicativeExpr ('*' | 'div' | 'mod') UnaryExpr
+uint32_t Parser::ParseMultiplicativeExpr() {
+  uint32_t left = ParseUnaryExpr();
+  while (left != kNone) {
+    ExprType type;
+    if (Peek().type == T_Multiply) {
+      type = X_Multiply;
+    } else if (PeekOperator(O_Div)) {
+      type = X_Div;
+    } else if (PeekOperator(O_Mod)) {
+      type = X_Mod;
+    } else {
+      return left;
+    }
+    size_t offset = Consume().offset;
+    uint32_t right = ParseUnaryExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(type, left, right, offset);
+  }
+  return left;
+}
+
+// UnaryExpr ::= UnionExpr | '-' UnaryExpr
+uint32_t Parser::ParseUnaryExpr() {
+  std::vector<size_t> offsets;
+  while (Peek().type == T_Minus) offsets.push_back(Consume().offset);
+  uint32_t expr = ParseUnionExpr();
+  while (expr != kNone && !offsets.empty()) {
+    expr = Add(X_Negate, expr);
+    SetText(expr, offsets.back(), 0);
+    offsets.pop_back();
+  }
+  return expr;
+}
+
+// UnionExpr ::= PathExpr | UnionExpr '|' PathExpr
+uint32_t Parser::ParseUnionExpr() {
+  uint32_t left = ParsePathExpr();
+  while (left != kNone && Peek().type == T_Pipe) {
+    size_t offset = Consume().offset;
+    uint32_t right = ParsePathExpr();
+    if (right == kNone) return kNone;
+    left = AddBinary(X_Union, left, right, offset);
+  }
+  return left;
+}
+
+// PathExpr ::= LocationPath
+//            | FilterExpr
+//            | FilterExpr '/' RelativeLocationPath
+//            | FilterExpr '//' RelativeLocationPath
+uint32_t Parser::ParsePathExpr() {
+  uint32_t path, last_child = kNone;
+  size_t offset = Peek().offset;
+  TokenType type = Peek().type;
+  if (type == T_Slash || type == T_DoubleSlash) {
+    // AbsoluteLocationPath ::= '/' RelativeLocationPath?
+    //                        | '//' RelativeLocationPath
+    path = Add(X_Path);
+    SetText(path, offset, 0);
+    node(path).absolute = true;
+    if (type == T_Slash) {
+      Consume();
+      if (StartsStep(Peek().type) && !ParseSteps(path, &last_child)) return kNone;
+      return path;
+    }
+  } else if (StartsStep(type)) {
+    path = Add(X_Path);
+    SetText(path, offset, 0);
+    if (!ParseSteps(path, &last_child)) return kNone;
+    return path;
+  } else {
+    uint32_t filter = ParseFilterExpr();
+    if (filter == kNone) return kNone;
+    type = Peek().type;
+    if (type != T_Slash && type != T_DoubleSlash) return filter;
+    path = Add(X_Path);
+    SetText(path, offset, 0);
+    AppendChild(path, &last_child, filter);
+  }
+  // Parse the remainder of the path, which starts with '/' or '//'.
+  return ParseSteps(path, &last_child) ? path : kNone;
+}
+
+// Parses a RelativeLocationPath, optionally preceded by '/' or '//', and
+// appends the steps to `path`.
+//
+// RelativeLocationPath ::= Step
+//                        | RelativeLocationPath '/' Step
+//                        | RelativeLocationPath '//' Step
+bool Parser::ParseSteps(uint32_t path, uint32_t* last_child) {
+  TokenType type = Peek().type;
+  if (type != T_Slash && type != T_DoubleSlash) {
+    uint32_t step = ParseStep();
+    if (step == kNone) return false;
+    AppendChild(path, last_child, step);
+  }
+  while ((type = Peek().type) == T_Slash || type == T_DoubleSlash) {
+    size_t offset = Consume().offset;
+    if (type == T_DoubleSlash) {
+      // '//' is short for '/descendant-or-self::node()/'
+      uint32_t step = AddStep(A_DescendantOrSelf, N_Node);
+      SetText(step, offset, 0);
+      AppendChild(path, last_child, step);
+    }
+    uint32_t step = ParseStep();
+    if (step == kNone) return false;
+    AppendChild(path, last_child, step);
+  }
+  return true;
+}
+
+// Step ::= AxisSpecifier NodeTest Predicate* | '.' | '..'
+// AxisSpecifier ::= AxisName '::' | '@'?
+// NodeTest ::= NameTest | NodeType '(' ')'
+//            | 'processing-instruction' '(' Literal ')'
+uint32_t Parser::ParseStep() {
+  size_t offset = Peek().offset;
+  uint32_t step;
+  switch (Peek().type) {
+    case T_Dot:
+      Consume();
+      step = AddStep(A_Self, N_Node);
+      SetText(step, offset, 0);
+      return step;
+    case T_DoubleDot:
+      Consume();
+      step = AddStep(A_Parent, N_Node);
+      SetText(step, offset, 0);
+      return step;
+    default:
+      break;
+  }
+
+  AxisName axis = A_Child;
+  if (Peek().type == T_At) {
+    Consume();
+    axis = A_Attribute;
+  } else if (Peek().type == T_AxisName) {
+    axis = ParseAxisName(ast_.source_.data() + Peek().offset, Peek().size);
+    if (axis == A_None) return Fail(), kNone;
+    Consume();
+    if (!Expect(T_DoubleColon)) return kNone;
+  }
+
+  if (Peek().type == T_NameTest) {
+    Token token = Consume();
+    step = AddStep(axis, N_None);
+    SetText(step, token.offset, token.size);
+  } else if (Peek().type == T_NodeType) {
+    NodeType node_type = ParseNodeType(
+        ast_.source_.data() + Peek().offset, Peek().size);
+    if (node_type == N_None) return Fail(), kNone;
+    Consume();
+    if (!Expect(T_LeftParen)) return kNone;
+    step = AddStep(axis, node_type);
+    SetText(step, offset, 0);
+    if (node_type == N_ProcessingInstruction && Peek().type == T_Literal) {
+      Token token = Consume();
+      SetText(step, token.offset + 1, token.size - 2);
+    }
+    if (!Expect(T_RightParen)) return kNone;
+  } else {
+    return Fail(), kNone;
+  }
+
+  uint32_t last_child = kNone;
+  while (Peek().type == T_LeftBracket) {
+    uint32_t predicate = ParsePredicate();
+    if (predicate == kNone) return kNone;
+    AppendChild(step, &last_child, predicate);
+  }
+  return step;
+}
+
+// Predicate ::= '[' PredicateExpr ']'
+// PredicateExpr ::= Expr
+uint32_t Parser::ParsePredicate() {
+  if (!Expect(T_LeftBracket)) return kNone;
+  uint32_t expr = ParseExpr();
+  if (expr == kNone || !Expect(T_RightBracket)) return kNone;
+  return expr;
+}
+
+// FilterExpr ::= PrimaryExpr | FilterExpr Predicate
+uint32_t Parser::ParseFilterExpr() {
+  size_t offset = Peek().offset;
+  uint32_t primary = ParsePrimaryExpr();
+  if (primary == kNone || Peek().type != T_LeftBracket) return primary;
+  uint32_t filter = Add(X_Filter, primary);
+  SetText(filter, offset, 0);
+  uint32_t last_child = primary;
+  while (Peek().type == T_LeftBracket) {
+    uint32_t predicate = ParsePredicate();
+    if (predicate == kNone) return kNone;
+    AppendChild(filter, &last_child, predicate);
+  }
+  return filter;
+}
+
+// PrimaryExpr ::= VariableReference | '(' Expr ')' | Literal | Number
+//               | FunctionCall
+uint32_t Parser::ParsePrimaryExpr() {
+  uint32_t expr;
+  switch (Peek().type) {
+    case T_VariableReference: {
+      Token token = Consume();
+      expr = Add(X_VariableReference);
+      SetText(expr, token.offset + 1, token.size - 1);
+      return expr;
+    }
+    case T_LeftParen:
+      Consume();
+      expr = ParseExpr();
+      if (expr == kNone || !Expect(T_RightParen)) return kNone;
+      return expr;
+    case T_Literal: {
+      Token token = Consume();
+      expr = Add(X_Literal);
+      SetText(expr, token.offset + 1, token.size - 2);
+      return expr;
+    }
+    case T_Number: {
+      Token token = Consume();
+      expr = Add(X_Number);
+      SetText(expr, token.offset, token.size);
+      node(expr).number = ParseNumber(
+          ast_.source_.data() + token.offset, token.size);
+      return expr;
+    }
+    case T_FunctionName:
+      return ParseFunctionCall();
+    default:
+      return Fail(), kNone;
+  }
+}
+
+// FunctionCall ::= FunctionName '(' ( Argument ( ',' Argument )* )? ')'
+// Argument ::= Expr
+uint32_t Parser::ParseFunctionCall() {
+  Token token = Consume();
+  uint32_t call = Add(X_FunctionCall);
+  SetText(call, token.offset, token.size);
+  node(call).function =
+      ParseFunctionName(ast_.source_.data() + token.offset, token.size);
+  if (!Expect(T_LeftParen)) return kNone;
+  if (Peek().type != T_RightParen) {
+    uint32_t last_child = kNone;
+    for (;;) {
+      uint32_t argument = ParseExpr();
+      if (argument == kNone) return kNone;
+      AppendChild(call, &last_child, argument);
+      if (Peek().type != T_Comma) break;
+      Consume();
+    }
+  }
+  return Expect(T_RightParen) ? call : kNone;
+}
+
+bool Parse(const char* data, size_t size, Ast* ast, size_t* error_offset) {
+  return Parser(data, size, ast).Parse(error_offset);
+}
+
+ExprType SwapOperands(ExprType op) {
+  switch (op) {
+    case X_LessThan: return X_GreaterThan;
+    case X_LessEqual: return X_GreaterEqual;
+    case X_GreaterThan: return X_LessThan;
+    case X_GreaterEqual: return X_LessEqual;
+    default: return op;
+  }
+}
+
+namespace {
+
+const char* const kExprTypeNames[] = {
+  "", "or", "and", "=", "!=", "<", "<=", ">", ">=", "+", "-", "*", "div",
+  "mod", "|", "neg", "literal", "number", "boolean", "var", "call", "filter",
+  "path", "step" };
+
+const char* const kAxisNames[] = {
+  "", "ancestor", "ancestor-or-self", "attribute", "child", "descendant",
+  "descendant-or-self", "following", "following-sibling", "namespace",
+  "parent", "preceding", "preceding-sibling", "self" };
+
+const char* const kNodeTypeNames[] = {
+  "", "comment", "text", "processing-instruction", "node" };
+
+void AppendDebugString(const Ast& ast, uint32_t i, std::string* out) {
+  const Expr& expr = ast.node(i);
+  switch (expr.type) {
+    case X_Literal:
+      *out += '\'';
+      out->append(ast.text_data(expr), expr.text_size);
+      *out += '\'';
+      return;
+    case X_Number: {
+      char buf[32];
+      SnprintfC(buf, sizeof(buf), "%g", expr.number);
+      *out += buf;
+      return;
+    }
+    case X_Boolean:
+      *out += expr.number != 0 ? "true" : "false";
+      return;
+    case X_VariableReference:
+      *out += '$';
+      out->append(ast.text_data(expr), expr.text_size);
+      return;
+    case X_FunctionCall:
+      *out += '(';
+      out->append(ast.text_data(expr), expr.text_size);
+      *out += "()";
+      break;
+    case X_Path:
+      *out += expr.absolute ? "(/" : "(path";
+      break;
+    case X_Step:
+      *out += '(';
+      *out += kAxisNames[expr.axis];
+      *out += "::";
+      if (expr.node_type == N_None) {
+        out->append(ast.text_data(expr), expr.text_size);
+      } else {
+        *out += kNodeTypeNames[expr.node_type];
+        *out += '(';
+        if (expr.text_size > 0) {
+          *out += '\'';
+          out->append(ast.text_data(expr), expr.text_size);
+          *out += '\'';
+        }
+        *out += ')';
+      }
+      if (expr.first_only) *out += " first";
+      break;
+    default:
+      *out += '(';
+      *out += kExprTypeNames[expr.type];
+      break;
+  }
+  for (uint32_t child = expr.first_child; child != Ast::kNone;
+       child = ast.node(child).next_sibling) {
+    *out += ' ';
+    AppendDebugString(ast, child, out);
+  }
+  *out += ')';
+}
+
+}  // namespace
+
+std::string DebugString(const Ast& ast, uint32_t root) {
+  std::string result;
+  AppendDebugString(ast, root, &result);
+  return result;
+}
+
+}  // namespace xpath
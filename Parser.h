@@ -0,0 +1,167 @@
+#ifndef XPATH_PARSER_INCLUDED
+#define XPATH_PARSER_INCLUDED
+
+#include "Functions.h"
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+enum ExprType {
+  X_None = 0,
+
+  // Binary operators. The two operands are the first and second child.
+  X_Or,
+  X_And,
+  X_Equal,
+  X_NotEqual,
+  X_LessThan,
+  X_LessEqual,
+  X_GreaterThan,
+  X_GreaterEqual,
+  X_Plus,
+  X_Minus,
+  X_Multiply,
+  X_Div,
+  X_Mod,
+  X_Union,
+
+  // Unary minus. The operand is the only child.
+  X_Negate,
+
+  // String literal. The text is the value of the literal, without quotes.
+  X_Literal,
+
+  // Number. The value is stored in Expr::number.
+  X_Number,
+
+  // Boolean constant, which is only produced by Optimize(). Expr::number is
+  // 1 for true and 0 for false.
+  X_Boolean,
+
+  // Variable reference. The text is the variable name, without '$'.
+  X_VariableReference,
+
+  // Function call. The text is the function name, Expr::function is the core
+  // function that it names (or F_None), and the arguments are the children,
+  // in order.
+  X_FunctionCall,
+
+  // Filter expression. The first child is a primary expression, and the
+  // remaining children are predicates.
+  X_Filter,
+
+  // Location path. If Expr::absolute is set, the path starts at the root node,
+  // and all children are X_Step nodes. Otherwise, the first child may be a
+  // filter or primary expression (e.g. in `$x/foo`) that selects the initial
+  // node-set, followed by one or more X_Step nodes.
+  X_Path,
+
+  // Location step. Expr::axis is the axis, Expr::node_type is the node type
+  // test (or N_None for a name test, in which case the text is the name or "*")
+  // and the children are predicates. For processing-instruction() tests, the
+  // text is the literal argument, if any. If Expr::first_only is set, only
+  // the first node selected by the node test (in the order of the axis) is
+  // kept, before the predicates are applied.
+  X_Step };
+
+// Returns the comparison operator that gives the same result with swapped
+// operands (e.g. X_GreaterThan for X_LessThan). Other operators are
+// returned unchanged.
+ExprType SwapOperands(ExprType op);
+
+// An expression node in a parsed expression. Nodes refer to each other by
+// index in Ast::nodes(); the children of a node are linked through
+// `next_sibling`, starting at `first_child`.
+//
+// `text_offset` and `text_size` describe the text of the node in the source.
+// Nodes without text (such as operators and paths) have `text_size` zero, and
+// `text_offset` set to the position of the expression in the source, which is
+// used to report evaluation errors.
+struct Expr {
+  ExprType type;
+  AxisName axis;
+  NodeType node_type;
+  FunctionName function;
+  bool absolute;
+  bool first_only;
+  uint32_t first_child;
+  uint32_t next_sibling;
+  uint32_t text_offset;
+  uint32_t text_size;
+  double number;
+};
+
+// A parsed XPath expression. All nodes are stored in a single contiguous
+// vector, and text is referenced by offset into a private copy of the source,
+// so an Ast is cheap to copy or free and does not depend on the parser input.
+class Ast {
+ public:
+  // Index value used to indicate the absence of a node.
+  static const uint32_t kNone = 0xffffffffu;
+
+  Ast() : root_(kNone) {}
+
+  // Index of the root expression, or kNone if nothing has been parsed.
+  uint32_t root() const { return root_; }
+
+  const std::vector<Expr>& nodes() const { return nodes_; }
+  const Expr& node(uint32_t i) const { return nodes_[i]; }
+
+  // The source text the expression was parsed from.
+  const std::string& source() const { return source_; }
+
+  // Returns the text associated with the given node.
+  const char* text_data(const Expr& expr) const {
+    return source_.data() + expr.text_offset;
+  }
+  std::string text(const Expr& expr) const {
+    return source_.substr(expr.text_offset, expr.text_size);
+  }
+
+  // Removes all nodes, but keeps allocated memory for reuse.
+  void Clear() {
+    nodes_.clear();
+    source_.clear();
+    root_ = kNone;
+  }
+
+ private:
+  friend class Optimizer;
+  friend class Parser;
+
+  std::vector<Expr> nodes_;
+  std::string source_;
+  uint32_t root_;
+};
+
+// Parses the XPath expression described by `data` and `size` into *ast.
+//
+// If the input is a valid expression, this function returns true. Otherwise,
+// it returns false and sets *error_offset to the index in the input where the
+// error occurred. This is the same index that Tokenize() returns when scanning
+// fails; for syntax errors it is the offset of the unexpected token (which is
+// `size` if the input ended prematurely). Expressions that nest or chain
+// operators too deeply for the recursive tree walkers are also rejected.
+//
+// Parsing into an Ast that was used before reuses its memory.
+bool Parse(const char* data, size_t size, Ast* ast, size_t* error_offset);
+
+inline bool Parse(const std::string& input, Ast* ast, size_t* error_offset) {
+  return Parse(input.data(), input.size(), ast, error_offset);
+}
+
+// Returns a human-readable representation of the expression tree rooted at
+// `root`, as a parenthesized prefix expression. Mainly useful for testing.
+std::string DebugString(const Ast& ast, uint32_t root);
+
+inline std::string DebugString(const Ast& ast) {
+  return ast.root() == Ast::kNone ? std::string() : DebugString(ast, ast.root());
+}
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_PARSER_INCLUDED */
@@ -0,0 +1,207 @@
+#include "Parser.h"
+#include "TestUtil.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+
+using std::string;
+
+namespace xpath {
+namespace {
+
+void TestParse(const string& input, const string& expected) {
+  Ast ast;
+  size_t error_offset = 1234567;
+  EXPECT_TRUE(Parse(input, &ast, &error_offset)) << input;
+  EXPECT_EQ(1234567, error_offset) << input;
+  EXPECT_EQ(expected, DebugString(ast)) << input;
+}
+
+void TestParseError(const string& input, size_t expected_error_offset) {
+  Ast ast;
+  size_t error_offset = 1234567;
+  EXPECT_FALSE(Parse(input, &ast, &error_offset)) << input;
+  EXPECT_EQ(expected_error_offset, error_offset) << input;
+  EXPECT_EQ(Ast::kNone, ast.root()) << input;
+}
+
+TEST(Parse, PrimaryExpressions) {
+  TestParse("'foo'", "'foo'");
+  TestParse("\"it's\"", "'it's'");
+  TestParse("42", "42");
+  TestParse(".5", "0.5");
+  TestParse("3.25", "3.25");
+  TestParse("$var", "$var");
+  TestParse("(1)", "1");
+  TestParse("true()", "(true())");
+  TestParse("concat('a', $b, 3)", "(concat() 'a' $b 3)");
+}
+
+TEST(Parse, Operators) {
+  TestParse("1 + 2 * 3", "(+ 1 (* 2 3))");
+  TestParse("(1 + 2) * 3", "(* (+ 1 2) 3)");
+  TestParse("1 - 2 - 3", "(- (- 1 2) 3)");
+  TestParse("6 div 2 mod 4", "(mod (div 6 2) 4)");
+  TestParse("--1", "(neg (neg 1))");
+  TestParse("1 < 2 = 3 >= 4", "(= (< 1 2) (>= 3 4))");
+  TestParse("1 <= 2 != 3 > 4", "(!= (<= 1 2) (> 3 4))");
+  TestParse("1 or 2 and 3", "(or 1 (and 2 3))");
+  TestParse("$a | $b | $c", "(| (| $a $b) $c)");
+  TestParse("-$a | $b", "(neg (| $a $b))");
+}
+
+TEST(Parse, LocationPaths) {
+  TestParse("/", "(/)");
+  TestParse("foo", "(path (child::foo))");
+  TestParse("/foo/bar", "(/ (child::foo) (child::bar))");
+  TestParse("//foo", "(/ (descendant-or-self::node()) (child::foo))");
+  TestParse("a//b",
+      "(path (child::a) (descendant-or-self::node()) (child::b))");
+  TestParse("*", "(path (child::*))");
+  TestParse("@id", "(path (attribute::id))");
+  TestParse(".", "(path (self::node()))");
+  TestParse("../x", "(path (parent::node()) (child::x))");
+  TestParse("ancestor-or-self::x", "(path (ancestor-or-self::x))");
+  TestParse("text()", "(path (child::text()))");
+  TestParse("processing-instruction('p')",
+      "(path (child::processing-instruction('p')))");
+  TestParse("child::node()", "(path (child::node()))");
+}
+
+TEST(Parse, Predicates) {
+  TestParse("foo[1]", "(path (child::foo 1))");
+  TestParse("foo[@a = 'x'][2]",
+      "(path (child::foo (= (path (attribute::a)) 'x') 2))");
+  TestParse("foo[bar[baz]]",
+      "(path (child::foo (path (child::bar (path (child::baz))))))");
+  TestParse("$x[1]", "(filter $x 1)");
+  TestParse("(//a)[last()]",
+      "(filter (/ (descendant-or-self::node()) (child::a)) (last()))");
+}
+
+TEST(Parse, FilterPaths) {
+  TestParse("$x/foo", "(path $x (child::foo))");
+  TestParse("$x[1]//foo",
+      "(path (filter $x 1) (descendant-or-self::node()) (child::foo))");
+  TestParse("id('x')/y", "(path (id() 'x') (child::y))");
+}
+
+TEST(Parse, Disambiguation) {
+  TestParse("* * *", "(* (path (child::*)) (path (child::*)))");
+  TestParse("div div div", "(div (path (child::div)) (path (child::div)))");
+  TestParse("and and and", "(and (path (child::and)) (path (child::and)))");
+  TestParse("child::child", "(path (child::child))");
+}
+
+TEST(Parse, Errors) {
+  TestParseError("", 0);
+  TestParseError("   ", 3);
+  TestParseError("~", 0);
+  TestParseError("foo ~", 4);
+  TestParseError("foo[", 4);
+  TestParseError("foo[1", 5);
+  TestParseError("foo]", 3);
+  TestParseError("1 +", 3);
+  TestParseError("1 plus 2", 2);
+  TestParseError("foo::bar", 0);
+  TestParseError("child::", 7);
+  TestParseError("f(1,)", 4);
+  TestParseError("f(1 2)", 4);
+  TestParseError("text(1)", 5);
+  TestParseError("/ /a", 2);
+  TestParseError("//", 2);
+  TestParseError("()", 1);
+  TestParseError("'unterminated", 0);
+}
+
+TEST(Parse, NestingLimit) {
+  string input = string(1000, '(') + "1" + string(1000, ')');
+  Ast ast;
+  size_t error_offset;
+  EXPECT_FALSE(Parse(input, &ast, &error_offset));
+  EXPECT_LT(error_offset, 1000);
+  input = string(100, '(') + "1" + string(100, ')');
+  EXPECT_TRUE(Parse(input, &ast, &error_offset));
+}
+
+TEST(Parse, DepthLimit) {
+  Ast ast;
+  size_t error_offset;
+  for (const char* chain : { " + 1", " | a", " or 1" }) {
+    string input = "1";
+    for (int i = 0; i < 50000; ++i) input += chain;
+    EXPECT_FALSE(Parse(input, &ast, &error_offset)) << chain;
+    EXPECT_LT(error_offset, input.size()) << chain;
+    input.resize(1 + 500 * strlen(chain));
+    EXPECT_TRUE(Parse(input, &ast, &error_offset)) << chain;
+  }
+  string negations;
+  for (int i = 0; i < 50000; ++i) negations += "- ";
+  EXPECT_FALSE(Parse(negations + "1", &ast, &error_offset));
+  negations.resize(2 * 500);
+  EXPECT_TRUE(Parse(negations + "1", &ast, &error_offset));
+}
+
+TEST(Parse, NegationOffsets) {
+  Ast ast;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("- -  1", &ast, &error_offset));
+  const Expr& outer = ast.node(ast.root());
+  EXPECT_EQ(0, outer.text_offset);
+  EXPECT_EQ(2, ast.node(outer.first_child).text_offset);
+}
+
+TEST(Parse, ResolvesFunctions) {
+  Ast ast;
+  size_t error_offset;
+  ASSERT_TRUE(Parse("concat(string-length(), foo())", &ast, &error_offset));
+  const Expr& concat = ast.node(ast.root());
+  EXPECT_EQ(F_Concat, concat.function);
+  const Expr& string_length = ast.node(concat.first_child);
+  EXPECT_EQ(F_StringLength, string_length.function);
+  EXPECT_EQ(F_None, ast.node(string_length.next_sibling).function);
+}
+
+TEST(Parse, IgnoresLocale) {
+  ScopedCommaLocale locale;
+  if (!locale.active()) return;  // No comma-decimal locale is installed.
+  TestParse("1.5", "1.5");
+  TestParse(".25 + 2.", "(+ 0.25 2)");
+}
+
+TEST(SwapOperands, MirrorsComparisons) {
+  EXPECT_EQ(X_GreaterThan, SwapOperands(X_LessThan));
+  EXPECT_EQ(X_GreaterEqual, SwapOperands(X_LessEqual));
+  EXPECT_EQ(X_LessThan, SwapOperands(X_GreaterThan));
+  EXPECT_EQ(X_LessEqual, SwapOperands(X_GreaterEqual));
+  EXPECT_EQ(X_Equal, SwapOperands(X_Equal));
+  EXPECT_EQ(X_NotEqual, SwapOperands(X_NotEqual));
+}
+
+TEST(Parse, TextReferencesCopy) {
+  Ast ast;
+  size_t error_offset;
+  {
+    string input = "foo[@bar = 'baz']";
+    EXPECT_TRUE(Parse(input, &ast, &error_offset));
+  }
+  Ast copy = ast;
+  ast.Clear();
+  EXPECT_EQ("(path (child::foo (= (path (attribute::bar)) 'baz')))",
+            DebugString(copy));
+}
+
+TEST(Parse, ReusesAst) {
+  Ast ast;
+  size_t error_offset;
+  EXPECT_TRUE(Parse("a/b/c", &ast, &error_offset));
+  EXPECT_FALSE(Parse("a/", &ast, &error_offset));
+  EXPECT_EQ(2, error_offset);
+  EXPECT_TRUE(ast.nodes().empty());
+  EXPECT_TRUE(Parse("x", &ast, &error_offset));
+  EXPECT_EQ("(path (child::x))", DebugString(ast));
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,195 @@
+#include "Profile.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace xpath {
+
+namespace {
+
+static_assert(sizeof(ProfileStats) % sizeof(uint64_t) == 0,
+              "ProfileStats must only contain counters");
+
+uint64_t* Values(ProfileStats* stats) {
+  return reinterpret_cast<uint64_t*>(stats);
+}
+
+const uint64_t* Values(const ProfileStats& stats) {
+  return reinterpret_cast<const uint64_t*>(&stats);
+}
+
+const char* const kPhaseNames[] = {
+  "tokenize", "disambiguate", "parse", "compile", "evaluate" };
+
+const char* const kAxisNames[] = {
+  "", "ancestor", "ancestor-or-self", "attribute", "child", "descendant",
+  "descendant-or-self", "following", "following-sibling", "namespace",
+  "parent", "preceding", "preceding-sibling", "self" };
+
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) ==
+                  kProfilePhaseCount,
+              "kPhaseNames does not match ProfilePhase");
+static_assert(sizeof(kAxisNames) / sizeof(kAxisNames[0]) == kProfileAxisCount,
+              "kAxisNames does not match AxisName");
+
+void AppendCounter(const char* name, const char* suffix, uint64_t value,
+                   std::string* out) {
+  if (value == 0) return;
+  out->append(name);
+  if (suffix != nullptr) {
+    out->append(".");
+    out->append(suffix);
+  }
+  out->append(" ");
+  out->append(std::to_string(value));
+  out->append("\n");
+}
+
+#ifdef XPATH_PROFILE
+
+using profile_internal::Counters;
+using profile_internal::kCounterCount;
+
+// The counters of all live threads, and the sum of those of exited threads.
+struct Registry {
+  Registry() { memset(&exited, 0, sizeof(exited)); }
+
+  std::mutex mutex;
+  std::vector<Counters*> threads;
+  ProfileStats exited;
+};
+
+Registry* GetRegistry() {
+  // Never destroyed, so that threads can exit during static destruction.
+  static Registry* registry = new Registry();
+  return registry;
+}
+
+void Load(const Counters& counters, ProfileStats* stats) {
+  uint64_t* values = Values(stats);
+  for (size_t i = 0; i < kCounterCount; ++i) {
+    values[i] = counters.values[i].load(std::memory_order_relaxed);
+  }
+}
+
+void Accumulate(const ProfileStats& stats, ProfileStats* sum) {
+  const uint64_t* values = Values(stats);
+  uint64_t* sums = Values(sum);
+  for (size_t i = 0; i < kCounterCount; ++i) sums[i] += values[i];
+}
+
+// Registers the counters of a thread on construction, and folds them into
+// Registry::exited when the thread exits.
+class ThreadRegistration {
+ public:
+  ThreadRegistration() {
+    for (size_t i = 0; i < kCounterCount; ++i) counters_.values[i].store(0);
+    Registry* registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    registry->threads.push_back(&counters_);
+  }
+
+  ~ThreadRegistration() {
+    Registry* registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    ProfileStats stats;
+    Load(counters_, &stats);
+    Accumulate(stats, &registry->exited);
+    registry->threads.erase(std::find(registry->threads.begin(),
+                                      registry->threads.end(), &counters_));
+  }
+
+  Counters* counters() { return &counters_; }
+
+ private:
+  Counters counters_;
+
+  ThreadRegistration(const ThreadRegistration&);
+  void operator=(const ThreadRegistration&);
+};
+
+#endif /* XPATH_PROFILE */
+
+}  // namespace
+
+#ifdef XPATH_PROFILE
+
+namespace profile_internal {
+
+Counters* ThreadCounters() {
+  static thread_local ThreadRegistration registration;
+  return registration.counters();
+}
+
+uint64_t Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace profile_internal
+
+void GetProfileStats(ProfileStats* stats) {
+  Registry* registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry->mutex);
+  *stats = registry->exited;
+  ProfileStats thread_stats;
+  for (const Counters* counters : registry->threads) {
+    Load(*counters, &thread_stats);
+    Accumulate(thread_stats, stats);
+  }
+}
+
+void GetThreadProfileStats(ProfileStats* stats) {
+  Load(*profile_internal::ThreadCounters(), stats);
+}
+
+#else
+
+void GetProfileStats(ProfileStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+void GetThreadProfileStats(ProfileStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+}
+
+#endif /* XPATH_PROFILE */
+
+void SubtractProfileStats(const ProfileStats& after,
+                          const ProfileStats& before,
+                          ProfileStats* difference) {
+  const uint64_t* a = Values(after);
+  const uint64_t* b = Values(before);
+  uint64_t* d = Values(difference);
+  for (size_t i = 0; i < sizeof(ProfileStats) / sizeof(uint64_t); ++i) {
+    d[i] = a[i] - b[i];
+  }
+}
+
+std::string DebugString(const ProfileStats& stats) {
+  std::string out;
+  for (int i = 0; i < kProfilePhaseCount; ++i) {
+    AppendCounter("phase_nanos", kPhaseNames[i], stats.phase_nanos[i], &out);
+    AppendCounter("phase_calls", kPhaseNames[i], stats.phase_calls[i], &out);
+  }
+  AppendCounter("tokens_scanned", nullptr, stats.tokens_scanned, &out);
+  for (int i = 1; i < kProfileAxisCount; ++i) {
+    AppendCounter("nodes_visited", kAxisNames[i], stats.nodes_visited[i],
+                  &out);
+  }
+  AppendCounter("predicates_evaluated", nullptr, stats.predicates_evaluated,
+                &out);
+  return out;
+}
+
+ProfileStats ProfileTrace::stats() const {
+  ProfileStats now, difference;
+  GetThreadProfileStats(&now);
+  SubtractProfileStats(now, start_, &difference);
+  return difference;
+}
+
+}  // namespace xpath
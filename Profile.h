@@ -0,0 +1,156 @@
+#ifndef XPATH_PROFILE_INCLUDED
+#define XPATH_PROFILE_INCLUDED
+
+#include "Tokenizer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+namespace xpath {
+
+// Optional counters for the hot paths of tokenizing, parsing and evaluating.
+//
+// Unless XPATH_PROFILE is defined, profiling is compiled out: the macros
+// below expand to nothing and all counters read as zero, so callers can use
+// the API unconditionally. When it is enabled, each thread updates its own
+// counters without locking or atomic read-modify-write operations;
+// GetProfileStats() sums the counters of all threads.
+
+enum ProfilePhase {
+  P_Tokenize = 0,     // Tokenize(), including disambiguation when fused.
+  P_Disambiguate,     // Tokenizer's separate disambiguation pass.
+  P_Parse,            // Parse(), including the scanning that it drives.
+  P_Compile,          // Compile().
+  P_Evaluate };       // Evaluator::Evaluate() and Evaluator::Execute().
+
+const int kProfilePhaseCount = P_Evaluate + 1;
+const int kProfileAxisCount = A_Self + 1;
+
+// A snapshot of the counters. All members are counters, which only grow.
+struct ProfileStats {
+  // Wall time spent in, and number of calls of, each ProfilePhase. Phases
+  // nest: the time of an inner phase is also counted in the outer one.
+  uint64_t phase_nanos[kProfilePhaseCount];
+  uint64_t phase_calls[kProfilePhaseCount];
+
+  // Number of tokens returned by ScanToken().
+  uint64_t tokens_scanned;
+
+  // Number of candidate nodes that steps looked at, indexed by AxisName.
+  uint64_t nodes_visited[kProfileAxisCount];
+
+  // Number of times a predicate was evaluated for a context node.
+  uint64_t predicates_evaluated;
+};
+
+// True if profiling is compiled in.
+#ifdef XPATH_PROFILE
+const bool kProfileEnabled = true;
+#else
+const bool kProfileEnabled = false;
+#endif
+
+// Sets *stats to the sum of the counters of all threads, including threads
+// that have exited.
+void GetProfileStats(ProfileStats* stats);
+
+// Sets *stats to the counters of the calling thread.
+void GetThreadProfileStats(ProfileStats* stats);
+
+// Sets *difference to `after` - `before`, counter by counter.
+void SubtractProfileStats(const ProfileStats& after,
+                          const ProfileStats& before,
+                          ProfileStats* difference);
+
+// Returns the nonzero counters of *stats, one per line, as "name value" (for
+// example "nodes_visited.child 12"), for export to other metrics systems.
+std::string DebugString(const ProfileStats& stats);
+
+// Records the counters of a single query, or of any other section of code, on
+// the calling thread: stats() returns what the thread did since the trace
+// was constructed or last restarted. Work that the section hands off to other
+// threads is not included.
+class ProfileTrace {
+ public:
+  ProfileTrace() { Restart(); }
+
+  void Restart() { GetThreadProfileStats(&start_); }
+
+  ProfileStats stats() const;
+
+ private:
+  ProfileStats start_;
+};
+
+#ifdef XPATH_PROFILE
+
+namespace profile_internal {
+
+const size_t kCounterCount = sizeof(ProfileStats) / sizeof(uint64_t);
+
+// The counters of a thread, laid out like ProfileStats. Only the owning thread
+// writes them; other threads read them for GetProfileStats().
+struct Counters {
+  std::atomic<uint64_t> values[kCounterCount];
+};
+
+Counters* ThreadCounters();
+
+inline void Add(size_t counter, uint64_t n) {
+  std::atomic<uint64_t>& value = ThreadCounters()->values[counter];
+  value.store(value.load(std::memory_order_relaxed) + n,
+              std::memory_order_relaxed);
+}
+
+uint64_t Now();
+
+// Adds the wall time of its scope to a phase.
+class PhaseTimer {
+ public:
+  explicit PhaseTimer(ProfilePhase phase) : phase_(phase), start_(Now()) {}
+
+  ~PhaseTimer() {
+    Add(offsetof(ProfileStats, phase_nanos) / sizeof(uint64_t) + phase_,
+        Now() - start_);
+    Add(offsetof(ProfileStats, phase_calls) / sizeof(uint64_t) + phase_, 1);
+  }
+
+ private:
+  ProfilePhase phase_;
+  uint64_t start_;
+
+  PhaseTimer(const PhaseTimer&);
+  void operator=(const PhaseTimer&);
+};
+
+}  // namespace profile_internal
+
+#define XPATH_PROFILE_COUNTER(Member) \
+  (offsetof(::xpath::ProfileStats, Member) / sizeof(uint64_t))
+
+// Times the rest of the enclosing scope as `Phase`.
+#define XPATH_PROFILE_PHASE(Phase) \
+  ::xpath::profile_internal::PhaseTimer xpath_profile_phase_timer(Phase)
+
+// Adds `N` to the counter ProfileStats::Member.
+#define XPATH_PROFILE_ADD(Member, N) \
+  ::xpath::profile_internal::Add(XPATH_PROFILE_COUNTER(Member), (N))
+
+// Adds `N` to the nodes_visited counter of `Axis`.
+#define XPATH_PROFILE_VISIT(Axis, N) \
+  ::xpath::profile_internal::Add( \
+      XPATH_PROFILE_COUNTER(nodes_visited) + (Axis), (N))
+
+#else
+
+#define XPATH_PROFILE_PHASE(Phase) do {} while (0)
+#define XPATH_PROFILE_ADD(Member, N) do {} while (0)
+#define XPATH_PROFILE_VISIT(Axis, N) do {} while (0)
+
+#endif /* XPATH_PROFILE */
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_PROFILE_INCLUDED */
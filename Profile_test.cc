@@ -0,0 +1,143 @@
+#include "Profile.h"
+#include "Bytecode.h"
+#include "Evaluator.h"
+#include "Parser.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+TEST(Profile, IsCompiledIn) {
+  // This test is built with XPATH_PROFILE; the library is not by default.
+  EXPECT_TRUE(kProfileEnabled);
+}
+
+TEST(Profile, CountsTokenizing) {
+  string input = "//book[@id = 'b1']/title";
+  vector<Token> tokens;
+  ProfileTrace trace;
+  ASSERT_EQ(input.size(), Tokenize(input, &tokens));
+  ProfileStats stats = trace.stats();
+  EXPECT_EQ(10u, stats.tokens_scanned);
+  EXPECT_EQ(1u, stats.phase_calls[P_Tokenize]);
+  EXPECT_EQ(0u, stats.phase_calls[P_Disambiguate]);
+  EXPECT_EQ(0u, stats.phase_calls[P_Parse]);
+
+  // Tokenizer disambiguates in a separate pass.
+  trace.Restart();
+  Tokenizer tokenizer;
+  ASSERT_EQ(input.size(), tokenizer.Tokenize(input.data(), input.size()));
+  stats = trace.stats();
+  EXPECT_EQ(10u, stats.tokens_scanned);
+  EXPECT_EQ(1u, stats.phase_calls[P_Tokenize]);
+  EXPECT_EQ(1u, stats.phase_calls[P_Disambiguate]);
+  EXPECT_LE(stats.phase_nanos[P_Disambiguate], stats.phase_nanos[P_Tokenize]);
+
+  // Scanning stops at the first error.
+  trace.Restart();
+  EXPECT_EQ(5u, Tokenize("book !", &tokens));
+  EXPECT_EQ(1u, trace.stats().tokens_scanned);
+}
+
+TEST(Profile, CountsEvaluation) {
+  std::unique_ptr<SimpleMessage> message(
+      SimpleMessage::ParseText(LibraryText()));
+  Document document(*message);
+  Evaluator evaluator(&document);
+  Ast ast;
+  Program program;
+  Value value;
+  size_t error_offset;
+
+  ProfileTrace trace;
+  ASSERT_TRUE(Parse("book[author]/@id", &ast, &error_offset));
+  ASSERT_TRUE(evaluator.Evaluate(ast, &value, &error_offset));
+  ASSERT_EQ(2u, value.nodes.size());
+  ProfileStats stats = trace.stats();
+  EXPECT_EQ(1u, stats.phase_calls[P_Parse]);
+  EXPECT_EQ(7u, stats.tokens_scanned);
+  EXPECT_EQ(1u, stats.phase_calls[P_Evaluate]);
+  EXPECT_EQ(0u, stats.phase_calls[P_Compile]);
+  // 4 children of the root, then the first author of each of 3 books (the
+  // predicate stops there), then the 3 attributes of each of 2 books.
+  EXPECT_EQ(6u, stats.nodes_visited[A_Child]);
+  EXPECT_EQ(6u, stats.nodes_visited[A_Attribute]);
+  EXPECT_EQ(0u, stats.nodes_visited[A_Descendant]);
+  EXPECT_EQ(3u, stats.predicates_evaluated);
+
+  // Compiled programs count the same predicates, but select every author.
+  trace.Restart();
+  ASSERT_TRUE(Compile(ast, &program, &error_offset));
+  ASSERT_TRUE(evaluator.Execute(program, &value, &error_offset));
+  ProfileStats compiled = trace.stats();
+  EXPECT_EQ(1u, compiled.phase_calls[P_Compile]);
+  EXPECT_EQ(1u, compiled.phase_calls[P_Evaluate]);
+  EXPECT_EQ(0u, compiled.tokens_scanned);
+  EXPECT_EQ(7u, compiled.nodes_visited[A_Child]);
+  EXPECT_EQ(stats.predicates_evaluated, compiled.predicates_evaluated);
+
+  trace.Restart();
+  ASSERT_TRUE(Parse("//book[@year > 2005]", &ast, &error_offset));
+  ASSERT_TRUE(evaluator.Evaluate(ast, &value, &error_offset));
+  ASSERT_EQ(2u, value.nodes.size());
+  stats = trace.stats();
+  EXPECT_LT(0u, stats.nodes_visited[A_DescendantOrSelf]);
+  EXPECT_EQ(4u, stats.predicates_evaluated);
+}
+
+TEST(Profile, SumsThreads) {
+  ProfileStats before, after;
+  GetProfileStats(&before);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(std::thread([] {
+      vector<Token> tokens;
+      Tokenize("a/b/c", &tokens);
+    }));
+  }
+  for (std::thread& thread : threads) thread.join();
+  GetProfileStats(&after);
+  ProfileStats difference;
+  SubtractProfileStats(after, before, &difference);
+  EXPECT_EQ(20u, difference.tokens_scanned);
+  EXPECT_EQ(4u, difference.phase_calls[P_Tokenize]);
+
+  // Other threads do not show up in the trace of this one.
+  ProfileTrace trace;
+  std::thread([] {
+    vector<Token> tokens;
+    Tokenize("a/b", &tokens);
+  }).join();
+  EXPECT_EQ(0u, trace.stats().tokens_scanned);
+}
+
+TEST(Profile, DebugString) {
+  ProfileStats stats;
+  memset(&stats, 0, sizeof(stats));
+  EXPECT_EQ("", DebugString(stats));
+  stats.phase_nanos[P_Parse] = 1500;
+  stats.phase_calls[P_Parse] = 2;
+  stats.tokens_scanned = 12;
+  stats.nodes_visited[A_FollowingSibling] = 3;
+  stats.predicates_evaluated = 1;
+  EXPECT_EQ("phase_nanos.parse 1500\n"
+            "phase_calls.parse 2\n"
+            "tokens_scanned 12\n"
+            "nodes_visited.following-sibling 3\n"
+            "predicates_evaluated 1\n",
+            DebugString(stats));
+}
+
+}  // namespace
+}  // namespace xpath
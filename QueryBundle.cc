@@ -0,0 +1,189 @@
+#include "QueryBundle.h"
+
+#include "Bytecode.h"
+#include "Optimizer.h"
+#include "Parser.h"
+
+#include <string.h>
+
+namespace xpath {
+
+namespace {
+
+const char kMagic[4] = { 'X', 'P', 'Q', 'B' };
+const uint32_t kVersion = 1;
+
+// The header is the magic number, the version, and the number of queries,
+// the number of tokens and the size of the pool.
+const size_t kHeaderSize = 20;
+
+// A query is the offset and size of its text in the pool, its first token
+// and number of tokens, and the offset and size of its program in the pool.
+const size_t kQueryFields = 6;
+const size_t kQuerySize = 4 * kQueryFields;
+enum QueryField {
+  kTextOffset = 0,
+  kTextSize,
+  kFirstToken,
+  kTokenCount,
+  kProgramOffset,
+  kProgramSize };
+
+// A token is its type, offset and size.
+const size_t kTokenSize = 12;
+
+uint32_t ReadUint32(const char* data) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | uint32_t(bytes[3]) << 24;
+}
+
+void AppendUint32(uint32_t value, std::string* output) {
+  for (int i = 0; i < 4; ++i) *output += char(value >> (8 * i));
+}
+
+}  // namespace
+
+bool QueryBundle::Load(const char* data, size_t size) {
+  data_ = nullptr;
+  query_count_ = token_count_ = 0;
+  if (size < kHeaderSize || memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+      ReadUint32(data + 4) != kVersion) {
+    return false;
+  }
+  uint64_t query_count = ReadUint32(data + 8);
+  uint64_t token_count = ReadUint32(data + 12);
+  uint64_t strings_size = ReadUint32(data + 16);
+  if (kHeaderSize + query_count * kQuerySize + token_count * kTokenSize +
+      strings_size != size) {
+    return false;
+  }
+  const char* queries = data + kHeaderSize;
+  const char* tokens = queries + query_count * kQuerySize;
+  const char* strings = tokens + token_count * kTokenSize;
+
+  for (size_t query = 0; query < query_count; ++query) {
+    const char* fields = queries + query * kQuerySize;
+    uint64_t text_offset = ReadUint32(fields + 4 * kTextOffset);
+    uint64_t text_size = ReadUint32(fields + 4 * kTextSize);
+    uint64_t first_token = ReadUint32(fields + 4 * kFirstToken);
+    uint64_t query_tokens = ReadUint32(fields + 4 * kTokenCount);
+    uint64_t program_offset = ReadUint32(fields + 4 * kProgramOffset);
+    uint64_t program_size = ReadUint32(fields + 4 * kProgramSize);
+    if (text_offset + text_size > strings_size ||
+        first_token + query_tokens > token_count ||
+        program_offset + program_size > strings_size) {
+      return false;
+    }
+    for (uint64_t i = first_token; i < first_token + query_tokens; ++i) {
+      const char* token = tokens + i * kTokenSize;
+      uint64_t type = ReadUint32(token);
+      uint64_t offset = ReadUint32(token + 4);
+      if (type > T_NameTest ||
+          offset + ReadUint32(token + 8) > text_size) {
+        return false;
+      }
+    }
+  }
+
+  data_ = data;
+  queries_ = queries;
+  tokens_ = tokens;
+  strings_ = strings;
+  query_count_ = query_count;
+  token_count_ = token_count;
+  return true;
+}
+
+uint32_t QueryBundle::QueryField(size_t query, size_t field) const {
+  return ReadUint32(queries_ + query * kQuerySize + 4 * field);
+}
+
+const char* QueryBundle::text(size_t query) const {
+  return strings_ + QueryField(query, kTextOffset);
+}
+
+size_t QueryBundle::text_size(size_t query) const {
+  return QueryField(query, kTextSize);
+}
+
+size_t QueryBundle::token_count(size_t query) const {
+  return QueryField(query, kTokenCount);
+}
+
+Token QueryBundle::token(size_t query, size_t index) const {
+  const char* data =
+      tokens_ + (QueryField(query, kFirstToken) + index) * kTokenSize;
+  Token token;
+  token.type = TokenType(ReadUint32(data));
+  token.offset = ReadUint32(data + 4);
+  token.size = ReadUint32(data + 8);
+  return token;
+}
+
+const char* QueryBundle::program(size_t query) const {
+  return strings_ + QueryField(query, kProgramOffset);
+}
+
+size_t QueryBundle::program_size(size_t query) const {
+  return QueryField(query, kProgramSize);
+}
+
+bool QueryBundleBuilder::Add(const std::string& expression,
+                             size_t* error_offset) {
+  size_t result = tokenizer_.Tokenize(expression);
+  if (result != expression.size()) {
+    *error_offset = result;
+    return false;
+  }
+  std::string serialized;
+  if (compile_) {
+    Ast ast;
+    Program program;
+    if (!Parse(expression, &ast, error_offset)) return false;
+    // Check calls in the expression as written, before it is optimized.
+    if (!Compile(ast, &program, error_offset)) return false;
+    Optimize(&ast);
+    if (!Compile(ast, &program, error_offset)) return false;
+    SerializeProgram(program, &serialized);
+  }
+
+  AppendUint32(AddString(expression), &queries_);
+  AppendUint32(expression.size(), &queries_);
+  AppendUint32(token_count_, &queries_);
+  AppendUint32(tokenizer_.tokens().size(), &queries_);
+  AppendUint32(serialized.empty() ? 0 : AddString(serialized), &queries_);
+  AppendUint32(serialized.size(), &queries_);
+  for (const Token& token : tokenizer_.tokens()) {
+    AppendUint32(token.type, &tokens_);
+    AppendUint32(token.offset, &tokens_);
+    AppendUint32(token.size, &tokens_);
+  }
+  token_count_ += tokenizer_.tokens().size();
+  return true;
+}
+
+// Returns the offset of `s` in the pool, adding it if it is not there yet.
+uint32_t QueryBundleBuilder::AddString(const std::string& s) {
+  uint32_t id = pooled_.Intern(s);
+  if (id == string_offsets_.size()) {
+    string_offsets_.push_back(strings_.size());
+    strings_ += s;
+  }
+  return string_offsets_[id];
+}
+
+void QueryBundleBuilder::Build(std::string* output) const {
+  output->clear();
+  output->reserve(kHeaderSize + queries_.size() + tokens_.size() +
+                  strings_.size());
+  output->append(kMagic, sizeof(kMagic));
+  AppendUint32(kVersion, output);
+  AppendUint32(queries_.size() / kQuerySize, output);
+  AppendUint32(token_count_, output);
+  AppendUint32(strings_.size(), output);
+  *output += queries_;
+  *output += tokens_;
+  *output += strings_;
+}
+
+}  // namespace xpath
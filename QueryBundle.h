@@ -0,0 +1,101 @@
+#ifndef XPATH_QUERY_BUNDLE_INCLUDED
+#define XPATH_QUERY_BUNDLE_INCLUDED
+
+#include "Interner.h"
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+// A read-only view of a bundle of precompiled queries, which lets a service
+// load thousands of expressions at startup without tokenizing or compiling
+// them.
+//
+// A bundle is a single position-independent block of little-endian data,
+// typically a file mapped into memory with mmap(): a header, a table of
+// queries, a table of tokens, and a pool that holds the text of the queries
+// (identical expressions share their text) and, optionally, their compiled
+// programs (see Bytecode.h). Load() checks that every offset in the tables
+// is in range, and accessors read the tables in place, so loading does no
+// parsing and no allocation, and its data is shared between the processes
+// that map the same file. There are no alignment requirements.
+class QueryBundle {
+ public:
+  QueryBundle() : data_(nullptr), query_count_(0), token_count_(0) {}
+
+  // Makes the bundle refer to the bundle data in [data, data + size), which
+  // must remain valid while the bundle is in use. Returns false if the data
+  // is truncated, was written by an incompatible version, or refers to data
+  // outside of itself, in which case the bundle is empty.
+  bool Load(const char* data, size_t size);
+
+  size_t size() const { return query_count_; }
+
+  // Returns the text of query `query`, which is text_size(query) bytes.
+  const char* text(size_t query) const;
+  size_t text_size(size_t query) const;
+
+  // Returns the number of tokens of the query, and its token `index`, whose
+  // offset is relative to text(query). The tokens are those of Tokenize().
+  size_t token_count(size_t query) const;
+  Token token(size_t query, size_t index) const;
+
+  // Returns the serialized compiled program of the query, to be loaded with
+  // LoadProgram(), or program_size(query) == 0 if the bundle was built
+  // without programs.
+  const char* program(size_t query) const;
+  size_t program_size(size_t query) const;
+
+ private:
+  uint32_t QueryField(size_t query, size_t field) const;
+
+  const char* data_;
+  const char* queries_;
+  const char* tokens_;
+  const char* strings_;
+  size_t query_count_;
+  size_t token_count_;
+};
+
+// Builds query bundles.
+class QueryBundleBuilder {
+ public:
+  // If `compile` is true, the bundle includes compiled programs.
+  explicit QueryBundleBuilder(bool compile)
+      : compile_(compile), token_count_(0) {}
+
+  // Adds `expression` as the next query of the bundle.
+  //
+  // Returns true on success. Otherwise, it returns false and sets
+  // *error_offset to the offset where tokenization, or parsing and compiling
+  // if programs are included, failed.
+  bool Add(const std::string& expression, size_t* error_offset);
+
+  // Writes the bundle of the queries added so far to *output.
+  void Build(std::string* output) const;
+
+ private:
+  uint32_t AddString(const std::string& s);
+
+  bool compile_;
+  Tokenizer tokenizer_;
+
+  // The query and token tables, and the pool, as they are written.
+  std::string queries_;
+  std::string tokens_;
+  size_t token_count_;
+  std::string strings_;
+  // The pool offset of each string, by its id in `pooled_`.
+  Interner pooled_;
+  std::vector<uint32_t> string_offsets_;
+
+  QueryBundleBuilder(const QueryBundleBuilder&);
+  void operator=(const QueryBundleBuilder&);
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_QUERY_BUNDLE_INCLUDED */
@@ -0,0 +1,138 @@
+// Builds and checks query bundles (see QueryBundle.h).
+//
+//   QueryBundleTool build [-c] EXPRESSIONS BUNDLE
+//       Writes a bundle of the expressions in the file EXPRESSIONS, one per
+//       line (empty lines and lines starting with '#' are ignored), to
+//       BUNDLE, and checks it. With -c, the bundle includes compiled
+//       programs.
+//
+//   QueryBundleTool check BUNDLE
+//       Maps BUNDLE into memory, loads it, and checks that the tokens of
+//       every query are those that Tokenize() returns for its text, and that
+//       its program, if any, loads.
+
+#include "Bytecode.h"
+#include "QueryBundle.h"
+#include "Tokenizer.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using xpath::Program;
+using xpath::QueryBundle;
+using xpath::QueryBundleBuilder;
+using xpath::Token;
+
+int Usage() {
+  fprintf(stderr,
+          "usage: QueryBundleTool build [-c] EXPRESSIONS BUNDLE\n"
+          "       QueryBundleTool check BUNDLE\n");
+  return 2;
+}
+
+bool CheckBundle(const char* data, size_t size, const char* path) {
+  QueryBundle bundle;
+  if (!bundle.Load(data, size)) {
+    fprintf(stderr, "%s: not a valid bundle\n", path);
+    return false;
+  }
+  std::vector<Token> tokens;
+  Program program;
+  size_t token_count = 0, program_count = 0;
+  for (size_t query = 0; query < bundle.size(); ++query) {
+    size_t text_size = bundle.text_size(query);
+    bool ok = xpath::Tokenize(bundle.text(query), text_size, &tokens) ==
+                  text_size &&
+              tokens.size() == bundle.token_count(query);
+    for (size_t i = 0; ok && i < tokens.size(); ++i) {
+      ok = tokens[i] == bundle.token(query, i);
+    }
+    if (!ok) {
+      fprintf(stderr, "%s: query %zu: tokens do not match its text\n", path,
+              query);
+      return false;
+    }
+    token_count += tokens.size();
+    if (bundle.program_size(query) == 0) continue;
+    if (!xpath::LoadProgram(bundle.program(query), bundle.program_size(query),
+                            &program)) {
+      fprintf(stderr, "%s: query %zu: invalid program\n", path, query);
+      return false;
+    }
+    ++program_count;
+  }
+  printf("%s: %zu queries, %zu tokens, %zu programs, %zu bytes\n", path,
+         bundle.size(), token_count, program_count, size);
+  return true;
+}
+
+int Check(const char* path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+  size_t size = st.st_size;
+  // mmap() rejects empty mappings, but an empty file is not a bundle anyway.
+  void* data = size == 0 ? nullptr
+                         : mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror(path);
+    return 1;
+  }
+  bool ok = CheckBundle(static_cast<const char*>(data), size, path);
+  if (data != nullptr) munmap(data, size);
+  return ok ? 0 : 1;
+}
+
+int Build(bool compile, const char* input_path, const char* output_path) {
+  std::ifstream input(input_path);
+  if (!input) {
+    perror(input_path);
+    return 1;
+  }
+  QueryBundleBuilder builder(compile);
+  std::string line;
+  for (int line_number = 1; std::getline(input, line); ++line_number) {
+    if (line.empty() || line[0] == '#') continue;
+    size_t error_offset;
+    if (!builder.Add(line, &error_offset)) {
+      fprintf(stderr, "%s:%d:%zu: invalid expression\n", input_path,
+              line_number, error_offset + 1);
+      return 1;
+    }
+  }
+
+  std::string bundle;
+  builder.Build(&bundle);
+  std::ofstream output(output_path, std::ios::binary | std::ios::trunc);
+  output.write(bundle.data(), bundle.size());
+  output.close();
+  if (!output) {
+    perror(output_path);
+    return 1;
+  }
+  return Check(output_path);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc == 3 && strcmp(argv[1], "check") == 0) return Check(argv[2]);
+  if (argc < 2 || strcmp(argv[1], "build") != 0) return Usage();
+  bool compile = argc == 5 && strcmp(argv[2], "-c") == 0;
+  if (argc != (compile ? 5 : 4)) return Usage();
+  return Build(compile, argv[argc - 2], argv[argc - 1]);
+}
@@ -0,0 +1,135 @@
+#include "QueryBundle.h"
+#include "Bytecode.h"
+#include "Parser.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+const char* const kExpressions[] = {
+  "/book/author", "//book[@year > 2000]/@id", "count(//author) = 3",
+  "/book/author", "", "concat('a', \"b\")", "child::*[position() = last()]",
+};
+
+void ExpectTokens(const QueryBundle& bundle, size_t query,
+                  const string& expression) {
+  SCOPED_TRACE(expression);
+  ASSERT_EQ(expression, string(bundle.text(query), bundle.text_size(query)));
+  vector<Token> tokens;
+  Tokenize(expression, &tokens);
+  ASSERT_EQ(tokens.size(), bundle.token_count(query));
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    EXPECT_EQ(tokens[i], bundle.token(query, i)) << i;
+  }
+}
+
+TEST(QueryBundle, RoundTrips) {
+  QueryBundleBuilder builder(false);
+  size_t error_offset;
+  for (const char* expression : kExpressions) {
+    EXPECT_TRUE(builder.Add(expression, &error_offset)) << expression;
+  }
+  string data;
+  builder.Build(&data);
+
+  QueryBundle bundle;
+  ASSERT_TRUE(bundle.Load(data.data(), data.size()));
+  ASSERT_EQ(7u, bundle.size());
+  for (size_t query = 0; query < bundle.size(); ++query) {
+    ExpectTokens(bundle, query, kExpressions[query]);
+    EXPECT_EQ(0u, bundle.program_size(query));
+  }
+  // Identical expressions share their text.
+  EXPECT_EQ(bundle.text(0), bundle.text(3));
+
+  // Loading a copy at another address gives the same result.
+  string copy = " " + data;
+  ASSERT_TRUE(bundle.Load(copy.data() + 1, data.size()));
+  ExpectTokens(bundle, 1, kExpressions[1]);
+}
+
+TEST(QueryBundle, IncludesPrograms) {
+  QueryBundleBuilder builder(true);
+  size_t error_offset;
+  EXPECT_TRUE(builder.Add("//book[1]/@id", &error_offset));
+  EXPECT_TRUE(builder.Add("count(//author)", &error_offset));
+  EXPECT_FALSE(builder.Add("//book[", &error_offset));
+  EXPECT_EQ(7u, error_offset);
+  EXPECT_FALSE(builder.Add("foo()", &error_offset));
+  EXPECT_EQ(0u, error_offset);
+  EXPECT_FALSE(builder.Add("true() or foo()", &error_offset));
+  EXPECT_EQ(10u, error_offset);
+  EXPECT_FALSE(builder.Add("'a", &error_offset));
+  EXPECT_EQ(0u, error_offset);
+  string data;
+  builder.Build(&data);
+
+  QueryBundle bundle;
+  ASSERT_TRUE(bundle.Load(data.data(), data.size()));
+  ASSERT_EQ(2u, bundle.size());
+  ExpectTokens(bundle, 1, "count(//author)");
+  Program program;
+  ASSERT_TRUE(LoadProgram(bundle.program(1), bundle.program_size(1),
+                          &program));
+  EXPECT_EQ("0: root\n"
+            "1: step descendant::author\n"
+            "2: call count/1\n"
+            "3: return\n",
+            DebugString(program));
+}
+
+TEST(QueryBundle, RejectsCorruptData) {
+  QueryBundleBuilder builder(true);
+  size_t error_offset;
+  ASSERT_TRUE(builder.Add("//book[@id = 'b1']", &error_offset));
+  ASSERT_TRUE(builder.Add("1 + 2", &error_offset));
+  string data;
+  builder.Build(&data);
+  QueryBundle bundle;
+  ASSERT_TRUE(bundle.Load(data.data(), data.size()));
+
+  // Every truncation is rejected, and so is trailing data.
+  for (size_t size = 0; size < data.size(); ++size) {
+    EXPECT_FALSE(bundle.Load(data.data(), size)) << size;
+    EXPECT_EQ(0u, bundle.size());
+  }
+  string corrupt = data + '\0';
+  EXPECT_FALSE(bundle.Load(corrupt.data(), corrupt.size()));
+
+  // So are bad magic numbers and versions.
+  corrupt = data;
+  corrupt[0] = 'Y';
+  EXPECT_FALSE(bundle.Load(corrupt.data(), corrupt.size()));
+  corrupt = data;
+  corrupt[4] = 2;
+  EXPECT_FALSE(bundle.Load(corrupt.data(), corrupt.size()));
+
+  // Any single corrupt byte either is rejected or yields a bundle whose
+  // ranges are all in bounds.
+  for (size_t i = 0; i < data.size(); ++i) {
+    for (int value : { 0x01, 0x1f, 0x80, 0xff }) {
+      corrupt = data;
+      corrupt[i] ^= char(value);
+      if (!bundle.Load(corrupt.data(), corrupt.size())) continue;
+      for (size_t query = 0; query < bundle.size(); ++query) {
+        const char* end = corrupt.data() + corrupt.size();
+        EXPECT_LE(bundle.text(query) + bundle.text_size(query), end);
+        EXPECT_LE(bundle.program(query) + bundle.program_size(query), end);
+        for (size_t j = 0; j < bundle.token_count(query); ++j) {
+          Token token = bundle.token(query, j);
+          EXPECT_LE(token.offset + token.size, bundle.text_size(query));
+          EXPECT_LE(token.type, T_NameTest);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace xpath
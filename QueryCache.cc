@@ -0,0 +1,86 @@
+#include "QueryCache.h"
+
+#include <assert.h>
+
+namespace xpath {
+
+void CompileQuery(const std::string& expression, CompiledQuery* query) {
+  query->expression = expression;
+  query->tokenize_result = Tokenize(expression, &query->tokens);
+  InternTokens(expression.data(), query->tokens.data(),
+               query->tokens.data() + query->tokens.size(), GlobalInterner(),
+               &query->symbols);
+  query->error_offset = expression.size();
+  query->valid = Parse(expression, &query->ast, &query->error_offset);
+}
+
+QueryCache::QueryCache(size_t capacity, size_t shard_count)
+    : shard_capacity_((capacity + shard_count - 1) / shard_count) {
+  assert(shard_count > 0);
+  if (shard_capacity_ == 0) shard_capacity_ = 1;
+  for (size_t i = 0; i < shard_count; ++i) {
+    shards_.push_back(std::unique_ptr<Shard>(new Shard()));
+  }
+}
+
+QueryCache::Shard& QueryCache::GetShard(const std::string& expression) {
+  return *shards_[std::hash<std::string>()(expression) % shards_.size()];
+}
+
+std::shared_ptr<const CompiledQuery> QueryCache::Get(
+    const std::string& expression) {
+  Shard& shard = GetShard(expression);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(expression);
+    if (it != shard.index.end()) {
+      ++shard.hits;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      return *it->second;
+    }
+    ++shard.misses;
+  }
+
+  // Compile outside the lock, so a slow compilation does not block lookups of
+  // other expressions in the same shard.
+  std::shared_ptr<CompiledQuery> query(new CompiledQuery());
+  CompileQuery(expression, query.get());
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(expression);
+  if (it != shard.index.end()) {
+    // Another thread inserted the same expression in the meantime.
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return *it->second;
+  }
+  shard.lru.push_front(query);
+  shard.index[expression] = shard.lru.begin();
+  if (shard.lru.size() > shard_capacity_) {
+    shard.index.erase(shard.lru.back()->expression);
+    shard.lru.pop_back();
+    ++shard.evictions;
+  }
+  return query;
+}
+
+QueryCache::Stats QueryCache::stats() const {
+  Stats stats = {0, 0, 0, 0};
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.hits += shard->hits;
+    stats.misses += shard->misses;
+    stats.evictions += shard->evictions;
+    stats.size += shard->lru.size();
+  }
+  return stats;
+}
+
+void QueryCache::Clear() {
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->lru.clear();
+  }
+}
+
+}  // namespace xpath
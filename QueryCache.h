@@ -0,0 +1,91 @@
+#ifndef XPATH_QUERY_CACHE_INCLUDED
+#define XPATH_QUERY_CACHE_INCLUDED
+
+#include "Interner.h"
+#include "Parser.h"
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xpath {
+
+// The tokenized and parsed form of an expression.
+struct CompiledQuery {
+  std::string expression;
+
+  // Tokens in `expression`, and the return value of Tokenize().
+  std::vector<Token> tokens;
+  size_t tokenize_result;
+
+  // The symbol of each token in GlobalInterner(), as set by InternTokens().
+  std::vector<uint32_t> symbols;
+
+  // True if the expression was parsed successfully, in which case `ast` holds
+  // the parsed expression. Otherwise, `error_offset` is the index of the error.
+  bool valid;
+  size_t error_offset;
+  Ast ast;
+};
+
+// Tokenizes and parses `expression` into *query.
+void CompileQuery(const std::string& expression, CompiledQuery* query);
+
+// A thread-safe, bounded cache of compiled queries keyed by expression text.
+//
+// The cache is split into shards by hash of the expression; each shard has its
+// own lock and evicts its least recently used entry when full, so concurrent
+// lookups only contend when they hit the same shard. Expressions are compiled
+// without holding any lock.
+class QueryCache {
+ public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+  };
+
+  // Creates a cache that holds at most `capacity` queries (rounded up to a
+  // multiple of `shard_count`).
+  explicit QueryCache(size_t capacity, size_t shard_count = 16);
+
+  // Returns the compiled form of `expression`, compiling it if necessary.
+  // The result remains valid after it has been evicted from the cache.
+  std::shared_ptr<const CompiledQuery> Get(const std::string& expression);
+
+  // Returns the sum of the counters of all shards.
+  Stats stats() const;
+
+  // Removes all entries. Counters are not reset.
+  void Clear();
+
+ private:
+  typedef std::list<std::shared_ptr<const CompiledQuery>> LruList;
+
+  struct Shard {
+    Shard() : hits(0), misses(0), evictions(0) {}
+
+    std::mutex mutex;
+    // Most recently used entries are at the front.
+    LruList lru;
+    std::unordered_map<std::string, LruList::iterator> index;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  Shard& GetShard(const std::string& expression);
+
+  size_t shard_capacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_QUERY_CACHE_INCLUDED */
@@ -0,0 +1,97 @@
+#include "QueryCache.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+TEST(QueryCache, CompilesQueries) {
+  QueryCache cache(10);
+  auto query = cache.Get("/foo[@bar = 1]");
+  EXPECT_EQ("/foo[@bar = 1]", query->expression);
+  EXPECT_EQ(query->expression.size(), query->tokenize_result);
+  EXPECT_EQ(8, query->tokens.size());
+  ASSERT_EQ(query->tokens.size(), query->symbols.size());
+  EXPECT_EQ("foo", GlobalInterner()->text(query->symbols[1]));
+  EXPECT_EQ(Interner::kNone, query->symbols[2]);
+  EXPECT_TRUE(query->valid);
+  EXPECT_EQ("(/ (child::foo (= (path (attribute::bar)) 1)))",
+            DebugString(query->ast));
+}
+
+TEST(QueryCache, CachesInvalidQueries) {
+  QueryCache cache(10);
+  auto query = cache.Get("foo ~");
+  EXPECT_EQ(4, query->tokenize_result);
+  EXPECT_FALSE(query->valid);
+  EXPECT_EQ(4, query->error_offset);
+  EXPECT_EQ(query, cache.Get("foo ~"));
+}
+
+TEST(QueryCache, CountsHitsAndMisses) {
+  QueryCache cache(10);
+  auto a = cache.Get("a");
+  auto b = cache.Get("b");
+  EXPECT_EQ(a, cache.Get("a"));
+  EXPECT_EQ(b, cache.Get("b"));
+  EXPECT_EQ(a, cache.Get("a"));
+  QueryCache::Stats stats = cache.stats();
+  EXPECT_EQ(3, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(0, stats.evictions);
+  EXPECT_EQ(2, stats.size);
+}
+
+TEST(QueryCache, EvictsLeastRecentlyUsed) {
+  QueryCache cache(2, 1);
+  auto a = cache.Get("a");
+  auto b = cache.Get("b");
+  cache.Get("a");
+  cache.Get("c");  // Evicts "b".
+  EXPECT_EQ(1, cache.stats().evictions);
+  EXPECT_EQ(2, cache.stats().size);
+  EXPECT_EQ(a, cache.Get("a"));
+  EXPECT_NE(b, cache.Get("b"));
+  // The evicted query remains usable.
+  EXPECT_EQ("b", b->expression);
+  EXPECT_EQ(2, cache.stats().evictions);
+}
+
+TEST(QueryCache, Clear) {
+  QueryCache cache(10);
+  auto a = cache.Get("a");
+  cache.Clear();
+  EXPECT_EQ(0, cache.stats().size);
+  EXPECT_NE(a, cache.Get("a"));
+  EXPECT_EQ(2, cache.stats().misses);
+}
+
+TEST(QueryCache, ConcurrentAccess) {
+  QueryCache cache(16, 4);
+  vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.push_back(std::thread([&cache, t]() {
+      for (int i = 0; i < 1000; ++i) {
+        string expression = "/a/b[" + std::to_string((i * 7 + t) % 24) + "]";
+        auto query = cache.Get(expression);
+        EXPECT_EQ(expression, query->expression);
+        EXPECT_TRUE(query->valid);
+      }
+    }));
+  }
+  for (auto& thread : threads) thread.join();
+  QueryCache::Stats stats = cache.stats();
+  EXPECT_EQ(4000, stats.hits + stats.misses);
+  EXPECT_LE(stats.size, 16);
+  // Concurrent misses on the same expression insert it only once.
+  EXPECT_GE(stats.misses, stats.evictions + stats.size);
+}
+
+}  // namespace
+}  // namespace xpath
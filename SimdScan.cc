@@ -0,0 +1,218 @@
+#include "SimdScan.h"
+#include "CharClasses.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XPATH_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace xpath {
+
+namespace {
+
+// Scalar reference implementations. The vectorized kernels below fall back to
+// these for the last few bytes of the input.
+
+size_t FindCharScalar(const char* data, size_t size, char c) {
+  size_t n = 0;
+  while (n != size && data[n] != c) ++n;
+  return n;
+}
+
+size_t SpanSpacesScalar(const char* data, size_t size) {
+  size_t n = 0;
+  while (n != size && IsSpace(data[n])) ++n;
+  return n;
+}
+
+size_t SpanIdentifierCharsScalar(const char* data, size_t size) {
+  size_t n = 0;
+  while (n != size && IsIdentifierChar(data[n])) ++n;
+  return n;
+}
+
+const ScanKernels kScalarKernels = {
+  FindCharScalar, SpanSpacesScalar, SpanIdentifierCharsScalar };
+
+#ifdef XPATH_HAVE_X86_SIMD
+
+// The vectorized kernels compute a byte mask of matching characters per block
+// of 16 or 32 bytes, and use the bit index of the first (non-)match in the
+// mask to locate the end of the run. Bytes are compared as signed 8-bit
+// integers, so range checks [lo, hi] first shift `lo` down to -128.
+
+// Returns a byte mask of the bytes in `v` in the range [lo, hi].
+TARGET_SSE2 inline __m128i InRange(__m128i v, char lo, char hi) {
+  __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(char(0x80 - lo)));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8(char(-128 + (hi - lo + 1))));
+}
+
+// Returns a byte mask of the whitespace characters in `v`: ' ' and '\t'
+// through '\r', which matches C_Space.
+TARGET_SSE2 inline __m128i SpaceMask(__m128i v) {
+  return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                      InRange(v, '\t', '\r'));
+}
+
+// Returns a byte mask of the identifier characters in `v`, which matches
+// C_Identifier. Setting bit 5 maps upper case letters to lower case, and
+// does not map any other character into the range of letters.
+TARGET_SSE2 inline __m128i IdentifierMask(__m128i v) {
+  __m128i letters = InRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+  __m128i digits = InRange(v, '0', '9');
+  __m128i others = _mm_or_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))));
+  return _mm_or_si128(letters, _mm_or_si128(digits, others));
+}
+
+TARGET_SSE2 inline __m128i Load128(const char* data) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+TARGET_SSE2 size_t FindCharSse2(const char* data, size_t size, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t n = 0;
+  for (; size - n >= 16; n += 16) {
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(Load128(data + n), needle));
+    if (mask != 0) return n + __builtin_ctz(mask);
+  }
+  return n + FindCharScalar(data + n, size - n, c);
+}
+
+TARGET_SSE2 size_t SpanSpacesSse2(const char* data, size_t size) {
+  size_t n = 0;
+  for (; size - n >= 16; n += 16) {
+    unsigned mask = _mm_movemask_epi8(SpaceMask(Load128(data + n)));
+    if (mask != 0xffff) return n + __builtin_ctz(~mask);
+  }
+  return n + SpanSpacesScalar(data + n, size - n);
+}
+
+TARGET_SSE2 size_t SpanIdentifierCharsSse2(const char* data, size_t size) {
+  size_t n = 0;
+  for (; size - n >= 16; n += 16) {
+    unsigned mask = _mm_movemask_epi8(IdentifierMask(Load128(data + n)));
+    if (mask != 0xffff) return n + __builtin_ctz(~mask);
+  }
+  return n + SpanIdentifierCharsScalar(data + n, size - n);
+}
+
+const ScanKernels kSse2Kernels = {
+  FindCharSse2, SpanSpacesSse2, SpanIdentifierCharsSse2 };
+
+TARGET_AVX2 inline __m256i InRange(__m256i v, char lo, char hi) {
+  __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(char(0x80 - lo)));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8(char(-128 + (hi - lo + 1))),
+                           shifted);
+}
+
+TARGET_AVX2 inline __m256i SpaceMask(__m256i v) {
+  return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                         InRange(v, '\t', '\r'));
+}
+
+TARGET_AVX2 inline __m256i IdentifierMask(__m256i v) {
+  __m256i letters =
+      InRange(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+  __m256i digits = InRange(v, '0', '9');
+  __m256i others = _mm256_or_si256(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')),
+                      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('.'))));
+  return _mm256_or_si256(letters, _mm256_or_si256(digits, others));
+}
+
+TARGET_AVX2 inline __m256i Load256(const char* data) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+}
+
+// The AVX2 kernels process 32 bytes at a time, and leave the remainder to the
+// SSE2 kernels. The compiler does not clear the upper halves of the AVX
+// registers before calling non-VEX code, which makes some CPUs pay a large
+// transition penalty on every call, so do it explicitly.
+
+TARGET_AVX2 size_t FindCharAvx2(const char* data, size_t size, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t n = 0;
+  for (; size - n >= 32; n += 32) {
+    unsigned mask =
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(Load256(data + n), needle));
+    if (mask != 0) return n + __builtin_ctz(mask);
+  }
+  _mm256_zeroupper();
+  return n + FindCharSse2(data + n, size - n, c);
+}
+
+TARGET_AVX2 size_t SpanSpacesAvx2(const char* data, size_t size) {
+  size_t n = 0;
+  for (; size - n >= 32; n += 32) {
+    unsigned mask = _mm256_movemask_epi8(SpaceMask(Load256(data + n)));
+    if (mask != 0xffffffffu) return n + __builtin_ctz(~mask);
+  }
+  _mm256_zeroupper();
+  return n + SpanSpacesSse2(data + n, size - n);
+}
+
+TARGET_AVX2 size_t SpanIdentifierCharsAvx2(const char* data, size_t size) {
+  size_t n = 0;
+  for (; size - n >= 32; n += 32) {
+    unsigned mask = _mm256_movemask_epi8(IdentifierMask(Load256(data + n)));
+    if (mask != 0xffffffffu) return n + __builtin_ctz(~mask);
+  }
+  _mm256_zeroupper();
+  return n + SpanIdentifierCharsSse2(data + n, size - n);
+}
+
+const ScanKernels kAvx2Kernels = {
+  FindCharAvx2, SpanSpacesAvx2, SpanIdentifierCharsAvx2 };
+
+#endif  // XPATH_HAVE_X86_SIMD
+
+const ScanKernels& Kernels() {
+  static const ScanKernels* const kernels = GetScanKernels(DetectSimdLevel());
+  return *kernels;
+}
+
+}  // namespace
+
+SimdLevel DetectSimdLevel() {
+#ifdef XPATH_HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+  return SIMD_None;
+}
+
+const ScanKernels* GetScanKernels(SimdLevel level) {
+  switch (level) {
+    case SIMD_None:
+      return &kScalarKernels;
+#ifdef XPATH_HAVE_X86_SIMD
+    case SIMD_SSE2:
+      return &kSse2Kernels;
+    case SIMD_AVX2:
+      return &kAvx2Kernels;
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+size_t FindChar(const char* data, size_t size, char c) {
+  return Kernels().find_char(data, size, c);
+}
+
+size_t SpanSpaces(const char* data, size_t size) {
+  return Kernels().span_spaces(data, size);
+}
+
+size_t SpanIdentifierChars(const char* data, size_t size) {
+  return Kernels().span_identifier_chars(data, size);
+}
+
+}  // namespace xpath
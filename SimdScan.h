@@ -0,0 +1,47 @@
+#ifndef XPATH_SIMD_SCAN_INCLUDED
+#define XPATH_SIMD_SCAN_INCLUDED
+
+#include <stdlib.h>
+
+namespace xpath {
+
+// Character scanning kernels used by ScanToken() to process long runs of
+// characters. Each function is implemented with scalar code and, on x86, with
+// SSE2 and AVX2 instructions; the best implementation supported by the CPU is
+// selected at runtime.
+
+// Returns the index of the first occurrence of `c` in the string described by
+// `data` and `size`, or `size` if `c` does not occur.
+size_t FindChar(const char* data, size_t size, char c);
+
+// Returns the length of the longest prefix of the string described by `data`
+// and `size` that consists of whitespace characters only.
+size_t SpanSpaces(const char* data, size_t size);
+
+// Returns the length of the longest prefix of the string described by `data`
+// and `size` that consists of identifier characters only (see ScanToken()).
+size_t SpanIdentifierChars(const char* data, size_t size);
+
+enum SimdLevel {
+  SIMD_None = 0,
+  SIMD_SSE2,
+  SIMD_AVX2 };
+
+// Returns the highest level of SIMD instructions supported by the CPU.
+SimdLevel DetectSimdLevel();
+
+// The implementation of the functions above at a particular SIMD level.
+struct ScanKernels {
+  size_t (*find_char)(const char* data, size_t size, char c);
+  size_t (*span_spaces)(const char* data, size_t size);
+  size_t (*span_identifier_chars)(const char* data, size_t size);
+};
+
+// Returns the kernels for the given level, or nullptr if they are not
+// available in this build. This is mainly useful for testing and benchmarking;
+// the functions above use the kernels for DetectSimdLevel().
+const ScanKernels* GetScanKernels(SimdLevel level);
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_SIMD_SCAN_INCLUDED */
@@ -0,0 +1,100 @@
+#include "SimdScan.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+vector<SimdLevel> AvailableLevels() {
+  vector<SimdLevel> levels;
+  for (int level = SIMD_None; level <= DetectSimdLevel(); ++level) {
+    if (GetScanKernels(SimdLevel(level))) levels.push_back(SimdLevel(level));
+  }
+  return levels;
+}
+
+TEST(SimdScan, ScalarKernelsAlwaysAvailable) {
+  EXPECT_NE(nullptr, GetScanKernels(SIMD_None));
+  EXPECT_NE(nullptr, GetScanKernels(DetectSimdLevel()));
+}
+
+TEST(SimdScan, Examples) {
+  for (SimdLevel level : AvailableLevels()) {
+    const ScanKernels& kernels = *GetScanKernels(level);
+    EXPECT_EQ(0, kernels.find_char("", 0, 'x')) << level;
+    EXPECT_EQ(3, kernels.find_char("abc'", 4, '\'')) << level;
+    EXPECT_EQ(5, kernels.find_char("abcde", 5, '\'')) << level;
+    EXPECT_EQ(0, kernels.span_spaces("x ", 2)) << level;
+    EXPECT_EQ(6, kernels.span_spaces(" \t\n\v\f\rx", 7)) << level;
+    EXPECT_EQ(0, kernels.span_identifier_chars("/a", 2)) << level;
+    EXPECT_EQ(9, kernels.span_identifier_chars("aZ_-.09zA:", 10)) << level;
+  }
+}
+
+// Compares all kernels with the scalar implementation on random strings of
+// various lengths, built from characters that are likely to occur in
+// expressions, including bytes outside the ASCII range.
+TEST(SimdScan, MatchesScalar) {
+  const string alphabet = "aAzZ09_-.: \t\r\n\v\f\x08\x0e/'\"@[\x80\xe1\xff";
+  const ScanKernels& scalar = *GetScanKernels(SIMD_None);
+  srand(42);
+  for (int iteration = 0; iteration < 2000; ++iteration) {
+    size_t size = rand() % 100;
+    // Use long runs of a single character class, so that the kernels don't
+    // always stop in the first block.
+    const string run_chars[] = {"ab-Z._09", " \t\r\n"};
+    const string& run = run_chars[rand() % 2];
+    string input;
+    size_t run_length = rand() % (size + 1);
+    for (size_t i = 0; i < size; ++i) {
+      input += i < run_length ? run[rand() % run.size()]
+                              : alphabet[rand() % alphabet.size()];
+    }
+    // Test unaligned starts as well.
+    size_t offset = size > 0 ? rand() % (size + 1) : 0;
+    const char* data = input.data() + offset;
+    size_t length = size - offset;
+    char c = alphabet[rand() % alphabet.size()];
+    for (SimdLevel level : AvailableLevels()) {
+      const ScanKernels& kernels = *GetScanKernels(level);
+      EXPECT_EQ(scalar.find_char(data, length, c),
+                kernels.find_char(data, length, c)) << level << input;
+      EXPECT_EQ(scalar.span_spaces(data, length),
+                kernels.span_spaces(data, length)) << level << input;
+      EXPECT_EQ(scalar.span_identifier_chars(data, length),
+                kernels.span_identifier_chars(data, length)) << level << input;
+    }
+  }
+}
+
+TEST(SimdScan, AllByteValues) {
+  const ScanKernels& scalar = *GetScanKernels(SIMD_None);
+  for (int c = 0; c < 256; ++c) {
+    // Place the byte at every position of a 64-byte run.
+    for (size_t i = 0; i < 64; ++i) {
+      string spaces(64, ' '), identifier(64, 'x');
+      spaces[i] = identifier[i] = char(c);
+      for (SimdLevel level : AvailableLevels()) {
+        const ScanKernels& kernels = *GetScanKernels(level);
+        EXPECT_EQ(scalar.span_spaces(spaces.data(), spaces.size()),
+                  kernels.span_spaces(spaces.data(), spaces.size()))
+            << level << " " << c;
+        EXPECT_EQ(scalar.span_identifier_chars(identifier.data(), identifier.size()),
+                  kernels.span_identifier_chars(identifier.data(), identifier.size()))
+            << level << " " << c;
+        EXPECT_EQ(scalar.find_char(identifier.data(), identifier.size(), char(c)),
+                  kernels.find_char(identifier.data(), identifier.size(), char(c)))
+            << level << " " << c;
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace xpath
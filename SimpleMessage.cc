@@ -0,0 +1,151 @@
+#include "SimpleMessage.h"
+
+#include "CharClasses.h"
+
+#include <assert.h>
+
+namespace xpath {
+
+namespace {
+
+class TextParser {
+ public:
+  explicit TextParser(const std::string& text) : text_(text), pos_(0) {}
+
+  // Parses fields into `message` until the end of the input (if `nested` is
+  // false) or a closing brace (if `nested` is true).
+  bool ParseFields(SimpleMessage* message, bool nested) {
+    for (;;) {
+      SkipSpaces();
+      if (pos_ == text_.size()) return !nested;
+      if (text_[pos_] == '}') {
+        if (!nested) return false;
+        ++pos_;
+        return true;
+      }
+      std::string name;
+      if (!ParseName(&name)) return false;
+      SkipSpaces();
+      if (Consume(':')) {
+        SkipSpaces();
+        if (Consume('{')) {
+          if (!ParseFields(message->AddMessage(name), true)) return false;
+        } else {
+          std::string value;
+          if (!ParseScalar(&value)) return false;
+          message->AddScalar(name, value);
+        }
+      } else if (Consume('{')) {
+        if (!ParseFields(message->AddMessage(name), true)) return false;
+      } else {
+        return false;
+      }
+    }
+  }
+
+ private:
+  void SkipSpaces() {
+    while (pos_ < text_.size() && IsSpace(text_[pos_])) ++pos_;
+  }
+
+  bool Consume(char c) {
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool ParseName(std::string* name) {
+    size_t begin = pos_;
+    if (pos_ == text_.size() || !IsIdentifierStartChar(text_[pos_])) {
+      return false;
+    }
+    while (pos_ < text_.size() && IsIdentifierChar(text_[pos_])) ++pos_;
+    name->assign(text_, begin, pos_ - begin);
+    return true;
+  }
+
+  bool ParseScalar(std::string* value) {
+    if (pos_ == text_.size()) return false;
+    char quote = text_[pos_];
+    if (quote == '"' || quote == '\'') {
+      size_t end = text_.find(quote, pos_ + 1);
+      if (end == std::string::npos) return false;
+      value->assign(text_, pos_ + 1, end - pos_ - 1);
+      pos_ = end + 1;
+      return true;
+    }
+    size_t begin = pos_;
+    while (pos_ < text_.size() && !IsSpace(text_[pos_]) &&
+           text_[pos_] != '{' && text_[pos_] != '}' && text_[pos_] != ':') {
+      ++pos_;
+    }
+    if (pos_ == begin) return false;
+    value->assign(text_, begin, pos_ - begin);
+    return true;
+  }
+
+  const std::string& text_;
+  size_t pos_;
+};
+
+}  // namespace
+
+SimpleMessage::Field* SimpleMessage::GetField(const std::string& name,
+                                              bool is_message) {
+  for (auto& field : fields_) {
+    if (field.name == name) {
+      assert(field.is_message == is_message);
+      return &field;
+    }
+  }
+  fields_.push_back(Field());
+  fields_.back().name = name;
+  fields_.back().is_message = is_message;
+  return &fields_.back();
+}
+
+SimpleMessage* SimpleMessage::AddMessage(const std::string& name) {
+  Field* field = GetField(name, true);
+  field->messages.push_back(
+      std::unique_ptr<SimpleMessage>(new SimpleMessage()));
+  return field->messages.back().get();
+}
+
+void SimpleMessage::AddScalar(const std::string& name,
+                              const std::string& value) {
+  GetField(name, false)->scalars.push_back(value);
+}
+
+std::unique_ptr<SimpleMessage> SimpleMessage::ParseText(
+    const std::string& text) {
+  std::unique_ptr<SimpleMessage> message(new SimpleMessage());
+  if (!TextParser(text).ParseFields(message.get(), false)) message.reset();
+  return message;
+}
+
+int SimpleMessage::field_count() const { return fields_.size(); }
+
+const std::string& SimpleMessage::field_name(int field) const {
+  return fields_[field].name;
+}
+
+bool SimpleMessage::is_message_field(int field) const {
+  return fields_[field].is_message;
+}
+
+size_t SimpleMessage::value_count(int field) const {
+  const Field& f = fields_[field];
+  return f.is_message ? f.messages.size() : f.scalars.size();
+}
+
+const Message& SimpleMessage::message_value(int field, size_t index) const {
+  return *fields_[field].messages[index];
+}
+
+std::string SimpleMessage::scalar_value(int field, size_t index) const {
+  return fields_[field].scalars[index];
+}
+
+}  // namespace xpath
@@ -0,0 +1,59 @@
+#ifndef XPATH_SIMPLE_MESSAGE_INCLUDED
+#define XPATH_SIMPLE_MESSAGE_INCLUDED
+
+#include "Message.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xpath {
+
+// A self-describing Message implementation that does not depend on the
+// protobuf runtime. Fields are defined implicitly, in the order in which
+// values are first added to them.
+class SimpleMessage : public Message {
+ public:
+  SimpleMessage() {}
+
+  // Appends an empty message to the field `name` and returns it.
+  SimpleMessage* AddMessage(const std::string& name);
+
+  // Appends a scalar value to the field `name`.
+  void AddScalar(const std::string& name, const std::string& value);
+
+  // Parses a message in a subset of the protobuf text format, for example:
+  //
+  //   id: 1 name: "foo" item { id: 2 } item { id: 3 }
+  //
+  // Scalar values are quoted strings (with single or double quotes, without
+  // escape sequences) or unquoted tokens. Returns nullptr if the text is
+  // malformed.
+  static std::unique_ptr<SimpleMessage> ParseText(const std::string& text);
+
+  int field_count() const;
+  const std::string& field_name(int field) const;
+  bool is_message_field(int field) const;
+  size_t value_count(int field) const;
+  const Message& message_value(int field, size_t index) const;
+  std::string scalar_value(int field, size_t index) const;
+
+ private:
+  struct Field {
+    std::string name;
+    bool is_message;
+    std::vector<std::unique_ptr<SimpleMessage>> messages;
+    std::vector<std::string> scalars;
+  };
+
+  Field* GetField(const std::string& name, bool is_message);
+
+  std::vector<Field> fields_;
+
+  SimpleMessage(const SimpleMessage&);
+  void operator=(const SimpleMessage&);
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_SIMPLE_MESSAGE_INCLUDED */
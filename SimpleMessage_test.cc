@@ -0,0 +1,53 @@
+#include "SimpleMessage.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+using std::string;
+using std::unique_ptr;
+
+namespace xpath {
+namespace {
+
+TEST(SimpleMessage, FieldsInOrderOfFirstUse) {
+  SimpleMessage message;
+  message.AddScalar("id", "1");
+  SimpleMessage* item = message.AddMessage("item");
+  item->AddScalar("name", "a");
+  message.AddScalar("id", "2");
+  message.AddMessage("item");
+
+  ASSERT_EQ(2, message.field_count());
+  EXPECT_EQ("id", message.field_name(0));
+  EXPECT_FALSE(message.is_message_field(0));
+  EXPECT_EQ(2, message.value_count(0));
+  EXPECT_EQ("2", message.scalar_value(0, 1));
+  EXPECT_EQ("item", message.field_name(1));
+  EXPECT_TRUE(message.is_message_field(1));
+  EXPECT_EQ(2, message.value_count(1));
+  EXPECT_EQ(item, &message.message_value(1, 0));
+  EXPECT_EQ(0, message.message_value(1, 1).field_count());
+}
+
+TEST(SimpleMessage, ParseText) {
+  unique_ptr<SimpleMessage> message = SimpleMessage::ParseText(
+      "id: 1 name: \"a b\" item { id: 'x' } item: { } tag: -2.5");
+  ASSERT_TRUE(message != nullptr);
+  ASSERT_EQ(4, message->field_count());
+  EXPECT_EQ("1", message->scalar_value(0, 0));
+  EXPECT_EQ("a b", message->scalar_value(1, 0));
+  EXPECT_EQ(2, message->value_count(2));
+  EXPECT_EQ("x", message->message_value(2, 0).scalar_value(0, 0));
+  EXPECT_EQ("-2.5", message->scalar_value(3, 0));
+
+  EXPECT_TRUE(SimpleMessage::ParseText("") != nullptr);
+  EXPECT_TRUE(SimpleMessage::ParseText("a {") == nullptr);
+  EXPECT_TRUE(SimpleMessage::ParseText("a }") == nullptr);
+  EXPECT_TRUE(SimpleMessage::ParseText("a: 'x") == nullptr);
+  EXPECT_TRUE(SimpleMessage::ParseText("a 1") == nullptr);
+  EXPECT_TRUE(SimpleMessage::ParseText("1: a") == nullptr);
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,757 @@
+#include "StreamEvaluator.h"
+
+#include "CLocale.h"
+#include "Evaluator.h"
+#include "Optimizer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace xpath {
+
+const uint32_t StreamEvaluator::kNone;
+const size_t StreamEvaluator::kMaxSteps;
+
+namespace {
+
+// Field numbers below this are looked up in WireSchema::Type::dense.
+const uint32_t kMaxDenseNumber = 256;
+
+// The maximum nesting of messages and groups, as in the protobuf runtime.
+const int kMaxDepth = 100;
+
+enum WireType {
+  kVarint = 0,
+  kFixed64 = 1,
+  kLengthDelimited = 2,
+  kStartGroup = 3,
+  kEndGroup = 4,
+  kFixed32 = 5 };
+
+// A field read from the wire format. Varint and fixed-size values are in
+// `bits`, and length-delimited values in `data` and `size`.
+struct WireValue {
+  uint32_t number;
+  uint32_t wire_type;
+  uint64_t bits;
+  const char* data;
+  size_t size;
+};
+
+bool ReadVarint(const char** pos, const char* end, uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*pos == end) return false;
+    uint8_t byte = **pos;
+    ++*pos;
+    result |= uint64_t(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ReadFixed(const char** pos, const char* end, size_t size,
+               uint64_t* value) {
+  if (size_t(end - *pos) < size) return false;
+  uint64_t result = 0;
+  for (size_t i = 0; i < size; ++i) {
+    result |= uint64_t(uint8_t((*pos)[i])) << (8 * i);
+  }
+  *pos += size;
+  *value = result;
+  return true;
+}
+
+bool SkipGroup(const char** pos, const char* end, uint32_t number, int depth);
+
+// Reads the field at *pos and advances past it. The contents of groups are
+// skipped; an end-group tag is returned as a field of its own.
+bool ReadField(const char** pos, const char* end, WireValue* field,
+               int depth) {
+  uint64_t tag;
+  if (!ReadVarint(pos, end, &tag) || tag >> 32 != 0) return false;
+  field->number = uint32_t(tag >> 3);
+  field->wire_type = tag & 7;
+  if (field->number == 0) return false;
+  switch (field->wire_type) {
+    case kVarint:
+      return ReadVarint(pos, end, &field->bits);
+    case kFixed64:
+      return ReadFixed(pos, end, 8, &field->bits);
+    case kFixed32:
+      return ReadFixed(pos, end, 4, &field->bits);
+    case kLengthDelimited: {
+      uint64_t size;
+      if (!ReadVarint(pos, end, &size) || size > uint64_t(end - *pos)) {
+        return false;
+      }
+      field->data = *pos;
+      field->size = size;
+      *pos += size;
+      return true;
+    }
+    case kStartGroup:
+      return SkipGroup(pos, end, field->number, depth + 1);
+    case kEndGroup:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool SkipGroup(const char** pos, const char* end, uint32_t number,
+               int depth) {
+  if (depth > kMaxDepth) return false;
+  WireValue field;
+  while (*pos < end) {
+    if (!ReadField(pos, end, &field, depth)) return false;
+    if (field.wire_type == kEndGroup) return field.number == number;
+  }
+  return false;
+}
+
+// Reads the next field of a message, which must not be an end-group tag.
+bool ReadMessageField(const char** pos, const char* end, WireValue* field) {
+  return ReadField(pos, end, field, 0) && field->wire_type != kEndGroup;
+}
+
+WireType GetWireType(WireFieldType type) {
+  switch (type) {
+    case W_Fixed32:
+    case W_SFixed32:
+    case W_Float:
+      return kFixed32;
+    case W_Fixed64:
+    case W_SFixed64:
+    case W_Double:
+      return kFixed64;
+    case W_String:
+    case W_Bytes:
+    case W_Message:
+      return kLengthDelimited;
+    default:
+      return kVarint;
+  }
+}
+
+// Formats a floating-point number with as few digits as needed to read it
+// back, as the protobuf text format does.
+std::string FormatFloatingPoint(double value, bool is_float) {
+  if (isnan(value)) return "nan";
+  if (isinf(value)) return value > 0 ? "inf" : "-inf";
+  char buffer[32];
+  SnprintfC(buffer, sizeof(buffer), "%.*g", is_float ? 6 : 15, value);
+  double parsed = StrtodC(buffer, nullptr);
+  if (is_float ? float(parsed) != float(value) : parsed != value) {
+    SnprintfC(buffer, sizeof(buffer), "%.*g", is_float ? 9 : 17, value);
+  }
+  return buffer;
+}
+
+// Converts a varint or fixed-size value to a string as in the protobuf text
+// format.
+std::string FormatScalar(WireFieldType type, uint64_t bits) {
+  switch (type) {
+    case W_Int32:
+    case W_Enum:
+    case W_SFixed32:
+      return std::to_string(int32_t(uint32_t(bits)));
+    case W_Int64:
+    case W_SFixed64:
+      return std::to_string(static_cast<long long>(bits));
+    case W_UInt32:
+    case W_Fixed32:
+      return std::to_string(uint32_t(bits));
+    case W_UInt64:
+    case W_Fixed64:
+      return std::to_string(static_cast<unsigned long long>(bits));
+    case W_SInt32: {
+      uint32_t n = uint32_t(bits);
+      return std::to_string(int32_t((n >> 1) ^ (0 - (n & 1))));
+    }
+    case W_SInt64:
+      return std::to_string(
+          static_cast<long long>((bits >> 1) ^ (0 - (bits & 1))));
+    case W_Bool:
+      return bits != 0 ? "true" : "false";
+    case W_Float: {
+      uint32_t n = uint32_t(bits);
+      float value;
+      memcpy(&value, &n, sizeof(value));
+      return FormatFloatingPoint(value, true);
+    }
+    default: {
+      double value;
+      memcpy(&value, &bits, sizeof(value));
+      return FormatFloatingPoint(value, false);
+    }
+  }
+}
+
+// Appends the values of a scalar field to *values. Numeric fields may be
+// packed. Values whose wire type does not match the field type are ignored,
+// as unknown fields are. Returns false if a packed field is malformed.
+bool DecodeScalars(WireFieldType type, const WireValue& field,
+                   std::vector<std::string>* values) {
+  WireType wire_type = GetWireType(type);
+  if (field.wire_type == uint32_t(wire_type)) {
+    if (wire_type == kLengthDelimited) {
+      values->push_back(std::string(field.data, field.size));
+    } else {
+      values->push_back(FormatScalar(type, field.bits));
+    }
+    return true;
+  }
+  if (field.wire_type != kLengthDelimited) return true;
+  const char* pos = field.data;
+  const char* end = pos + field.size;
+  while (pos < end) {
+    uint64_t bits;
+    bool ok = wire_type == kVarint ? ReadVarint(&pos, end, &bits)
+                                   : ReadFixed(&pos, end,
+                                               wire_type == kFixed32 ? 4 : 8,
+                                               &bits);
+    if (!ok) return false;
+    values->push_back(FormatScalar(type, bits));
+  }
+  return true;
+}
+
+}  // namespace
+
+int WireSchema::AddType() {
+  types_.push_back(Type());
+  return types_.size() - 1;
+}
+
+void WireSchema::AddField(int type, uint32_t number, const std::string& name,
+                          WireFieldType field_type, int message_type) {
+  Type& t = types_[type];
+  WireField field;
+  field.number = number;
+  field.name = name;
+  field.type = field_type;
+  field.message_type = field_type == W_Message ? message_type : -1;
+  int index = t.fields.size();
+  t.fields.push_back(field);
+  if (number < kMaxDenseNumber) {
+    if (t.dense.size() <= number) t.dense.resize(number + 1, -1);
+    t.dense[number] = index;
+  } else {
+    t.sparse[number] = index;
+  }
+}
+
+int WireSchema::FindField(int type, uint32_t number) const {
+  const Type& t = types_[type];
+  if (number < kMaxDenseNumber) {
+    return number < t.dense.size() ? t.dense[number] : -1;
+  }
+  auto it = t.sparse.find(number);
+  return it == t.sparse.end() ? -1 : it->second;
+}
+
+// A node that conditions are evaluated on: an element or the root node,
+// given by its type and its serialized fields, or an attribute, given by its
+// value.
+struct StreamEvaluator::Node {
+  int type;
+  const char* data;
+  size_t size;
+  const std::string* value;
+};
+
+struct StreamEvaluator::Run {
+  bool stop_at_first;
+  bool done;
+  size_t count;
+  std::vector<std::string>* values;
+};
+
+StreamEvaluator::StreamEvaluator(const WireSchema* schema)
+    : schema_(schema), root_type_(0), selected_bit_(1) {
+  ComputeMasks();
+}
+
+bool StreamEvaluator::Compile(const std::string& expression, int root_type,
+                              size_t* error_offset) {
+  root_type_ = root_type;
+  steps_.clear();
+  conditions_.clear();
+  ComputeMasks();
+
+  Ast ast;
+  if (!Parse(expression, &ast, error_offset)) return false;
+  Optimize(&ast);
+  const Expr& path = ast.node(ast.root());
+  // A relative path is evaluated from the root, just like an absolute one.
+  if (path.type != X_Path ||
+      (!path.absolute && ast.node(path.first_child).type != X_Step)) {
+    *error_offset = path.text_offset;
+    return false;
+  }
+  bool attribute = false;
+  for (uint32_t step = path.first_child; step != Ast::kNone;
+       step = ast.node(step).next_sibling) {
+    // The kind of the nodes that the step selects.
+    switch (ast.node(step).axis) {
+      case A_Attribute: attribute = true; break;
+      case A_Child: case A_Descendant: attribute = false; break;
+      default: break;
+    }
+    if (!CompileStep(ast, step, attribute, error_offset)) {
+      steps_.clear();
+      conditions_.clear();
+      ComputeMasks();
+      return false;
+    }
+  }
+  ComputeMasks();
+  return true;
+}
+
+bool StreamEvaluator::CompileStep(const Ast& ast, uint32_t step,
+                                  bool attribute, size_t* error_offset) {
+  const Expr& s = ast.node(step);
+  switch (s.axis) {
+    case A_Child:
+    case A_Descendant:
+    case A_DescendantOrSelf:
+    case A_Attribute:
+    case A_Self:
+      break;
+    default:
+      *error_offset = s.text_offset;
+      return false;
+  }
+  if (s.first_only || steps_.size() == kMaxSteps) {
+    *error_offset = s.text_offset;
+    return false;
+  }
+  Step compiled;
+  compiled.axis = s.axis;
+  compiled.node_type = s.node_type;
+  compiled.name = ast.text(s);
+  compiled.condition = kNone;
+  // Without positional predicates, [a][b] is the same as [a and b].
+  for (uint32_t predicate = s.first_child; predicate != Ast::kNone;
+       predicate = ast.node(predicate).next_sibling) {
+    uint32_t condition =
+        CompileCondition(ast, predicate, attribute, error_offset);
+    if (condition == kNone) return false;
+    if (compiled.condition != kNone) {
+      Condition both = Condition();
+      both.type = C_And;
+      both.first = compiled.condition;
+      both.second = condition;
+      conditions_.push_back(both);
+      condition = conditions_.size() - 1;
+    }
+    compiled.condition = condition;
+  }
+  steps_.push_back(compiled);
+  return true;
+}
+
+// Compiles a predicate, or part of one, that is evaluated on an attribute
+// if `attribute` is true, or on an element. Returns the index of the
+// condition, or kNone if the predicate is not supported.
+uint32_t StreamEvaluator::CompileCondition(const Ast& ast, uint32_t expr,
+                                           bool attribute,
+                                           size_t* error_offset) {
+  const Expr& e = ast.node(expr);
+  Condition c = Condition();
+  bool supported = true;
+  switch (e.type) {
+    case X_Boolean:
+      c.type = e.number != 0 ? C_True : C_False;
+      break;
+    case X_And:
+    case X_Or: {
+      c.type = e.type == X_And ? C_And : C_Or;
+      c.first = CompileCondition(ast, e.first_child, attribute, error_offset);
+      if (c.first == kNone) return kNone;
+      c.second = CompileCondition(ast, ast.node(e.first_child).next_sibling,
+                                  attribute, error_offset);
+      if (c.second == kNone) return kNone;
+      break;
+    }
+    case X_FunctionCall:
+      supported = e.function == F_Not && e.first_child != Ast::kNone &&
+                  ast.node(e.first_child).next_sibling == Ast::kNone;
+      if (!supported) break;
+      c.type = C_Not;
+      c.first = CompileCondition(ast, e.first_child, attribute, error_offset);
+      if (c.first == kNone) return kNone;
+      break;
+    case X_Path:
+      supported = GetTerm(ast, expr, attribute, &c);
+      // The context node always exists.
+      if (c.self) c.type = C_True;
+      break;
+    case X_Equal:
+    case X_NotEqual:
+    case X_LessThan:
+    case X_LessEqual:
+    case X_GreaterThan:
+    case X_GreaterEqual: {
+      uint32_t left = e.first_child, right = ast.node(left).next_sibling;
+      c.op = e.type;
+      ExprType right_type = ast.node(right).type;
+      if (right_type != X_Literal && right_type != X_Number) {
+        std::swap(left, right);
+        c.op = SwapOperands(c.op);
+      }
+      const Expr& value = ast.node(right);
+      supported = (value.type == X_Literal || value.type == X_Number) &&
+                  GetTerm(ast, left, attribute, &c) &&
+                  c.type == C_Attribute;
+      if (!supported) break;
+      c.type = C_Compare;
+      c.is_number = value.type == X_Number;
+      if (c.is_number) {
+        c.number = value.number;
+      } else {
+        c.literal = ast.text(value);
+        c.number = StringToNumber(c.literal);
+      }
+      break;
+    }
+    default:
+      supported = false;
+      break;
+  }
+  if (!supported) {
+    *error_offset = e.text_offset;
+    return kNone;
+  }
+  conditions_.push_back(c);
+  return conditions_.size() - 1;
+}
+
+// Checks that `expr` is a node-set that a condition can test: the context
+// node if it is an attribute, or attributes or children of the context node
+// if it is an element. Sets the type and the node test of *condition.
+bool StreamEvaluator::GetTerm(const Ast& ast, uint32_t expr, bool attribute,
+                              Condition* condition) const {
+  const Expr& path = ast.node(expr);
+  if (path.type != X_Path || path.absolute) return false;
+  const Expr& step = ast.node(path.first_child);
+  if (step.type != X_Step || step.next_sibling != Ast::kNone ||
+      step.first_child != Ast::kNone || step.first_only) {
+    return false;
+  }
+  if (attribute) {
+    // `.`, which is where the value of an attribute is.
+    condition->type = C_Attribute;
+    condition->self = true;
+    return step.axis == A_Self && step.node_type == N_Node;
+  }
+  if (step.axis != A_Attribute && step.axis != A_Child) return false;
+  if (step.node_type != N_None && step.node_type != N_Node) return false;
+  condition->type = step.axis == A_Attribute ? C_Attribute : C_Child;
+  condition->name = ast.text(step);
+  condition->any_name = step.node_type == N_Node || condition->name == "*";
+  return true;
+}
+
+bool StreamEvaluator::MatchesNodeTest(const Step& step,
+                                      const WireField& field) const {
+  switch (step.node_type) {
+    case N_Node: return true;
+    case N_None: return step.name == "*" || step.name == field.name;
+    default: return false;
+  }
+}
+
+void StreamEvaluator::ComputeMasks() {
+  child_mask_ = attribute_mask_ = descendant_mask_ = self_mask_ = 0;
+  condition_mask_ = node_mask_ = 0;
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    const Step& step = steps_[i];
+    uint64_t bit = uint64_t(1) << i;
+    switch (step.axis) {
+      case A_Child: child_mask_ |= bit; break;
+      case A_Attribute: attribute_mask_ |= bit; break;
+      case A_Descendant: descendant_mask_ |= bit; break;
+      case A_DescendantOrSelf:
+        descendant_mask_ |= bit;
+        self_mask_ |= bit;
+        break;
+      default: self_mask_ |= bit; break;
+    }
+    if (step.condition != kNone) condition_mask_ |= bit;
+    if (step.node_type == N_Node) node_mask_ |= bit;
+  }
+  selected_bit_ = uint64_t(1) << steps_.size();
+
+  int type_count = schema_->type_count();
+  element_masks_.assign(type_count, std::vector<uint64_t>());
+  attribute_masks_.assign(type_count, std::vector<uint64_t>());
+  condition_fields_.assign(type_count, std::vector<int>());
+  for (int type = 0; type < type_count; ++type) {
+    int field_count = schema_->field_count(type);
+    element_masks_[type].assign(field_count, 0);
+    attribute_masks_[type].assign(field_count, 0);
+    for (int index = 0; index < field_count; ++index) {
+      const WireField& field = schema_->field(type, index);
+      uint64_t mask = 0;
+      for (size_t i = 0; i < steps_.size(); ++i) {
+        if (MatchesNodeTest(steps_[i], field)) mask |= uint64_t(1) << i;
+      }
+      if (field.type == W_Message) {
+        element_masks_[type][index] = mask;
+      } else {
+        attribute_masks_[type][index] = mask;
+      }
+    }
+    condition_fields_[type].assign(conditions_.size(), -1);
+    for (size_t i = 0; i < conditions_.size(); ++i) {
+      const Condition& c = conditions_[i];
+      if (c.type != C_Attribute && c.type != C_Child && c.type != C_Compare) {
+        continue;
+      }
+      for (int index = 0; index < field_count; ++index) {
+        const WireField& field = schema_->field(type, index);
+        if (field.name == c.name &&
+            (field.type == W_Message) == (c.type == C_Child)) {
+          condition_fields_[type][i] = index;
+        }
+      }
+    }
+  }
+
+  // The steps that match some element below each type, which is a fixed
+  // point since types can be recursive.
+  reachable_masks_.assign(type_count, 0);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int type = 0; type < type_count; ++type) {
+      uint64_t mask = 0;
+      for (int index = 0; index < schema_->field_count(type); ++index) {
+        const WireField& field = schema_->field(type, index);
+        if (field.type != W_Message) continue;
+        mask |= element_masks_[type][index] |
+                reachable_masks_[field.message_type];
+      }
+      mask &= descendant_mask_;
+      if (mask != reachable_masks_[type]) {
+        reachable_masks_[type] = mask;
+        changed = true;
+      }
+    }
+  }
+}
+
+// Sets *result to the value of a condition for `node`. Returns false if the
+// fields of the node are malformed.
+bool StreamEvaluator::Evaluate(uint32_t condition, const Node& node,
+                               bool* result) const {
+  const Condition& c = conditions_[condition];
+  switch (c.type) {
+    case C_True:
+    case C_False:
+      *result = c.type == C_True;
+      return true;
+    case C_And:
+    case C_Or:
+      if (!Evaluate(c.first, node, result)) return false;
+      if (*result != (c.type == C_And)) return true;
+      return Evaluate(c.second, node, result);
+    case C_Not:
+      if (!Evaluate(c.first, node, result)) return false;
+      *result = !*result;
+      return true;
+    default:
+      break;
+  }
+  if (c.self) {
+    *result = Compare(c, *node.value);
+    return true;
+  }
+
+  *result = false;
+  if (node.value != nullptr) return true;  // Attributes have no fields.
+  int match = condition_fields_[node.type][condition];
+  if (!c.any_name && match < 0) return true;
+  const char* pos = node.data;
+  const char* end = pos + node.size;
+  WireValue field;
+  std::vector<std::string> values;
+  while (pos < end) {
+    if (!ReadMessageField(&pos, end, &field)) return false;
+    int index = schema_->FindField(node.type, field.number);
+    if (index < 0 || (!c.any_name && index != match)) continue;
+    const WireField& f = schema_->field(node.type, index);
+    if ((f.type == W_Message) != (c.type == C_Child)) continue;
+    if (c.type == C_Child) {
+      if (field.wire_type != kLengthDelimited) continue;
+      *result = true;
+      return true;
+    }
+    values.clear();
+    if (!DecodeScalars(f.type, field, &values)) return false;
+    for (const std::string& value : values) {
+      if (c.type == C_Attribute || Compare(c, value)) {
+        *result = true;
+        return true;
+      }
+    }
+  }
+  return true;
+}
+
+// Compares an attribute value with the operand of a C_Compare condition, as
+// the XPath comparison of a node-set with a string or a number does.
+bool StreamEvaluator::Compare(const Condition& condition,
+                              const std::string& value) const {
+  if (condition.type != C_Compare) return true;
+  if (!condition.is_number) {
+    if (condition.op == X_Equal) return value == condition.literal;
+    if (condition.op == X_NotEqual) return value != condition.literal;
+  }
+  double a = StringToNumber(value), b = condition.number;
+  switch (condition.op) {
+    case X_Equal: return a == b;
+    case X_NotEqual: return a != b;
+    case X_LessThan: return a < b;
+    case X_LessEqual: return a <= b;
+    case X_GreaterThan: return a > b;
+    default: return a >= b;
+  }
+}
+
+// Adds to *active the steps that `node` is a context node for, given the
+// `candidates` steps whose node test it matched on their axis, and the
+// `matching` steps whose node test it matches on the self axis. Returns
+// false if the fields of the node are malformed.
+bool StreamEvaluator::Enter(uint64_t candidates, uint64_t matching,
+                            const Node& node, uint64_t* active) const {
+  uint64_t result = *active;
+  // Self steps may select the node for later steps, so steps are handled in
+  // order.
+  for (size_t i = 0; i < steps_.size(); ++i) {
+    uint64_t bit = uint64_t(1) << i;
+    if ((result & self_mask_ & matching & bit) != 0) candidates |= bit;
+    if ((candidates & bit) == 0) continue;
+    if ((condition_mask_ & bit) != 0) {
+      bool selected;
+      if (!Evaluate(steps_[i].condition, node, &selected)) return false;
+      if (!selected) continue;
+    }
+    result |= bit << 1;
+  }
+  *active = result;
+  return true;
+}
+
+// Runs the automaton on the fields of an element or of the root node, whose
+// active steps are `active`, and which is below the `descendants` steps.
+bool StreamEvaluator::Visit(Run* run, const Node& node, uint64_t active,
+                            uint64_t descendants, int depth) const {
+  if (depth > kMaxDepth) return false;
+  uint64_t children = active & child_mask_;
+  uint64_t attributes = active & attribute_mask_;
+  descendants = (descendants | (active & descendant_mask_)) &
+                reachable_masks_[node.type];
+  if (children == 0 && attributes == 0 && descendants == 0) return true;
+
+  const std::vector<uint64_t>& element_masks = element_masks_[node.type];
+  const std::vector<uint64_t>& attribute_masks = attribute_masks_[node.type];
+  const char* pos = node.data;
+  const char* end = pos + node.size;
+  WireValue field;
+  std::vector<std::string> values;
+  while (pos < end) {
+    if (!ReadMessageField(&pos, end, &field)) return false;
+    int index = schema_->FindField(node.type, field.number);
+    if (index < 0) continue;
+    const WireField& f = schema_->field(node.type, index);
+    if (f.type == W_Message) {
+      if (field.wire_type != kLengthDelimited) continue;
+      uint64_t candidates = (children | descendants) & element_masks[index];
+      if (candidates == 0 &&
+          (descendants & reachable_masks_[f.message_type]) == 0) {
+        continue;
+      }
+      Node child = { f.message_type, field.data, field.size, nullptr };
+      uint64_t child_active = 0;
+      if (!Enter(candidates, element_masks[index], child, &child_active)) {
+        return false;
+      }
+      if ((child_active & selected_bit_) != 0) {
+        ++run->count;
+        if (run->stop_at_first) {
+          run->done = true;
+          return true;
+        }
+      }
+      if (!Visit(run, child, child_active, descendants, depth + 1)) {
+        return false;
+      }
+      if (run->done) return true;
+    } else {
+      uint64_t candidates = attributes & attribute_masks[index];
+      if (candidates == 0) continue;
+      values.clear();
+      if (!DecodeScalars(f.type, field, &values)) return false;
+      for (const std::string& value : values) {
+        Node attribute = { -1, nullptr, 0, &value };
+        uint64_t attribute_active = 0;
+        if (!Enter(candidates, node_mask_, attribute, &attribute_active)) {
+          return false;
+        }
+        if ((attribute_active & selected_bit_) == 0) continue;
+        ++run->count;
+        if (run->values != nullptr) run->values->push_back(value);
+        if (run->stop_at_first) {
+          run->done = true;
+          return true;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool StreamEvaluator::RunPath(Run* run, const char* data, size_t size) const {
+  run->done = false;
+  run->count = 0;
+  Node root = { root_type_, data, size, nullptr };
+  // The root node is the context node of the first step.
+  uint64_t active = 1;
+  if (!Enter(0, node_mask_, root, &active)) return false;
+  if ((active & selected_bit_) != 0) {
+    ++run->count;
+    if (run->stop_at_first) return true;
+  }
+  return Visit(run, root, active, 0, 0);
+}
+
+bool StreamEvaluator::Matches(const char* data, size_t size,
+                              bool* matched) const {
+  Run run;
+  run.stop_at_first = true;
+  run.values = nullptr;
+  if (!RunPath(&run, data, size)) return false;
+  *matched = run.count != 0;
+  return true;
+}
+
+bool StreamEvaluator::Select(const char* data, size_t size, size_t* count,
+                             std::vector<std::string>* values) const {
+  Run run;
+  run.stop_at_first = false;
+  run.values = values;
+  if (values != nullptr) values->clear();
+  if (!RunPath(&run, data, size)) return false;
+  *count = run.count;
+  return true;
+}
+
+}  // namespace xpath
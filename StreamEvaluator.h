@@ -0,0 +1,234 @@
+#ifndef XPATH_STREAM_EVALUATOR_INCLUDED
+#define XPATH_STREAM_EVALUATOR_INCLUDED
+
+#include "Parser.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xpath {
+
+// Types of protocol buffer fields, which determine how their values are
+// decoded from the wire format.
+enum WireFieldType {
+  W_Int32 = 0,
+  W_Int64,
+  W_UInt32,
+  W_UInt64,
+  W_SInt32,
+  W_SInt64,
+  W_Bool,
+  W_Enum,
+  W_Fixed32,
+  W_Fixed64,
+  W_SFixed32,
+  W_SFixed64,
+  W_Float,
+  W_Double,
+  W_String,
+  W_Bytes,
+  W_Message };
+
+struct WireField {
+  uint32_t number;
+  std::string name;
+  WireFieldType type;
+
+  // Index of the message type of W_Message fields, or -1.
+  int message_type;
+};
+
+// The part of a set of message definitions that is needed to read messages
+// in the wire format, which does not contain field names. This can be built
+// from a google::protobuf::Descriptor; it is filled in by hand here, to
+// avoid depending on the protobuf runtime.
+//
+// Fields of a type are in definition order, which is the order in which
+// they are added (see NOTES.txt).
+class WireSchema {
+ public:
+  WireSchema() {}
+
+  // Adds a message type without fields and returns its index.
+  int AddType();
+
+  // Adds a field to the message type `type`. `message_type` is the index of
+  // the type of a W_Message field, and is ignored for other fields.
+  void AddField(int type, uint32_t number, const std::string& name,
+                WireFieldType field_type, int message_type);
+
+  int type_count() const { return types_.size(); }
+  int field_count(int type) const { return types_[type].fields.size(); }
+  const WireField& field(int type, int field) const {
+    return types_[type].fields[field];
+  }
+
+  // Returns the index of the field of `type` with the given number, or -1.
+  int FindField(int type, uint32_t number) const;
+
+ private:
+  struct Type {
+    std::vector<WireField> fields;
+
+    // Field indexes by number: small numbers are looked up in `dense`, and
+    // larger ones in `sparse`.
+    std::vector<int> dense;
+    std::unordered_map<uint32_t, int> sparse;
+  };
+
+  std::vector<Type> types_;
+
+  WireSchema(const WireSchema&);
+  void operator=(const WireSchema&);
+};
+
+// Evaluates a location path directly over serialized messages, without
+// building a Message or a Document.
+//
+// Only forward axes are supported: the path may use child, descendant,
+// descendant-or-self (that is, `//`), attribute and self steps, starting at
+// the root. Step predicates may test for the presence of an attribute or
+// child element (`[@id]`, `[author]`), compare attributes with a literal or
+// a number (`[@year > 2000]`, or `[. = 'x']` on attributes), and combine
+// these with `and`, `or` and not(). Positional predicates and predicates
+// that need the string-value of an element are not supported.
+//
+// The path is compiled into a small automaton over the fields of the
+// schema. Running it reads the message in a single pass, in wire order, and
+// skips the bytes of every length-delimited field that cannot lead to a
+// match without decoding them. A step predicate is checked by scanning the
+// tags of the fields of its element, before its children are visited.
+//
+// Compiled evaluators are immutable, and can be run from multiple threads.
+// The schema must outlive the evaluator.
+class StreamEvaluator {
+ public:
+  explicit StreamEvaluator(const WireSchema* schema);
+
+  // Compiles `expression` for messages of type `root_type`.
+  //
+  // Returns true on success. Otherwise, it returns false and sets
+  // *error_offset to the offset of the syntax error, or of the first part of
+  // the expression that is not supported.
+  bool Compile(const std::string& expression, int root_type,
+               size_t* error_offset);
+
+  // Sets *matched to true if the path selects at least one node of the
+  // serialized message in [data, data + size). Stops at the first match.
+  // Returns false if the message is malformed.
+  bool Matches(const char* data, size_t size, bool* matched) const;
+
+  // Sets *count to the number of nodes that the path selects in the
+  // serialized message. If `values` is not null, it is set to the values of
+  // the selected attributes, in the order in which they appear in the data
+  // (which is document order if scalar fields are serialized before message
+  // fields, and in definition order). Returns false if the message is
+  // malformed; skipped fields are not checked.
+  bool Select(const char* data, size_t size, size_t* count,
+              std::vector<std::string>* values) const;
+
+ private:
+  // Index value used to indicate the absence of a condition.
+  static const uint32_t kNone = 0xffffffffu;
+
+  // The maximum number of steps, so that sets of steps fit in 64 bits.
+  static const size_t kMaxSteps = 63;
+
+  enum ConditionType {
+    C_True = 0,
+    C_False,
+    C_And,
+    C_Or,
+    C_Not,
+    C_Attribute,
+    C_Child,
+    C_Compare };
+
+  // A predicate, as a tree of conditions.
+  struct Condition {
+    ConditionType type;
+
+    // Operands of C_And, C_Or and C_Not.
+    uint32_t first;
+    uint32_t second;
+
+    // The node-set that C_Attribute, C_Child and C_Compare test: attributes
+    // or children with the given name (or any if `any_name`), or the context
+    // node itself if `self`.
+    bool self;
+    bool any_name;
+    std::string name;
+
+    // The comparison of C_Compare, whose left operand is the node-set, and
+    // whose right operand is a string, or a number if `is_number`.
+    ExprType op;
+    bool is_number;
+    double number;
+    std::string literal;
+  };
+
+  struct Step {
+    AxisName axis;
+    NodeType node_type;
+    std::string name;
+    uint32_t condition;
+  };
+
+  struct Node;
+  struct Run;
+
+  bool CompileStep(const Ast& ast, uint32_t step, bool attribute,
+                   size_t* error_offset);
+  uint32_t CompileCondition(const Ast& ast, uint32_t expr, bool attribute,
+                            size_t* error_offset);
+  bool GetTerm(const Ast& ast, uint32_t expr, bool attribute,
+               Condition* condition) const;
+  bool MatchesNodeTest(const Step& step, const WireField& field) const;
+  void ComputeMasks();
+
+  bool Evaluate(uint32_t condition, const Node& node, bool* result) const;
+  bool Compare(const Condition& condition, const std::string& value) const;
+  bool Enter(uint64_t candidates, uint64_t matching, const Node& node,
+             uint64_t* active) const;
+  bool Visit(Run* run, const Node& node, uint64_t active,
+             uint64_t descendants, int depth) const;
+  bool RunPath(Run* run, const char* data, size_t size) const;
+
+  const WireSchema* schema_;
+  int root_type_;
+  std::vector<Step> steps_;
+  std::vector<Condition> conditions_;
+
+  // Sets of steps, as bit masks: steps by axis, steps with conditions, and
+  // steps whose node test is node().
+  uint64_t child_mask_;
+  uint64_t attribute_mask_;
+  uint64_t descendant_mask_;
+  uint64_t self_mask_;
+  uint64_t condition_mask_;
+  uint64_t node_mask_;
+
+  // The bit of the position after the last step, which is set for the
+  // nodes that the path selects.
+  uint64_t selected_bit_;
+
+  // For each field of each type, the steps whose node test matches the
+  // field as an element or as an attribute, and for each type, the
+  // descendant steps whose node test matches some element below it.
+  std::vector<std::vector<uint64_t>> element_masks_;
+  std::vector<std::vector<uint64_t>> attribute_masks_;
+  std::vector<uint64_t> reachable_masks_;
+
+  // For each type and condition, the index of the field that the condition
+  // tests, or -1.
+  std::vector<std::vector<int>> condition_fields_;
+
+  StreamEvaluator(const StreamEvaluator&);
+  void operator=(const StreamEvaluator&);
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_STREAM_EVALUATOR_INCLUDED */
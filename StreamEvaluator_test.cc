@@ -0,0 +1,343 @@
+#include "StreamEvaluator.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+#include "TestLibrary.h"
+#include "TestUtil.h"
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using ::testing::ElementsAre;
+
+namespace xpath {
+namespace {
+
+// A minimal encoder for the protobuf wire format.
+void WriteVarint(uint64_t value, string* out) {
+  while (value >= 0x80) {
+    *out += char(value | 0x80);
+    value >>= 7;
+  }
+  *out += char(value);
+}
+
+void WriteFixed(uint64_t value, int size, string* out) {
+  for (int i = 0; i < size; ++i) *out += char(value >> (8 * i));
+}
+
+void WriteTag(uint32_t number, int wire_type, string* out) {
+  WriteVarint(uint64_t(number) << 3 | wire_type, out);
+}
+
+void WriteBytes(uint32_t number, const string& bytes, string* out) {
+  WriteTag(number, 2, out);
+  WriteVarint(bytes.size(), out);
+  *out += bytes;
+}
+
+// Encodes a scalar given in the text format.
+void WriteScalar(const WireField& field, const string& text, string* out) {
+  switch (field.type) {
+    case W_String:
+    case W_Bytes:
+      WriteBytes(field.number, text, out);
+      return;
+    case W_Float: {
+      float value = strtof(text.c_str(), nullptr);
+      uint32_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      WriteTag(field.number, 5, out);
+      WriteFixed(bits, 4, out);
+      return;
+    }
+    case W_Double: {
+      double value = strtod(text.c_str(), nullptr);
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      WriteTag(field.number, 1, out);
+      WriteFixed(bits, 8, out);
+      return;
+    }
+    case W_Fixed32:
+    case W_SFixed32:
+      WriteTag(field.number, 5, out);
+      WriteFixed(strtoll(text.c_str(), nullptr, 10), 4, out);
+      return;
+    case W_Fixed64:
+    case W_SFixed64:
+      WriteTag(field.number, 1, out);
+      WriteFixed(strtoull(text.c_str(), nullptr, 10), 8, out);
+      return;
+    default:
+      break;
+  }
+  WriteTag(field.number, 0, out);
+  int64_t value = strtoll(text.c_str(), nullptr, 10);
+  switch (field.type) {
+    case W_Bool:
+      WriteVarint(text == "true", out);
+      break;
+    case W_UInt64:
+      WriteVarint(strtoull(text.c_str(), nullptr, 10), out);
+      break;
+    case W_SInt32:
+    case W_SInt64:
+      WriteVarint(uint64_t(value) << 1 ^ uint64_t(value >> 63), out);
+      break;
+    default:
+      WriteVarint(value, out);
+      break;
+  }
+}
+
+// Encodes `message` as a message of type `type`, with scalar fields before
+// message fields, so that the wire order is document order.
+void Encode(const WireSchema& schema, int type, const Message& message,
+            string* out) {
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int field = 0; field < message.field_count(); ++field) {
+      if (message.is_message_field(field) != (pass == 1)) continue;
+      const WireField* wire_field = nullptr;
+      for (int i = 0; i < schema.field_count(type); ++i) {
+        if (schema.field(type, i).name == message.field_name(field)) {
+          wire_field = &schema.field(type, i);
+        }
+      }
+      ASSERT_TRUE(wire_field != nullptr) << message.field_name(field);
+      for (size_t i = 0; i < message.value_count(field); ++i) {
+        if (pass == 0) {
+          WriteScalar(*wire_field, message.scalar_value(field, i), out);
+          continue;
+        }
+        string bytes;
+        Encode(schema, wire_field->message_type,
+               message.message_value(field, i), &bytes);
+        WriteBytes(wire_field->number, bytes, out);
+      }
+    }
+  }
+}
+
+// The shelf has a nested shelf, and a negative year.
+const char kShelf[] =
+    "shelf { book { id: 'b4' title: 'Nested' year: 2001 } "
+    "        shelf { name: 'inner' book { id: 'b5' year: -7 } } }";
+
+class StreamEvaluatorTest : public ::testing::Test {
+ protected:
+  StreamEvaluatorTest()
+      : message_(SimpleMessage::ParseText(LibraryText(kShelf))),
+        document_(*message_) {
+    library_ = schema_.AddType();
+    int book = schema_.AddType();
+    int author = schema_.AddType();
+    int shelf = schema_.AddType();
+    schema_.AddField(library_, 1, "name", W_String, -1);
+    schema_.AddField(library_, 2, "book", W_Message, book);
+    schema_.AddField(library_, 3, "shelf", W_Message, shelf);
+    schema_.AddField(book, 1, "id", W_String, -1);
+    schema_.AddField(book, 2, "title", W_String, -1);
+    schema_.AddField(book, 3, "year", W_SInt32, -1);
+    schema_.AddField(book, 4, "author", W_Message, author);
+    schema_.AddField(author, 1000, "name", W_String, -1);
+    schema_.AddField(shelf, 1, "book", W_Message, book);
+    schema_.AddField(shelf, 2, "name", W_String, -1);
+    schema_.AddField(shelf, 3, "shelf", W_Message, shelf);
+    Encode(schema_, library_, *message_, &data_);
+  }
+
+  // Returns the number of selected nodes and the selected values, or an
+  // error.
+  string Select(const string& expression) {
+    return Select(expression, data_);
+  }
+
+  string Select(const string& expression, const string& data) {
+    StreamEvaluator evaluator(&schema_);
+    size_t error_offset;
+    if (!evaluator.Compile(expression, library_, &error_offset)) {
+      return "error at " + std::to_string(error_offset);
+    }
+    size_t count;
+    vector<string> values;
+    if (!evaluator.Select(data.data(), data.size(), &count, &values)) {
+      return "malformed";
+    }
+    string result = std::to_string(count);
+    for (const string& value : values) result += " '" + value + "'";
+    return result;
+  }
+
+  unique_ptr<SimpleMessage> message_;
+  Document document_;
+  WireSchema schema_;
+  int library_;
+  string data_;
+};
+
+TEST_F(StreamEvaluatorTest, SelectsNodes) {
+  EXPECT_EQ("1", Select("/"));
+  EXPECT_EQ("3", Select("book"));
+  EXPECT_EQ("3 'b1' 'b2' 'b3'", Select("/book/@id"));
+  EXPECT_EQ("5", Select("//book"));
+  EXPECT_EQ("2 'library' 'inner'", Select("//@name[. != 'James' and "
+                                          "not(. = 'Kenton' or . = 'Sanjay')]"));
+  EXPECT_EQ("2 'b4' 'b5'", Select("shelf//book/@id"));
+  EXPECT_EQ("1 '-7'", Select("//book[@year < 0]/@year"));
+  EXPECT_EQ("2 'Kenton' 'Sanjay'", Select("//book[@id = 'b2']/*/@*"));
+  EXPECT_EQ("1 'b1'", Select("book[author][1999 = @year]/@id"));
+  EXPECT_EQ("2", Select("//shelf/self::shelf[@name or book]"));
+  EXPECT_EQ("0", Select("//book[@missing]"));
+}
+
+TEST_F(StreamEvaluatorTest, RejectsUnsupportedExpressions) {
+  EXPECT_EQ("error at 5", Select("book["));
+  EXPECT_EQ("error at 5", Select("book[2]"));
+  EXPECT_EQ("error at 7", Select("//book/../@name"));
+  EXPECT_EQ("error at 0", Select("count(book)"));
+  EXPECT_EQ("error at 0", Select("$books/author"));
+  EXPECT_EQ("error at 11", Select("book[title = 'XPath']"));
+  EXPECT_EQ("error at 9", Select("book/@id[@name]"));
+  EXPECT_EQ("error at 5", Select("book[last()]"));
+  EXPECT_EQ("error at 0", Select("book[1]"));
+}
+
+// Expressions in the supported subset, evaluated both ways.
+const char* const kExpressions[] = {
+  "/", "/@name", "book", "book/@id", "/book/author/@name", "//author",
+  "//@name", "//@*", "/*/*", "//*", "//node()", "/descendant::book/@year",
+  "//shelf//book", "//shelf/descendant-or-self::shelf/@name",
+  "//book[author]/@id", "//book[not(author)]/@title", "//book[@year]",
+  "//book[@year > 2000]/@id", "//book[@year >= '2008']/@id",
+  "//book[@year = 2008 or @id = 'b1']/@id", "//book[@year != 1999]",
+  "//book[@id = 'b4'][@year <= 2001]/@title", "//*[@id = 'b5']/@year",
+  "//book/@year[. < 2000]", "//@title[. = 'Nested']", "//book/self::book",
+  "//shelf[shelf]/book/@id", "//shelf[@name = 'inner']/book",
+  "//book[@title = ' Spaced   out ']", "//nothing", "//@nothing",
+  "book/text()", "//*[*]", "//*[@*]/@id", "/self::node()/book",
+};
+
+TEST_F(StreamEvaluatorTest, MatchesEvaluate) {
+  Evaluator evaluator(&document_);
+  for (const char* expression : kExpressions) {
+    SCOPED_TRACE(expression);
+    Ast ast;
+    size_t error_offset;
+    ASSERT_TRUE(Parse(expression, &ast, &error_offset));
+    Value value;
+    ASSERT_TRUE(evaluator.Evaluate(ast, &value, &error_offset));
+    string expected = std::to_string(value.nodes.size());
+    for (uint32_t node : value.nodes) {
+      if (document_.kind(node) == K_Attribute) {
+        expected += " '" + document_.StringValue(node) + "'";
+      }
+    }
+    EXPECT_EQ(expected, Select(expression));
+
+    StreamEvaluator stream(&schema_);
+    ASSERT_TRUE(stream.Compile(expression, library_, &error_offset));
+    bool matched;
+    ASSERT_TRUE(stream.Matches(data_.data(), data_.size(), &matched));
+    EXPECT_EQ(!value.nodes.empty(), matched);
+  }
+}
+
+TEST_F(StreamEvaluatorTest, SkipsUnreachableFields) {
+  // A shelf that is not a valid message, and unknown fields, one of them a
+  // group.
+  string data = data_;
+  WriteBytes(3, "\xff\xff", &data);
+  WriteTag(9, 3, &data);
+  WriteTag(1, 0, &data);
+  WriteVarint(1, &data);
+  WriteTag(9, 4, &data);
+  WriteTag(10, 1, &data);
+  WriteFixed(0, 8, &data);
+
+  EXPECT_EQ("3 'b1' 'b2' 'b3'", Select("/book/@id", data));
+  EXPECT_EQ("1 'library'", Select("/@name", data));
+  EXPECT_EQ("3", Select("/book/author", data));
+  // The shelf is selected without reading it.
+  EXPECT_EQ("2", Select("shelf", data));
+  EXPECT_EQ("malformed", Select("shelf/@name", data));
+  EXPECT_EQ("malformed", Select("//author", data));
+
+  // Truncated data.
+  EXPECT_EQ("malformed", Select("//@id", data_.substr(0, data_.size() - 1)));
+  EXPECT_EQ("0", Select("//@id", string()));
+}
+
+TEST(StreamEvaluator, DecodesScalars) {
+  WireSchema schema;
+  int type = schema.AddType();
+  WireFieldType types[] = {
+    W_Int32, W_Int64, W_UInt32, W_UInt64, W_SInt32, W_SInt64, W_Bool, W_Enum,
+    W_Fixed32, W_Fixed64, W_SFixed32, W_SFixed64, W_Float, W_Double,
+    W_String, W_Bytes,
+  };
+  for (WireFieldType field_type : types) {
+    schema.AddField(type, field_type + 1, "f" + std::to_string(field_type),
+                    field_type, -1);
+  }
+  string data;
+  for (int i = 0; i < schema.field_count(type); ++i) {
+    const WireField& field = schema.field(type, i);
+    switch (field.type) {
+      case W_Float: WriteScalar(field, "1.1", &data); break;
+      case W_Double: WriteScalar(field, "0.1", &data); break;
+      case W_Bool: WriteScalar(field, "true", &data); break;
+      case W_String: WriteScalar(field, "a\0b", &data); break;
+      case W_UInt32: case W_UInt64: case W_Fixed32: case W_Fixed64:
+        WriteScalar(field, "4000000000", &data);
+        break;
+      default: WriteScalar(field, "-5", &data); break;
+    }
+  }
+  // Packed values, and a value with the wrong wire type, which is ignored.
+  string packed;
+  WriteVarint(1, &packed);
+  WriteVarint(300, &packed);
+  WriteBytes(1, packed, &data);
+  WriteTag(15, 0, &data);
+  WriteVarint(1, &data);
+
+  StreamEvaluator evaluator(&schema);
+  size_t error_offset, count;
+  ASSERT_TRUE(evaluator.Compile("@*", type, &error_offset));
+  vector<string> values;
+  ASSERT_TRUE(evaluator.Select(data.data(), data.size(), &count, &values));
+  EXPECT_THAT(values, ElementsAre("-5", "-5", "4000000000", "4000000000",
+                                  "-5", "-5", "true", "-5", "4000000000",
+                                  "4000000000", "-5", "-5", "1.1", "0.1",
+                                  "a", "-5", "1", "300"));
+  EXPECT_EQ(values.size(), count);
+  {
+    // Floating-point values are formatted the same in any locale.
+    ScopedCommaLocale locale;
+    vector<string> localized;
+    ASSERT_TRUE(evaluator.Select(data.data(), data.size(), &count,
+                                 &localized));
+    EXPECT_EQ(values, localized);
+  }
+
+  // Malformed packed values.
+  data.resize(data.size() - 2);
+  data[data.size() - 1] = char(0x80);
+  EXPECT_FALSE(evaluator.Select(data.data(), data.size(), &count, &values));
+
+  // A path that does not select anything.
+  ASSERT_TRUE(evaluator.Compile("@f14[. = 'x']", type, &error_offset));
+  bool matched = true;
+  ASSERT_TRUE(evaluator.Matches(data.data(), data.size(), &matched));
+  EXPECT_FALSE(matched);
+}
+
+}  // namespace
+}  // namespace xpath
@@ -0,0 +1,68 @@
+#ifndef XPATH_TEST_LIBRARY_INCLUDED
+#define XPATH_TEST_LIBRARY_INCLUDED
+
+// The library document that the tests evaluate expressions against, and a
+// fixture for evaluating them.
+
+#include "Document.h"
+#include "Evaluator.h"
+#include "SimpleMessage.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+namespace xpath {
+
+// The shelf of the library document, unless a test needs other nodes there.
+const char kLibraryShelf[] =
+    "shelf { book { id: 'b4' title: 'Nested' year: 2001 } }";
+
+// Returns the text of the library document, with `shelf` after the books.
+inline std::string LibraryText(const std::string& shelf = kLibraryShelf) {
+  return "name: 'library' "
+         "book { id: 'b1' title: 'XPath' year: 1999 author { name: 'James' } } "
+         "book { id: 'b2' title: 'Protocol Buffers' year: 2008 "
+         "       author { name: 'Kenton' } author { name: 'Sanjay' } } "
+         "book { id: 'b3' title: ' Spaced   out ' year: 2015 } " + shelf;
+}
+
+// Evaluates expressions against the library document, without and with the
+// document-order index.
+class LibraryTest : public ::testing::TestWithParam<bool> {
+ protected:
+  LibraryTest()
+      : message_(SimpleMessage::ParseText(LibraryText())),
+        document_(*message_),
+        evaluator_(&document_) {
+    if (GetParam()) document_.BuildOrderIndex();
+  }
+
+  // Returns the value as a string, with node-sets as their node indexes in
+  // braces, or the error offset if `ok` is false.
+  static std::string ToString(bool ok, const Value& value,
+                              size_t error_offset) {
+    if (!ok) return "error at " + std::to_string(error_offset);
+    switch (value.type) {
+      case V_Boolean:
+        return value.boolean ? "true" : "false";
+      case V_Number:
+        return NumberToString(value.number);
+      case V_String:
+        return "'" + value.string + "'";
+      default:
+        break;
+    }
+    std::string result = "{";
+    for (uint32_t node : value.nodes) result += " " + std::to_string(node);
+    return result + " }";
+  }
+
+  std::unique_ptr<SimpleMessage> message_;
+  Document document_;
+  Evaluator evaluator_;
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_TEST_LIBRARY_INCLUDED */
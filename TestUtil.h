@@ -0,0 +1,39 @@
+#ifndef XPATH_TEST_UTIL_INCLUDED
+#define XPATH_TEST_UTIL_INCLUDED
+
+// Helpers shared by the tests (the *_test.cc files).
+
+#include <locale.h>
+#include <string>
+
+namespace xpath {
+
+// Sets LC_NUMERIC to an installed locale whose decimal point is a comma, if
+// there is one, for as long as this object exists.
+class ScopedCommaLocale {
+ public:
+  ScopedCommaLocale() : previous_(setlocale(LC_NUMERIC, nullptr)),
+                        active_(false) {
+    for (const char* name : { "de_DE.UTF-8", "fr_FR.UTF-8", "nl_NL.UTF-8",
+                              "ru_RU.UTF-8", "de_DE", "fr_FR" }) {
+      if (setlocale(LC_NUMERIC, name) != nullptr &&
+          localeconv()->decimal_point[0] == ',') {
+        active_ = true;
+        return;
+      }
+    }
+    setlocale(LC_NUMERIC, previous_.c_str());
+  }
+  ~ScopedCommaLocale() { setlocale(LC_NUMERIC, previous_.c_str()); }
+
+  // Returns false if no such locale is installed.
+  bool active() const { return active_; }
+
+ private:
+  std::string previous_;
+  bool active_;
+};
+
+}  // namespace xpath
+
+#endif /* ndef XPATH_TEST_UTIL_INCLUDED */
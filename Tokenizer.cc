@@ -2,10 +2,14 @@
 // Based on: http://www.w3.org/TR/xpath/#exprlex
 
 #include "Tokenizer.h"
+#include "CharClasses.h"
+#include "Profile.h"
+#include "SimdScan.h"
 
 #include <assert.h>
-#include <ctype.h>
+#include <stdint.h>
 #include <string.h>
+#include <algorithm>
 
 #define RETURN_TOKEN(Size, Type) do { *token_size = Size; return Type; } while(0)
 #define RETURN_ERROR() RETURN_TOKEN(1, T_None)
@@ -14,16 +18,10 @@ namespace xpath {
   
 namespace {
 
-bool IsIdentifierStartChar(char c) {
-  // TODO: support Unicode chars too. Requires UTF-8 decoding?
-  // Note: unlike XPath we don't support ':' in identifiers.
-  return c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
-}
-
-bool IsIdentifierChar(char c) {
-  // TODO: support Unicode chars too. Requires UTF-8 decoding?
-  return IsIdentifierStartChar(c) || c == '-' || c == '.' || (c >= '0' && c <= '9');
-}
+// Most tokens and whitespace runs are short, so the scanning loops below look
+// at this many characters inline before they call a vectorized kernel from
+// SimdScan.h to scan the remainder.
+const size_t kInlineScanLength = 16;
 
 // Returns the length of the longest prefix of the string described by `data`
 // and `size` that is a valid identifier. If the input does not start with an
@@ -31,53 +29,175 @@ bool IsIdentifierChar(char c) {
 size_t ScanIdentifier(const char* data, size_t size) {
   if (size == 0 || !IsIdentifierStartChar(data[0])) return 0;
   size_t n = 1;
-  while (n != size && IsIdentifierChar(data[n])) ++n;
+  while (n != size && n != kInlineScanLength && IsIdentifierChar(data[n])) ++n;
+  if (n == kInlineScanLength) n += SpanIdentifierChars(data + n, size - n);
   return n;
 }
 
-}  // namespace
+// Describes a keyword: an identifier that converts to a NodeType, an
+// OperatorName or an AxisName, depending on `type`.
+struct Keyword {
+  TokenType type;
+  int value;
+  const char* text;
+  size_t size;
+};
+
+#define KEYWORD(Type, Value, Text) {Type, Value, Text, sizeof(Text) - 1}
+
+constexpr Keyword kKeywords[] = {
+  KEYWORD(T_NodeType, N_Comment, "comment"),
+  KEYWORD(T_NodeType, N_Text, "text"),
+  KEYWORD(T_NodeType, N_ProcessingInstruction, "processing-instruction"),
+  KEYWORD(T_NodeType, N_Node, "node"),
+  KEYWORD(T_OperatorName, O_And, "and"),
+  KEYWORD(T_OperatorName, O_Or, "or"),
+  KEYWORD(T_OperatorName, O_Mod, "mod"),
+  KEYWORD(T_OperatorName, O_Div, "div"),
+  KEYWORD(T_AxisName, A_Ancestor, "ancestor"),
+  KEYWORD(T_AxisName, A_AncestorOrSelf, "ancestor-or-self"),
+  KEYWORD(T_AxisName, A_Attribute, "attribute"),
+  KEYWORD(T_AxisName, A_Child, "child"),
+  KEYWORD(T_AxisName, A_Descendant, "descendant"),
+  KEYWORD(T_AxisName, A_DescendantOrSelf, "descendant-or-self"),
+  KEYWORD(T_AxisName, A_Following, "following"),
+  KEYWORD(T_AxisName, A_FollowingSibling, "following-sibling"),
+  KEYWORD(T_AxisName, A_Namespace, "namespace"),
+  KEYWORD(T_AxisName, A_Parent, "parent"),
+  KEYWORD(T_AxisName, A_Preceding, "preceding"),
+  KEYWORD(T_AxisName, A_PrecedingSibling, "preceding-sibling"),
+  KEYWORD(T_AxisName, A_Self, "self") };
+
+#undef KEYWORD
+
+constexpr size_t kKeywordCount = sizeof(kKeywords) / sizeof(kKeywords[0]);
+
+// Keywords are located with a perfect hash over the length and the first and
+// last characters of the identifier, so each lookup takes a single table load
+// and at most one string comparison. The static_assert below verifies that the
+// hash function is perfect for kKeywords; if it fails after adding a keyword,
+// the multiplier or the table size must be changed.
+constexpr size_t kKeywordSlotCount = 64;
+
+constexpr size_t KeywordHash(const char* data, size_t size) {
+  return (size + static_cast<unsigned char>(data[0]) +
+          20 * static_cast<unsigned char>(data[size - 1])) % kKeywordSlotCount;
+}
+
+constexpr size_t KeywordHash(size_t i) {
+  return KeywordHash(kKeywords[i].text, kKeywords[i].size);
+}
 
-template<int N> bool Equals(const char (&buf)[N], const char* data, size_t size) {
-  return N > 0 && size == N - 1 && memcmp(data, &buf[0], N - 1) == 0;
+constexpr bool IsPerfectHash(size_t i = 0, size_t j = 1) {
+  return i == kKeywordCount ? true :
+         j == kKeywordCount ? IsPerfectHash(i + 1, i + 2) :
+         KeywordHash(i) != KeywordHash(j) && IsPerfectHash(i, j + 1);
 }
 
+static_assert(IsPerfectHash(), "KeywordHash() has collisions");
+
+constexpr size_t MinKeywordSize(size_t i = 0) {
+  return i == kKeywordCount ? size_t(-1) :
+      kKeywords[i].size < MinKeywordSize(i + 1) ?
+          kKeywords[i].size : MinKeywordSize(i + 1);
+}
+
+constexpr size_t MaxKeywordSize(size_t i = 0) {
+  return i == kKeywordCount ? 0 :
+      kKeywords[i].size > MaxKeywordSize(i + 1) ?
+          kKeywords[i].size : MaxKeywordSize(i + 1);
+}
+
+// Returns a bitmask with bit `n` set if there is a keyword of the given type of
+// length `n`, used to reject most identifiers before hashing them.
+constexpr uint32_t KeywordSizeMask(TokenType type, size_t i = 0) {
+  return i == kKeywordCount ? 0 :
+      (kKeywords[i].type == type ? uint32_t(1) << kKeywords[i].size : 0) |
+      KeywordSizeMask(type, i + 1);
+}
+
+// Returns the index of the keyword that hashes to `slot`, or -1 if none does.
+constexpr int KeywordAtSlot(size_t slot, size_t i = 0) {
+  return i == kKeywordCount ? -1 :
+         KeywordHash(i) == slot ? int(i) : KeywordAtSlot(slot, i + 1);
+}
+
+#define SLOT4(i) KeywordAtSlot(i), KeywordAtSlot(i + 1), \
+                 KeywordAtSlot(i + 2), KeywordAtSlot(i + 3)
+#define SLOT16(i) SLOT4(i), SLOT4(i + 4), SLOT4(i + 8), SLOT4(i + 12)
+
+constexpr signed char kKeywordSlots[kKeywordSlotCount] = {
+  SLOT16(0), SLOT16(16), SLOT16(32), SLOT16(48) };
+
+#undef SLOT16
+#undef SLOT4
+
+template<class T> T Load(const char* data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Compares two strings of length `size` (between 2 and 24 inclusive) with a
+// few overlapping word-sized loads instead of a call to memcmp().
+inline bool EqualsShort(const char* a, const char* b, size_t size) {
+  if (size >= 8) {
+    uint64_t x = (Load<uint64_t>(a) ^ Load<uint64_t>(b)) |
+        (Load<uint64_t>(a + size - 8) ^ Load<uint64_t>(b + size - 8));
+    if (size > 16) {
+      x |= Load<uint64_t>(a + 8) ^ Load<uint64_t>(b + 8);
+    }
+    return x == 0;
+  }
+  if (size >= 4) {
+    return ((Load<uint32_t>(a) ^ Load<uint32_t>(b)) |
+        (Load<uint32_t>(a + size - 4) ^ Load<uint32_t>(b + size - 4))) == 0;
+  }
+  return ((Load<uint16_t>(a) ^ Load<uint16_t>(b)) |
+      (Load<uint16_t>(a + size - 2) ^ Load<uint16_t>(b + size - 2))) == 0;
+}
+
+static_assert(MinKeywordSize() >= 2 && MaxKeywordSize() <= 24,
+              "EqualsShort() does not support all keyword sizes");
+
+// Returns the value of the keyword of the given type described by `data` and
+// `size`, or 0 if the string is not such a keyword.
+template<TokenType type>
+inline int FindKeyword(const char* data, size_t size) {
+  const uint32_t size_mask = KeywordSizeMask(type);
+  if (size >= 32 || (size_mask >> size & 1) == 0) return 0;
+  int i = kKeywordSlots[KeywordHash(data, size)];
+  if (i < 0) return 0;
+  const Keyword& keyword = kKeywords[i];
+  if (keyword.type != type || keyword.size != size ||
+      !EqualsShort(keyword.text, data, size)) {
+    return 0;
+  }
+  return keyword.value;
+}
+
+}  // namespace
+
 NodeType ParseNodeType(const char* data, size_t size) {
-  if (Equals("comment", data, size)) return N_Comment;
-  if (Equals("text", data, size)) return N_Text;
-  if (Equals("processing-instruction", data, size)) return N_ProcessingInstruction;
-  if (Equals("node", data, size)) return N_Node;
-  return N_None;
+  return static_cast<NodeType>(FindKeyword<T_NodeType>(data, size));
 }
 
 OperatorName ParseOperatorName(const char* data, size_t size) {
-  if (Equals("and", data, size)) return O_And;
-  if (Equals("or", data, size)) return O_Or;
-  if (Equals("mod", data, size)) return O_Mod;
-  if (Equals("div", data, size)) return O_Div;
-  return O_None;
+  return static_cast<OperatorName>(FindKeyword<T_OperatorName>(data, size));
 }
 
 AxisName ParseAxisName(const char* data, size_t size) {
-  if (Equals("ancestor", data, size)) return A_Ancestor;
-  if (Equals("ancestor-or-self", data, size)) return A_AncestorOrSelf;
-  if (Equals("attribute", data, size)) return A_Attribute;
-  if (Equals("child", data, size)) return A_Child;
-  if (Equals("descendant", data, size)) return A_Descendant;
-  if (Equals("descendant-or-self", data, size)) return A_DescendantOrSelf;
-  if (Equals("following", data, size)) return A_Following;
-  if (Equals("following-sibling", data, size)) return A_FollowingSibling;
-  if (Equals("namespace", data, size)) return A_Namespace;
-  if (Equals("parent", data, size)) return A_Parent;
-  if (Equals("preceding", data, size)) return A_Preceding;
-  if (Equals("preceding-sibling", data, size)) return A_PrecedingSibling;
-  if (Equals("self", data, size)) return A_Self;
-  return A_None;
+  return static_cast<AxisName>(FindKeyword<T_AxisName>(data, size));
 }
 
 TokenType ScanToken(const char* data, size_t size,
                     const char** token_data, size_t* token_size) {
-  // Skip leading whitespace                       
-  while (size != 0 && isspace(*data)) ++data, --size;
+  // Skip leading whitespace
+  size_t skip = 0;
+  while (skip != size && skip != kInlineScanLength && IsSpace(data[skip])) ++skip;
+  if (skip == kInlineScanLength) skip += SpanSpaces(data + skip, size - skip);
+  data += skip;
+  size -= skip;
   *token_data = data;
   if (size == 0) RETURN_TOKEN(0, T_None);  // End of input.
 
@@ -92,10 +212,10 @@ TokenType ScanToken(const char* data, size_t size,
       RETURN_TOKEN(1, T_RightBracket);
     case '.':
       if (size > 1 && data[1] == '.') RETURN_TOKEN(2, T_DoubleDot);
-      if (size > 1 && isdigit(data[1])) {
+      if (size > 1 && IsDigit(data[1])) {
         // Recognize a number of the form: '.' Digits
         size_t n = 2;
-        while (n != size && isdigit(data[n])) ++n;
+        while (n != size && IsDigit(data[n])) ++n;
         RETURN_TOKEN(n, T_Number);
       }
       RETURN_TOKEN(1, T_Dot);
@@ -110,7 +230,8 @@ TokenType ScanToken(const char* data, size_t size,
     case '\"': {
       // Recognize a literal. Seach for delimiter matching data[0].
       size_t n = 1;
-      while (n != size && data[n] != data[0]) ++n;
+      while (n != size && n != kInlineScanLength && data[n] != data[0]) ++n;
+      if (n == kInlineScanLength) n += FindChar(data + n, size - n, data[0]);
       if (n == size) RETURN_ERROR();  // Matching delimiter not found.
       RETURN_TOKEN(n + 1, T_Literal);
     }
@@ -143,13 +264,13 @@ TokenType ScanToken(const char* data, size_t size,
     }
   }
 
-  if (isdigit(data[0])) {
+  if (IsDigit(data[0])) {
     // Recognize a number of the form: Digits ('.' Digits?)?
     size_t n = 1;
-    while (n != size && isdigit(data[n])) ++n;
+    while (n != size && IsDigit(data[n])) ++n;
     if (n != size && data[n] == '.') {
       ++n;
-      while (n != size && isdigit(data[n])) ++n;
+      while (n != size && IsDigit(data[n])) ++n;
     }
     RETURN_TOKEN(n, T_Number);
   }
@@ -189,35 +310,269 @@ TokenType DisambiguateToken(TokenType previous,
   return current;
 }
 
+TokenStream::TokenStream(
+    const char* data, size_t size,
+    const std::function<bool(const char*, size_t)>& is_node_type)
+    : data_(data), size_(size), pos_(0), error_offset_(size),
+      previous_(T_None), is_node_type_function_(nullptr),
+      is_node_type_(is_node_type) {
+  next_ = Scan();
+  Advance();
+}
+
+TokenStream::TokenStream(const char* data, size_t size,
+                         NodeTypePredicate is_node_type)
+    : data_(data), size_(size), pos_(0), error_offset_(size),
+      previous_(T_None), is_node_type_function_(is_node_type) {
+  next_ = Scan();
+  Advance();
+}
+
+TokenStream::TokenStream(const char* data, size_t size)
+    : TokenStream(data, size, &IsNodeType) {
+}
+
+Token TokenStream::Scan() {
+  const char* token_data = nullptr;
+  size_t token_size = 0;
+  TokenType type = ScanToken(data_ + pos_, size_ - pos_, &token_data, &token_size);
+  Token token = {type, size_t(token_data - data_), token_size};
+  if (type != T_None) {
+    XPATH_PROFILE_ADD(tokens_scanned, 1);
+    pos_ = token.offset + token.size;
+  } else {
+    if (token_size != 0) {
+      assert(token.offset < size_);
+      error_offset_ = token.offset;
+    }
+    // Stop scanning; all further tokens are T_None at the same offset.
+    token.size = 0;
+    size_ = pos_ = token.offset;
+  }
+  return token;
+}
+
+void TokenStream::Advance() {
+  current_ = next_;
+  if (current_.type == T_None) return;
+  next_ = Scan();
+  current_.type = DisambiguateToken(previous_, current_.type, next_.type);
+  // Disambiguate function names and node types.
+  if (current_.type == T_FunctionName) {
+    const char* text = data_ + current_.offset;
+    if (is_node_type_function_ != nullptr
+            ? is_node_type_function_(text, current_.size)
+            : is_node_type_(text, current_.size)) {
+      current_.type = T_NodeType;
+    }
+  }
+}
+
+bool TokenStream::Next(Token* token) {
+  if (current_.type == T_None) return false;
+  *token = current_;
+  previous_ = current_.type;
+  Advance();
+  return true;
+}
+
+namespace {
+
+template<class NodeTypeTest>
+size_t TokenizeInto(const char* input, size_t input_size,
+                    const NodeTypeTest& is_node_type,
+                    std::vector<Token>* tokens_ptr) {
+  XPATH_PROFILE_PHASE(P_Tokenize);
+  auto& tokens = *tokens_ptr;
+  tokens.clear();
+  TokenStream stream(input, input_size, is_node_type);
+  Token token;
+  while (stream.Next(&token)) tokens.push_back(token);
+  return stream.error_offset();
+}
+
+}  // namespace
+
+size_t Tokenize(const char* input, size_t input_size,
+                const std::function<bool(const char*, size_t)>& is_node_type,
+                std::vector<Token>* tokens) {
+  return TokenizeInto(input, input_size, is_node_type, tokens);
+}
+
+size_t Tokenize(const char* input, size_t input_size,
+                std::vector<Token>* tokens) {
+  return TokenizeInto(input, input_size, &IsNodeType, tokens);
+}
+
+bool Tokenizer::ScanAt(size_t* pos, Token* token, size_t* error_offset) const {
+  const char* data = input_.data();
+  const char* token_data;
+  size_t token_size;
+  TokenType type = ScanToken(data + *pos, input_.size() - *pos, &token_data,
+                             &token_size);
+  if (type == T_None) {
+    *error_offset = token_size != 0 ? token_data - data : input_.size();
+    return false;
+  }
+  XPATH_PROFILE_ADD(tokens_scanned, 1);
+  token->type = type;
+  token->offset = token_data - data;
+  token->size = token_size;
+  *pos = token->offset + token_size;
+  return true;
+}
+
+TokenType Tokenizer::DisambiguatedType(size_t i) const {
+  TokenType previous = i > 0 ? tokens_[i - 1].type : T_None;
+  TokenType next = i + 1 < tokens_.size() ? scanned_types_[i + 1] : T_None;
+  TokenType type = DisambiguateToken(previous, scanned_types_[i], next);
+  if (type == T_FunctionName &&
+      is_node_type_(token_data(tokens_[i]), tokens_[i].size)) {
+    type = T_NodeType;
+  }
+  return type;
+}
+
+size_t Tokenizer::Tokenize(const char* data, size_t size) {
+  XPATH_PROFILE_PHASE(P_Tokenize);
+  input_.assign(data, size);
+  tokens_.clear();
+  scanned_types_.clear();
+  size_t pos = 0;
+  Token token;
+  while (ScanAt(&pos, &token, &result_)) {
+    tokens_.push_back(token);
+    scanned_types_.push_back(token.type);
+  }
+  {
+    XPATH_PROFILE_PHASE(P_Disambiguate);
+    for (size_t i = 0; i < tokens_.size(); ++i) {
+      tokens_[i].type = DisambiguatedType(i);
+    }
+  }
+  return result_;
+}
+
+size_t Tokenizer::Edit(size_t offset, size_t removed_size, const char* inserted,
+                       size_t inserted_size, TokenRange* changed) {
+  assert(offset + removed_size <= input_.size());
+  size_t old_input_size = input_.size();
+  input_.replace(offset, removed_size, inserted, inserted_size);
+
+  // Tokens that end before the edit cannot change, because ScanToken() looks
+  // at most one character past the end of a token. Resume scanning after the
+  // last of them.
+  size_t old_count = tokens_.size();
+  size_t first = 0, last = old_count;
+  while (first < last) {
+    size_t middle = first + (last - first) / 2;
+    if (tokens_[middle].offset + tokens_[middle].size < offset) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  size_t pos = first > 0 ? tokens_[first - 1].offset + tokens_[first - 1].size
+                         : 0;
+
+  // Scan until a token matches an old token after the edit, from which point
+  // on the old tokens are still valid. The old offset of a token at `new`
+  // after the edit is new - inserted_size + removed_size.
+  size_t edit_end = offset + inserted_size;
+  size_t old_end = first;
+  bool resynchronized = false;
+  size_t result = input_.size();
+  edit_tokens_.clear();
+  edit_types_.clear();
+  Token token;
+  while (ScanAt(&pos, &token, &result)) {
+    if (token.offset >= edit_end) {
+      size_t old_offset = token.offset - inserted_size + removed_size;
+      while (old_end < old_count && tokens_[old_end].offset < old_offset) {
+        ++old_end;
+      }
+      if (old_end < old_count && tokens_[old_end].offset == old_offset &&
+          tokens_[old_end].size == token.size &&
+          scanned_types_[old_end] == token.type) {
+        resynchronized = true;
+        break;
+      }
+    }
+    edit_tokens_.push_back(token);
+    edit_types_.push_back(token.type);
+  }
+  if (resynchronized) {
+    result = result_ == old_input_size
+        ? input_.size() : result_ - removed_size + inserted_size;
+  } else {
+    old_end = old_count;
+  }
+  result_ = result;
+
+  // Replace the old tokens in [first, old_end) and shift the ones after.
+  // Edits within a token (the common case when typing) replace it in place.
+  size_t end = first + edit_tokens_.size();
+  if (end != old_end) {
+    tokens_.erase(tokens_.begin() + first, tokens_.begin() + old_end);
+    tokens_.insert(tokens_.begin() + first, edit_tokens_.begin(),
+                   edit_tokens_.end());
+    scanned_types_.erase(scanned_types_.begin() + first,
+                         scanned_types_.begin() + old_end);
+    scanned_types_.insert(scanned_types_.begin() + first,
+                          edit_types_.begin(), edit_types_.end());
+  } else {
+    std::copy(edit_tokens_.begin(), edit_tokens_.end(),
+              tokens_.begin() + first);
+    std::copy(edit_types_.begin(), edit_types_.end(),
+              scanned_types_.begin() + first);
+  }
+  if (removed_size != inserted_size) {
+    for (size_t i = end; i < tokens_.size(); ++i) {
+      tokens_[i].offset = tokens_[i].offset - removed_size + inserted_size;
+    }
+  }
+
+  // The token before the edit has a new successor, the new tokens need to be
+  // disambiguated, and so does each following token until one keeps its type
+  // (after which the previous types of all further tokens are unchanged).
+  changed->begin = first;
+  if (first > 0) {
+    TokenType type = DisambiguatedType(first - 1);
+    if (type != tokens_[first - 1].type) {
+      tokens_[first - 1].type = type;
+      changed->begin = first - 1;
+    }
+  }
+  for (size_t i = first; i < end; ++i) tokens_[i].type = DisambiguatedType(i);
+  size_t changed_end = end;
+  for (size_t i = end; i < tokens_.size(); ++i) {
+    TokenType type = DisambiguatedType(i);
+    if (type == tokens_[i].type) break;
+    tokens_[i].type = type;
+    changed_end = i + 1;
+  }
+  changed->end = changed_end;
+  changed->old_end = old_end + (changed_end - end);
+  return result_;
+}
+
 size_t Tokenize(const std::string& input,
                 std::function<bool(const std::string&)> is_node_type,
                 std::vector<std::pair<TokenType, std::string>> *tokens_ptr) {
   auto& tokens = *tokens_ptr;
+  std::vector<Token> spans;
+  size_t result = Tokenize(
+      input.data(), input.size(),
+      [&is_node_type](const char* data, size_t size) {
+        return is_node_type(std::string(data, size));
+      },
+      &spans);
   tokens.clear();
-  const char* data = input.data();
-  const char* data_end = data + input.size();
-  const char* token_data = nullptr;
-  size_t token_size = 0;
-  TokenType token_type;
-  while ((token_type = ScanToken(data, data_end - data, &token_data, &token_size)) != T_None) {
-    tokens.push_back({token_type, std::string(token_data, token_size)});
-    data = token_data + token_size;
-  }
-  for (size_t i = 0; i < tokens.size(); ++i) {
-    tokens[i].first = DisambiguateToken(
-        i > 0 ? tokens[i - 1].first : T_None,
-        tokens[i].first,
-        i + 1 < tokens.size() ? tokens[i + 1].first : T_None);
-    // Disambiguate function names and node types.
-    if (tokens[i].first == T_FunctionName && is_node_type(tokens[i].second)) {
-      tokens[i].first = T_NodeType;
-    }
-  }
-  if (token_size != 0) {
-    assert(token_data >= data && token_data < data_end);
-    return token_data - input.data();
+  tokens.reserve(spans.size());
+  for (const Token& token : spans) {
+    tokens.push_back({token.type, input.substr(token.offset, token.size)});
   }
-  return input.size();
+  return result;
 }
 
 }  // namespace xpath
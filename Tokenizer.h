@@ -84,6 +84,23 @@ enum AxisName {
   A_PrecedingSibling,
   A_Self };
 
+// A token in an input string, described by its type and by the position of its
+// text in the input. Unlike std::pair<TokenType, std::string>, this does not
+// require a copy of the token text; the caller must keep the input alive.
+struct Token {
+  TokenType type;
+  size_t offset;
+  size_t size;
+};
+
+inline bool operator==(const Token& a, const Token& b) {
+  return a.type == b.type && a.offset == b.offset && a.size == b.size;
+}
+
+inline bool operator!=(const Token& a, const Token& b) {
+  return !(a == b);
+}
+
 // Converts the string described by `data` and `size` to a NodeType or returns
 // N_None if it does not match any node type. Matching is case sensitive.
 NodeType ParseNodeType(const char* data, size_t size);
@@ -92,6 +109,16 @@ inline NodeType ParseNodeType(const std::string& s) {
   return ParseNodeType(s.data(), s.size());
 }
 
+// Returns true if the string described by `data` and `size` is a node type.
+// This is the default node type predicate for the functions below.
+inline bool IsNodeType(const char* data, size_t size) {
+  return ParseNodeType(data, size) != N_None;
+}
+
+// A node type predicate that can be passed without wrapping it in a
+// std::function (which may allocate).
+typedef bool (*NodeTypePredicate)(const char* data, size_t size);
+
 // Converts the string described by `data` and `size` to an OperatorName or
 // returns O_None if it does not match any operator name. Matching is case
 // sensitive.
@@ -142,10 +169,184 @@ TokenType DisambiguateToken(TokenType previous,
                             TokenType current,
                             TokenType next);
 
+// Produces fully disambiguated tokens from an input string one at a time.
+//
+// Unlike Tokenize(), which scans the entire input before disambiguating, this
+// class scans a single token ahead of the token that is returned next, which
+// is sufficient context for DisambiguateToken(). Memory use is constant, and
+// the first token is available without scanning the rest of the input.
+//
+// The input must remain valid while the stream is in use.
+class TokenStream {
+ public:
+  // Constructs a stream over the string described by `data` and `size`.
+  // `is_node_type` is called with the text of each function name token, and
+  // should return true if the token is a node type instead.
+  TokenStream(const char* data, size_t size,
+              const std::function<bool(const char*, size_t)>& is_node_type);
+
+  // Same as above, but takes a plain function, which never allocates.
+  TokenStream(const char* data, size_t size, NodeTypePredicate is_node_type);
+
+  // Constructs a stream that recognizes node types with IsNodeType().
+  TokenStream(const char* data, size_t size);
+
+  // Returns the next token without consuming it. At the end of the input, or
+  // when the next token cannot be scanned, a token of type T_None is returned.
+  const Token& Peek() const { return current_; }
+
+  // Consumes the next token and stores it in *token. Returns false if there
+  // are no more tokens (either at the end of the input, or because of a
+  // scanning error) in which case *token is not modified.
+  bool Next(Token* token);
+
+  // Returns the input size if the input has been tokenized successfully so
+  // far, or the index where a scanning error occurred otherwise. This is the
+  // same value that Tokenize() returns, once Next() has returned false.
+  size_t error_offset() const { return error_offset_; }
+
+ private:
+  Token Scan();
+  void Advance();
+
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+  size_t error_offset_;
+  TokenType previous_;
+  Token current_;
+  Token next_;
+  // Exactly one of these is set.
+  NodeTypePredicate is_node_type_function_;
+  std::function<bool(const char*, size_t)> is_node_type_;
+};
+
+// Tokenizes the string described by `data` and `size`, disambiguates tokens,
+// and writes the result to *tokens. Token offsets are relative to `data`.
+// `is_node_type` is called with the text of each function name token, and
+// should return true if the token is a node type instead.
+//
+// If the whole input can be succesfully tokenized, this function returns
+// `size`. Otherwise, it returns a value less than `size`: the index where the
+// scanning error occurred.
+//
+// No memory is allocated for the token text, and *tokens is cleared without
+// releasing its capacity, so reusing the same vector across calls avoids
+// allocations altogether once it has grown large enough.
+size_t Tokenize(const char* data, size_t size,
+                const std::function<bool(const char*, size_t)>& is_node_type,
+                std::vector<Token>* tokens);
+
+size_t Tokenize(const char* data, size_t size, std::vector<Token>* tokens);
+
+inline size_t Tokenize(const std::string& input, std::vector<Token>* tokens) {
+  return Tokenize(input.data(), input.size(), tokens);
+}
+
+// Describes which tokens changed in Tokenizer::Edit(): tokens [begin, end) of
+// the new token list replace tokens [begin, old_end) of the old list. Tokens
+// before `begin` are unchanged, and tokens after the range differ only in
+// their offsets, which are shifted by the change in input size.
+struct TokenRange {
+  size_t begin;
+  size_t end;
+  size_t old_end;
+};
+
+// Tokenizes expressions into storage that it owns and keeps between calls.
+//
+// The tokenizer copies each input into an internal buffer, so the tokens (and
+// their text) remain valid until the next call to Tokenize() or the
+// destruction of the tokenizer, independently of the input. Once the buffers
+// have grown to fit the largest input, tokenizing does not allocate memory.
+//
+// A Tokenizer is not thread-safe; use one per thread.
+class Tokenizer {
+ public:
+  explicit Tokenizer(NodeTypePredicate is_node_type = &IsNodeType)
+      : is_node_type_(is_node_type), result_(0) {}
+
+  // Tokenizes the string described by `data` and `size`. The result is the
+  // same as that of the Tokenize() function.
+  size_t Tokenize(const char* data, size_t size);
+
+  size_t Tokenize(const std::string& input) {
+    return Tokenize(input.data(), input.size());
+  }
+
+  // Replaces `removed_size` bytes at `offset` in the current input with the
+  // string described by `inserted` and `inserted_size`, and updates the
+  // tokens to match the new input. Returns the same value as Tokenize() on
+  // the new input would, and stores the tokens that changed in *changed.
+  //
+  // Only the tokens around the edit are rescanned: scanning resumes at the
+  // end of the last token before the edit, and stops as soon as it produces a
+  // token that was also present (at the same position relative to the end of
+  // the input) before the edit. Only tokens whose neighbours changed are
+  // disambiguated again.
+  size_t Edit(size_t offset, size_t removed_size, const char* inserted,
+              size_t inserted_size, TokenRange* changed);
+
+  size_t Edit(size_t offset, size_t removed_size, const std::string& inserted,
+              TokenRange* changed) {
+    return Edit(offset, removed_size, inserted.data(), inserted.size(),
+                changed);
+  }
+
+  // Preallocates storage for an input of `size` bytes with `token_count`
+  // tokens.
+  void Reserve(size_t size, size_t token_count) {
+    input_.reserve(size);
+    tokens_.reserve(token_count);
+    scanned_types_.reserve(token_count);
+    edit_tokens_.reserve(token_count);
+    edit_types_.reserve(token_count);
+  }
+
+  // The tokens of the last input. Offsets are relative to input().
+  const std::vector<Token>& tokens() const { return tokens_; }
+
+  // The tokenizer's copy of the last input.
+  const std::string& input() const { return input_; }
+
+  // Returns a pointer to the text of `token`, which is `token.size` bytes.
+  const char* token_data(const Token& token) const {
+    return input_.data() + token.offset;
+  }
+
+ private:
+  // Scans one token at `*pos`. Returns false at the end of the input or on
+  // a scanning error, in which case *error_offset is set.
+  bool ScanAt(size_t* pos, Token* token, size_t* error_offset) const;
+
+  // Returns the disambiguated type of token `i`, given the (disambiguated)
+  // type of the token before it and the scanned type of the token after it.
+  TokenType DisambiguatedType(size_t i) const;
+
+  NodeTypePredicate is_node_type_;
+  std::string input_;
+  std::vector<Token> tokens_;
+  size_t result_;
+
+  // The context-free types returned by ScanToken() for each token, which
+  // are needed to disambiguate tokens again after an edit.
+  std::vector<TokenType> scanned_types_;
+
+  // Tokens scanned by Edit(), kept to reuse their capacity.
+  std::vector<Token> edit_tokens_;
+  std::vector<TokenType> edit_types_;
+
+  Tokenizer(const Tokenizer&);
+  void operator=(const Tokenizer&);
+};
+
 // Tokenizes  the `input` string, disambiguates tokens, and writes the result
 // to *tokens. If the whole input can be succesfully tokenized, this function
 // returns input.size(). Otherwise, it returns a value less than input.size():
 // the index where the scanning error occurred.
+//
+// This is a wrapper around the Token-based overload above, which copies the
+// text of each token into a separate string.
 size_t Tokenize(const std::string& input,
                 std::function<bool(const std::string&)> is_node_type,
                 std::vector<std::pair<TokenType, std::string>> *tokens);
@@ -154,9 +355,7 @@ inline size_t Tokenize(const std::string& input,
     std::vector<std::pair<TokenType, std::string>> *tokens) {
   return Tokenize(
       input,
-      [](const std::string& s) {
-        return ParseNodeType(s) != N_None;
-      },
+      [](const std::string& s) { return IsNodeType(s.data(), s.size()); },
       tokens);
 }
 
@@ -0,0 +1,230 @@
+#include "Tokenizer.h"
+#include "SimdScan.h"
+#include <benchmark/benchmark.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+// Identifiers as they occur in typical expressions: mostly element names and
+// function names, with the occasional axis name, node type or operator.
+const vector<string>& IdentifierMix() {
+  static const vector<string> identifiers = {
+    "item", "name", "id", "child", "position", "value", "and", "text",
+    "descendant-or-self", "count", "entries", "or", "node", "attribute",
+    "last", "key", "contains", "following-sibling", "div", "metadata",
+    "self", "string-length", "parent", "type", "ancestor", "mod",
+    "timestamp", "comment", "preceding", "processing-instruction" };
+  return identifiers;
+}
+
+// The sequential comparisons that ParseNodeType(), ParseOperatorName() and
+// ParseAxisName() used before they switched to a hash table, for comparison.
+template<int N> bool Equals(const char (&buf)[N], const char* data, size_t size) {
+  return N > 0 && size == N - 1 && memcmp(data, &buf[0], N - 1) == 0;
+}
+
+__attribute__((noinline))
+NodeType LinearParseNodeType(const char* data, size_t size) {
+  if (Equals("comment", data, size)) return N_Comment;
+  if (Equals("text", data, size)) return N_Text;
+  if (Equals("processing-instruction", data, size)) return N_ProcessingInstruction;
+  if (Equals("node", data, size)) return N_Node;
+  return N_None;
+}
+
+__attribute__((noinline))
+OperatorName LinearParseOperatorName(const char* data, size_t size) {
+  if (Equals("and", data, size)) return O_And;
+  if (Equals("or", data, size)) return O_Or;
+  if (Equals("mod", data, size)) return O_Mod;
+  if (Equals("div", data, size)) return O_Div;
+  return O_None;
+}
+
+__attribute__((noinline))
+AxisName LinearParseAxisName(const char* data, size_t size) {
+  if (Equals("ancestor", data, size)) return A_Ancestor;
+  if (Equals("ancestor-or-self", data, size)) return A_AncestorOrSelf;
+  if (Equals("attribute", data, size)) return A_Attribute;
+  if (Equals("child", data, size)) return A_Child;
+  if (Equals("descendant", data, size)) return A_Descendant;
+  if (Equals("descendant-or-self", data, size)) return A_DescendantOrSelf;
+  if (Equals("following", data, size)) return A_Following;
+  if (Equals("following-sibling", data, size)) return A_FollowingSibling;
+  if (Equals("namespace", data, size)) return A_Namespace;
+  if (Equals("parent", data, size)) return A_Parent;
+  if (Equals("preceding", data, size)) return A_Preceding;
+  if (Equals("preceding-sibling", data, size)) return A_PrecedingSibling;
+  if (Equals("self", data, size)) return A_Self;
+  return A_None;
+}
+
+// Classifies each identifier in the mix with `Parse`.
+template<class T, T (*Parse)(const char*, size_t)>
+void BM_Classify(benchmark::State& state) {
+  const vector<string>& identifiers = IdentifierMix();
+  while (state.KeepRunning()) {
+    for (const string& s : identifiers) {
+      benchmark::DoNotOptimize(Parse(s.data(), s.size()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * identifiers.size());
+}
+BENCHMARK_TEMPLATE2(BM_Classify, AxisName, ParseAxisName);
+BENCHMARK_TEMPLATE2(BM_Classify, AxisName, LinearParseAxisName);
+BENCHMARK_TEMPLATE2(BM_Classify, NodeType, ParseNodeType);
+BENCHMARK_TEMPLATE2(BM_Classify, NodeType, LinearParseNodeType);
+BENCHMARK_TEMPLATE2(BM_Classify, OperatorName, ParseOperatorName);
+BENCHMARK_TEMPLATE2(BM_Classify, OperatorName, LinearParseOperatorName);
+
+// Scans all tokens in `input` with ScanToken().
+void ScanTokens(benchmark::State& state, const string& input) {
+  while (state.KeepRunning()) {
+    const char* data = input.data();
+    const char* data_end = data + input.size();
+    const char* token_data;
+    size_t token_size;
+    while (ScanToken(data, data_end - data, &token_data, &token_size) != T_None) {
+      data = token_data + token_size;
+    }
+    benchmark::DoNotOptimize(data);
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void BM_ScanLongIdentifier(benchmark::State& state) {
+  string input = "a" + string(state.range(0) - 1, 'z');
+  ScanTokens(state, input);
+}
+BENCHMARK(BM_ScanLongIdentifier)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_ScanWhitespace(benchmark::State& state) {
+  string input = string(state.range(0) - 1, ' ') + "x";
+  ScanTokens(state, input);
+}
+BENCHMARK(BM_ScanWhitespace)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_ScanNumber(benchmark::State& state) {
+  string input = string(state.range(0) / 2, '1') + "." +
+                 string(state.range(0) - state.range(0) / 2 - 1, '9');
+  ScanTokens(state, input);
+}
+BENCHMARK(BM_ScanNumber)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_ScanLiteral(benchmark::State& state) {
+  string input = "'" + string(state.range(0) - 2, 'Q') + "'";
+  ScanTokens(state, input);
+}
+BENCHMARK(BM_ScanLiteral)->Arg(16)->Arg(256)->Arg(4096)->Arg(65536);
+
+// Scans a literal-heavy expression: a comparison against serialized IDs.
+void BM_ScanLiteralHeavy(benchmark::State& state) {
+  string input;
+  for (int i = 0; i < 64; ++i) {
+    if (i > 0) input += " or ";
+    input += "@id = '" + string(100 + i, char('A' + i % 26)) + "'";
+  }
+  ScanTokens(state, input);
+}
+BENCHMARK(BM_ScanLiteralHeavy);
+
+// Benchmarks the scanning kernels at a particular SIMD level directly.
+void BM_FindChar(benchmark::State& state) {
+  const ScanKernels* kernels = GetScanKernels(SimdLevel(state.range(0)));
+  if (!kernels || state.range(0) > DetectSimdLevel()) {
+    state.SkipWithError("not supported");
+    return;
+  }
+  string input(state.range(1), 'x');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(kernels->find_char(input.data(), input.size(), '\''));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_FindChar)->ArgPair(SIMD_None, 4096)->ArgPair(SIMD_SSE2, 4096)
+    ->ArgPair(SIMD_AVX2, 4096);
+
+void BM_SpanIdentifierChars(benchmark::State& state) {
+  const ScanKernels* kernels = GetScanKernels(SimdLevel(state.range(0)));
+  if (!kernels || state.range(0) > DetectSimdLevel()) {
+    state.SkipWithError("not supported");
+    return;
+  }
+  string input(state.range(1), 'x');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        kernels->span_identifier_chars(input.data(), input.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_SpanIdentifierChars)->ArgPair(SIMD_None, 4096)
+    ->ArgPair(SIMD_SSE2, 4096)->ArgPair(SIMD_AVX2, 4096);
+
+void BM_SpanSpaces(benchmark::State& state) {
+  const ScanKernels* kernels = GetScanKernels(SimdLevel(state.range(0)));
+  if (!kernels || state.range(0) > DetectSimdLevel()) {
+    state.SkipWithError("not supported");
+    return;
+  }
+  string input(state.range(1), ' ');
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(kernels->span_spaces(input.data(), input.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_SpanSpaces)->ArgPair(SIMD_None, 4096)->ArgPair(SIMD_SSE2, 4096)
+    ->ArgPair(SIMD_AVX2, 4096);
+
+void BM_ScanShortTokens(benchmark::State& state) {
+  ScanTokens(state,
+      "/catalog/item[@id = 12 and price >= 10.5]/name | //entry[3]/value");
+}
+BENCHMARK(BM_ScanShortTokens);
+
+// An expression of about `size` bytes, for the editing benchmarks.
+string EditableExpression(size_t size) {
+  string input;
+  while (input.size() < size) input += "item[@id = 'x'] | ";
+  return input + "last";
+}
+
+// Types a character in the middle of an expression and deletes it again,
+// retokenizing incrementally.
+void BM_Edit(benchmark::State& state) {
+  string input = EditableExpression(state.range(0));
+  Tokenizer tokenizer;
+  tokenizer.Tokenize(input);
+  TokenRange changed;
+  size_t offset = input.size() / 2;
+  while (state.KeepRunning()) {
+    tokenizer.Edit(offset, 0, "y", &changed);
+    tokenizer.Edit(offset, 1, "", &changed);
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_Edit)->Arg(64)->Arg(1024)->Arg(16384);
+
+// Same as above, but retokenizes the whole expression after each edit.
+void BM_EditRetokenizeAll(benchmark::State& state) {
+  string input = EditableExpression(state.range(0));
+  string edited = input;
+  edited.insert(input.size() / 2, "y");
+  Tokenizer tokenizer;
+  while (state.KeepRunning()) {
+    tokenizer.Tokenize(edited);
+    tokenizer.Tokenize(input);
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_EditRetokenizeAll)->Arg(64)->Arg(1024)->Arg(16384);
+
+}  // namespace
+}  // namespace xpath
+
+BENCHMARK_MAIN();
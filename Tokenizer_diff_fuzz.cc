@@ -0,0 +1,150 @@
+// Differential fuzz target for the fast paths of the scanner. For every
+// input, it checks that:
+//
+//  - ScanToken(), with its inline loops and the SIMD kernels selected for
+//    this CPU, returns the same tokens as ReferenceScanToken() below, which
+//    follows the XPath grammar one character at a time;
+//  - the kernels of every SIMD level available in the build and on this CPU
+//    return the same as the scalar kernels, from each of the first offsets
+//    of the input.
+
+#include "Fuzz.h"
+#include "CharClasses.h"
+#include "SimdScan.h"
+#include "Tokenizer.h"
+#include <string.h>
+
+namespace xpath {
+namespace {
+
+// Kernels are compared from this many offsets at most, which keeps the
+// quadratic work bounded for long inputs.
+const size_t kMaxKernelOffsets = 64;
+
+// Same as ScanToken(), but returns the token as an offset into `data`.
+// See http://www.w3.org/TR/xpath/#exprlex.
+TokenType ReferenceScanToken(const char* data, size_t size,
+                             size_t* token_offset, size_t* token_size) {
+  size_t i = 0;
+  while (i < size && IsSpace(data[i])) ++i;
+  *token_offset = i;
+  *token_size = 0;
+  if (i == size) return T_None;
+
+  static const struct {
+    const char* text;
+    TokenType type;
+  } kOperators[] = {
+    // Longest first.
+    { "..", T_DoubleDot }, { "::", T_DoubleColon }, { "//", T_DoubleSlash },
+    { "!=", T_NotEqual }, { "<=", T_LessEqual }, { ">=", T_GreaterEqual },
+    { "(", T_LeftParen }, { ")", T_RightParen }, { "[", T_LeftBracket },
+    { "]", T_RightBracket }, { "@", T_At }, { ",", T_Comma },
+    { "/", T_Slash }, { "|", T_Pipe }, { "+", T_Plus }, { "-", T_Minus },
+    { "=", T_Equal }, { "<", T_LessThan }, { ">", T_GreaterThan },
+    { "*", T_Multiply },
+  };
+  const char* rest = data + i;
+  size_t rest_size = size - i;
+
+  if (rest[0] == '\'' || rest[0] == '"') {
+    for (size_t n = 1; n < rest_size; ++n) {
+      if (rest[n] == rest[0]) {
+        *token_size = n + 1;
+        return T_Literal;
+      }
+    }
+    *token_size = 1;
+    return T_None;
+  }
+  if (IsDigit(rest[0]) ||
+      (rest[0] == '.' && rest_size > 1 && IsDigit(rest[1]))) {
+    size_t n = 0;
+    while (n < rest_size && IsDigit(rest[n])) ++n;
+    if (n < rest_size && rest[n] == '.') {
+      ++n;
+      while (n < rest_size && IsDigit(rest[n])) ++n;
+    }
+    *token_size = n;
+    return T_Number;
+  }
+  for (const auto& op : kOperators) {
+    size_t n = strlen(op.text);
+    if (n <= rest_size && memcmp(rest, op.text, n) == 0) {
+      *token_size = n;
+      return op.type;
+    }
+  }
+  if (rest[0] == '.') {
+    *token_size = 1;
+    return T_Dot;
+  }
+  size_t start = rest[0] == '$' ? 1 : 0;
+  if (start < rest_size && IsIdentifierStartChar(rest[start])) {
+    size_t n = start + 1;
+    while (n < rest_size && IsIdentifierChar(rest[n])) ++n;
+    *token_size = n;
+    return start ? T_VariableReference : T_NameTest;
+  }
+  *token_size = 1;
+  return T_None;
+}
+
+void CheckScanToken(const char* data, size_t size) {
+  size_t pos = 0;
+  for (;;) {
+    const char* token_data;
+    size_t token_size;
+    TokenType type = ScanToken(data + pos, size - pos, &token_data,
+                               &token_size);
+    size_t expected_offset, expected_size;
+    TokenType expected_type = ReferenceScanToken(
+        data + pos, size - pos, &expected_offset, &expected_size);
+    FUZZ_CHECK(type == expected_type);
+    FUZZ_CHECK(token_data == data + pos + expected_offset);
+    FUZZ_CHECK(token_size == expected_size);
+    if (type == T_None) return;
+    pos = token_data - data + token_size;
+  }
+}
+
+void CheckKernels(const char* data, size_t size) {
+  const ScanKernels& scalar = *GetScanKernels(SIMD_None);
+  for (int level = SIMD_SSE2; level <= DetectSimdLevel(); ++level) {
+    const ScanKernels* kernels = GetScanKernels(SimdLevel(level));
+    if (kernels == nullptr) continue;
+    for (size_t offset = 0; offset < size && offset < kMaxKernelOffsets;
+         ++offset) {
+      const char* p = data + offset;
+      size_t n = size - offset;
+      FUZZ_CHECK(kernels->span_spaces(p, n) == scalar.span_spaces(p, n));
+      FUZZ_CHECK(kernels->span_identifier_chars(p, n) ==
+                 scalar.span_identifier_chars(p, n));
+      for (char c : { '\'', '"', p[0] }) {
+        FUZZ_CHECK(kernels->find_char(p, n, c) == scalar.find_char(p, n, c));
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace xpath
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  using namespace xpath;
+  const char* input = reinterpret_cast<const char*>(data);
+  CheckScanToken(input, size);
+  CheckKernels(input, size);
+  return 0;
+}
+
+void FuzzTimedRun(const uint8_t* data, size_t size) {
+  const char* input = reinterpret_cast<const char*>(data);
+  const char* end = input + size;
+  const char* token_data;
+  size_t token_size;
+  while (xpath::ScanToken(input, end - input, &token_data, &token_size) !=
+         xpath::T_None) {
+    input = token_data + token_size;
+  }
+}
@@ -0,0 +1,149 @@
+// Fuzz target for ScanToken(), Tokenize(), TokenStream and Tokenizer. For
+// every input, it checks that:
+//
+//  - each token from ScanToken() lies within the input, after whitespace
+//    only; at the end of the input, T_None is returned with an empty token,
+//    and on an error, with a one-character token at the offending character;
+//  - Tokenize() returns the offset of that error, or the input size, and its
+//    tokens are those of ScanToken() up to there;
+//  - TokenStream and Tokenizer give the same tokens and result as
+//    Tokenize(), and so does Tokenizer::Edit() for an edit chosen by the
+//    first bytes of the input, which only changes the tokens it reports.
+
+#include "Fuzz.h"
+#include "CharClasses.h"
+#include "Tokenizer.h"
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+namespace xpath {
+namespace {
+
+// Scans all tokens with ScanToken() and checks them. Returns the offset of
+// the scanning error, or `size`.
+size_t CheckScanToken(const char* data, size_t size,
+                      vector<Token>* tokens) {
+  size_t pos = 0;
+  for (;;) {
+    const char* token_data = nullptr;
+    size_t token_size = 0;
+    TokenType type = ScanToken(data + pos, size - pos, &token_data,
+                               &token_size);
+    FUZZ_CHECK(token_data >= data + pos && token_data <= data + size);
+    size_t offset = token_data - data;
+    FUZZ_CHECK(token_size <= size - offset);
+    for (size_t i = pos; i < offset; ++i) FUZZ_CHECK(IsSpace(data[i]));
+    if (type == T_None) {
+      if (token_size == 0) {
+        FUZZ_CHECK(offset == size);
+        return size;
+      }
+      FUZZ_CHECK(token_size == 1 && offset < size);
+      return offset;
+    }
+    FUZZ_CHECK(token_size > 0);
+    FUZZ_CHECK(type != T_OperatorName && type != T_FunctionName &&
+               type != T_NodeType && type != T_AxisName);
+    Token token = {type, offset, token_size};
+    tokens->push_back(token);
+    pos = offset + token_size;
+  }
+}
+
+// Checks that `tokens` (as returned by Tokenize()) are the scanned tokens
+// with disambiguated types.
+void CheckSameTokens(const vector<Token>& scanned,
+                     const vector<Token>& tokens) {
+  FUZZ_CHECK(scanned.size() == tokens.size());
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    FUZZ_CHECK(scanned[i].offset == tokens[i].offset);
+    FUZZ_CHECK(scanned[i].size == tokens[i].size);
+    if (scanned[i].type != T_NameTest && scanned[i].type != T_Multiply) {
+      FUZZ_CHECK(scanned[i].type == tokens[i].type);
+    }
+  }
+}
+
+void CheckTokenStream(const char* data, size_t size, size_t expected_result,
+                      const vector<Token>& expected_tokens) {
+  TokenStream stream(data, size);
+  Token token;
+  size_t i = 0;
+  while (stream.Next(&token)) {
+    FUZZ_CHECK(i < expected_tokens.size() && token == expected_tokens[i]);
+    ++i;
+  }
+  FUZZ_CHECK(i == expected_tokens.size());
+  FUZZ_CHECK(stream.Peek().type == T_None);
+  FUZZ_CHECK(stream.error_offset() == expected_result);
+}
+
+// Applies an edit chosen by the first bytes of `input` and checks it
+// against tokenizing the edited input from scratch.
+void CheckEdit(Tokenizer* tokenizer, const string& input) {
+  if (input.size() < 2) return;
+  size_t offset = uint8_t(input[0]) % (input.size() + 1);
+  size_t removed_size = uint8_t(input[1]) % (input.size() - offset + 1);
+  // Insert a part of the input, so that edits use its characters too.
+  size_t inserted_offset = removed_size % input.size();
+  size_t inserted_size = offset % (input.size() - inserted_offset + 1);
+  string inserted = input.substr(inserted_offset, inserted_size);
+
+  vector<Token> old_tokens = tokenizer->tokens();
+  TokenRange changed;
+  size_t result = tokenizer->Edit(offset, removed_size, inserted, &changed);
+  string edited = input;
+  edited.replace(offset, removed_size, inserted);
+  FUZZ_CHECK(tokenizer->input() == edited);
+
+  vector<Token> expected_tokens;
+  FUZZ_CHECK(result == Tokenize(edited, &expected_tokens));
+  const vector<Token>& tokens = tokenizer->tokens();
+  FUZZ_CHECK(tokens == expected_tokens);
+
+  // Tokens outside the reported range are the old ones, shifted.
+  FUZZ_CHECK(changed.begin <= changed.end && changed.end <= tokens.size());
+  FUZZ_CHECK(changed.begin <= changed.old_end &&
+             changed.old_end <= old_tokens.size());
+  FUZZ_CHECK(tokens.size() - changed.end ==
+             old_tokens.size() - changed.old_end);
+  for (size_t i = 0; i < changed.begin; ++i) {
+    FUZZ_CHECK(tokens[i] == old_tokens[i]);
+  }
+  for (size_t i = changed.end; i < tokens.size(); ++i) {
+    Token old_token = old_tokens[i - changed.end + changed.old_end];
+    old_token.offset = old_token.offset - input.size() + edited.size();
+    FUZZ_CHECK(tokens[i] == old_token);
+  }
+}
+
+}  // namespace
+}  // namespace xpath
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  using namespace xpath;
+  const char* input = reinterpret_cast<const char*>(data);
+  vector<Token> scanned;
+  size_t scanned_result = CheckScanToken(input, size, &scanned);
+
+  vector<Token> tokens;
+  size_t result = Tokenize(input, size, &tokens);
+  FUZZ_CHECK(result <= size);
+  FUZZ_CHECK(result == scanned_result);
+  CheckSameTokens(scanned, tokens);
+  CheckTokenStream(input, size, result, tokens);
+
+  Tokenizer tokenizer;
+  FUZZ_CHECK(tokenizer.Tokenize(input, size) == result);
+  FUZZ_CHECK(tokenizer.tokens() == tokens);
+  CheckEdit(&tokenizer, string(input, size));
+  return 0;
+}
+
+void FuzzTimedRun(const uint8_t* data, size_t size) {
+  static vector<xpath::Token> tokens;
+  xpath::Tokenize(reinterpret_cast<const char*>(data), size, &tokens);
+}
@@ -1,6 +1,8 @@
 #include "Tokenizer.h"
+#include <stdlib.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <new>
 #include <string>
 #include <vector>
 #include <utility>
@@ -10,6 +12,23 @@ using std::vector;
 using std::pair;
 using testing::ContainerEq;
 
+namespace {
+
+// Number of calls to operator new, to verify that code does not allocate.
+size_t allocation_count = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocation_count;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
 namespace xpath {
 namespace {
   
@@ -27,6 +46,7 @@ TEST(ScanToken, EmptyInput) {
   TestEndOfInput("");
   TestEndOfInput(" ");
   TestEndOfInput("   \r\n\t ");
+  TestEndOfInput("\v\f");
 }
 
 void TestScanToken(const string& input, TokenType expected) {
@@ -80,6 +100,20 @@ TEST(ScanToken, SingleToken) {
   TestScanToken("f", T_NameTest);
 }
 
+TEST(ScanToken, NonAsciiCharacters) {
+  // Bytes outside the ASCII range are never whitespace, digits or identifier
+  // characters, regardless of the current locale.
+  for (int c = 128; c < 256; ++c) {
+    TestScanToken(string(1, char(c)), T_None);
+    TestScanToken(string(1, char(c)) + "x", T_None);
+  }
+  const string input = "a\xe9";
+  const char *token_data = nullptr;
+  size_t token_size = 0;
+  EXPECT_EQ(T_NameTest, ScanToken(input.data(), input.size(), &token_data, &token_size));
+  EXPECT_EQ(1, token_size);
+}
+
 void TestScanToken(
     const string& input,
     const vector<pair<TokenType, string>>& expected) {
@@ -179,6 +213,8 @@ TEST(ParseNodeType, InvalidNodeTypes) {
   EXPECT_EQ(N_None, ParseNodeType("nodex"));
   EXPECT_EQ(N_None, ParseNodeType("processing_instruction"));
   EXPECT_EQ(N_None, ParseNodeType("and"));
+  EXPECT_EQ(N_None, ParseNodeType("tent"));
+  EXPECT_EQ(N_None, ParseNodeType("child"));
 }
 
 TEST(ParseOperatorName, ValidOperatorNames) {
@@ -194,6 +230,8 @@ TEST(ParseOperatorName, InvalidOperatorNames) {
   EXPECT_EQ(O_None, ParseOperatorName("an"));
   EXPECT_EQ(O_None, ParseOperatorName("andy"));
   EXPECT_EQ(O_None, ParseOperatorName("node"));
+  EXPECT_EQ(O_None, ParseOperatorName("dov"));
+  EXPECT_EQ(O_None, ParseOperatorName("o"));
 }
 
 TEST(ParseAxisName, ValidAxisNames) {
@@ -218,6 +256,10 @@ TEST(ParseAxisName, InvalidAxisNames) {
   EXPECT_EQ(A_None, ParseAxisName("ancestor_or_self"));
   EXPECT_EQ(A_None, ParseAxisName("and"));
   EXPECT_EQ(A_None, ParseAxisName("node"));
+  EXPECT_EQ(A_None, ParseAxisName("cxxxd"));
+  EXPECT_EQ(A_None, ParseAxisName("descendant-or-selF"));
+  EXPECT_EQ(A_None, ParseAxisName("processing-instruction"));
+  EXPECT_EQ(A_None, ParseAxisName(string(100, 'x')));
 }
 
 void TestTokenize(const string& input, size_t parsed_prefix_length,
@@ -300,5 +342,258 @@ TEST(Tokenize, InvalidOperatorName) {
        {T_Number, "2"}});
 }
 
+TEST(Tokenize, TokenSpans) {
+  const string input = " /foo[@bar = 'baz'] ~";
+  vector<Token> received;
+  EXPECT_EQ(20, Tokenize(input, &received));
+  vector<Token> expected = {
+      {T_Slash, 1, 1},
+      {T_NameTest, 2, 3},
+      {T_LeftBracket, 5, 1},
+      {T_At, 6, 1},
+      {T_NameTest, 7, 3},
+      {T_Equal, 11, 1},
+      {T_Literal, 13, 5},
+      {T_RightBracket, 18, 1}};
+  EXPECT_THAT(received, ContainerEq(expected));
+}
+
+TEST(Tokenize, TokenSpansMatchStrings) {
+  const string input = "count(/a//b[text() and position() != last()]) * 2";
+  vector<Token> spans;
+  vector<pair<TokenType, string>> strings;
+  EXPECT_EQ(input.size(), Tokenize(input, &spans));
+  EXPECT_EQ(input.size(), Tokenize(input, &strings));
+  ASSERT_EQ(strings.size(), spans.size());
+  for (size_t i = 0; i < spans.size(); ++i) {
+    EXPECT_EQ(strings[i].first, spans[i].type);
+    EXPECT_EQ(strings[i].second, input.substr(spans[i].offset, spans[i].size));
+  }
+}
+
+TEST(Tokenize, TokenSpansReuseCapacity) {
+  vector<Token> received;
+  Tokenize("a/b/c/d", &received);
+  EXPECT_EQ(7, received.size());
+  const Token* data = received.data();
+  Tokenize("x", &received);
+  EXPECT_EQ(1, received.size());
+  EXPECT_EQ(data, received.data());
+}
+
+TEST(Tokenize, TokenSpansNodeTypePredicate) {
+  const string input = "foo()";
+  vector<Token> received;
+  Tokenize(input.data(), input.size(),
+      [](const char* data, size_t size) {
+        return string(data, size) == "foo";
+      },
+      &received);
+  ASSERT_EQ(3, received.size());
+  EXPECT_EQ(T_NodeType, received[0].type);
+}
+
+TEST(TokenStream, MatchesTokenize) {
+  const string inputs[] = {
+      "", "  ", "foo", "/foo/sibling::bar[index()<7]", "/text()",
+      "1 plus 2", "* * *", "a//b | c[. > 3 and @d]", "foo ~", "bar 'baz"};
+  for (const string& input : inputs) {
+    vector<Token> expected;
+    size_t expected_result = Tokenize(input, &expected);
+    vector<Token> received;
+    TokenStream stream(input.data(), input.size());
+    Token token;
+    while (stream.Next(&token)) received.push_back(token);
+    EXPECT_THAT(received, ContainerEq(expected)) << input;
+    EXPECT_EQ(expected_result, stream.error_offset()) << input;
+  }
+}
+
+TEST(TokenStream, Peek) {
+  const string input = "child::x";
+  TokenStream stream(input.data(), input.size());
+  Token token;
+  EXPECT_EQ(T_AxisName, stream.Peek().type);
+  EXPECT_TRUE(stream.Next(&token));
+  EXPECT_EQ(T_AxisName, token.type);
+  EXPECT_EQ(T_DoubleColon, stream.Peek().type);
+  EXPECT_TRUE(stream.Next(&token));
+  EXPECT_EQ(T_NameTest, stream.Peek().type);
+  EXPECT_TRUE(stream.Next(&token));
+  EXPECT_EQ(T_None, stream.Peek().type);
+  EXPECT_EQ(input.size(), stream.Peek().offset);
+  EXPECT_FALSE(stream.Next(&token));
+  EXPECT_EQ(T_NameTest, token.type);
+  EXPECT_EQ(input.size(), stream.error_offset());
+}
+
+TEST(TokenStream, StopsAtError) {
+  const string input = "a ! b";
+  TokenStream stream(input.data(), input.size());
+  Token token;
+  EXPECT_TRUE(stream.Next(&token));
+  EXPECT_EQ(T_NameTest, token.type);
+  EXPECT_EQ(T_None, stream.Peek().type);
+  EXPECT_EQ(2, stream.Peek().offset);
+  EXPECT_FALSE(stream.Next(&token));
+  EXPECT_FALSE(stream.Next(&token));
+  EXPECT_EQ(2, stream.error_offset());
+}
+
+bool IsCommentOnly(const char* data, size_t size) {
+  return ParseNodeType(data, size) == N_Comment;
+}
+
+TEST(Tokenizer, MatchesTokenize) {
+  Tokenizer tokenizer;
+  vector<Token> expected;
+  for (const string& input : { "/a/b[@c = 'd']", "node() | text()", "", "a ~",
+                               "child::*[1]//x" }) {
+    string copy = input;
+    EXPECT_EQ(Tokenize(copy, &expected), tokenizer.Tokenize(copy)) << input;
+    copy.assign(copy.size(), '!');
+    EXPECT_EQ(expected, tokenizer.tokens()) << input;
+    EXPECT_EQ(input, tokenizer.input());
+  }
+  tokenizer.Tokenize("foo('bar')");
+  ASSERT_EQ(4, tokenizer.tokens().size());
+  const Token& literal = tokenizer.tokens()[2];
+  EXPECT_EQ("'bar'", string(tokenizer.token_data(literal), literal.size));
+}
+
+TEST(Tokenizer, NodeTypePredicate) {
+  Tokenizer tokenizer(&IsCommentOnly);
+  tokenizer.Tokenize("comment() | text()");
+  ASSERT_EQ(7, tokenizer.tokens().size());
+  EXPECT_EQ(T_NodeType, tokenizer.tokens()[0].type);
+  EXPECT_EQ(T_FunctionName, tokenizer.tokens()[4].type);
+}
+
+TEST(Tokenizer, DoesNotAllocateInSteadyState) {
+  const vector<string> inputs = {
+    "/catalog/item[@id = 12 and price >= 10.5]/name | //entry[3]/value",
+    "comment() | processing-instruction('x') | node()",
+    "'" + string(1000, 'x') + "'",
+    "a ~ b",
+    "" };
+  Tokenizer tokenizer;
+  for (const string& input : inputs) tokenizer.Tokenize(input);
+  size_t allocations = allocation_count;
+  for (int i = 0; i < 100; ++i) {
+    for (const string& input : inputs) tokenizer.Tokenize(input);
+  }
+  EXPECT_EQ(0, allocation_count - allocations);
+
+  // Reserve() makes even the first call allocation-free.
+  Tokenizer reserved;
+  reserved.Reserve(2000, 100);
+  allocations = allocation_count;
+  for (const string& input : inputs) reserved.Tokenize(input);
+  EXPECT_EQ(0, allocation_count - allocations);
+}
+
+// Applies an edit with Tokenizer::Edit() and checks the result against
+// tokenizing the edited input from scratch.
+void TestEdit(const string& input, size_t offset, size_t removed_size,
+              const string& inserted) {
+  Tokenizer tokenizer;
+  tokenizer.Tokenize(input);
+  vector<Token> old_tokens = tokenizer.tokens();
+  TokenRange changed;
+  size_t result = tokenizer.Edit(offset, removed_size, inserted, &changed);
+
+  string edited = input;
+  edited.replace(offset, removed_size, inserted);
+  vector<Token> expected;
+  SCOPED_TRACE("'" + input + "' -> '" + edited + "'");
+  EXPECT_EQ(edited, tokenizer.input());
+  EXPECT_EQ(Tokenize(edited, &expected), result);
+  ASSERT_EQ(expected, tokenizer.tokens());
+
+  // Outside the changed range, tokens are the same except for the shift.
+  ASSERT_LE(changed.begin, changed.end);
+  ASSERT_LE(changed.begin, changed.old_end);
+  ASSERT_EQ(old_tokens.size() - changed.old_end,
+            expected.size() - changed.end);
+  for (size_t i = 0; i < changed.begin; ++i) {
+    EXPECT_EQ(old_tokens[i], expected[i]) << i;
+  }
+  for (size_t i = changed.end; i < expected.size(); ++i) {
+    Token token = old_tokens[i - changed.end + changed.old_end];
+    token.offset = token.offset - removed_size + inserted.size();
+    EXPECT_EQ(token, expected[i]) << i;
+  }
+}
+
+TEST(Tokenizer, Edit) {
+  TestEdit("", 0, 0, "a/b");
+  TestEdit("a/b", 0, 3, "");
+  TestEdit("foo/bar", 3, 1, "//");
+  TestEdit("a < b", 3, 0, "=");
+  TestEdit("a = b", 2, 0, "!");
+  TestEdit("a ! b", 2, 1, "");
+  TestEdit("1.5 + 2", 1, 0, "2");
+  TestEdit("1 . 5", 1, 1, "");
+  TestEdit("foo(1)", 3, 3, "");
+  TestEdit("foo (1) + bar", 3, 0, "bar");
+  TestEdit("'abc' = x", 4, 0, "'");
+  TestEdit("'abc' = x", 0, 1, "");
+  TestEdit("x = 'a' or y = 'b'", 0, 0, "'");
+  TestEdit("child::* div 2", 0, 7, "");
+  TestEdit("a * b * c * d", 0, 1, "@");
+  TestEdit("a * b * c * d", 2, 1, "and");
+  TestEdit("text ( )", 4, 1, " |");
+  TestEdit("comment", 7, 0, "()");
+  TestEdit("a ~ b ~ c", 2, 1, "");
+}
+
+TEST(Tokenizer, RandomEdits) {
+  const char* fragments[] = {
+    "a", "bc", "(", ")", "[", "]", "'", "'x'", "\"", "1", ".", "..", "5",
+    "/", "//", "*", "@", "::", ":", "child", "text", "node", "and", "div",
+    "=", "!", "<", ">", "-", "|", "$", "$v", " ", "  ", "~", "," };
+  const size_t fragment_count = sizeof(fragments) / sizeof(fragments[0]);
+  unsigned seed = 42;
+  auto random = [&seed](size_t n) {
+    seed = seed * 1103515245 + 12345;
+    return size_t(seed >> 8) % n;
+  };
+  for (int iteration = 0; iteration < 2000; ++iteration) {
+    string input;
+    for (size_t i = random(12); i > 0; --i) {
+      input += fragments[random(fragment_count)];
+    }
+    size_t offset = random(input.size() + 1);
+    size_t removed_size = random(input.size() - offset + 1) % 4;
+    string inserted;
+    for (size_t i = random(3); i > 0; --i) {
+      inserted += fragments[random(fragment_count)];
+    }
+    TestEdit(input, offset, removed_size, inserted);
+    if (HasFatalFailure()) return;
+  }
+}
+
+TEST(Tokenizer, EditRescansLocally) {
+  string input;
+  for (int i = 0; i < 1000; ++i) input += "item[@id = 'x'] | ";
+  input += "last";
+  Tokenizer tokenizer;
+  tokenizer.Tokenize(input);
+  TokenRange changed;
+  // Typing '(' turns the last name test into a function name.
+  tokenizer.Edit(input.size(), 0, "(", &changed);
+  EXPECT_EQ(8000, changed.begin);
+  EXPECT_EQ(8002, changed.end);
+  EXPECT_EQ(8001, changed.old_end);
+  EXPECT_EQ(T_FunctionName, tokenizer.tokens()[8000].type);
+  // Changing the first name only rescans that token.
+  tokenizer.Edit(0, 4, "entry", &changed);
+  EXPECT_EQ(0, changed.begin);
+  EXPECT_EQ(1, changed.end);
+  EXPECT_EQ(1, changed.old_end);
+  EXPECT_EQ(5, tokenizer.tokens()[1].offset);
+}
+
 }  // namespace
 }  // namespace xpath